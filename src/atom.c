@@ -70,68 +70,188 @@
  *
  ********************************************************/
 
+#include <pthread.h>
+
 #include "utils.h"
 #include "atom.h"
 
-struct atom_node {
-    struct atom_node *left, *right;
-    xkb_atom_t atom;
-    unsigned int fingerprint;
-    char *string;
+/*
+ * The atoms are kept in open addressing hash tables, split into shards by
+ * the hash of their string, and in an array indexed by the atom.  The
+ * strings are copied into blocks which are only freed with the table, and
+ * the array is made of segments of growing size, which never move once
+ * allocated.  A slot of a hash table is filled in with a single store, and
+ * a hash table which was replaced by a bigger one is kept until the table
+ * is freed.  Thus looking atoms up doesn't need any locking; with a
+ * thread-safe table, interning a new atom only locks its shard.
+ */
+#define ATOM_SHARDS 16
+#define ATOM_FIRST_SEGMENT_SHIFT 6
+#define ATOM_NUM_SEGMENTS (32 - ATOM_FIRST_SEGMENT_SHIFT)
+#define ATOM_MIN_SLOTS 16
+#define ATOM_BLOCK_SIZE 4096
+
+/*
+ * A slot holds the hash of the string in its high half and the atom in its
+ * low half, or 0 if it is empty.
+ */
+struct atom_slots {
+    /* The slots this replaced. */
+    struct atom_slots *prev;
+    uint32_t mask;
+    uint64_t slots[];
+};
+
+struct atom_block {
+    struct atom_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+struct atom_shard {
+    struct atom_slots *slots;
+    unsigned int count;
+    struct atom_block *blocks;
+    pthread_mutex_t lock;
 };
 
 struct atom_table {
-    struct atom_node *root;
-    darray(struct atom_node *) table;
+    bool thread_safe;
+    xkb_atom_t next_atom;
+    const char **segments[ATOM_NUM_SEGMENTS];
+    struct atom_shard shards[ATOM_SHARDS];
 };
 
+static struct atom_slots *
+slots_new(uint32_t num_slots)
+{
+    struct atom_slots *slots;
+
+    slots = calloc(1, sizeof(*slots) + num_slots * sizeof(slots->slots[0]));
+    if (!slots)
+        return NULL;
+
+    slots->mask = num_slots - 1;
+    return slots;
+}
+
 struct atom_table *
-atom_table_new(void)
+atom_table_new(bool thread_safe)
 {
     struct atom_table *table;
+    unsigned int i;
 
     table = calloc(1, sizeof(*table));
     if (!table)
         return NULL;
 
-    darray_init(table->table);
-    darray_growalloc(table->table, 100);
-    darray_append(table->table, NULL);
+    table->thread_safe = thread_safe;
+    table->next_atom = XKB_ATOM_NONE + 1;
+    for (i = 0; i < ATOM_SHARDS; i++) {
+        table->shards[i].slots = slots_new(ATOM_MIN_SLOTS);
+        if (!table->shards[i].slots)
+            goto err;
+        pthread_mutex_init(&table->shards[i].lock, NULL);
+    }
 
     return table;
-}
 
-static void
-free_atom(struct atom_node *patom)
-{
-    if (!patom)
-        return;
-
-    free_atom(patom->left);
-    free_atom(patom->right);
-    free(patom->string);
-    free(patom);
+err:
+    while (i-- > 0) {
+        free(table->shards[i].slots);
+        pthread_mutex_destroy(&table->shards[i].lock);
+    }
+    free(table);
+    return NULL;
 }
 
 void
 atom_table_free(struct atom_table *table)
 {
+    struct atom_shard *shard;
+    struct atom_slots *slots;
+    struct atom_block *block;
+    unsigned int i;
+
     if (!table)
         return;
 
-    free_atom(table->root);
-    darray_free(table->table);
+    for (shard = table->shards; shard < table->shards + ATOM_SHARDS;
+         shard++) {
+        while ((slots = shard->slots)) {
+            shard->slots = slots->prev;
+            free(slots);
+        }
+        while ((block = shard->blocks)) {
+            shard->blocks = block->next;
+            free(block);
+        }
+        pthread_mutex_destroy(&shard->lock);
+    }
+    for (i = 0; i < ATOM_NUM_SEGMENTS; i++)
+        free(table->segments[i]);
     free(table);
 }
 
+/*
+ * Segment i holds (1 << (i + ATOM_FIRST_SEGMENT_SHIFT)) atoms, starting
+ * from the first ones.
+ */
+static void
+atom_position(xkb_atom_t atom, unsigned int *segment, size_t *offset)
+{
+    uint32_t n = atom + (1u << ATOM_FIRST_SEGMENT_SHIFT);
+    unsigned int msb = 31 - __builtin_clz(n);
+
+    *segment = msb - ATOM_FIRST_SEGMENT_SHIFT;
+    *offset = n - (1u << msb);
+}
+
 const char *
 atom_text(struct atom_table *table, xkb_atom_t atom)
 {
-    if (atom >= darray_size(table->table) ||
-        darray_item(table->table, atom) == NULL)
+    const char **segment;
+    unsigned int i;
+    size_t offset;
+
+    if (atom == XKB_ATOM_NONE ||
+        atom >= atomic_load_acquire(&table->next_atom))
+        return NULL;
+
+    atom_position(atom, &i, &offset);
+    segment = atomic_load_acquire(&table->segments[i]);
+    if (!segment)
         return NULL;
 
-    return darray_item(table->table, atom)->string;
+    return atomic_load_acquire(&segment[offset]);
+}
+
+static bool
+set_text(struct atom_table *table, xkb_atom_t atom, const char *string)
+{
+    const char **segment, **new_segment;
+    unsigned int i;
+    size_t offset;
+
+    atom_position(atom, &i, &offset);
+    segment = atomic_load_acquire(&table->segments[i]);
+    if (!segment) {
+        /* Other shards may race to allocate the same segment. */
+        new_segment = calloc(1u << (i + ATOM_FIRST_SEGMENT_SHIFT),
+                             sizeof(*new_segment));
+        if (!new_segment)
+            return false;
+
+        if (atomic_compare_exchange(&table->segments[i], &segment,
+                                    new_segment))
+            segment = new_segment;
+        else
+            free(new_segment);
+    }
+
+    atomic_store_release(&segment[offset], string);
+    return true;
 }
 
 char *
@@ -140,109 +260,334 @@ atom_strdup(struct atom_table *table, xkb_atom_t atom)
     return strdup_safe(atom_text(table, atom));
 }
 
-static bool
-find_node_pointer(struct atom_table *table, const char *string,
-                  struct atom_node ***np_out, unsigned int *fingerprint_out)
+/* FNV-1a, 32 bit. */
+static uint32_t
+hash_string(const char *string, size_t len)
 {
-    struct atom_node **np;
-    unsigned i;
-    int comp;
-    unsigned int fp = 0;
-    size_t len;
-    bool found = false;
+    uint32_t hash = 2166136261u;
+    size_t i;
 
-    len = strlen(string);
-    np = &table->root;
-    for (i = 0; i < (len + 1) / 2; i++) {
-        fp = fp * 27 + string[i];
-        fp = fp * 27 + string[len - 1 - i];
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char) string[i];
+        hash *= 16777619u;
     }
 
-    while (*np) {
-        if (fp < (*np)->fingerprint) {
-            np = &((*np)->left);
-        }
-        else if (fp > (*np)->fingerprint) {
-            np = &((*np)->right);
-        }
-        else {
-            /* now start testing the strings */
-            comp = strncmp(string, (*np)->string, len);
-            if (comp < 0 || (comp == 0 && len < strlen((*np)->string))) {
-                np = &((*np)->left);
-            }
-            else if (comp > 0) {
-                np = &((*np)->right);
-            }
-            else {
-                found = true;
-                break;
-            }
+    return hash;
+}
+
+/*
+ * The low bits of the hash pick the shard, so the slot is picked by the
+ * others.
+ */
+static uint32_t
+first_slot(const struct atom_slots *slots, uint32_t hash)
+{
+    return (hash / ATOM_SHARDS) & slots->mask;
+}
+
+/*
+ * Returns the atom of the string if it is in @slots.  Otherwise, returns
+ * XKB_ATOM_NONE and sets @pos_out to the empty slot it would go in.
+ */
+static xkb_atom_t
+find_atom(struct atom_table *table, const struct atom_slots *slots,
+          const char *string, size_t len, uint32_t hash, uint32_t *pos_out)
+{
+    uint32_t pos = first_slot(slots, hash);
+    uint64_t slot;
+    const char *text;
+
+    while ((slot = atomic_load_acquire(&slots->slots[pos]))) {
+        if ((uint32_t) (slot >> 32) == hash) {
+            text = atom_text(table, (xkb_atom_t) slot);
+            if (strncmp(text, string, len) == 0 && text[len] == '\0')
+                return (xkb_atom_t) slot;
         }
+        pos = (pos + 1) & slots->mask;
     }
 
-    *fingerprint_out = fp;
-    *np_out = np;
-    return found;
+    *pos_out = pos;
+    return XKB_ATOM_NONE;
+}
+
+/*
+ * Replace the shard's slots with twice as many.  The old ones are kept,
+ * since lookups may still be going through them.
+ */
+static bool
+grow_slots(struct atom_shard *shard)
+{
+    struct atom_slots *old = shard->slots, *new;
+    uint32_t i, pos;
+
+    new = slots_new((old->mask + 1) * 2);
+    if (!new)
+        return false;
+
+    for (i = 0; i <= old->mask; i++) {
+        if (!old->slots[i])
+            continue;
+
+        pos = first_slot(new, (uint32_t) (old->slots[i] >> 32));
+        while (new->slots[pos])
+            pos = (pos + 1) & new->mask;
+        new->slots[pos] = old->slots[i];
+    }
+
+    new->prev = old;
+    atomic_store_release(&shard->slots, new);
+    return true;
+}
+
+static char *
+copy_string(struct atom_shard *shard, const char *string, size_t len)
+{
+    struct atom_block *block = shard->blocks;
+    size_t size;
+    char *copy;
+
+    if (!block || block->size - block->used < len + 1) {
+        size = MAX(ATOM_BLOCK_SIZE - sizeof(*block), len + 1);
+        block = malloc(sizeof(*block) + size);
+        if (!block)
+            return NULL;
+
+        block->used = 0;
+        block->size = size;
+        block->next = shard->blocks;
+        shard->blocks = block;
+    }
+
+    copy = block->data + block->used;
+    memcpy(copy, string, len);
+    copy[len] = '\0';
+    block->used += len + 1;
+    return copy;
+}
+
+static xkb_atom_t
+lookup_len(struct atom_table *table, const char *string, size_t len,
+           uint32_t hash)
+{
+    struct atom_shard *shard = &table->shards[hash % ATOM_SHARDS];
+    uint32_t pos;
+
+    return find_atom(table, atomic_load_acquire(&shard->slots),
+                     string, len, hash, &pos);
 }
 
 xkb_atom_t
 atom_lookup(struct atom_table *table, const char *string)
 {
-    struct atom_node **np;
-    unsigned int fp;
+    size_t len;
 
     if (!string)
         return XKB_ATOM_NONE;
 
-    if (!find_node_pointer(table, string, &np, &fp))
+    len = strlen(string);
+    return lookup_len(table, string, len, hash_string(string, len));
+}
+
+/* Like atom_lookup(), for the first @len bytes of @string. */
+xkb_atom_t
+atom_lookup_len(struct atom_table *table, const char *string, size_t len)
+{
+    if (!string)
         return XKB_ATOM_NONE;
 
-    return (*np)->atom;
+    return lookup_len(table, string, len, hash_string(string, len));
 }
 
 /*
- * If steal is true, we do not strdup @string; therefore it must be
- * dynamically allocated, not be free'd by the caller and not be used
- * afterwards. Use to avoid some redundant allocations.
+ * Intern the first @len bytes of @string, which needn't be NUL-terminated
+ * but mustn't contain a NUL.
  */
 xkb_atom_t
-atom_intern(struct atom_table *table, const char *string,
-            bool steal)
+atom_intern_len(struct atom_table *table, const char *string, size_t len)
 {
-    struct atom_node **np;
-    struct atom_node *nd;
-    unsigned int fp;
+    struct atom_shard *shard;
+    struct atom_slots *slots;
+    xkb_atom_t atom;
+    uint32_t hash, pos;
+    const char *copy;
 
     if (!string)
         return XKB_ATOM_NONE;
 
-    if (find_node_pointer(table, string, &np, &fp)) {
-        if (steal)
-            free(UNCONSTIFY(string));
-        return (*np)->atom;
+    hash = hash_string(string, len);
+    atom = lookup_len(table, string, len, hash);
+    if (atom != XKB_ATOM_NONE)
+        return atom;
+
+    shard = &table->shards[hash % ATOM_SHARDS];
+    if (table->thread_safe)
+        pthread_mutex_lock(&shard->lock);
+
+    /* Someone may have added it meanwhile. */
+    slots = shard->slots;
+    atom = find_atom(table, slots, string, len, hash, &pos);
+    if (atom != XKB_ATOM_NONE)
+        goto out;
+
+    /* Keep the slots at most half full, so that the probes are short. */
+    if ((shard->count + 1) * 2 > slots->mask + 1) {
+        if (!grow_slots(shard))
+            goto out;
+        slots = shard->slots;
+        find_atom(table, slots, string, len, hash, &pos);
+    }
+
+    copy = copy_string(shard, string, len);
+    if (!copy)
+        goto out;
+
+    atom = atomic_fetch_add_acq_rel(&table->next_atom, 1);
+    if (!set_text(table, atom, copy)) {
+        atom = XKB_ATOM_NONE;
+        goto out;
     }
 
-    nd = malloc(sizeof(*nd));
-    if (!nd)
+    /* The text must be set before the atom can be found. */
+    atomic_store_release(&slots->slots[pos], ((uint64_t) hash << 32) | atom);
+    shard->count++;
+
+out:
+    if (table->thread_safe)
+        pthread_mutex_unlock(&shard->lock);
+    return atom;
+}
+
+/*
+ * If steal is true, @string must be dynamically allocated, and is freed
+ * once interned, so the caller must not use it afterwards.
+ */
+xkb_atom_t
+atom_intern(struct atom_table *table, const char *string,
+            bool steal)
+{
+    xkb_atom_t atom;
+
+    if (!string)
         return XKB_ATOM_NONE;
 
-    if (steal) {
-        nd->string = UNCONSTIFY(string);
+    atom = atom_intern_len(table, string, strlen(string));
+    if (steal)
+        free(UNCONSTIFY(string));
+
+    return atom;
+}
+
+/***====================================================================***/
+
+/* The atoms are mostly consecutive, so this spreads them well enough. */
+static unsigned int
+atom_map_first(const struct atom_map *map, xkb_atom_t atom)
+{
+    return (atom * 2654435761u) & (map->size - 1);
+}
+
+void
+atom_map_free(struct atom_map *map)
+{
+    free(map->entries);
+    memset(map, 0, sizeof(*map));
+}
+
+bool
+atom_map_lookup(const struct atom_map *map, xkb_atom_t atom,
+                unsigned int *value_out)
+{
+    unsigned int i;
+
+    if (map->size == 0 || atom == XKB_ATOM_NONE)
+        return false;
+
+    for (i = atom_map_first(map, atom);
+         map->entries[i].atom != XKB_ATOM_NONE;
+         i = (i + 1) & (map->size - 1)) {
+        if (map->entries[i].atom == atom) {
+            *value_out = map->entries[i].value;
+            return true;
+        }
     }
-    else {
-        nd->string = strdup(string);
-        if (!nd->string) {
-            free(nd);
-            return XKB_ATOM_NONE;
+
+    return false;
+}
+
+static void
+atom_map_put(struct atom_map *map, xkb_atom_t atom, unsigned int value)
+{
+    unsigned int i;
+
+    for (i = atom_map_first(map, atom);
+         map->entries[i].atom != XKB_ATOM_NONE &&
+         map->entries[i].atom != atom;
+         i = (i + 1) & (map->size - 1));
+
+    if (map->entries[i].atom == XKB_ATOM_NONE)
+        map->num_entries++;
+    map->entries[i].atom = atom;
+    map->entries[i].value = value;
+}
+
+bool
+atom_map_insert(struct atom_map *map, xkb_atom_t atom, unsigned int value)
+{
+    struct atom_map old = *map;
+    unsigned int i;
+
+    if (atom == XKB_ATOM_NONE)
+        return false;
+
+    /* Keep it at most half full. */
+    if ((map->num_entries + 1) * 2 > map->size) {
+        map->size = MAX(old.size * 2, 16);
+        map->num_entries = 0;
+        map->entries = calloc(map->size, sizeof(*map->entries));
+        if (!map->entries) {
+            *map = old;
+            return false;
         }
+
+        for (i = 0; i < old.size; i++)
+            if (old.entries[i].atom != XKB_ATOM_NONE)
+                atom_map_put(map, old.entries[i].atom, old.entries[i].value);
+        free(old.entries);
     }
 
-    *np = nd;
-    nd->left = nd->right = NULL;
-    nd->fingerprint = fp;
-    nd->atom = darray_size(table->table);
-    darray_append(table->table, nd);
+    atom_map_put(map, atom, value);
+    return true;
+}
+
+void
+atom_map_remove(struct atom_map *map, xkb_atom_t atom)
+{
+    unsigned int i, j, first;
+
+    if (map->size == 0 || atom == XKB_ATOM_NONE)
+        return;
+
+    for (i = atom_map_first(map, atom);
+         map->entries[i].atom != atom;
+         i = (i + 1) & (map->size - 1))
+        if (map->entries[i].atom == XKB_ATOM_NONE)
+            return;
+
+    /*
+     * Move back the entries after it which would no longer be found,
+     * since there are no deleted markers.
+     */
+    for (j = (i + 1) & (map->size - 1);
+         map->entries[j].atom != XKB_ATOM_NONE;
+         j = (j + 1) & (map->size - 1)) {
+        first = atom_map_first(map, map->entries[j].atom);
+        if (((j - first) & (map->size - 1)) >=
+            ((j - i) & (map->size - 1))) {
+            map->entries[i] = map->entries[j];
+            i = j;
+        }
+    }
 
-    return nd->atom;
+    map->entries[i].atom = XKB_ATOM_NONE;
+    map->num_entries--;
 }
@@ -31,7 +31,7 @@ typedef uint32_t xkb_atom_t;
 struct atom_table;
 
 struct atom_table *
-atom_table_new(void);
+atom_table_new(bool thread_safe);
 
 void
 atom_table_free(struct atom_table *table);
@@ -39,14 +39,50 @@ atom_table_free(struct atom_table *table);
 xkb_atom_t
 atom_lookup(struct atom_table *table, const char *string);
 
+xkb_atom_t
+atom_lookup_len(struct atom_table *table, const char *string, size_t len);
+
 xkb_atom_t
 atom_intern(struct atom_table *table, const char *string,
             bool steal);
 
+xkb_atom_t
+atom_intern_len(struct atom_table *table, const char *string, size_t len);
+
 char *
 atom_strdup(struct atom_table *table, xkb_atom_t atom);
 
 const char *
 atom_text(struct atom_table *table, xkb_atom_t atom);
 
+/*
+ * A hash table from atoms to unsigned ints, e.g. indexes into an array.
+ * A zeroed one is empty.
+ */
+struct atom_map_entry {
+    xkb_atom_t atom;
+    unsigned int value;
+};
+
+struct atom_map {
+    struct atom_map_entry *entries;
+    /* A power of 2, or 0. */
+    unsigned int size;
+    unsigned int num_entries;
+};
+
+void
+atom_map_free(struct atom_map *map);
+
+bool
+atom_map_lookup(const struct atom_map *map, xkb_atom_t atom,
+                unsigned int *value_out);
+
+/* Adds @atom, or replaces its value. Returns false if allocation fails. */
+bool
+atom_map_insert(struct atom_map *map, xkb_atom_t atom, unsigned int value);
+
+void
+atom_map_remove(struct atom_map *map, xkb_atom_t atom);
+
 #endif /* ATOM_H */
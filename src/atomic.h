@@ -0,0 +1,94 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include <stdbool.h>
+
+/*
+ * The atomic operations on plain variables which the reference counts,
+ * the atom table and the thread-safe contexts use.  configure checks for
+ * the __atomic builtins, and else for the older __sync ones, which are
+ * full barriers and so stronger than asked for; with those, a load is a
+ * volatile read followed by a barrier.
+ *
+ * atomic_compare_exchange() stores @desired if *@p equals *@expected,
+ * and returns whether it did; otherwise it sets *@expected to *@p.
+ */
+#if defined(HAVE_ATOMIC_BUILTINS)
+
+#define atomic_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define atomic_store_release(p, v) \
+    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define atomic_fetch_add_relaxed(p, v) \
+    __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+#define atomic_fetch_add_acq_rel(p, v) \
+    __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+#define atomic_compare_exchange(p, expected, desired) \
+    __atomic_compare_exchange_n((p), (expected), (desired), false, \
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+#elif defined(HAVE_SYNC_BUILTINS)
+
+#define atomic_load_acquire(p) \
+    __extension__ ({ \
+        __typeof__(*(p)) val_ = *(volatile __typeof__(*(p)) *) (p); \
+        __sync_synchronize(); \
+        val_; \
+    })
+#define atomic_store_release(p, v) \
+    (__sync_synchronize(), (void) __sync_lock_test_and_set((p), (v)))
+#define atomic_fetch_add_relaxed(p, v) __sync_fetch_and_add((p), (v))
+#define atomic_fetch_add_acq_rel(p, v) __sync_fetch_and_add((p), (v))
+#define atomic_compare_exchange(p, expected, desired) \
+    __extension__ ({ \
+        __typeof__(*(p)) old_ = \
+            __sync_val_compare_and_swap((p), *(expected), (desired)); \
+        bool ok_ = (old_ == *(expected)); \
+        *(expected) = old_; \
+        ok_; \
+    })
+
+#else
+#error "The __atomic or __sync compiler builtins are needed"
+#endif
+
+/*
+ * Atomic reference counts, so that objects can be referenced and released
+ * from several threads at once. refcnt_dec() returns true if the last
+ * reference was dropped.
+ */
+static inline void
+refcnt_inc(int *refcnt)
+{
+    atomic_fetch_add_relaxed(refcnt, 1);
+}
+
+static inline bool
+refcnt_dec(int *refcnt)
+{
+    return atomic_fetch_add_acq_rel(refcnt, -1) == 1;
+}
+
+#endif
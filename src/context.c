@@ -24,15 +24,56 @@
  * Author: Daniel Stone <daniel@fooishbar.org>
  */
 
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <ctype.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "xkbcommon/xkbcommon.h"
 #include "utils.h"
 #include "context.h"
+#include "keymap.h"
+#include "list.h"
+#include "xkbcomp/file-cache.h"
+#include "xkbcomp/xkbcomp-priv.h"
+#include "xkbcomp/include.h"
+#include "xkbcomp/rules.h"
+
+struct keymap_cache_entry {
+    /* The normalized RMLVO names, each terminated by a NUL. */
+    char *key;
+    size_t key_len;
+    enum xkb_keymap_compile_flags flags;
+    uint32_t hash;
+
+    struct xkb_keymap *keymap;
+    size_t size;
+
+    struct keymap_cache_entry *next_in_bucket;
+    /* In the LRU list, most recently used first. */
+    struct list lru;
+};
+
+/*
+ * Compiled keymaps by the RMLVO names and flags they were compiled from.
+ * Disabled while max_size is 0.
+ */
+struct keymap_cache {
+    pthread_mutex_t lock;
+    size_t max_size;
+    size_t size;
+
+    struct keymap_cache_entry **buckets;
+    unsigned int num_buckets;
+    unsigned int num_entries;
+    struct list lru;
+
+    uint64_t hits;
+    uint64_t misses;
+};
 
 struct xkb_context {
     int refcnt;
@@ -52,11 +93,464 @@ struct xkb_context {
 
     struct atom_table *atom_table;
 
+    /* If set, the text buffer below isn't used, see xkb_context_get_buffer. */
+    bool thread_safe;
+
     /* Buffer for the *Text() functions. */
     char text_buffer[1024];
     size_t text_next;
+
+    struct keymap_cache keymap_cache;
+    /* Directory of the on-disk keymap cache, or NULL. */
+    char *keymap_cache_dir;
+    /*
+     * The parsed include files, or NULL.  Once created, it is only freed
+     * with the context: disabling it merely stops new lookups, since other
+     * threads may still be compiling from the files it handed out.
+     */
+    struct file_cache *file_cache;
+    bool file_cache_enabled;
+    /* The compiled rules files. */
+    struct rules_cache *rules_cache;
+    /* See RecordFileDeps(). */
+    darray_file_dep *recorded_deps;
 };
 
+#ifdef HAVE_THREAD_LOCAL
+/*
+ * Thread-safe contexts keep these per thread instead: the buffer for the
+ * *Text() functions, and where RecordFileDeps() records to.
+ */
+static THREAD_LOCAL char thread_text_buffer[1024];
+static THREAD_LOCAL size_t thread_text_next;
+static THREAD_LOCAL darray_file_dep *thread_recorded_deps;
+#endif
+
+static void
+keymap_cache_lock(struct xkb_context *ctx)
+{
+    if (ctx->thread_safe)
+        pthread_mutex_lock(&ctx->keymap_cache.lock);
+}
+
+static void
+keymap_cache_unlock(struct xkb_context *ctx)
+{
+    if (ctx->thread_safe)
+        pthread_mutex_unlock(&ctx->keymap_cache.lock);
+}
+
+/* FNV-1a. */
+static uint32_t
+keymap_cache_hash(const char *key, size_t key_len,
+                  enum xkb_keymap_compile_flags flags)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < key_len; i++) {
+        hash ^= (unsigned char) key[i];
+        hash *= 16777619u;
+    }
+
+    hash ^= (uint32_t) flags;
+    hash *= 16777619u;
+
+    return hash;
+}
+
+/*
+ * The RMLVO names must already have their defaults filled in, so that
+ * e.g. an empty layout and "us" share an entry.
+ */
+static char *
+keymap_cache_make_key(const struct xkb_rule_names *rmlvo, size_t *key_len)
+{
+    const char *names[] = {
+        rmlvo->rules, rmlvo->model, rmlvo->layout, rmlvo->variant,
+        rmlvo->options,
+    };
+    size_t lens[ARRAY_SIZE(names)];
+    size_t len = 0;
+    unsigned int i;
+    char *key, *p;
+
+    for (i = 0; i < ARRAY_SIZE(names); i++) {
+        lens[i] = names[i] ? strlen(names[i]) : 0;
+        len += lens[i] + 1;
+    }
+
+    key = malloc(len);
+    if (!key)
+        return NULL;
+
+    for (i = 0, p = key; i < ARRAY_SIZE(names); i++) {
+        if (lens[i] > 0)
+            memcpy(p, names[i], lens[i]);
+        p += lens[i];
+        *p++ = '\0';
+    }
+
+    *key_len = len;
+    return key;
+}
+
+static struct keymap_cache_entry *
+keymap_cache_find(struct keymap_cache *cache, const char *key, size_t key_len,
+                  enum xkb_keymap_compile_flags flags, uint32_t hash)
+{
+    struct keymap_cache_entry *entry;
+
+    if (cache->num_buckets == 0)
+        return NULL;
+
+    for (entry = cache->buckets[hash & (cache->num_buckets - 1)];
+         entry; entry = entry->next_in_bucket)
+        if (entry->hash == hash && entry->flags == flags &&
+            entry->key_len == key_len &&
+            memcmp(entry->key, key, key_len) == 0)
+            return entry;
+
+    return NULL;
+}
+
+static bool
+keymap_cache_grow(struct keymap_cache *cache)
+{
+    struct keymap_cache_entry **buckets, *entry, *next;
+    unsigned int num_buckets = cache->num_buckets ? cache->num_buckets * 2 : 16;
+    unsigned int i;
+
+    buckets = calloc(num_buckets, sizeof(*buckets));
+    if (!buckets)
+        return false;
+
+    for (i = 0; i < cache->num_buckets; i++) {
+        for (entry = cache->buckets[i]; entry; entry = next) {
+            next = entry->next_in_bucket;
+            entry->next_in_bucket = buckets[entry->hash & (num_buckets - 1)];
+            buckets[entry->hash & (num_buckets - 1)] = entry;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->num_buckets = num_buckets;
+    return true;
+}
+
+/* Take the entry out of the cache and put it in @victims. */
+static void
+keymap_cache_remove(struct keymap_cache *cache,
+                    struct keymap_cache_entry *entry, struct list *victims)
+{
+    struct keymap_cache_entry **p;
+
+    p = &cache->buckets[entry->hash & (cache->num_buckets - 1)];
+    while (*p != entry)
+        p = &(*p)->next_in_bucket;
+    *p = entry->next_in_bucket;
+
+    list_del(&entry->lru);
+    list_append(&entry->lru, victims);
+    cache->size -= entry->size;
+    cache->num_entries--;
+}
+
+/*
+ * Evict the least recently used entries until @extra more bytes fit in
+ * the budget.
+ */
+static void
+keymap_cache_evict(struct keymap_cache *cache, size_t extra,
+                   struct list *victims)
+{
+    struct keymap_cache_entry *entry;
+
+    while (!list_empty(&cache->lru) && cache->size + extra > cache->max_size) {
+        entry = list_last_entry(&cache->lru, struct keymap_cache_entry, lru);
+        keymap_cache_remove(cache, entry, victims);
+    }
+}
+
+/*
+ * Must be called without the lock held: releasing the keymaps releases
+ * their references to the context, which may be the last ones.
+ */
+static void
+keymap_cache_free_entries(struct list *entries)
+{
+    struct keymap_cache_entry *entry, *tmp;
+
+    list_foreach_safe(entry, tmp, entries, lru) {
+        xkb_keymap_unref(entry->keymap);
+        free(entry->key);
+        free(entry);
+    }
+}
+
+static void
+keymap_cache_flush(struct xkb_context *ctx)
+{
+    struct list victims;
+    struct keymap_cache_entry *entry;
+
+    list_init(&victims);
+
+    keymap_cache_lock(ctx);
+    while (!list_empty(&ctx->keymap_cache.lru)) {
+        entry = list_first_entry(&ctx->keymap_cache.lru,
+                                 struct keymap_cache_entry, lru);
+        keymap_cache_remove(&ctx->keymap_cache, entry, &victims);
+    }
+    keymap_cache_unlock(ctx);
+
+    keymap_cache_free_entries(&victims);
+}
+
+/*
+ * The cached keymaps hold references to the context. If those are all
+ * that is left, nobody can use the cache anymore, so drop it, which
+ * releases the context.
+ */
+static void
+keymap_cache_release_if_orphaned(struct xkb_context *ctx)
+{
+    struct keymap_cache *cache = &ctx->keymap_cache;
+    bool orphaned;
+
+    keymap_cache_lock(ctx);
+    orphaned = (cache->num_entries > 0 &&
+                atomic_load_acquire(&ctx->refcnt) == (int) cache->num_entries);
+    keymap_cache_unlock(ctx);
+
+    if (orphaned)
+        keymap_cache_flush(ctx);
+}
+
+struct xkb_keymap *
+xkb_context_keymap_cache_lookup(struct xkb_context *ctx,
+                                const struct xkb_rule_names *rmlvo,
+                                enum xkb_keymap_compile_flags flags)
+{
+    struct keymap_cache *cache = &ctx->keymap_cache;
+    struct keymap_cache_entry *entry;
+    struct xkb_keymap *keymap = NULL;
+    size_t key_len;
+    uint32_t hash;
+    char *key;
+
+    key = keymap_cache_make_key(rmlvo, &key_len);
+    if (!key)
+        return NULL;
+
+    hash = keymap_cache_hash(key, key_len, flags);
+
+    keymap_cache_lock(ctx);
+    if (cache->max_size > 0) {
+        entry = keymap_cache_find(cache, key, key_len, flags, hash);
+        if (entry) {
+            list_del(&entry->lru);
+            list_add(&entry->lru, &cache->lru);
+            keymap = xkb_keymap_ref(entry->keymap);
+            cache->hits++;
+        }
+        else {
+            cache->misses++;
+        }
+    }
+    keymap_cache_unlock(ctx);
+
+    free(key);
+    return keymap;
+}
+
+void
+xkb_context_keymap_cache_add(struct xkb_context *ctx,
+                             const struct xkb_rule_names *rmlvo,
+                             enum xkb_keymap_compile_flags flags,
+                             struct xkb_keymap *keymap)
+{
+    struct keymap_cache *cache = &ctx->keymap_cache;
+    struct keymap_cache_entry *entry;
+    struct list victims;
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry)
+        return;
+
+    entry->key = keymap_cache_make_key(rmlvo, &entry->key_len);
+    if (!entry->key) {
+        free(entry);
+        return;
+    }
+
+    entry->flags = flags;
+    entry->hash = keymap_cache_hash(entry->key, entry->key_len, flags);
+    entry->size = sizeof(*entry) + entry->key_len +
+                  xkb_keymap_memory_size(keymap);
+
+    list_init(&victims);
+
+    keymap_cache_lock(ctx);
+
+    /* Another thread may have compiled the same keymap meanwhile. */
+    if (entry->size > cache->max_size ||
+        keymap_cache_find(cache, entry->key, entry->key_len, flags,
+                          entry->hash) ||
+        (cache->num_entries >= cache->num_buckets &&
+         !keymap_cache_grow(cache))) {
+        keymap_cache_unlock(ctx);
+        free(entry->key);
+        free(entry);
+        return;
+    }
+
+    keymap_cache_evict(cache, entry->size, &victims);
+
+    entry->keymap = xkb_keymap_ref(keymap);
+    entry->next_in_bucket = cache->buckets[entry->hash &
+                                           (cache->num_buckets - 1)];
+    cache->buckets[entry->hash & (cache->num_buckets - 1)] = entry;
+    list_add(&entry->lru, &cache->lru);
+    cache->size += entry->size;
+    cache->num_entries++;
+
+    keymap_cache_unlock(ctx);
+
+    keymap_cache_free_entries(&victims);
+}
+
+XKB_EXPORT void
+xkb_context_set_keymap_cache_size(struct xkb_context *ctx, size_t size)
+{
+    struct list victims;
+
+    list_init(&victims);
+
+    keymap_cache_lock(ctx);
+    ctx->keymap_cache.max_size = size;
+    keymap_cache_evict(&ctx->keymap_cache, 0, &victims);
+    keymap_cache_unlock(ctx);
+
+    keymap_cache_free_entries(&victims);
+}
+
+XKB_EXPORT size_t
+xkb_context_get_keymap_cache_size(struct xkb_context *ctx)
+{
+    size_t size;
+
+    keymap_cache_lock(ctx);
+    size = ctx->keymap_cache.max_size;
+    keymap_cache_unlock(ctx);
+
+    return size;
+}
+
+XKB_EXPORT uint64_t
+xkb_context_get_keymap_cache_hits(struct xkb_context *ctx)
+{
+    uint64_t hits;
+
+    keymap_cache_lock(ctx);
+    hits = ctx->keymap_cache.hits;
+    keymap_cache_unlock(ctx);
+
+    return hits;
+}
+
+XKB_EXPORT uint64_t
+xkb_context_get_keymap_cache_misses(struct xkb_context *ctx)
+{
+    uint64_t misses;
+
+    keymap_cache_lock(ctx);
+    misses = ctx->keymap_cache.misses;
+    keymap_cache_unlock(ctx);
+
+    return misses;
+}
+
+XKB_EXPORT int
+xkb_context_set_keymap_cache_dir(struct xkb_context *ctx, const char *path)
+{
+    struct stat stat_buf;
+    char *dir;
+
+    if (!path) {
+        free(ctx->keymap_cache_dir);
+        ctx->keymap_cache_dir = NULL;
+        return 1;
+    }
+
+    if (stat(path, &stat_buf) != 0 || !S_ISDIR(stat_buf.st_mode))
+        goto err;
+
+#if defined(HAVE_EACCESS)
+    if (eaccess(path, R_OK | W_OK | X_OK) != 0)
+        goto err;
+#elif defined(HAVE_EUIDACCESS)
+    if (euidaccess(path, R_OK | W_OK | X_OK) != 0)
+        goto err;
+#endif
+
+    dir = strdup(path);
+    if (!dir)
+        goto err;
+
+    free(ctx->keymap_cache_dir);
+    ctx->keymap_cache_dir = dir;
+    return 1;
+
+err:
+    log_err(ctx, "Keymap cache directory %s is not usable\n", path);
+    return 0;
+}
+
+XKB_EXPORT const char *
+xkb_context_get_keymap_cache_dir(struct xkb_context *ctx)
+{
+    return ctx->keymap_cache_dir;
+}
+
+XKB_EXPORT int
+xkb_context_set_file_cache_enabled(struct xkb_context *ctx, int enable)
+{
+    if (enable && !atomic_load_acquire(&ctx->file_cache)) {
+        struct file_cache *cache = file_cache_new(ctx->thread_safe);
+        struct file_cache *expected = NULL;
+
+        if (!cache)
+            return 0;
+        if (!atomic_compare_exchange(&ctx->file_cache, &expected, cache))
+            file_cache_free(cache);
+    }
+
+    atomic_store_release(&ctx->file_cache_enabled, !!enable);
+    return 1;
+}
+
+XKB_EXPORT int
+xkb_context_get_file_cache_enabled(struct xkb_context *ctx)
+{
+    return atomic_load_acquire(&ctx->file_cache_enabled);
+}
+
+struct file_cache *
+xkb_context_get_file_cache(struct xkb_context *ctx)
+{
+    if (!atomic_load_acquire(&ctx->file_cache_enabled))
+        return NULL;
+    return atomic_load_acquire(&ctx->file_cache);
+}
+
+struct rules_cache *
+xkb_context_get_rules_cache(struct xkb_context *ctx)
+{
+    return ctx->rules_cache;
+}
+
 /**
  * Append one directory to the context's include path.
  */
@@ -86,6 +580,8 @@ xkb_context_include_path_append(struct xkb_context *ctx, const char *path)
 #endif
 
     darray_append(ctx->includes, tmp);
+    /* Keymaps compiled before may come out differently now. */
+    keymap_cache_flush(ctx);
     return 1;
 
 err:
@@ -126,6 +622,8 @@ xkb_context_include_path_clear(struct xkb_context *ctx)
 {
     char **path;
 
+    keymap_cache_flush(ctx);
+
     darray_foreach(path, ctx->includes)
         free(*path);
     darray_free(ctx->includes);
@@ -186,7 +684,23 @@ xkb_context_failed_include_path_get(struct xkb_context *ctx,
 unsigned
 xkb_context_take_file_id(struct xkb_context *ctx)
 {
-    return ctx->file_id++;
+    return atomic_fetch_add_relaxed(&ctx->file_id, 1);
+}
+
+bool
+xkb_context_is_thread_safe(struct xkb_context *ctx)
+{
+    return ctx->thread_safe;
+}
+
+darray_file_dep **
+xkb_context_recorded_deps(struct xkb_context *ctx)
+{
+#ifdef HAVE_THREAD_LOCAL
+    if (ctx->thread_safe)
+        return &thread_recorded_deps;
+#endif
+    return &ctx->recorded_deps;
 }
 
 /**
@@ -195,7 +709,7 @@ xkb_context_take_file_id(struct xkb_context *ctx)
 XKB_EXPORT struct xkb_context *
 xkb_context_ref(struct xkb_context *ctx)
 {
-    ctx->refcnt++;
+    refcnt_inc(&ctx->refcnt);
     return ctx;
 }
 
@@ -206,10 +720,20 @@ xkb_context_ref(struct xkb_context *ctx)
 XKB_EXPORT void
 xkb_context_unref(struct xkb_context *ctx)
 {
-    if (!ctx || --ctx->refcnt > 0)
+    if (!ctx)
         return;
 
+    if (!refcnt_dec(&ctx->refcnt)) {
+        keymap_cache_release_if_orphaned(ctx);
+        return;
+    }
+
     xkb_context_include_path_clear(ctx);
+    free(ctx->keymap_cache.buckets);
+    free(ctx->keymap_cache_dir);
+    file_cache_free(ctx->file_cache);
+    rules_cache_free(ctx->rules_cache);
+    pthread_mutex_destroy(&ctx->keymap_cache.lock);
     atom_table_free(ctx->atom_table);
     free(ctx);
 }
@@ -294,6 +818,9 @@ xkb_context_new(enum xkb_context_flags flags)
 
     ctx->refcnt = 1;
     ctx->log_fn = default_log_fn;
+    ctx->thread_safe = !!(flags & XKB_CONTEXT_THREAD_SAFE);
+    pthread_mutex_init(&ctx->keymap_cache.lock, NULL);
+    list_init(&ctx->keymap_cache.lru);
     ctx->log_level = XKB_LOG_LEVEL_ERROR;
     ctx->log_verbosity = 0;
 
@@ -306,6 +833,15 @@ xkb_context_new(enum xkb_context_flags flags)
     if (env)
         xkb_context_set_log_verbosity(ctx, log_verbosity(env));
 
+#ifndef HAVE_THREAD_LOCAL
+    if (ctx->thread_safe) {
+        log_err(ctx, "thread-safe contexts need thread-local storage, "
+                "which this build lacks\n");
+        xkb_context_unref(ctx);
+        return NULL;
+    }
+#endif
+
     if (!(flags & XKB_CONTEXT_NO_DEFAULT_INCLUDES) &&
         !xkb_context_include_path_append_default(ctx)) {
         log_err(ctx, "failed to add default include path %s\n",
@@ -314,12 +850,18 @@ xkb_context_new(enum xkb_context_flags flags)
         return NULL;
     }
 
-    ctx->atom_table = atom_table_new();
+    ctx->atom_table = atom_table_new(ctx->thread_safe);
     if (!ctx->atom_table) {
         xkb_context_unref(ctx);
         return NULL;
     }
 
+    ctx->rules_cache = rules_cache_new(ctx->thread_safe);
+    if (!ctx->rules_cache) {
+        xkb_context_unref(ctx);
+        return NULL;
+    }
+
     return ctx;
 }
 
@@ -329,12 +871,24 @@ xkb_atom_lookup(struct xkb_context *ctx, const char *string)
     return atom_lookup(ctx->atom_table, string);
 }
 
+xkb_atom_t
+xkb_atom_lookup_len(struct xkb_context *ctx, const char *string, size_t len)
+{
+    return atom_lookup_len(ctx->atom_table, string, len);
+}
+
 xkb_atom_t
 xkb_atom_intern(struct xkb_context *ctx, const char *string)
 {
     return atom_intern(ctx->atom_table, string, false);
 }
 
+xkb_atom_t
+xkb_atom_intern_len(struct xkb_context *ctx, const char *string, size_t len)
+{
+    return atom_intern_len(ctx->atom_table, string, len);
+}
+
 xkb_atom_t
 xkb_atom_steal(struct xkb_context *ctx, char *string)
 {
@@ -411,19 +965,33 @@ xkb_context_set_user_data(struct xkb_context *ctx, void *user_data)
     ctx->user_data = user_data;
 }
 
+/*
+ * The returned buffer is only valid until a few more calls have been made,
+ * so the *Text() functions are meant for logging and such. With a
+ * thread-safe context, each thread has its own buffers.
+ */
 char *
 xkb_context_get_buffer(struct xkb_context *ctx, size_t size)
 {
+    char *buffer = ctx->text_buffer;
+    size_t *next = &ctx->text_next;
     char *rtrn;
 
+#ifdef HAVE_THREAD_LOCAL
+    if (ctx->thread_safe) {
+        buffer = thread_text_buffer;
+        next = &thread_text_next;
+    }
+#endif
+
     if (size >= sizeof(ctx->text_buffer))
         return NULL;
 
-    if (sizeof(ctx->text_buffer) - ctx->text_next <= size)
-        ctx->text_next = 0;
+    if (sizeof(ctx->text_buffer) - *next <= size)
+        *next = 0;
 
-    rtrn = &ctx->text_buffer[ctx->text_next];
-    ctx->text_next += size;
+    rtrn = &buffer[*next];
+    *next += size;
 
     return rtrn;
 }
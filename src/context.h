@@ -31,6 +31,31 @@
 unsigned
 xkb_context_take_file_id(struct xkb_context *ctx);
 
+bool
+xkb_context_is_thread_safe(struct xkb_context *ctx);
+
+/*
+ * Returns a new reference to the keymap cached for the RMLVO names, or
+ * NULL. The names must already have their defaults filled in.
+ */
+struct xkb_keymap *
+xkb_context_keymap_cache_lookup(struct xkb_context *ctx,
+                                const struct xkb_rule_names *rmlvo,
+                                enum xkb_keymap_compile_flags flags);
+
+void
+xkb_context_keymap_cache_add(struct xkb_context *ctx,
+                             const struct xkb_rule_names *rmlvo,
+                             enum xkb_keymap_compile_flags flags,
+                             struct xkb_keymap *keymap);
+
+/* Returns NULL unless the file cache is enabled. */
+struct file_cache *
+xkb_context_get_file_cache(struct xkb_context *ctx);
+
+struct rules_cache *
+xkb_context_get_rules_cache(struct xkb_context *ctx);
+
 unsigned int
 xkb_context_num_failed_include_paths(struct xkb_context *ctx);
 
@@ -45,14 +70,24 @@ xkb_context_failed_include_path_get(struct xkb_context *ctx,
 xkb_atom_t
 xkb_atom_lookup(struct xkb_context *ctx, const char *string);
 
+/* Like xkb_atom_lookup, for the first @len bytes of @string. */
+xkb_atom_t
+xkb_atom_lookup_len(struct xkb_context *ctx, const char *string, size_t len);
+
 xkb_atom_t
 xkb_atom_intern(struct xkb_context *ctx, const char *string);
 
+/*
+ * Interns the first @len bytes of @string, which doesn't need to be
+ * NUL-terminated.
+ */
+xkb_atom_t
+xkb_atom_intern_len(struct xkb_context *ctx, const char *string, size_t len);
+
 /**
- * If @string is dynamically allocated, free'd immediately after
- * being interned, and not used afterwards, use this function
- * instead of xkb_atom_intern to avoid some unnecessary allocations.
- * The caller should not use or free the passed in string afterwards.
+ * Like xkb_atom_intern, but also frees @string, which must be dynamically
+ * allocated.  The caller should not use or free the passed in string
+ * afterwards.
  */
 xkb_atom_t
 xkb_atom_steal(struct xkb_context *ctx, char *string);
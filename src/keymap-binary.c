@@ -0,0 +1,1178 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The XKB_KEYMAP_FORMAT_BINARY_V1 format.
+ *
+ * This is a dump of the compiled keymap structures, so that loading it
+ * doesn't involve any parsing or compiling. It is made to be shared between
+ * processes, e.g. in a memfd or a file, and so does not contain any
+ * pointers or atoms:
+ *
+ * - The file starts with a header (struct bin_header), followed by a
+ *   number of sections, each an array of fixed-size little records.
+ *   The header holds the offset and count of each section.
+ * - Records refer to each other by their index in the section.
+ * - Strings (e.g. the atoms) are all in one pool, and are referred to by
+ *   their offset in the pool plus one; 0 is the NULL string.
+ * - Everything is a native-endian uint32_t, or an array thereof, so the
+ *   loader can read the buffer in place, as long as it is suitably
+ *   aligned. The header records the byte order, and a buffer from a
+ *   machine with a different one is refused.
+ *
+ * The loader must not trust anything in the buffer, since it may come from
+ * another process; every offset, index and count is checked before use.
+ */
+
+#include "keymap.h"
+
+#define BINARY_MAGIC "xkbB"
+#define BINARY_VERSION 2
+#define BINARY_BYTE_ORDER 0x01020304
+
+enum bin_section_index {
+    SECTION_STRINGS,
+    SECTION_MODS,
+    SECTION_TYPES,
+    SECTION_TYPE_ENTRIES,
+    SECTION_LEVEL_NAMES,
+    SECTION_LOOKUPS,
+    SECTION_KEYS,
+    SECTION_GROUPS,
+    SECTION_LEVELS,
+    SECTION_SYMS,
+    SECTION_INTERPRETS,
+    SECTION_INDICATORS,
+    SECTION_ALIASES,
+    SECTION_GROUP_NAMES,
+    _SECTION_NUM_ENTRIES
+};
+
+struct bin_section {
+    uint32_t offset;
+    /* The number of records; for the string pool, of bytes. */
+    uint32_t count;
+};
+
+struct bin_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t size;
+
+    uint32_t enabled_ctrls;
+    uint32_t min_key_code;
+    uint32_t max_key_code;
+    uint32_t num_groups;
+    uint32_t indicator_deps;
+    uint32_t ctrl_indicators;
+
+    uint32_t keycodes_section_name;
+    uint32_t types_section_name;
+    uint32_t compat_section_name;
+    uint32_t symbols_section_name;
+
+    struct bin_section sections[_SECTION_NUM_ENTRIES];
+};
+
+/*
+ * The action union has a different layout for each type; it is stored as
+ * the type, the flags, and up to three words of arguments.
+ */
+struct bin_action {
+    uint32_t type;
+    uint32_t flags;
+    uint32_t args[3];
+};
+
+struct bin_mod {
+    uint32_t name;
+    uint32_t type;
+    uint32_t mapping;
+};
+
+struct bin_type {
+    uint32_t name;
+    uint32_t mods;
+    uint32_t mask;
+    uint32_t num_levels;
+    uint32_t first_entry;
+    uint32_t num_entries;
+    uint32_t first_level_name;
+    uint32_t num_level_names;
+    /* The number of lookups is determined by the mask. */
+    uint32_t first_lookup;
+    uint8_t lookup_index_lo[16];
+    uint8_t lookup_index_hi[16];
+};
+
+struct bin_type_entry {
+    uint32_t level;
+    uint32_t mods;
+    uint32_t mask;
+    uint32_t preserve_mods;
+    uint32_t preserve_mask;
+};
+
+struct bin_lookup {
+    uint32_t level;
+    uint32_t consumed;
+};
+
+/* One for each key, in keycode order. */
+struct bin_key {
+    uint32_t keycode;
+    uint32_t name;
+    uint32_t explicit;
+    uint32_t modmap;
+    uint32_t vmodmap;
+    uint32_t repeats;
+    uint32_t out_of_range_group_action;
+    uint32_t out_of_range_group_number;
+    uint32_t first_group;
+    uint32_t num_groups;
+};
+
+/* The number of levels is the number of levels of the type. */
+struct bin_group {
+    uint32_t explicit_type;
+    uint32_t type;
+    uint32_t first_level;
+};
+
+struct bin_level {
+    struct bin_action action;
+    uint32_t num_syms;
+    /* The keysym if num_syms == 1, otherwise the index of the first one. */
+    uint32_t syms;
+};
+
+struct bin_interpret {
+    uint32_t sym;
+    uint32_t match;
+    uint32_t level_one_only;
+    uint32_t mods;
+    uint32_t virtual_mod;
+    uint32_t repeat;
+    struct bin_action action;
+};
+
+struct bin_indicator {
+    uint32_t name;
+    uint32_t which_groups;
+    uint32_t groups;
+    uint32_t which_mods;
+    uint32_t mods;
+    uint32_t mask;
+    uint32_t ctrls;
+};
+
+struct bin_alias {
+    uint32_t real;
+    uint32_t alias;
+};
+
+static const size_t section_record_size[_SECTION_NUM_ENTRIES] = {
+    [SECTION_STRINGS] = 1,
+    [SECTION_MODS] = sizeof(struct bin_mod),
+    [SECTION_TYPES] = sizeof(struct bin_type),
+    [SECTION_TYPE_ENTRIES] = sizeof(struct bin_type_entry),
+    [SECTION_LEVEL_NAMES] = sizeof(uint32_t),
+    [SECTION_LOOKUPS] = sizeof(struct bin_lookup),
+    [SECTION_KEYS] = sizeof(struct bin_key),
+    [SECTION_GROUPS] = sizeof(struct bin_group),
+    [SECTION_LEVELS] = sizeof(struct bin_level),
+    [SECTION_SYMS] = sizeof(uint32_t),
+    [SECTION_INTERPRETS] = sizeof(struct bin_interpret),
+    [SECTION_INDICATORS] = sizeof(struct bin_indicator),
+    [SECTION_ALIASES] = sizeof(struct bin_alias),
+    [SECTION_GROUP_NAMES] = sizeof(uint32_t),
+};
+
+/***====================================================================***/
+
+struct bin_writer {
+    struct xkb_keymap *keymap;
+
+    darray_char strings;
+    /* The string reference of each atom, or 0 if not written yet. */
+    darray(uint32_t) atom_refs;
+
+    darray(struct bin_mod) mods;
+    darray(struct bin_type) types;
+    darray(struct bin_type_entry) type_entries;
+    darray(uint32_t) level_names;
+    darray(struct bin_lookup) lookups;
+    darray(struct bin_key) keys;
+    darray(struct bin_group) groups;
+    darray(struct bin_level) levels;
+    darray(uint32_t) syms;
+    darray(struct bin_interpret) interprets;
+    darray(struct bin_indicator) indicators;
+    darray(struct bin_alias) aliases;
+    darray(uint32_t) group_names;
+};
+
+static uint32_t
+write_string(struct bin_writer *w, const char *string)
+{
+    uint32_t ref;
+
+    if (!string)
+        return 0;
+
+    ref = darray_size(w->strings) + 1;
+    darray_append_items(w->strings, string, strlen(string) + 1);
+    return ref;
+}
+
+static uint32_t
+write_atom(struct bin_writer *w, xkb_atom_t atom)
+{
+    if (atom == XKB_ATOM_NONE)
+        return 0;
+
+    if (atom >= darray_size(w->atom_refs))
+        darray_resize0(w->atom_refs, atom + 1);
+
+    if (darray_item(w->atom_refs, atom) == 0)
+        darray_item(w->atom_refs, atom) =
+            write_string(w, xkb_atom_text(w->keymap->ctx, atom));
+
+    return darray_item(w->atom_refs, atom);
+}
+
+static void
+write_action(const union xkb_action *action, struct bin_action *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->type = action->type;
+
+    switch (action->type) {
+    case ACTION_TYPE_MOD_SET:
+    case ACTION_TYPE_MOD_LATCH:
+    case ACTION_TYPE_MOD_LOCK:
+        out->flags = action->mods.flags;
+        out->args[0] = action->mods.mods;
+        out->args[1] = action->mods.mask;
+        break;
+
+    case ACTION_TYPE_GROUP_SET:
+    case ACTION_TYPE_GROUP_LATCH:
+    case ACTION_TYPE_GROUP_LOCK:
+        out->flags = action->group.flags;
+        out->args[0] = (uint32_t) action->group.group;
+        break;
+
+    case ACTION_TYPE_PTR_MOVE:
+        out->flags = action->ptr.flags;
+        out->args[0] = (uint32_t) action->ptr.x;
+        out->args[1] = (uint32_t) action->ptr.y;
+        break;
+
+    case ACTION_TYPE_PTR_BUTTON:
+    case ACTION_TYPE_PTR_LOCK:
+        out->flags = action->btn.flags;
+        out->args[0] = action->btn.count;
+        out->args[1] = (uint32_t) action->btn.button;
+        break;
+
+    case ACTION_TYPE_PTR_DEFAULT:
+        out->flags = action->dflt.flags;
+        out->args[0] = (uint32_t) action->dflt.value;
+        break;
+
+    case ACTION_TYPE_SWITCH_VT:
+        out->flags = action->screen.flags;
+        out->args[0] = (uint32_t) action->screen.screen;
+        break;
+
+    case ACTION_TYPE_CTRL_SET:
+    case ACTION_TYPE_CTRL_LOCK:
+        out->flags = action->ctrls.flags;
+        out->args[0] = action->ctrls.ctrls;
+        break;
+
+    default:
+        /* Private actions use all the types from ACTION_TYPE_PRIVATE up. */
+        if (action->type >= ACTION_TYPE_PRIVATE)
+            memcpy(out->args, action->priv.data, sizeof(action->priv.data));
+        break;
+    }
+}
+
+static void
+write_types(struct bin_writer *w)
+{
+    struct xkb_keymap *keymap = w->keymap;
+    unsigned int i, j;
+
+    for (i = 0; i < keymap->num_types; i++) {
+        const struct xkb_key_type *type = &keymap->types[i];
+        struct bin_type out;
+        unsigned int num_lookups = XkbKeyTypeNumLookups(type->mods.mask);
+
+        out.name = write_atom(w, type->name);
+        out.mods = type->mods.mods;
+        out.mask = type->mods.mask;
+        out.num_levels = type->num_levels;
+
+        out.first_entry = darray_size(w->type_entries);
+        out.num_entries = type->num_entries;
+        for (j = 0; j < type->num_entries; j++) {
+            const struct xkb_kt_map_entry *entry = &type->map[j];
+            struct bin_type_entry e = {
+                .level = entry->level,
+                .mods = entry->mods.mods,
+                .mask = entry->mods.mask,
+                .preserve_mods = entry->preserve.mods,
+                .preserve_mask = entry->preserve.mask,
+            };
+            darray_append(w->type_entries, e);
+        }
+
+        out.first_level_name = darray_size(w->level_names);
+        out.num_level_names = type->level_names ? type->num_level_names : 0;
+        for (j = 0; j < out.num_level_names; j++)
+            darray_append(w->level_names,
+                          write_atom(w, type->level_names[j]));
+
+        out.first_lookup = darray_size(w->lookups);
+        for (j = 0; j < num_lookups; j++) {
+            struct bin_lookup l = {
+                .level = type->lookup[j].level,
+                .consumed = type->lookup[j].consumed,
+            };
+            darray_append(w->lookups, l);
+        }
+        memcpy(out.lookup_index_lo, type->lookup_index_lo,
+               sizeof(out.lookup_index_lo));
+        memcpy(out.lookup_index_hi, type->lookup_index_hi,
+               sizeof(out.lookup_index_hi));
+
+        darray_append(w->types, out);
+    }
+}
+
+static void
+write_keys(struct bin_writer *w)
+{
+    struct xkb_keymap *keymap = w->keymap;
+    const struct xkb_key *key;
+    xkb_layout_index_t i;
+    xkb_level_index_t j;
+
+    xkb_foreach_key(key, keymap) {
+        const struct xkb_key_aux *aux = XkbKeyAux(keymap, key);
+        struct bin_key out = {
+            .keycode = aux->keycode,
+            .name = write_atom(w, aux->name),
+            .explicit = aux->explicit,
+            .modmap = aux->modmap,
+            .vmodmap = aux->vmodmap,
+            .repeats = key->repeats,
+            .out_of_range_group_action = key->out_of_range_group_action,
+            .out_of_range_group_number = key->out_of_range_group_number,
+            .first_group = darray_size(w->groups),
+            .num_groups = key->num_groups,
+        };
+
+        for (i = 0; i < key->num_groups; i++) {
+            const struct xkb_group *group = &key->groups[i];
+            struct bin_group g = {
+                .explicit_type = !!(aux->explicit_types & (1u << i)),
+                .type = group->type - keymap->types,
+                .first_level = darray_size(w->levels),
+            };
+
+            for (j = 0; j < XkbKeyGroupWidth(key, i); j++) {
+                const struct xkb_level *level = &group->levels[j];
+                struct bin_level l;
+
+                write_action(&level->action, &l.action);
+                l.num_syms = level->num_syms;
+                if (level->num_syms <= 1) {
+                    l.syms = level->u.sym;
+                }
+                else {
+                    l.syms = darray_size(w->syms);
+                    darray_append_items(w->syms, level->u.syms,
+                                        level->num_syms);
+                }
+
+                darray_append(w->levels, l);
+            }
+
+            darray_append(w->groups, g);
+        }
+
+        darray_append(w->keys, out);
+    }
+}
+
+static void
+write_compat(struct bin_writer *w)
+{
+    struct xkb_keymap *keymap = w->keymap;
+    const struct xkb_sym_interpret *si;
+    const struct xkb_indicator_map *im;
+
+    darray_foreach(si, keymap->sym_interprets) {
+        struct bin_interpret out = {
+            .sym = si->sym,
+            .match = si->match,
+            .level_one_only = si->level_one_only,
+            .mods = si->mods,
+            .virtual_mod = si->virtual_mod,
+            .repeat = si->repeat,
+        };
+
+        write_action(&si->action, &out.action);
+        darray_append(w->interprets, out);
+    }
+
+    darray_foreach(im, keymap->indicators) {
+        struct bin_indicator out = {
+            .name = write_atom(w, im->name),
+            .which_groups = im->which_groups,
+            .groups = im->groups,
+            .which_mods = im->which_mods,
+            .mods = im->mods.mods,
+            .mask = im->mods.mask,
+            .ctrls = im->ctrls,
+        };
+
+        darray_append(w->indicators, out);
+    }
+}
+
+static void
+write_names(struct bin_writer *w)
+{
+    struct xkb_keymap *keymap = w->keymap;
+    const struct xkb_mod *mod;
+    const struct xkb_key_alias *alias;
+    xkb_layout_index_t i;
+
+    darray_foreach(mod, keymap->mods) {
+        struct bin_mod out = {
+            .name = write_atom(w, mod->name),
+            .type = mod->type,
+            .mapping = mod->mapping,
+        };
+
+        darray_append(w->mods, out);
+    }
+
+    darray_foreach(alias, keymap->key_aliases) {
+        struct bin_alias out = {
+            .real = write_atom(w, alias->real),
+            .alias = write_atom(w, alias->alias),
+        };
+
+        darray_append(w->aliases, out);
+    }
+
+    for (i = 0; i < keymap->num_group_names; i++)
+        darray_append(w->group_names,
+                      write_atom(w, keymap->group_names[i]));
+}
+
+static void
+append_section(darray_char *buf, struct bin_header *header,
+               enum bin_section_index idx, const void *records,
+               size_t count)
+{
+    /* Keep every section aligned for the reader. */
+    while (darray_size(*buf) % sizeof(uint32_t) != 0)
+        darray_append(*buf, '\0');
+
+    header->sections[idx].offset = darray_size(*buf);
+    header->sections[idx].count = count;
+
+    if (count > 0)
+        darray_append_items(*buf, (const char *) records,
+                            count * section_record_size[idx]);
+}
+
+char *
+keymap_get_as_binary(struct xkb_keymap *keymap, size_t *size_out)
+{
+    struct bin_writer w;
+    struct bin_header header;
+    darray_char buf;
+
+    memset(&w, 0, sizeof(w));
+    memset(&header, 0, sizeof(header));
+    darray_init(buf);
+
+    w.keymap = keymap;
+
+    write_names(&w);
+    write_types(&w);
+    write_keys(&w);
+    write_compat(&w);
+
+    memcpy(header.magic, BINARY_MAGIC, sizeof(header.magic));
+    header.version = BINARY_VERSION;
+    header.byte_order = BINARY_BYTE_ORDER;
+    header.enabled_ctrls = keymap->enabled_ctrls;
+    header.min_key_code = keymap->min_key_code;
+    header.max_key_code = keymap->max_key_code;
+    header.num_groups = keymap->num_groups;
+    header.indicator_deps = keymap->indicator_deps;
+    header.ctrl_indicators = keymap->ctrl_indicators;
+    header.keycodes_section_name =
+        write_string(&w, keymap->keycodes_section_name);
+    header.types_section_name = write_string(&w, keymap->types_section_name);
+    header.compat_section_name =
+        write_string(&w, keymap->compat_section_name);
+    header.symbols_section_name =
+        write_string(&w, keymap->symbols_section_name);
+
+    /* Leave room for the header, which is filled in last. */
+    darray_resize0(buf, sizeof(header));
+
+#define APPEND(idx, arr) \
+    append_section(&buf, &header, idx, darray_mem(arr, 0), darray_size(arr))
+    APPEND(SECTION_MODS, w.mods);
+    APPEND(SECTION_TYPES, w.types);
+    APPEND(SECTION_TYPE_ENTRIES, w.type_entries);
+    APPEND(SECTION_LEVEL_NAMES, w.level_names);
+    APPEND(SECTION_LOOKUPS, w.lookups);
+    APPEND(SECTION_KEYS, w.keys);
+    APPEND(SECTION_GROUPS, w.groups);
+    APPEND(SECTION_LEVELS, w.levels);
+    APPEND(SECTION_SYMS, w.syms);
+    APPEND(SECTION_INTERPRETS, w.interprets);
+    APPEND(SECTION_INDICATORS, w.indicators);
+    APPEND(SECTION_ALIASES, w.aliases);
+    APPEND(SECTION_GROUP_NAMES, w.group_names);
+    APPEND(SECTION_STRINGS, w.strings);
+#undef APPEND
+
+    header.size = darray_size(buf);
+    memcpy(darray_mem(buf, 0), &header, sizeof(header));
+
+    darray_free(w.strings);
+    darray_free(w.atom_refs);
+    darray_free(w.mods);
+    darray_free(w.types);
+    darray_free(w.type_entries);
+    darray_free(w.level_names);
+    darray_free(w.lookups);
+    darray_free(w.keys);
+    darray_free(w.groups);
+    darray_free(w.levels);
+    darray_free(w.syms);
+    darray_free(w.interprets);
+    darray_free(w.indicators);
+    darray_free(w.aliases);
+    darray_free(w.group_names);
+
+    *size_out = header.size;
+    return darray_mem(buf, 0);
+}
+
+/***====================================================================***/
+
+struct bin_reader {
+    struct xkb_context *ctx;
+    const char *buffer;
+    const struct bin_header *header;
+    const char *strings;
+    uint32_t strings_size;
+};
+
+static const void *
+section(struct bin_reader *r, enum bin_section_index idx)
+{
+    return r->buffer + r->header->sections[idx].offset;
+}
+
+static uint32_t
+section_count(struct bin_reader *r, enum bin_section_index idx)
+{
+    return r->header->sections[idx].count;
+}
+
+/* Is [first, first + count) a valid range of records in the section? */
+static bool
+section_range_ok(struct bin_reader *r, enum bin_section_index idx,
+                 uint32_t first, uint32_t count)
+{
+    uint32_t total = section_count(r, idx);
+
+    return first <= total && count <= total - first;
+}
+
+static bool
+read_string(struct bin_reader *r, uint32_t ref, const char **out)
+{
+    if (ref == 0) {
+        *out = NULL;
+        return true;
+    }
+
+    if (ref - 1 >= r->strings_size)
+        return false;
+
+    *out = r->strings + ref - 1;
+    return true;
+}
+
+static bool
+read_atom(struct bin_reader *r, uint32_t ref, xkb_atom_t *out)
+{
+    const char *string;
+
+    if (!read_string(r, ref, &string))
+        return false;
+
+    *out = string ? xkb_atom_intern(r->ctx, string) : XKB_ATOM_NONE;
+    return string == NULL || *out != XKB_ATOM_NONE;
+}
+
+/* For the names which the rest of the library expects to be set. */
+static bool
+read_atom_required(struct bin_reader *r, uint32_t ref, xkb_atom_t *out)
+{
+    return ref != 0 && read_atom(r, ref, out);
+}
+
+static bool
+read_section_name(struct bin_reader *r, uint32_t ref, char **out)
+{
+    const char *string;
+
+    if (!read_string(r, ref, &string))
+        return false;
+
+    *out = strdup_safe(string);
+    return string == NULL || *out != NULL;
+}
+
+static bool
+read_action(const struct bin_action *in, union xkb_action *action)
+{
+    memset(action, 0, sizeof(*action));
+
+    /* See HandlePrivate(). */
+    if (in->type > 255)
+        return false;
+
+    action->type = in->type;
+
+    switch (action->type) {
+    case ACTION_TYPE_MOD_SET:
+    case ACTION_TYPE_MOD_LATCH:
+    case ACTION_TYPE_MOD_LOCK:
+        action->mods.flags = in->flags;
+        action->mods.mods = in->args[0];
+        action->mods.mask = in->args[1] & MOD_REAL_MASK_ALL;
+        break;
+
+    case ACTION_TYPE_GROUP_SET:
+    case ACTION_TYPE_GROUP_LATCH:
+    case ACTION_TYPE_GROUP_LOCK:
+        action->group.flags = in->flags;
+        action->group.group = (int32_t) in->args[0];
+        break;
+
+    case ACTION_TYPE_PTR_MOVE:
+        action->ptr.flags = in->flags;
+        action->ptr.x = (int16_t) in->args[0];
+        action->ptr.y = (int16_t) in->args[1];
+        break;
+
+    case ACTION_TYPE_PTR_BUTTON:
+    case ACTION_TYPE_PTR_LOCK:
+        action->btn.flags = in->flags;
+        action->btn.count = in->args[0];
+        action->btn.button = (int8_t) in->args[1];
+        break;
+
+    case ACTION_TYPE_PTR_DEFAULT:
+        action->dflt.flags = in->flags;
+        action->dflt.value = (int8_t) in->args[0];
+        break;
+
+    case ACTION_TYPE_SWITCH_VT:
+        action->screen.flags = in->flags;
+        action->screen.screen = (int8_t) in->args[0];
+        break;
+
+    case ACTION_TYPE_CTRL_SET:
+    case ACTION_TYPE_CTRL_LOCK:
+        action->ctrls.flags = in->flags;
+        action->ctrls.ctrls = in->args[0];
+        break;
+
+    default:
+        if (action->type >= ACTION_TYPE_PRIVATE)
+            memcpy(action->priv.data, in->args, sizeof(action->priv.data));
+        break;
+    }
+
+    return true;
+}
+
+static bool
+read_header(struct bin_reader *r, size_t length)
+{
+    const struct bin_header *header = r->header;
+    unsigned int i;
+
+    if (length < sizeof(*header) ||
+        memcmp(header->magic, BINARY_MAGIC, sizeof(header->magic)) != 0) {
+        log_err(r->ctx, "Not a binary keymap\n");
+        return false;
+    }
+
+    if (header->byte_order != BINARY_BYTE_ORDER) {
+        log_err(r->ctx, "Binary keymap has the wrong byte order\n");
+        return false;
+    }
+
+    if (header->version != BINARY_VERSION) {
+        log_err(r->ctx, "Unsupported binary keymap version %u\n",
+                header->version);
+        return false;
+    }
+
+    if (header->size != length) {
+        log_err(r->ctx, "Binary keymap is truncated (%u bytes, expected %u)\n",
+                (unsigned) length, header->size);
+        return false;
+    }
+
+    for (i = 0; i < _SECTION_NUM_ENTRIES; i++) {
+        const struct bin_section *s = &header->sections[i];
+
+        if (s->offset % sizeof(uint32_t) != 0 || s->offset > length ||
+            s->count > (length - s->offset) / section_record_size[i]) {
+            log_err(r->ctx, "Binary keymap section %u is out of bounds\n", i);
+            return false;
+        }
+    }
+
+    r->strings = section(r, SECTION_STRINGS);
+    r->strings_size = section_count(r, SECTION_STRINGS);
+    if (r->strings_size > 0 && r->strings[r->strings_size - 1] != '\0') {
+        log_err(r->ctx, "Binary keymap string pool is not terminated\n");
+        return false;
+    }
+
+    if (header->min_key_code > header->max_key_code ||
+        header->max_key_code > XKB_KEYCODE_MAX ||
+        header->max_key_code - header->min_key_code + 1 <
+        section_count(r, SECTION_KEYS) ||
+        header->num_groups > XKB_MAX_GROUPS ||
+        section_count(r, SECTION_MODS) > XKB_MAX_MODS ||
+        section_count(r, SECTION_INDICATORS) > XKB_MAX_LEDS ||
+        section_count(r, SECTION_GROUP_NAMES) > XKB_MAX_GROUPS ||
+        section_count(r, SECTION_TYPES) == 0) {
+        log_err(r->ctx, "Binary keymap has invalid counts\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+read_types(struct bin_reader *r, struct xkb_keymap *keymap)
+{
+    const struct bin_type *types = section(r, SECTION_TYPES);
+    const struct bin_type_entry *entries = section(r, SECTION_TYPE_ENTRIES);
+    const uint32_t *level_names = section(r, SECTION_LEVEL_NAMES);
+    const struct bin_lookup *lookups = section(r, SECTION_LOOKUPS);
+    unsigned int i, j, num_lookups, lookup_index;
+
+    keymap->num_types = section_count(r, SECTION_TYPES);
+    keymap->types = calloc(keymap->num_types, sizeof(*keymap->types));
+    if (!keymap->types) {
+        keymap->num_types = 0;
+        return false;
+    }
+
+    for (i = 0; i < keymap->num_types; i++) {
+        const struct bin_type *in = &types[i];
+        struct xkb_key_type *type = &keymap->types[i];
+
+        num_lookups = XkbKeyTypeNumLookups(in->mask);
+
+        if (in->num_levels == 0 ||
+            in->mask & ~MOD_REAL_MASK_ALL ||
+            !section_range_ok(r, SECTION_TYPE_ENTRIES, in->first_entry,
+                              in->num_entries) ||
+            !section_range_ok(r, SECTION_LEVEL_NAMES, in->first_level_name,
+                              in->num_level_names) ||
+            !section_range_ok(r, SECTION_LOOKUPS, in->first_lookup,
+                              num_lookups) ||
+            !read_atom_required(r, in->name, &type->name))
+            return false;
+
+        lookup_index = 0;
+        for (j = 0; j < 16; j++)
+            lookup_index |= in->lookup_index_lo[j] | in->lookup_index_hi[j];
+        if (lookup_index >= num_lookups)
+            return false;
+
+        type->mods.mods = in->mods;
+        type->mods.mask = in->mask;
+        type->num_levels = in->num_levels;
+        memcpy(type->lookup_index_lo, in->lookup_index_lo,
+               sizeof(type->lookup_index_lo));
+        memcpy(type->lookup_index_hi, in->lookup_index_hi,
+               sizeof(type->lookup_index_hi));
+
+        if (in->num_entries > 0) {
+            type->map = calloc(in->num_entries, sizeof(*type->map));
+            if (!type->map)
+                return false;
+            type->num_entries = in->num_entries;
+
+            for (j = 0; j < in->num_entries; j++) {
+                const struct bin_type_entry *e = &entries[in->first_entry + j];
+
+                if (e->level >= in->num_levels)
+                    return false;
+
+                type->map[j].level = e->level;
+                type->map[j].mods.mods = e->mods;
+                type->map[j].mods.mask = e->mask;
+                type->map[j].preserve.mods = e->preserve_mods;
+                type->map[j].preserve.mask = e->preserve_mask;
+            }
+        }
+
+        if (in->num_level_names > 0) {
+            type->level_names = calloc(in->num_level_names,
+                                       sizeof(*type->level_names));
+            if (!type->level_names)
+                return false;
+            type->num_level_names = in->num_level_names;
+
+            for (j = 0; j < in->num_level_names; j++)
+                if (!read_atom(r, level_names[in->first_level_name + j],
+                               &type->level_names[j]))
+                    return false;
+        }
+
+        type->lookup = calloc(num_lookups, sizeof(*type->lookup));
+        if (!type->lookup)
+            return false;
+
+        for (j = 0; j < num_lookups; j++) {
+            if (lookups[in->first_lookup + j].level >= in->num_levels)
+                return false;
+
+            type->lookup[j].level = lookups[in->first_lookup + j].level;
+            type->lookup[j].consumed = lookups[in->first_lookup + j].consumed;
+        }
+    }
+
+    return true;
+}
+
+static void
+free_levels(struct xkb_level *levels, xkb_level_index_t num_levels)
+{
+    xkb_level_index_t i;
+
+    for (i = 0; i < num_levels; i++)
+        if (levels[i].num_syms > 1)
+            free(levels[i].u.syms);
+    free(levels);
+}
+
+/* The group is only filled in if it is read successfully. */
+static bool
+read_group(struct bin_reader *r, struct xkb_keymap *keymap,
+           const struct bin_group *in, struct xkb_group *group)
+{
+    const struct bin_level *levels = section(r, SECTION_LEVELS);
+    const uint32_t *syms = section(r, SECTION_SYMS);
+    const struct xkb_key_type *type;
+    struct xkb_level *out;
+    xkb_level_index_t i;
+
+    if (in->type >= keymap->num_types)
+        return false;
+
+    type = &keymap->types[in->type];
+
+    if (!section_range_ok(r, SECTION_LEVELS, in->first_level,
+                          type->num_levels))
+        return false;
+
+    out = calloc(type->num_levels, sizeof(*out));
+    if (!out)
+        return false;
+
+    for (i = 0; i < type->num_levels; i++) {
+        const struct bin_level *l = &levels[in->first_level + i];
+
+        if (!read_action(&l->action, &out[i].action))
+            goto err;
+
+        if (l->num_syms <= 1) {
+            out[i].num_syms = l->num_syms;
+            out[i].u.sym = l->syms;
+            continue;
+        }
+
+        if (!section_range_ok(r, SECTION_SYMS, l->syms, l->num_syms))
+            goto err;
+
+        out[i].u.syms = calloc(l->num_syms, sizeof(*out[i].u.syms));
+        if (!out[i].u.syms)
+            goto err;
+        out[i].num_syms = l->num_syms;
+        memcpy(out[i].u.syms, &syms[l->syms],
+               l->num_syms * sizeof(*out[i].u.syms));
+    }
+
+    group->type = type;
+    group->levels = out;
+    return true;
+
+err:
+    free_levels(out, type->num_levels);
+    return false;
+}
+
+static bool
+read_keys(struct bin_reader *r, struct xkb_keymap *keymap)
+{
+    const struct bin_key *keys = section(r, SECTION_KEYS);
+    const struct bin_group *groups = section(r, SECTION_GROUPS);
+    unsigned int num_keys = section_count(r, SECTION_KEYS);
+    struct xkb_key *key;
+    xkb_layout_index_t i;
+
+    keymap->min_key_code = r->header->min_key_code;
+    keymap->max_key_code = r->header->max_key_code;
+    keymap->num_groups = r->header->num_groups;
+
+    if (keymap->num_groups > XKB_MAX_GROUPS)
+        return false;
+
+    keymap->keys = calloc(MAX(num_keys, 1), sizeof(*keymap->keys));
+    keymap->key_aux = calloc(MAX(num_keys, 1), sizeof(*keymap->key_aux));
+    if (!keymap->keys || !keymap->key_aux)
+        return false;
+
+    /* Count only the keys read so far, for xkb_keymap_unref(). */
+    for (key = keymap->keys; key < keymap->keys + num_keys; key++) {
+        struct xkb_key_aux *aux = XkbKeyAux(keymap, key);
+        const struct bin_key *in = &keys[key - keymap->keys];
+
+        keymap->num_keys++;
+        aux->keycode = in->keycode;
+
+        if (in->keycode < keymap->min_key_code ||
+            in->keycode > keymap->max_key_code ||
+            (key > keymap->keys && in->keycode <= aux[-1].keycode) ||
+            in->num_groups > keymap->num_groups ||
+            in->out_of_range_group_action > RANGE_REDIRECT ||
+            (in->out_of_range_group_action == RANGE_REDIRECT &&
+             in->num_groups > 0 &&
+             in->out_of_range_group_number >= in->num_groups) ||
+            !section_range_ok(r, SECTION_GROUPS, in->first_group,
+                              in->num_groups) ||
+            in->name == 0 ||
+            !read_atom(r, in->name, &aux->name))
+            return false;
+
+        aux->explicit = in->explicit;
+        aux->modmap = in->modmap;
+        aux->vmodmap = in->vmodmap;
+        key->repeats = !!in->repeats;
+        key->out_of_range_group_action = in->out_of_range_group_action;
+        key->out_of_range_group_number = in->out_of_range_group_number;
+
+        if (in->num_groups == 0)
+            continue;
+
+        key->groups = calloc(in->num_groups, sizeof(*key->groups));
+        if (!key->groups)
+            return false;
+
+        /* Count only the groups read so far, for xkb_keymap_unref(). */
+        for (i = 0; i < in->num_groups; i++) {
+            if (!read_group(r, keymap, &groups[in->first_group + i],
+                            &key->groups[i]))
+                return false;
+            if (groups[in->first_group + i].explicit_type)
+                aux->explicit_types |= (1u << i);
+            key->num_groups++;
+        }
+    }
+
+    return keymap_index_keys(keymap);
+}
+
+static bool
+read_compat(struct bin_reader *r, struct xkb_keymap *keymap)
+{
+    const struct bin_interpret *interprets = section(r, SECTION_INTERPRETS);
+    const struct bin_indicator *indicators = section(r, SECTION_INDICATORS);
+    unsigned int i;
+
+    darray_resize0(keymap->sym_interprets,
+                   section_count(r, SECTION_INTERPRETS));
+    for (i = 0; i < section_count(r, SECTION_INTERPRETS); i++) {
+        const struct bin_interpret *in = &interprets[i];
+        struct xkb_sym_interpret *si = &darray_item(keymap->sym_interprets, i);
+
+        if (in->match > MATCH_EXACTLY ||
+            (in->virtual_mod != XKB_MOD_INVALID &&
+             in->virtual_mod >= darray_size(keymap->mods)) ||
+            !read_action(&in->action, &si->action))
+            return false;
+
+        si->sym = in->sym;
+        si->match = in->match;
+        si->level_one_only = !!in->level_one_only;
+        si->mods = in->mods;
+        si->virtual_mod = in->virtual_mod;
+        si->repeat = !!in->repeat;
+    }
+
+    darray_resize0(keymap->indicators, section_count(r, SECTION_INDICATORS));
+    for (i = 0; i < section_count(r, SECTION_INDICATORS); i++) {
+        const struct bin_indicator *in = &indicators[i];
+        struct xkb_indicator_map *im = &darray_item(keymap->indicators, i);
+
+        /* Unnamed indicators are only placeholders. */
+        if ((in->name == 0 &&
+             (in->which_groups || in->groups || in->which_mods ||
+              in->mods || in->ctrls)) ||
+            !read_atom(r, in->name, &im->name))
+            return false;
+
+        im->which_groups = in->which_groups;
+        im->groups = in->groups;
+        im->which_mods = in->which_mods;
+        im->mods.mods = in->mods;
+        im->mods.mask = in->mask;
+        im->ctrls = in->ctrls;
+    }
+
+    return true;
+}
+
+static bool
+read_names(struct bin_reader *r, struct xkb_keymap *keymap)
+{
+    const struct bin_mod *mods = section(r, SECTION_MODS);
+    const struct bin_alias *aliases = section(r, SECTION_ALIASES);
+    const uint32_t *group_names = section(r, SECTION_GROUP_NAMES);
+    const struct bin_header *header = r->header;
+    unsigned int i;
+
+    darray_resize0(keymap->mods, section_count(r, SECTION_MODS));
+    for (i = 0; i < section_count(r, SECTION_MODS); i++) {
+        struct xkb_mod *mod = &darray_item(keymap->mods, i);
+
+        if ((mods[i].type != MOD_REAL && mods[i].type != MOD_VIRT) ||
+            !read_atom_required(r, mods[i].name, &mod->name))
+            return false;
+
+        mod->type = mods[i].type;
+        mod->mapping = mods[i].mapping;
+    }
+
+    darray_resize0(keymap->key_aliases, section_count(r, SECTION_ALIASES));
+    for (i = 0; i < section_count(r, SECTION_ALIASES); i++) {
+        struct xkb_key_alias *alias = &darray_item(keymap->key_aliases, i);
+
+        if (!read_atom_required(r, aliases[i].real, &alias->real) ||
+            !read_atom_required(r, aliases[i].alias, &alias->alias))
+            return false;
+    }
+
+    keymap->num_group_names = section_count(r, SECTION_GROUP_NAMES);
+    if (keymap->num_group_names > 0) {
+        keymap->group_names = calloc(keymap->num_group_names,
+                                     sizeof(*keymap->group_names));
+        if (!keymap->group_names) {
+            keymap->num_group_names = 0;
+            return false;
+        }
+
+        for (i = 0; i < keymap->num_group_names; i++)
+            if (!read_atom(r, group_names[i], &keymap->group_names[i]))
+                return false;
+    }
+
+    return (read_section_name(r, header->keycodes_section_name,
+                              &keymap->keycodes_section_name) &&
+            read_section_name(r, header->types_section_name,
+                              &keymap->types_section_name) &&
+            read_section_name(r, header->compat_section_name,
+                              &keymap->compat_section_name) &&
+            read_section_name(r, header->symbols_section_name,
+                              &keymap->symbols_section_name));
+}
+
+struct xkb_keymap *
+keymap_new_from_binary(struct xkb_context *ctx, const char *buffer,
+                       size_t length, enum xkb_keymap_compile_flags flags)
+{
+    struct xkb_keymap *keymap;
+    struct bin_reader r;
+
+    if ((uintptr_t) buffer % sizeof(uint32_t) != 0) {
+        log_err(ctx, "Binary keymap buffer is not aligned\n");
+        return NULL;
+    }
+
+    r.ctx = ctx;
+    r.buffer = buffer;
+    r.header = (const struct bin_header *) buffer;
+
+    if (!read_header(&r, length))
+        return NULL;
+
+    keymap = xkb_keymap_new(ctx, XKB_KEYMAP_FORMAT_BINARY_V1, flags);
+    if (!keymap)
+        return NULL;
+
+    keymap->enabled_ctrls = r.header->enabled_ctrls;
+    keymap->indicator_deps = r.header->indicator_deps;
+    keymap->ctrl_indicators = r.header->ctrl_indicators;
+
+    if (!read_names(&r, keymap) ||
+        !read_types(&r, keymap) ||
+        !read_keys(&r, keymap) ||
+        !read_compat(&r, keymap)) {
+        log_err(ctx, "Invalid binary keymap\n");
+        xkb_keymap_unref(keymap);
+        return NULL;
+    }
+
+    keymap_pack(keymap);
+    return keymap;
+}
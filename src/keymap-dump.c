@@ -163,11 +163,13 @@ write_keycodes(struct xkb_keymap *keymap, struct buf *buf)
         write_buf(buf, "\txkb_keycodes {\n");
 
     xkb_foreach_key(key, keymap) {
-        if (key->name == XKB_ATOM_NONE)
+        const struct xkb_key_aux *aux = XkbKeyAux(keymap, key);
+
+        if (aux->name == XKB_ATOM_NONE)
             continue;
 
         write_buf(buf, "\t\t%-20s = %d;\n",
-                  KeyNameText(keymap->ctx, key->name), key->keycode);
+                  KeyNameText(keymap->ctx, aux->name), aux->keycode);
     }
 
     darray_enumerate(i, im, keymap->indicators)
@@ -233,7 +235,7 @@ write_types(struct xkb_keymap *keymap, struct buf *buf)
         }
 
         if (type->level_names) {
-            for (n = 0; n < type->num_levels; n++) {
+            for (n = 0; n < MIN(type->num_levels, type->num_level_names); n++) {
                 if (!type->level_names[n])
                     continue;
                 write_buf(buf, "\t\t\tlevel_name[Level%d]= \"%s\";\n", n + 1,
@@ -303,7 +305,7 @@ write_action(struct xkb_keymap *keymap, struct buf *buf,
         if (action->mods.flags & ACTION_MODS_LOOKUP_MODMAP)
             args = "modMapMods";
         else
-            args = ModMaskText(keymap, action->mods.mods.mods);
+            args = ModMaskText(keymap, action->mods.mods);
         write_buf(buf, "%s%s(modifiers=%s%s%s)%s", prefix, type, args,
                   (action->type != ACTION_TYPE_MOD_LOCK &&
                    (action->mods.flags & ACTION_LOCK_CLEAR)) ?
@@ -478,6 +480,7 @@ static bool
 write_keysyms(struct xkb_keymap *keymap, struct buf *buf,
               struct xkb_key *key, xkb_layout_index_t group)
 {
+    xkb_keycode_t kc = XkbKeyAux(keymap, key)->keycode;
     const xkb_keysym_t *syms;
     int num_syms;
     xkb_level_index_t level;
@@ -487,8 +490,8 @@ write_keysyms(struct xkb_keymap *keymap, struct buf *buf,
     for (level = 0; level < XkbKeyGroupWidth(key, group); level++) {
         if (level != 0)
             write_buf(buf, ", ");
-        num_syms = xkb_keymap_key_get_syms_by_level(keymap, key->keycode,
-                                                    group, level, &syms);
+        num_syms = xkb_keymap_key_get_syms_by_level(keymap, kc, group, level,
+                                                    &syms);
         if (num_syms == 0) {
             write_buf(buf, "%15s", "NoSymbol");
         }
@@ -535,30 +538,26 @@ write_symbols(struct xkb_keymap *keymap, struct buf *buf)
         write_buf(buf, "\n");
 
     xkb_foreach_key(key, keymap) {
+        const struct xkb_key_aux *aux = XkbKeyAux(keymap, key);
         bool simple = true;
-        bool explicit_types = false;
         bool multi_type = false;
 
         if (key->num_groups == 0)
             continue;
 
-        write_buf(buf, "\t\tkey %-20s {", KeyNameText(keymap->ctx, key->name));
-
-        for (group = 0; group < key->num_groups; group++) {
-            if (key->groups[group].explicit_type)
-                explicit_types = true;
+        write_buf(buf, "\t\tkey %-20s {", KeyNameText(keymap->ctx, aux->name));
 
-            if (group != 0 && key->groups[group].type != key->groups[0].type)
+        for (group = 1; group < key->num_groups; group++)
+            if (key->groups[group].type != key->groups[0].type)
                 multi_type = true;
-        }
 
-        if (explicit_types) {
+        if (aux->explicit_types) {
             const struct xkb_key_type *type;
             simple = false;
 
             if (multi_type) {
                 for (group = 0; group < key->num_groups; group++) {
-                    if (!key->groups[group].explicit_type)
+                    if (!(aux->explicit_types & (1u << group)))
                         continue;
 
                     type = key->groups[group].type;
@@ -574,7 +573,7 @@ write_symbols(struct xkb_keymap *keymap, struct buf *buf)
             }
         }
 
-        if (key->explicit & EXPLICIT_REPEAT) {
+        if (aux->explicit & EXPLICIT_REPEAT) {
             if (key->repeats)
                 write_buf(buf, "\n\t\t\trepeat= Yes,");
             else
@@ -582,9 +581,9 @@ write_symbols(struct xkb_keymap *keymap, struct buf *buf)
             simple = false;
         }
 
-        if (key->vmodmap && (key->explicit & EXPLICIT_VMODMAP))
+        if (aux->vmodmap && (aux->explicit & EXPLICIT_VMODMAP))
             write_buf(buf, "\n\t\t\tvirtualMods= %s,",
-                      ModMaskText(keymap, key->vmodmap));
+                      ModMaskText(keymap, aux->vmodmap));
 
         switch (key->out_of_range_group_action) {
         case RANGE_SATURATE:
@@ -600,7 +599,7 @@ write_symbols(struct xkb_keymap *keymap, struct buf *buf)
             break;
         }
 
-        showActions = !!(key->explicit & EXPLICIT_INTERP);
+        showActions = !!(aux->explicit & EXPLICIT_INTERP);
 
         if (key->num_groups > 1 || showActions)
             simple = false;
@@ -640,19 +639,20 @@ write_symbols(struct xkb_keymap *keymap, struct buf *buf)
     }
 
     xkb_foreach_key(key, keymap) {
+        const struct xkb_key_aux *aux = XkbKeyAux(keymap, key);
         xkb_mod_index_t i;
         const struct xkb_mod *mod;
 
-        if (key->modmap == 0)
+        if (aux->modmap == 0)
             continue;
 
         darray_enumerate(i, mod, keymap->mods) {
-            if (!(key->modmap & (1 << i)))
+            if (!(aux->modmap & (1 << i)))
                 continue;
 
             write_buf(buf, "\t\tmodifier_map %s { %s };\n",
                       xkb_atom_text(keymap->ctx, mod->name),
-                      KeyNameText(keymap->ctx, key->name));
+                      KeyNameText(keymap->ctx, aux->name));
         }
     }
 
@@ -667,8 +667,10 @@ xkb_keymap_get_as_string(struct xkb_keymap *keymap,
     bool ok;
     struct buf buf = { NULL, 0, 0 };
 
+    /* A binary keymap is dumped as text, which is what fits a string. */
     if (format == XKB_KEYMAP_USE_ORIGINAL_FORMAT)
-        format = keymap->format;
+        format = (keymap->format == XKB_KEYMAP_FORMAT_BINARY_V1 ?
+                  XKB_KEYMAP_FORMAT_TEXT_V1 : keymap->format);
 
     if (format != XKB_KEYMAP_FORMAT_TEXT_V1) {
         log_err(keymap->ctx,
@@ -686,3 +688,31 @@ xkb_keymap_get_as_string(struct xkb_keymap *keymap,
 
     return (ok ? buf.buf : NULL);
 }
+
+XKB_EXPORT char *
+xkb_keymap_get_as_buffer(struct xkb_keymap *keymap,
+                         enum xkb_keymap_format format,
+                         size_t *size)
+{
+    char *buf;
+
+    if (format == XKB_KEYMAP_USE_ORIGINAL_FORMAT)
+        format = keymap->format;
+
+    switch (format) {
+    case XKB_KEYMAP_FORMAT_TEXT_V1:
+        buf = xkb_keymap_get_as_string(keymap, format);
+        if (buf)
+            *size = strlen(buf);
+        return buf;
+
+    case XKB_KEYMAP_FORMAT_BINARY_V1:
+        return keymap_get_as_binary(keymap, size);
+
+    default:
+        log_err(keymap->ctx,
+                "Trying to get a keymap in an unsupported format (%d)\n",
+                format);
+        return NULL;
+    }
+}
@@ -76,7 +76,7 @@ xkb_keymap_new(struct xkb_context *ctx,
 XKB_EXPORT struct xkb_keymap *
 xkb_keymap_ref(struct xkb_keymap *keymap)
 {
-    keymap->refcnt++;
+    refcnt_inc(&keymap->refcnt);
     return keymap;
 }
 
@@ -86,9 +86,14 @@ xkb_keymap_unref(struct xkb_keymap *keymap)
     unsigned int i, j;
     struct xkb_key *key;
 
-    if (!keymap || --keymap->refcnt > 0)
+    if (!keymap || !refcnt_dec(&keymap->refcnt))
         return;
 
+    if (keymap->arena) {
+        free(keymap->arena);
+        goto out;
+    }
+
     if (keymap->keys) {
         xkb_foreach_key(key, keymap) {
             for (i = 0; i < key->num_groups; i++) {
@@ -101,13 +106,18 @@ xkb_keymap_unref(struct xkb_keymap *keymap)
         }
         free(keymap->keys);
     }
+    free(keymap->key_aux);
+    free(keymap->key_index);
     for (i = 0; i < keymap->num_types; i++) {
         free(keymap->types[i].map);
         free(keymap->types[i].level_names);
+        free(keymap->types[i].lookup);
     }
     free(keymap->types);
     darray_free(keymap->sym_interprets);
     darray_free(keymap->key_aliases);
+    atom_map_free(&keymap->key_names_index);
+    atom_map_free(&keymap->key_aliases_index);
     free(keymap->group_names);
     darray_free(keymap->mods);
     darray_free(keymap->indicators);
@@ -115,10 +125,289 @@ xkb_keymap_unref(struct xkb_keymap *keymap)
     free(keymap->symbols_section_name);
     free(keymap->types_section_name);
     free(keymap->compat_section_name);
+out:
     xkb_context_unref(keymap->ctx);
     free(keymap);
 }
 
+/*
+ * Build the keycode index of keymap->keys, which must be sorted by
+ * keycode, with the keycodes in keymap->key_aux.
+ */
+bool
+keymap_index_keys(struct xkb_keymap *keymap)
+{
+    unsigned int level_nodes[XKB_KEY_INDEX_MAX_DEPTH];
+    unsigned int depth, level, shift, base, node, child, i;
+    struct xkb_key_node *n;
+    uint64_t range, offset, prev = 0;
+
+    free(keymap->key_index);
+    keymap->key_index = NULL;
+    keymap->num_key_nodes = 0;
+    keymap->key_index_shift = 0;
+
+    if (keymap->num_keys == 0)
+        return true;
+
+    /* Add levels until the first one has no more nodes than keys. */
+    range = keymap->max_key_code - keymap->min_key_code;
+    depth = 1;
+    while (depth < XKB_KEY_INDEX_MAX_DEPTH &&
+           (range >> (depth * XKB_KEY_PAGE_BITS)) + 1 > keymap->num_keys)
+        depth++;
+
+    /*
+     * The first level has a node for each value of the top bits, the
+     * others one for each run of keys sharing a slot above them.
+     */
+    level_nodes[0] = (range >> (depth * XKB_KEY_PAGE_BITS)) + 1;
+    keymap->num_key_nodes = level_nodes[0];
+    for (level = 1; level < depth; level++) {
+        shift = (depth - level) * XKB_KEY_PAGE_BITS;
+        level_nodes[level] = 0;
+        for (i = 0; i < keymap->num_keys; i++) {
+            offset = keymap->key_aux[i].keycode - keymap->min_key_code;
+            if (i == 0 || (offset >> shift) != (prev >> shift))
+                level_nodes[level]++;
+            prev = offset;
+        }
+        keymap->num_key_nodes += level_nodes[level];
+    }
+
+    keymap->key_index = calloc(keymap->num_key_nodes,
+                               sizeof(*keymap->key_index));
+    if (!keymap->key_index) {
+        keymap->num_key_nodes = 0;
+        return false;
+    }
+    keymap->key_index_shift = (depth - 1) * XKB_KEY_PAGE_BITS;
+
+    base = 0;
+    for (level = 0; level < depth; level++) {
+        shift = (depth - 1 - level) * XKB_KEY_PAGE_BITS;
+        node = base;
+        child = base + level_nodes[level];
+        for (i = 0; i < keymap->num_keys; i++) {
+            offset = keymap->key_aux[i].keycode - keymap->min_key_code;
+            if (i > 0 && (offset >> shift) == (prev >> shift))
+                continue;
+            if (level == 0)
+                node = base + (offset >> (shift + XKB_KEY_PAGE_BITS));
+            else if (i > 0 &&
+                     (offset >> (shift + XKB_KEY_PAGE_BITS)) !=
+                     (prev >> (shift + XKB_KEY_PAGE_BITS)))
+                node++;
+
+            n = &keymap->key_index[node];
+            if (!n->present)
+                n->first = (shift == 0 ? i : child);
+            n->present |=
+                UINT64_C(1) << ((offset >> shift) & (XKB_KEY_PAGE_SIZE - 1));
+            child++;
+            prev = offset;
+        }
+        base += level_nodes[level];
+    }
+
+    return true;
+}
+
+/*
+ * The block the data of a keymap is packed into. With no base, only the
+ * size needed is counted.
+ */
+struct keymap_arena {
+    char *base;
+    size_t size;
+};
+
+/*
+ * Take @size bytes from the arena and move the allocation at @ptr there.
+ * Returns the new location, or @ptr while counting.
+ */
+static void *
+arena_move(struct keymap_arena *arena, void *ptr, size_t size,
+           size_t elem_size)
+{
+    /* Every type's alignment divides its size. */
+    size_t align = MIN(elem_size & -elem_size, 16);
+    size_t offset;
+    char *new;
+
+    if (!ptr)
+        return NULL;
+
+    arena->size = (arena->size + align - 1) & ~(align - 1);
+    offset = arena->size;
+    arena->size += size;
+
+    if (!arena->base)
+        return ptr;
+
+    new = arena->base + offset;
+    memcpy(new, ptr, size);
+    free(ptr);
+    return new;
+}
+
+#define arena_move_array(arena, ptr, count) \
+    ((ptr) = arena_move((arena), (ptr), (count) * sizeof(*(ptr)), \
+                        sizeof(*(ptr))))
+
+#define arena_move_darray(arena, arr) do { \
+    arena_move_array((arena), (arr).item, (arr).size); \
+    if ((arena)->base) \
+        (arr).alloc = (arr).size; \
+} while (0)
+
+#define arena_move_string(arena, str) \
+    ((str) = arena_move((arena), (str), (str) ? strlen(str) + 1 : 0, 1))
+
+static void
+keymap_pack_data(struct xkb_keymap *keymap, struct keymap_arena *arena)
+{
+    struct xkb_key *key;
+    struct xkb_key_type *type, *old_types;
+    xkb_layout_index_t i;
+    xkb_level_index_t j;
+
+    /*
+     * Each key is followed by its groups, levels and keysyms, so that
+     * looking up a key touches as few cache lines as possible.
+     */
+    arena_move_array(arena, keymap->key_index, keymap->num_key_nodes);
+    if (keymap->keys) {
+        arena_move_array(arena, keymap->keys, keymap->num_keys);
+        xkb_foreach_key(key, keymap) {
+            arena_move_array(arena, key->groups, key->num_groups);
+            for (i = 0; i < key->num_groups; i++) {
+                struct xkb_group *group = &key->groups[i];
+
+                arena_move_array(arena, group->levels,
+                                 XkbKeyGroupWidth(key, i));
+                for (j = 0; j < XkbKeyGroupWidth(key, i); j++)
+                    if (group->levels[j].num_syms > 1)
+                        arena_move_array(arena, group->levels[j].u.syms,
+                                         group->levels[j].num_syms);
+            }
+        }
+    }
+
+    /* The groups point into the types; they are fixed up below. */
+    old_types = keymap->types;
+    keymap->types = arena_move(arena, keymap->types,
+                               keymap->num_types * sizeof(*keymap->types),
+                               sizeof(*keymap->types));
+    for (type = keymap->types;
+         type && type < keymap->types + keymap->num_types;
+         type++) {
+        arena_move_array(arena, type->map, type->num_entries);
+        arena_move_array(arena, type->level_names, type->num_level_names);
+        arena_move_array(arena, type->lookup,
+                         XkbKeyTypeNumLookups(type->mods.mask));
+    }
+
+    if (arena->base && keymap->keys && old_types) {
+        xkb_foreach_key(key, keymap)
+            for (i = 0; i < key->num_groups; i++)
+                key->groups[i].type =
+                    keymap->types + (key->groups[i].type - old_types);
+    }
+
+    /* The rest is hardly used once the keymap is compiled. */
+    if (keymap->key_aux)
+        arena_move_array(arena, keymap->key_aux, keymap->num_keys);
+    arena_move_darray(arena, keymap->key_aliases);
+    arena_move_darray(arena, keymap->sym_interprets);
+    arena_move_darray(arena, keymap->mods);
+    arena_move_darray(arena, keymap->indicators);
+    arena_move_array(arena, keymap->group_names, keymap->num_group_names);
+    arena_move_string(arena, keymap->keycodes_section_name);
+    arena_move_string(arena, keymap->symbols_section_name);
+    arena_move_string(arena, keymap->types_section_name);
+    arena_move_string(arena, keymap->compat_section_name);
+}
+
+/*
+ * Move all the data of a newly created keymap into a single allocation.
+ * The keymap must not be modified afterwards. If the allocation fails,
+ * the keymap is left as it is, which works just as well.
+ */
+void
+keymap_pack(struct xkb_keymap *keymap)
+{
+    struct keymap_arena arena = { NULL, 0 };
+
+    if (keymap->arena)
+        return;
+
+    keymap_pack_data(keymap, &arena);
+    if (arena.size == 0)
+        return;
+
+    arena.base = malloc(arena.size);
+    if (!arena.base)
+        return;
+
+    keymap->arena_size = arena.size;
+    arena.size = 0;
+    keymap_pack_data(keymap, &arena);
+    keymap->arena = arena.base;
+}
+
+/*
+ * An estimate of the memory used by the keymap, i.e. the sizes of all of
+ * its allocations, without allocator overhead.
+ */
+size_t
+xkb_keymap_memory_size(struct xkb_keymap *keymap)
+{
+    size_t size = sizeof(*keymap);
+    unsigned int i, j;
+    struct xkb_key *key;
+
+    if (keymap->arena)
+        return size + keymap->arena_size;
+
+    size += keymap->num_key_nodes * sizeof(*keymap->key_index);
+    if (keymap->keys) {
+        size += keymap->num_keys * sizeof(*keymap->keys);
+        size += keymap->num_keys * sizeof(*keymap->key_aux);
+        xkb_foreach_key(key, keymap) {
+            size += key->num_groups * sizeof(*key->groups);
+            for (i = 0; i < key->num_groups; i++) {
+                size += XkbKeyGroupWidth(key, i) *
+                        sizeof(*key->groups[i].levels);
+                for (j = 0; j < XkbKeyGroupWidth(key, i); j++)
+                    if (key->groups[i].levels[j].num_syms > 1)
+                        size += key->groups[i].levels[j].num_syms *
+                                sizeof(xkb_keysym_t);
+            }
+        }
+    }
+
+    size += keymap->num_types * sizeof(*keymap->types);
+    for (i = 0; i < keymap->num_types; i++) {
+        const struct xkb_key_type *type = &keymap->types[i];
+
+        size += type->num_entries * sizeof(*type->map);
+        size += type->num_level_names * sizeof(*type->level_names);
+        size += XkbKeyTypeNumLookups(type->mods.mask) * sizeof(*type->lookup);
+    }
+
+    size += darray_size(keymap->sym_interprets) *
+            sizeof(darray_item(keymap->sym_interprets, 0));
+    size += darray_size(keymap->key_aliases) *
+            sizeof(darray_item(keymap->key_aliases, 0));
+    size += darray_size(keymap->mods) * sizeof(darray_item(keymap->mods, 0));
+    size += darray_size(keymap->indicators) *
+            sizeof(darray_item(keymap->indicators, 0));
+    size += keymap->num_group_names * sizeof(*keymap->group_names);
+
+    return size;
+}
+
 /**
  * Returns the total number of modifiers active in the keymap.
  */
@@ -183,74 +183,72 @@ struct xkb_mods {
     xkb_mod_mask_t mask;       /* computed effective mask */
 };
 
+/*
+ * Every action fits in 8 bytes: each struct starts with the type, as an
+ * enum xkb_action_type, and then mostly 16 bits of enum xkb_action_flags,
+ * so that the actions of a whole group of levels share few cache lines.
+ */
+
 struct xkb_mod_action {
-    enum xkb_action_type type;
-    enum xkb_action_flags flags;
-    struct xkb_mods mods;
+    uint8_t type;
+    /* The effective mask, computed from mods; only has real modifiers. */
+    uint8_t mask;
+    uint16_t flags;
+    /* The modifiers as given, real and virtual. */
+    xkb_mod_mask_t mods;
 };
 
 struct xkb_group_action {
-    enum xkb_action_type type;
-    enum xkb_action_flags flags;
+    uint8_t type;
+    uint16_t flags;
     int32_t group;
 };
 
 struct xkb_controls_action {
-    enum xkb_action_type type;
-    enum xkb_action_flags flags;
+    uint8_t type;
+    uint16_t flags;
     enum xkb_action_controls ctrls;
 };
 
 struct xkb_pointer_default_action {
-    enum xkb_action_type type;
-    enum xkb_action_flags flags;
+    uint8_t type;
+    uint16_t flags;
     int8_t value;
 };
 
 struct xkb_switch_screen_action {
-    enum xkb_action_type type;
-    enum xkb_action_flags flags;
+    uint8_t type;
+    uint16_t flags;
     int8_t screen;
 };
 
-struct xkb_redirect_key_action {
-    enum xkb_action_type type;
-    enum xkb_action_flags flags;
-    xkb_keycode_t new_kc;
-    uint8_t mods_mask;
-    uint8_t mods;
-    uint16_t vmods_mask;
-    uint16_t vmods;
-};
-
 struct xkb_pointer_action {
-    enum xkb_action_type type;
-    enum xkb_action_flags flags;
+    uint8_t type;
+    uint16_t flags;
     int16_t x;
     int16_t y;
 };
 
 struct xkb_pointer_button_action {
-    enum xkb_action_type type;
-    enum xkb_action_flags flags;
+    uint8_t type;
+    uint16_t flags;
     uint8_t count;
     int8_t button;
 };
 
+/* Private actions have no flags, only data. */
 struct xkb_private_action {
-    enum xkb_action_type type;
-    enum xkb_action_flags flags;
+    uint8_t type;
     uint8_t data[7];
 };
 
 union xkb_action {
-    enum xkb_action_type type;
+    uint8_t type;
     struct xkb_mod_action mods;
     struct xkb_group_action group;
     struct xkb_controls_action ctrls;
     struct xkb_pointer_default_action dflt;
     struct xkb_switch_screen_action screen;
-    struct xkb_redirect_key_action redirect;    /* XXX wholly unnecessary? */
     struct xkb_pointer_action ptr;
     struct xkb_pointer_button_action btn;
     struct xkb_private_action priv;
@@ -262,6 +260,12 @@ struct xkb_kt_map_entry {
     struct xkb_mods preserve;
 };
 
+/* The result of matching a modifier state against a key type's map. */
+struct xkb_kt_lookup {
+    xkb_level_index_t level;
+    xkb_mod_mask_t consumed;
+};
+
 struct xkb_key_type {
     struct xkb_mods mods;
     xkb_level_index_t num_levels;
@@ -269,6 +273,17 @@ struct xkb_key_type {
     unsigned int num_entries;
     xkb_atom_t name;
     xkb_atom_t *level_names;
+    unsigned int num_level_names;
+
+    /*
+     * Precomputed map matches for every combination of the modifiers in
+     * mods.mask (see XkbKeyTypeLookup). The effective mask only contains
+     * real modifiers, so the index is compressed from at most 8 bits, one
+     * nibble at a time.
+     */
+    uint8_t lookup_index_lo[16];
+    uint8_t lookup_index_hi[16];
+    struct xkb_kt_lookup *lookup;
 };
 
 struct xkb_sym_interpret {
@@ -334,29 +349,61 @@ struct xkb_level {
 };
 
 struct xkb_group {
-    bool explicit_type;
     /* Points to a type in keymap->types. */
     const struct xkb_key_type *type;
     /* Use XkbKeyGroupWidth for the number of levels. */
     struct xkb_level *levels;
 };
 
+/*
+ * What is needed to process a key in a state, packed into 16 bytes. The
+ * rest of the key is in struct xkb_key_aux.
+ */
 struct xkb_key {
+    struct xkb_group *groups;
+    uint8_t num_groups;
+    /* enum xkb_range_exceed_type */
+    uint8_t out_of_range_group_action;
+    uint8_t out_of_range_group_number;
+    bool repeats;
+};
+
+/*
+ * The parts of a key only used to compile and print the keymap, in
+ * keymap->key_aux alongside keymap->keys; see XkbKeyAux.
+ */
+struct xkb_key_aux {
     xkb_keycode_t keycode;
     xkb_atom_t name;
 
     enum xkb_explicit_components explicit;
+    /* The groups whose type was given explicitly. */
+    xkb_layout_mask_t explicit_types;
 
     xkb_mod_mask_t modmap;
     xkb_mod_mask_t vmodmap;
+};
 
-    bool repeats;
-
-    enum xkb_range_exceed_type out_of_range_group_action;
-    xkb_layout_index_t out_of_range_group_number;
-
-    xkb_layout_index_t num_groups;
-    struct xkb_group *groups;
+/*
+ * The keys are stored in keycode order, without holes for the keycodes
+ * which don't have one.  To find the key of a keycode, its offset from
+ * min_key_code is looked up in a trie, XKB_KEY_PAGE_BITS at a time.  Each
+ * node has a bitmap of the slots which are in use, and the index of the
+ * child of its first slot in use, whose rank gives the rest; the children
+ * of the last level are the keys.  The first level is indexed directly by
+ * the top bits of the offset, and has no more nodes than there are keys;
+ * below it, only the nodes in use are allocated.  So there are at most
+ * XKB_KEY_INDEX_MAX_DEPTH nodes per key, and ordinary keymaps only have
+ * the one level.  See XkbKey.
+ */
+#define XKB_KEY_PAGE_BITS 6
+#define XKB_KEY_PAGE_SIZE (1u << XKB_KEY_PAGE_BITS)
+#define XKB_KEY_INDEX_MAX_DEPTH \
+    ((32 + XKB_KEY_PAGE_BITS - 1) / XKB_KEY_PAGE_BITS)
+
+struct xkb_key_node {
+    uint64_t present;
+    unsigned int first;
 };
 
 struct xkb_mod {
@@ -378,10 +425,24 @@ struct xkb_keymap {
     xkb_keycode_t min_key_code;
     xkb_keycode_t max_key_code;
     struct xkb_key *keys;
+    struct xkb_key_aux *key_aux;
+    unsigned int num_keys;
+    /* The levels of the trie one after the other, the first one first. */
+    struct xkb_key_node *key_index;
+    unsigned int num_key_nodes;
+    /* The shift of the slot in the offset on the first level. */
+    unsigned int key_index_shift;
 
     /* aliases in no particular order */
     darray(struct xkb_key_alias) key_aliases;
 
+    /*
+     * Only while compiling: the index of each key name in keys, and of
+     * each alias in key_aliases; see FindNamedKey().
+     */
+    struct atom_map key_names_index;
+    struct atom_map key_aliases_index;
+
     struct xkb_key_type *types;
     unsigned int num_types;
 
@@ -396,24 +457,64 @@ struct xkb_keymap {
     xkb_atom_t *group_names;
 
     darray(struct xkb_indicator_map) indicators;
+    /*
+     * The state components the indicators depend on, and the indicators
+     * lit by the enabled controls, which don't change with the state.
+     */
+    enum xkb_state_component indicator_deps;
+    xkb_led_mask_t ctrl_indicators;
 
     char *keycodes_section_name;
     char *symbols_section_name;
     char *types_section_name;
     char *compat_section_name;
+
+    /*
+     * If set, everything above is allocated from this single block; see
+     * keymap_pack().
+     */
+    char *arena;
+    size_t arena_size;
 };
 
 static inline const struct xkb_key *
 XkbKey(struct xkb_keymap *keymap, xkb_keycode_t kc)
 {
-    if (kc < keymap->min_key_code || kc > keymap->max_key_code)
+    const struct xkb_key_node *node;
+    xkb_keycode_t offset;
+    unsigned int shift, i;
+    uint64_t bit;
+
+    if (kc < keymap->min_key_code || kc > keymap->max_key_code ||
+        !keymap->key_index)
         return NULL;
-    return &keymap->keys[kc];
+
+    offset = kc - keymap->min_key_code;
+    shift = keymap->key_index_shift;
+    node = &keymap->key_index[(uint64_t) offset >>
+                              (shift + XKB_KEY_PAGE_BITS)];
+    for (;; shift -= XKB_KEY_PAGE_BITS) {
+        bit = UINT64_C(1) << ((offset >> shift) & (XKB_KEY_PAGE_SIZE - 1));
+        if (!(node->present & bit))
+            return NULL;
+
+        i = node->first + popcount64(node->present & (bit - 1));
+        if (shift == 0)
+            return &keymap->keys[i];
+
+        node = &keymap->key_index[i];
+    }
+}
+
+static inline struct xkb_key_aux *
+XkbKeyAux(struct xkb_keymap *keymap, const struct xkb_key *key)
+{
+    return &keymap->key_aux[key - keymap->keys];
 }
 
 #define xkb_foreach_key(iter, keymap) \
-    for (iter = keymap->keys + keymap->min_key_code; \
-         iter <= keymap->keys + keymap->max_key_code; \
+    for (iter = keymap->keys; \
+         iter < keymap->keys + keymap->num_keys; \
          iter++)
 
 static inline xkb_level_index_t
@@ -422,11 +523,53 @@ XkbKeyGroupWidth(const struct xkb_key *key, xkb_layout_index_t layout)
     return key->groups[layout].type->num_levels;
 }
 
+/*
+ * Returns the level and consumed modifiers a key type yields for the given
+ * effective modifiers, i.e. the first entry in type->map whose mask matches
+ * exactly, or level 0 if there is none.
+ */
+static inline const struct xkb_kt_lookup *
+XkbKeyTypeLookup(const struct xkb_key_type *type, xkb_mod_mask_t mods)
+{
+    mods &= type->mods.mask;
+    return &type->lookup[type->lookup_index_lo[mods & 0x0f] |
+                         type->lookup_index_hi[(mods >> 4) & 0x0f]];
+}
+
+/* The number of entries in the lookup table of a type with this mask. */
+static inline unsigned int
+XkbKeyTypeNumLookups(xkb_mod_mask_t mask)
+{
+    unsigned int i, num_bits = 0;
+
+    for (i = 0; i < 8; i++)
+        if (mask & (1u << i))
+            num_bits++;
+
+    return 1u << num_bits;
+}
+
 struct xkb_keymap *
 xkb_keymap_new(struct xkb_context *ctx,
                enum xkb_keymap_format format,
                enum xkb_keymap_compile_flags);
 
+size_t
+xkb_keymap_memory_size(struct xkb_keymap *keymap);
+
+bool
+keymap_index_keys(struct xkb_keymap *keymap);
+
+void
+keymap_pack(struct xkb_keymap *keymap);
+
+char *
+keymap_get_as_binary(struct xkb_keymap *keymap, size_t *size);
+
+struct xkb_keymap *
+keymap_new_from_binary(struct xkb_context *ctx, const char *buffer,
+                       size_t length, enum xkb_keymap_compile_flags flags);
+
 xkb_layout_index_t
 wrap_group_into_range(int32_t group,
                       xkb_layout_index_t num_groups,
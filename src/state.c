@@ -72,6 +72,15 @@ struct xkb_filter {
     int refcnt;
 };
 
+/*
+ * The filters live in a fixed pool inside the state, so that processing a
+ * key never allocates. A filter is only needed for each held down key with
+ * a modifier or group action, and for each pending latch, so this is
+ * plenty; an action which finds the pool full is ignored.  The slots in
+ * use are the bits of a single word, so finding a free one is one ctz.
+ */
+#define XKB_MAX_FILTERS 64
+
 struct state_components {
     /* These may be negative, because of -1 group actions. */
     int32_t base_group; /**< depressed */
@@ -110,23 +119,19 @@ struct xkb_state {
     int16_t mod_key_count[sizeof(xkb_mod_mask_t) * 8];
 
     int refcnt;
-    darray(struct xkb_filter) filters;
+
+    /* Bit i is set if filters[i] is in use. */
+    uint64_t active_filters;
+    struct xkb_filter filters[XKB_MAX_FILTERS];
+
     struct xkb_keymap *keymap;
 };
 
-static const struct xkb_kt_map_entry *
-get_entry_for_key_state(struct xkb_state *state, const struct xkb_key *key,
-                        xkb_layout_index_t group)
+static const struct xkb_kt_lookup *
+get_lookup_for_key_state(struct xkb_state *state, const struct xkb_key *key,
+                         xkb_layout_index_t group)
 {
-    const struct xkb_key_type *type = key->groups[group].type;
-    xkb_mod_mask_t active_mods = state->components.mods & type->mods.mask;
-    unsigned int i;
-
-    for (i = 0; i < type->num_entries; i++)
-        if (type->map[i].mods.mask == active_mods)
-            return &type->map[i];
-
-    return NULL;
+    return XkbKeyTypeLookup(key->groups[group].type, state->components.mods);
 }
 
 /**
@@ -138,17 +143,11 @@ xkb_state_key_get_level(struct xkb_state *state, xkb_keycode_t kc,
                         xkb_layout_index_t layout)
 {
     const struct xkb_key *key = XkbKey(state->keymap, kc);
-    const struct xkb_kt_map_entry *entry;
 
     if (!key || layout >= key->num_groups)
         return XKB_LEVEL_INVALID;
 
-    /* If we don't find an explicit match the default is 0. */
-    entry = get_entry_for_key_state(state, key, layout);
-    if (!entry)
-        return 0;
-
-    return entry->level;
+    return get_lookup_for_key_state(state, key, layout)->level;
 }
 
 xkb_layout_index_t
@@ -188,6 +187,14 @@ wrap_group_into_range(int32_t group,
     }
 }
 
+static xkb_layout_index_t
+key_get_layout(struct xkb_state *state, const struct xkb_key *key)
+{
+    return wrap_group_into_range(state->components.group, key->num_groups,
+                                 key->out_of_range_group_action,
+                                 key->out_of_range_group_number);
+}
+
 /**
  * Returns the layout to use for the given key and state, taking
  * wrapping/clamping/etc into account, or XKB_LAYOUT_INVALID.
@@ -200,9 +207,7 @@ xkb_state_key_get_layout(struct xkb_state *state, xkb_keycode_t kc)
     if (!key)
         return XKB_LAYOUT_INVALID;
 
-    return wrap_group_into_range(state->components.group, key->num_groups,
-                                 key->out_of_range_group_action,
-                                 key->out_of_range_group_number);
+    return key_get_layout(state, key);
 }
 
 static const union xkb_action fake = { .type = ACTION_TYPE_NONE };
@@ -213,13 +218,11 @@ xkb_key_get_action(struct xkb_state *state, const struct xkb_key *key)
     xkb_layout_index_t layout;
     xkb_level_index_t level;
 
-    layout = xkb_state_key_get_layout(state, key->keycode);
+    layout = key_get_layout(state, key);
     if (layout == XKB_LAYOUT_INVALID)
         return &fake;
 
-    level = xkb_state_key_get_level(state, key->keycode, layout);
-    if (level == XKB_LEVEL_INVALID)
-        return &fake;
+    level = get_lookup_for_key_state(state, key, layout)->level;
 
     return &key->groups[layout].levels[level].action;
 }
@@ -227,20 +230,15 @@ xkb_key_get_action(struct xkb_state *state, const struct xkb_key *key)
 static struct xkb_filter *
 xkb_filter_new(struct xkb_state *state)
 {
-    struct xkb_filter *filter = NULL, *iter;
-
-    darray_foreach(iter, state->filters) {
-        if (iter->func)
-            continue;
-        filter = iter;
-        break;
-    }
+    struct xkb_filter *filter;
+    unsigned int i;
 
-    if (!filter) {
-        darray_resize0(state->filters, darray_size(state->filters) + 1);
-        filter = &darray_item(state->filters, darray_size(state->filters) -1);
-    }
+    if (state->active_filters == UINT64_MAX)
+        return NULL;
 
+    i = ctz64(~state->active_filters);
+    state->active_filters |= (UINT64_C(1) << i);
+    filter = &state->filters[i];
     filter->refcnt = 1;
     return filter;
 }
@@ -333,9 +331,9 @@ xkb_filter_mod_set_func(struct xkb_state *state,
         return 0;
     }
 
-    state->clear_mods = filter->action.mods.mods.mask;
+    state->clear_mods = filter->action.mods.mask;
     if (filter->action.mods.flags & ACTION_LOCK_CLEAR)
-        state->components.locked_mods &= ~filter->action.mods.mods.mask;
+        state->components.locked_mods &= ~filter->action.mods.mask;
 
     filter->func = NULL;
     return 1;
@@ -344,7 +342,7 @@ xkb_filter_mod_set_func(struct xkb_state *state,
 static void
 xkb_filter_mod_set_new(struct xkb_state *state, struct xkb_filter *filter)
 {
-    state->set_mods = filter->action.mods.mods.mask;
+    state->set_mods = filter->action.mods.mask;
 }
 
 static int
@@ -363,7 +361,7 @@ xkb_filter_mod_lock_func(struct xkb_state *state,
     if (--filter->refcnt > 0)
         return 0;
 
-    state->clear_mods |= filter->action.mods.mods.mask;
+    state->clear_mods |= filter->action.mods.mask;
     if (!(filter->action.mods.flags & ACTION_LOCK_NO_UNLOCK))
         state->components.locked_mods &= ~filter->priv;
 
@@ -375,10 +373,10 @@ static void
 xkb_filter_mod_lock_new(struct xkb_state *state, struct xkb_filter *filter)
 {
     filter->priv = (state->components.locked_mods &
-                    filter->action.mods.mods.mask);
-    state->set_mods |= filter->action.mods.mods.mask;
+                    filter->action.mods.mask);
+    state->set_mods |= filter->action.mods.mask;
     if (!(filter->action.mods.flags & ACTION_LOCK_NO_LOCK))
-        state->components.locked_mods |= filter->action.mods.mods.mask;
+        state->components.locked_mods |= filter->action.mods.mask;
 }
 
 enum xkb_key_latch_state {
@@ -421,27 +419,27 @@ xkb_filter_mod_latch_func(struct xkb_state *state,
         const union xkb_action *action = xkb_key_get_action(state, key);
         if (action->type == ACTION_TYPE_MOD_LATCH &&
             action->mods.flags == filter->action.mods.flags &&
-            action->mods.mods.mask == filter->action.mods.mods.mask) {
+            action->mods.mask == filter->action.mods.mask) {
             filter->action = *action;
             if (filter->action.mods.flags & ACTION_LATCH_TO_LOCK) {
                 filter->action.type = ACTION_TYPE_MOD_LOCK;
                 filter->func = xkb_filter_mod_lock_func;
-                state->components.locked_mods |= filter->action.mods.mods.mask;
+                state->components.locked_mods |= filter->action.mods.mask;
             }
             else {
                 filter->action.type = ACTION_TYPE_MOD_SET;
                 filter->func = xkb_filter_mod_set_func;
-                state->set_mods = filter->action.mods.mods.mask;
+                state->set_mods = filter->action.mods.mask;
             }
             filter->key = key;
-            state->components.latched_mods &= ~filter->action.mods.mods.mask;
+            state->components.latched_mods &= ~filter->action.mods.mask;
             /* XXX beep beep! */
             return 0;
         }
         else if (xkb_action_breaks_latch(action)) {
             /* XXX: This may be totally broken, we might need to break the
              *      latch in the next run after this press? */
-            state->components.latched_mods &= ~filter->action.mods.mods.mask;
+            state->components.latched_mods &= ~filter->action.mods.mask;
             filter->func = NULL;
             return 1;
         }
@@ -454,22 +452,22 @@ xkb_filter_mod_latch_func(struct xkb_state *state,
          * latched. */
         if (latch == NO_LATCH ||
             ((filter->action.mods.flags & ACTION_LOCK_CLEAR) &&
-             (state->components.locked_mods & filter->action.mods.mods.mask) ==
-             filter->action.mods.mods.mask)) {
+             (state->components.locked_mods & filter->action.mods.mask) ==
+             filter->action.mods.mask)) {
             /* XXX: We might be a bit overenthusiastic about clearing
              *      mods other filters have set here? */
             if (latch == LATCH_PENDING)
                 state->components.latched_mods &=
-                    ~filter->action.mods.mods.mask;
+                    ~filter->action.mods.mask;
             else
-                state->clear_mods = filter->action.mods.mods.mask;
-            state->components.locked_mods &= ~filter->action.mods.mods.mask;
+                state->clear_mods = filter->action.mods.mask;
+            state->components.locked_mods &= ~filter->action.mods.mask;
             filter->func = NULL;
         }
         else {
             latch = LATCH_PENDING;
-            state->clear_mods = filter->action.mods.mods.mask;
-            state->components.latched_mods |= filter->action.mods.mods.mask;
+            state->clear_mods = filter->action.mods.mask;
+            state->components.latched_mods |= filter->action.mods.mask;
             /* XXX beep beep! */
         }
     }
@@ -490,7 +488,7 @@ static void
 xkb_filter_mod_latch_new(struct xkb_state *state, struct xkb_filter *filter)
 {
     filter->priv = LATCH_KEY_DOWN;
-    state->set_mods = filter->action.mods.mods.mask;
+    state->set_mods = filter->action.mods.mask;
 }
 
 static const struct {
@@ -522,14 +520,19 @@ xkb_filter_apply_all(struct xkb_state *state,
 {
     struct xkb_filter *filter;
     const union xkb_action *action;
+    uint64_t active;
+    unsigned int i;
     int send = 1;
 
     /* First run through all the currently active filters and see if any of
-     * them have claimed this event. */
-    darray_foreach(filter, state->filters) {
-        if (!filter->func)
-            continue;
+     * them have claimed this event. A filter is done once it clears its
+     * func, which frees its slot. */
+    for (active = state->active_filters; active; active &= active - 1) {
+        i = ctz64(active);
+        filter = &state->filters[i];
         send &= filter->func(state, filter, key, direction);
+        if (!filter->func)
+            state->active_filters &= ~(UINT64_C(1) << i);
     }
 
     if (!send || direction == XKB_KEY_UP)
@@ -560,43 +563,24 @@ xkb_filter_apply_all(struct xkb_state *state,
     filter_action_funcs[action->type].new(state, filter);
 }
 
-XKB_EXPORT struct xkb_state *
-xkb_state_new(struct xkb_keymap *keymap)
+/* All bits set if component is one of which, otherwise none. */
+static inline uint32_t
+component_mask(enum xkb_state_component which,
+               enum xkb_state_component component)
 {
-    struct xkb_state *ret;
-
-    ret = calloc(sizeof(*ret), 1);
-    if (!ret)
-        return NULL;
-
-    ret->refcnt = 1;
-    ret->keymap = xkb_keymap_ref(keymap);
-
-    return ret;
+    return -(uint32_t) !!(which & component);
 }
 
-XKB_EXPORT struct xkb_state *
-xkb_state_ref(struct xkb_state *state)
-{
-    state->refcnt++;
-    return state;
-}
-
-XKB_EXPORT void
-xkb_state_unref(struct xkb_state *state)
-{
-    if (!state || --state->refcnt > 0)
-        return;
-
-    xkb_keymap_unref(state->keymap);
-    darray_free(state->filters);
-    free(state);
-}
-
-XKB_EXPORT struct xkb_keymap *
-xkb_state_get_keymap(struct xkb_state *state)
+/*
+ * The bit of @group in a layout mask, or none if it is out of range; the
+ * depressed, latched and locked groups may be anything.
+ */
+static inline xkb_layout_mask_t
+group_bit(int64_t group)
 {
-    return state->keymap;
+    if (group < 0 || group >= 32)
+        return 0;
+    return (xkb_layout_mask_t) 1 << group;
 }
 
 /**
@@ -607,46 +591,51 @@ xkb_state_led_update_all(struct xkb_state *state)
 {
     xkb_led_index_t led;
     const struct xkb_indicator_map *map;
-
-    state->components.leds = 0;
+    const struct state_components *c = &state->components;
+    const xkb_layout_mask_t effective_group_bit = group_bit(c->group);
+    const xkb_layout_mask_t base_group_bit = group_bit(c->base_group);
+    const xkb_layout_mask_t latched_group_bit = group_bit(c->latched_group);
+    const xkb_layout_mask_t locked_group_bit = group_bit(c->locked_group);
+    xkb_led_mask_t leds = state->keymap->ctrl_indicators;
 
     darray_enumerate(led, map, state->keymap->indicators) {
-        xkb_mod_mask_t mod_mask = 0;
-        xkb_layout_mask_t group_mask = 0;
-
-        if (map->which_mods & XKB_STATE_MODS_EFFECTIVE)
-            mod_mask |= state->components.mods;
-        if (map->which_mods & XKB_STATE_MODS_DEPRESSED)
-            mod_mask |= state->components.base_mods;
-        if (map->which_mods & XKB_STATE_MODS_LATCHED)
-            mod_mask |= state->components.latched_mods;
-        if (map->which_mods & XKB_STATE_MODS_LOCKED)
-            mod_mask |= state->components.locked_mods;
-        if (map->mods.mask & mod_mask)
-            state->components.leds |= (1 << led);
-
-        if (map->which_groups & XKB_STATE_LAYOUT_EFFECTIVE)
-            group_mask |= (1 << state->components.group);
-        if (map->which_groups & XKB_STATE_LAYOUT_DEPRESSED)
-            group_mask |= (1 << state->components.base_group);
-        if (map->which_groups & XKB_STATE_LAYOUT_LATCHED)
-            group_mask |= (1 << state->components.latched_group);
-        if (map->which_groups & XKB_STATE_LAYOUT_LOCKED)
-            group_mask |= (1 << state->components.locked_group);
-        if (map->groups & group_mask)
-            state->components.leds |= (1 << led);
-
-        if (map->ctrls & state->keymap->enabled_ctrls)
-            state->components.leds |= (1 << led);
+        xkb_mod_mask_t mod_mask;
+        xkb_layout_mask_t group_mask;
+
+        mod_mask =
+            (component_mask(map->which_mods, XKB_STATE_MODS_EFFECTIVE) &
+             c->mods) |
+            (component_mask(map->which_mods, XKB_STATE_MODS_DEPRESSED) &
+             c->base_mods) |
+            (component_mask(map->which_mods, XKB_STATE_MODS_LATCHED) &
+             c->latched_mods) |
+            (component_mask(map->which_mods, XKB_STATE_MODS_LOCKED) &
+             c->locked_mods);
+
+        group_mask =
+            (component_mask(map->which_groups, XKB_STATE_LAYOUT_EFFECTIVE) &
+             effective_group_bit) |
+            (component_mask(map->which_groups, XKB_STATE_LAYOUT_DEPRESSED) &
+             base_group_bit) |
+            (component_mask(map->which_groups, XKB_STATE_LAYOUT_LATCHED) &
+             latched_group_bit) |
+            (component_mask(map->which_groups, XKB_STATE_LAYOUT_LOCKED) &
+             locked_group_bit);
+
+        leds |= (xkb_led_mask_t) !!((map->mods.mask & mod_mask) |
+                                    (map->groups & group_mask)) << led;
     }
+
+    state->components.leds = leds;
 }
 
 /**
- * Calculates the derived state (effective mods/group and LEDs) from an
- * up-to-date xkb_state.
+ * Calculates the effective mods and group from an up-to-date xkb_state.
+ * These are needed by the filters, so unlike the LEDs they must always be
+ * kept current between key events.
  */
 static void
-xkb_state_update_derived(struct xkb_state *state)
+xkb_state_update_effective(struct xkb_state *state)
 {
     state->components.mods = (state->components.base_mods |
                        state->components.latched_mods |
@@ -663,8 +652,6 @@ xkb_state_update_derived(struct xkb_state *state)
                                              state->components.locked_group,
                                              state->keymap->num_groups,
                                              RANGE_WRAP, 0);
-
-    xkb_state_led_update_all(state);
 }
 
 static enum xkb_state_component
@@ -696,22 +683,110 @@ get_state_component_changes(const struct state_components *a,
 }
 
 /**
- * Given a particular key event, updates the state structure to reflect the
- * new modifiers.
+ * Calculates the derived state (effective mods/group and LEDs) from an
+ * up-to-date xkb_state, and returns the components which changed from prev.
+ * The LEDs are only recalculated if something they depend on has changed.
  */
-XKB_EXPORT enum xkb_state_component
-xkb_state_update_key(struct xkb_state *state, xkb_keycode_t kc,
-                     enum xkb_key_direction direction)
+static enum xkb_state_component
+xkb_state_update_derived(struct xkb_state *state,
+                         const struct state_components *prev)
 {
-    xkb_mod_index_t i;
-    xkb_mod_mask_t bit;
-    struct state_components prev_components;
-    const struct xkb_key *key = XkbKey(state->keymap, kc);
+    enum xkb_state_component changed;
 
-    if (!key)
-        return 0;
+    xkb_state_update_effective(state);
 
-    prev_components = state->components;
+    changed = get_state_component_changes(prev, &state->components);
+    if (changed & state->keymap->indicator_deps) {
+        xkb_state_led_update_all(state);
+        if (state->components.leds != prev->leds)
+            changed |= XKB_STATE_LEDS;
+    }
+
+    return changed;
+}
+
+XKB_EXPORT struct xkb_state *
+xkb_state_new(struct xkb_keymap *keymap)
+{
+    struct xkb_state *ret;
+
+    ret = calloc(sizeof(*ret), 1);
+    if (!ret)
+        return NULL;
+
+    ret->refcnt = 1;
+    ret->keymap = xkb_keymap_ref(keymap);
+
+    /* The LEDs are only updated on changes from here on. */
+    xkb_state_update_effective(ret);
+    xkb_state_led_update_all(ret);
+
+    return ret;
+}
+
+XKB_EXPORT struct xkb_state *
+xkb_state_clone(struct xkb_state *state)
+{
+    struct xkb_state *ret;
+    uint64_t active;
+    unsigned int i;
+
+    /* Only the filters in use are copied, the rest are never read. */
+    ret = malloc(sizeof(*ret));
+    if (!ret)
+        return NULL;
+
+    ret->components = state->components;
+    ret->set_mods = state->set_mods;
+    ret->clear_mods = state->clear_mods;
+    memcpy(ret->mod_key_count, state->mod_key_count,
+           sizeof(ret->mod_key_count));
+
+    ret->active_filters = state->active_filters;
+    for (active = state->active_filters; active; active &= active - 1) {
+        i = ctz64(active);
+        ret->filters[i] = state->filters[i];
+    }
+
+    ret->refcnt = 1;
+    ret->keymap = xkb_keymap_ref(state->keymap);
+
+    return ret;
+}
+
+XKB_EXPORT struct xkb_state *
+xkb_state_ref(struct xkb_state *state)
+{
+    refcnt_inc(&state->refcnt);
+    return state;
+}
+
+XKB_EXPORT void
+xkb_state_unref(struct xkb_state *state)
+{
+    if (!state || !refcnt_dec(&state->refcnt))
+        return;
+
+    xkb_keymap_unref(state->keymap);
+    free(state);
+}
+
+XKB_EXPORT struct xkb_keymap *
+xkb_state_get_keymap(struct xkb_state *state)
+{
+    return state->keymap;
+}
+
+/**
+ * Runs a key event through the filters and applies the resulting base
+ * modifier changes.  The derived state is left for the caller to update.
+ */
+static void
+xkb_state_apply_key(struct xkb_state *state, const struct xkb_key *key,
+                    enum xkb_key_direction direction)
+{
+    xkb_mod_index_t i;
+    xkb_mod_mask_t bit;
 
     state->set_mods = 0;
     state->clear_mods = 0;
@@ -736,10 +811,129 @@ xkb_state_update_key(struct xkb_state *state, xkb_keycode_t kc,
             state->clear_mods &= ~bit;
         }
     }
+}
+
+/**
+ * Given a particular key event, updates the state structure to reflect the
+ * new modifiers.
+ */
+XKB_EXPORT enum xkb_state_component
+xkb_state_update_key(struct xkb_state *state, xkb_keycode_t kc,
+                     enum xkb_key_direction direction)
+{
+    struct state_components prev_components;
+    const struct xkb_key *key = XkbKey(state->keymap, kc);
+
+    if (!key)
+        return 0;
+
+    prev_components = state->components;
+
+    xkb_state_apply_key(state, key, direction);
+
+    return xkb_state_update_derived(state, &prev_components);
+}
+
+/**
+ * Same as calling xkb_state_update_key() for every event, except that the
+ * LEDs are only updated once at the end, unless the caller wants to know
+ * the changes caused by each event.
+ */
+XKB_EXPORT enum xkb_state_component
+xkb_state_update_keys(struct xkb_state *state,
+                      const struct xkb_key_event *events, size_t num_events,
+                      enum xkb_state_component *changed)
+{
+    size_t i;
+    enum xkb_state_component mask = 0, event_mask;
+    struct state_components start_components, prev_components;
+    const struct xkb_key *key;
+
+    start_components = state->components;
+
+    for (i = 0; i < num_events; i++) {
+        key = XkbKey(state->keymap, events[i].keycode);
+        if (!key) {
+            if (changed)
+                changed[i] = 0;
+            continue;
+        }
+
+        prev_components = state->components;
+
+        xkb_state_apply_key(state, key, events[i].direction);
+
+        /* Without per-event changes, the LEDs are only updated at the end. */
+        if (changed) {
+            event_mask = xkb_state_update_derived(state, &prev_components);
+            changed[i] = event_mask;
+        }
+        else {
+            xkb_state_update_effective(state);
+            event_mask = get_state_component_changes(&prev_components,
+                                                     &state->components);
+        }
+
+        mask |= event_mask;
+    }
 
-    xkb_state_update_derived(state);
+    /*
+     * The LEDs only depend on the current state, so comparing with the
+     * start of the batch is enough to know whether they need updating.
+     */
+    if (!changed)
+        mask |= xkb_state_update_derived(state, &start_components);
 
-    return get_state_component_changes(&prev_components, &state->components);
+    return mask;
+}
+
+/**
+ * Looks up everything about the key in the current state before updating
+ * it, so the key only needs to be found once.
+ */
+XKB_EXPORT int
+xkb_state_process_key(struct xkb_state *state, xkb_keycode_t kc,
+                      enum xkb_key_direction direction,
+                      struct xkb_key_result *result)
+{
+    const struct xkb_key *key = XkbKey(state->keymap, kc);
+    const struct xkb_kt_lookup *lookup;
+    const struct xkb_level *level;
+    struct state_components prev_components;
+
+    memset(result, 0, sizeof(*result));
+    result->layout = XKB_LAYOUT_INVALID;
+    result->level = XKB_LEVEL_INVALID;
+
+    if (!key)
+        return 0;
+
+    result->repeats = key->repeats;
+
+    result->layout = key_get_layout(state, key);
+    if (result->layout != XKB_LAYOUT_INVALID) {
+        lookup = get_lookup_for_key_state(state, key, result->layout);
+        result->level = lookup->level;
+        result->consumed = lookup->consumed;
+
+        level = &key->groups[result->layout].levels[lookup->level];
+        result->num_syms = level->num_syms;
+        if (level->num_syms == 1) {
+            result->syms = &level->u.sym;
+            xkb_keysym_to_utf8(level->u.sym, result->utf8,
+                               sizeof(result->utf8));
+        }
+        else if (level->num_syms > 1) {
+            result->syms = level->u.syms;
+        }
+    }
+
+    prev_components = state->components;
+
+    xkb_state_apply_key(state, key, direction);
+
+    result->changed = xkb_state_update_derived(state, &prev_components);
+    return 1;
 }
 
 /**
@@ -783,9 +977,7 @@ xkb_state_update_mask(struct xkb_state *state,
     state->components.latched_group = latched_group;
     state->components.locked_group = locked_group;
 
-    xkb_state_update_derived(state);
-
-    return get_state_component_changes(&prev_components, &state->components);
+    return xkb_state_update_derived(state, &prev_components);
 }
 
 /**
@@ -1074,18 +1266,13 @@ xkb_state_led_name_is_active(struct xkb_state *state, const char *name)
 static xkb_mod_mask_t
 key_get_consumed(struct xkb_state *state, const struct xkb_key *key)
 {
-    const struct xkb_kt_map_entry *entry;
     xkb_layout_index_t group;
 
-    group = xkb_state_key_get_layout(state, key->keycode);
+    group = key_get_layout(state, key);
     if (group == XKB_LAYOUT_INVALID)
         return 0;
 
-    entry = get_entry_for_key_state(state, key, group);
-    if (!entry)
-        return 0;
-
-    return entry->mods.mask & ~entry->preserve.mask;
+    return get_lookup_for_key_state(state, key, group)->consumed;
 }
 
 /**
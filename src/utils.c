@@ -0,0 +1,97 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "utils.h"
+
+/*
+ * Read the rest of a file which can't be mapped, such as a pipe, into a
+ * buffer of its own.
+ */
+static bool
+read_file(FILE *file, struct mapped_file *mf)
+{
+    char *string = NULL, *new_string;
+    size_t size = 0, alloc = 0;
+
+    do {
+        if (alloc - size < 4096) {
+            alloc = alloc ? alloc * 2 : 16384;
+            new_string = realloc(string, alloc);
+            if (!new_string)
+                goto err;
+            string = new_string;
+        }
+
+        size += fread(string + size, 1, alloc - size, file);
+    } while (!feof(file) && !ferror(file));
+
+    if (ferror(file))
+        goto err;
+
+    mf->string = string;
+    mf->size = size;
+    mf->mapped = false;
+    return true;
+
+err:
+    free(string);
+    return false;
+}
+
+bool
+map_file(FILE *file, struct mapped_file *mf)
+{
+    int fd = fileno(file);
+    struct stat stat_buf;
+    char *string;
+
+    if (fstat(fd, &stat_buf) == 0 && S_ISREG(stat_buf.st_mode) &&
+        stat_buf.st_size > 0 && ftello(file) == 0) {
+        string = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (string != MAP_FAILED) {
+            mf->string = string;
+            mf->size = stat_buf.st_size;
+            mf->mapped = true;
+            return true;
+        }
+    }
+
+    return read_file(file, mf);
+}
+
+void
+unmap_file(struct mapped_file *mf)
+{
+    if (mf->mapped)
+        munmap(mf->string, mf->size);
+    else
+        free(mf->string);
+    mf->string = NULL;
+    mf->size = 0;
+}
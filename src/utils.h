@@ -26,9 +26,11 @@
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <string.h>
 #include <strings.h>
 
+#include "atomic.h"
 #include "darray.h"
 
 /*
@@ -133,4 +135,58 @@ memdup(const void *mem, size_t nmemb, size_t size)
 # define ATTR_NULL_SENTINEL
 #endif /* GNUC >= 4 */
 
+/*
+ * The number of bits set in @x, and the index of the lowest bit set in
+ * @x, which must not be 0.
+ */
+#if defined(__GNUC__) && ((__GNUC__ * 100 + __GNUC_MINOR__) >= 304)
+static inline unsigned int
+popcount64(uint64_t x)
+{
+    return __builtin_popcountll(x);
+}
+
+static inline unsigned int
+ctz64(uint64_t x)
+{
+    return __builtin_ctzll(x);
+}
+#else
+static inline unsigned int
+popcount64(uint64_t x)
+{
+    x -= (x >> 1) & UINT64_C(0x5555555555555555);
+    x = (x & UINT64_C(0x3333333333333333)) +
+        ((x >> 2) & UINT64_C(0x3333333333333333));
+    x = (x + (x >> 4)) & UINT64_C(0x0f0f0f0f0f0f0f0f);
+    return (x * UINT64_C(0x0101010101010101)) >> 56;
+}
+
+static inline unsigned int
+ctz64(uint64_t x)
+{
+    return popcount64((x & -x) - 1);
+}
+#endif
+
+/*
+ * The contents of a file, mapped into memory if possible or else read
+ * into a buffer; either way, not NUL-terminated.
+ */
+struct mapped_file {
+    char *string;
+    size_t size;
+    bool mapped;
+};
+
+/*
+ * Get the rest of the file, from its current position. Regular files
+ * read from the start are mapped; anything else, e.g. a pipe, is read.
+ */
+bool
+map_file(FILE *file, struct mapped_file *mf);
+
+void
+unmap_file(struct mapped_file *mf);
+
 #endif /* UTILS_H */
@@ -320,7 +320,7 @@ HandleSetLatchMods(struct xkb_keymap *keymap, union xkb_action *action,
         t1 = act->flags;
         if (CheckModifierField(keymap, action->type, value, &t1, &t2)) {
             act->flags = t1;
-            act->mods.mods = t2;
+            act->mods = t2;
             return true;
         }
         return false;
@@ -349,7 +349,7 @@ HandleLockMods(struct xkb_keymap *keymap, union xkb_action *action,
         t1 = act->flags;
         if (CheckModifierField(keymap, action->type, value, &t1, &t2)) {
             act->flags = t1;
-            act->mods.mods = t2;
+            act->mods = t2;
             return true;
         }
         return false;
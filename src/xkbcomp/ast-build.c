@@ -67,6 +67,118 @@ malloc_or_die(size_t size)
     return p;
 }
 
+/*
+ * Everything in a parsed file is bump-allocated from an arena, which the
+ * outermost XkbFile owns, so that freeing a file is freeing a few blocks
+ * rather than walking the tree.  The arena lives at the start of its
+ * first block, which is enough for most included files.
+ */
+struct ast_block {
+    struct ast_block *next;
+};
+
+struct ast_arena {
+    char *next;
+    char *end;
+    size_t block_size;
+    struct ast_block *blocks;
+};
+
+#define AST_ALIGN 8
+#define AST_FIRST_BLOCK_SIZE 4096
+#define AST_MAX_BLOCK_SIZE 65536
+
+static inline size_t
+ast_align(size_t size)
+{
+    return (size + AST_ALIGN - 1) & ~(size_t) (AST_ALIGN - 1);
+}
+
+struct ast_arena *
+ast_arena_new(void)
+{
+    struct ast_arena *arena = malloc_or_die(AST_FIRST_BLOCK_SIZE);
+
+    arena->next = (char *) arena + ast_align(sizeof(*arena));
+    arena->end = (char *) arena + AST_FIRST_BLOCK_SIZE;
+    arena->block_size = AST_FIRST_BLOCK_SIZE;
+    arena->blocks = NULL;
+    return arena;
+}
+
+void
+ast_arena_free(struct ast_arena *arena)
+{
+    struct ast_block *block, *next;
+
+    if (!arena)
+        return;
+
+    for (block = arena->blocks; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+    free(arena);
+}
+
+ATTR_MALLOC static void *
+ast_arena_alloc(struct ast_arena *arena, size_t size)
+{
+    struct ast_block *block;
+    size_t block_size;
+    void *p;
+
+    size = ast_align(size);
+
+    if ((size_t) (arena->end - arena->next) < size) {
+        arena->block_size = MIN(arena->block_size * 2, AST_MAX_BLOCK_SIZE);
+        block_size = MAX(arena->block_size,
+                         ast_align(sizeof(*block)) + size);
+
+        block = malloc_or_die(block_size);
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->next = (char *) block + ast_align(sizeof(*block));
+        arena->end = (char *) block + block_size;
+    }
+
+    p = arena->next;
+    arena->next += size;
+    return p;
+}
+
+static char *
+ast_arena_strdup(struct ast_arena *arena, const char *str)
+{
+    size_t size;
+
+    if (!str)
+        return NULL;
+
+    size = strlen(str) + 1;
+    return memcpy(ast_arena_alloc(arena, size), str, size);
+}
+
+/*
+ * Make room in an array in the arena for one more element.  The old
+ * array is left behind when it moves, so grow it by doubling.
+ */
+static void *
+ast_arena_grow(struct ast_arena *arena, void *array, unsigned int num,
+               unsigned int *alloc, size_t elem_size)
+{
+    void *new_array;
+
+    if (num < *alloc)
+        return array;
+
+    *alloc = *alloc ? *alloc * 2 : 4;
+    new_array = ast_arena_alloc(arena, *alloc * elem_size);
+    if (num > 0)
+        memcpy(new_array, array, num * elem_size);
+    return new_array;
+}
+
 ParseCommon *
 AppendStmt(ParseCommon *to, ParseCommon *append)
 {
@@ -82,11 +194,12 @@ AppendStmt(ParseCommon *to, ParseCommon *append)
 }
 
 ExprDef *
-ExprCreate(enum expr_op_type op, enum expr_value_type type)
+ExprCreate(struct ast_arena *arena, enum expr_op_type op,
+           enum expr_value_type type)
 {
     ExprDef *expr;
 
-    expr = malloc_or_die(sizeof(*expr));
+    expr = ast_arena_alloc(arena, sizeof(*expr));
 
     expr->common.type = STMT_EXPR;
     expr->common.next = NULL;
@@ -96,11 +209,11 @@ ExprCreate(enum expr_op_type op, enum expr_value_type type)
 }
 
 ExprDef *
-ExprCreateUnary(enum expr_op_type op, enum expr_value_type type,
-                ExprDef *child)
+ExprCreateUnary(struct ast_arena *arena, enum expr_op_type op,
+                enum expr_value_type type, ExprDef *child)
 {
     ExprDef *expr;
-    expr = malloc_or_die(sizeof(*expr));
+    expr = ast_arena_alloc(arena, sizeof(*expr));
 
     expr->common.type = STMT_EXPR;
     expr->common.next = NULL;
@@ -111,11 +224,12 @@ ExprCreateUnary(enum expr_op_type op, enum expr_value_type type,
 }
 
 ExprDef *
-ExprCreateBinary(enum expr_op_type op, ExprDef *left, ExprDef *right)
+ExprCreateBinary(struct ast_arena *arena, enum expr_op_type op,
+                 ExprDef *left, ExprDef *right)
 {
     ExprDef *expr;
 
-    expr = malloc_or_die(sizeof(*expr));
+    expr = ast_arena_alloc(arena, sizeof(*expr));
 
     expr->common.type = STMT_EXPR;
     expr->common.next = NULL;
@@ -133,11 +247,11 @@ ExprCreateBinary(enum expr_op_type op, ExprDef *left, ExprDef *right)
 }
 
 KeycodeDef *
-KeycodeCreate(xkb_atom_t name, int64_t value)
+KeycodeCreate(struct ast_arena *arena, xkb_atom_t name, int64_t value)
 {
     KeycodeDef *def;
 
-    def = malloc_or_die(sizeof(*def));
+    def = ast_arena_alloc(arena, sizeof(*def));
 
     def->common.type = STMT_KEYCODE;
     def->common.next = NULL;
@@ -147,11 +261,11 @@ KeycodeCreate(xkb_atom_t name, int64_t value)
 }
 
 KeyAliasDef *
-KeyAliasCreate(xkb_atom_t alias, xkb_atom_t real)
+KeyAliasCreate(struct ast_arena *arena, xkb_atom_t alias, xkb_atom_t real)
 {
     KeyAliasDef *def;
 
-    def = malloc_or_die(sizeof(*def));
+    def = ast_arena_alloc(arena, sizeof(*def));
 
     def->common.type = STMT_ALIAS;
     def->common.next = NULL;
@@ -161,11 +275,11 @@ KeyAliasCreate(xkb_atom_t alias, xkb_atom_t real)
 }
 
 VModDef *
-VModCreate(xkb_atom_t name, ExprDef * value)
+VModCreate(struct ast_arena *arena, xkb_atom_t name, ExprDef * value)
 {
     VModDef *def;
 
-    def = malloc_or_die(sizeof(*def));
+    def = ast_arena_alloc(arena, sizeof(*def));
 
     def->common.type = STMT_VMOD;
     def->common.next = NULL;
@@ -175,10 +289,10 @@ VModCreate(xkb_atom_t name, ExprDef * value)
 }
 
 VarDef *
-VarCreate(ExprDef * name, ExprDef * value)
+VarCreate(struct ast_arena *arena, ExprDef * name, ExprDef * value)
 {
     VarDef *def;
-    def = malloc_or_die(sizeof(*def));
+    def = ast_arena_alloc(arena, sizeof(*def));
 
     def->common.type = STMT_VAR;
     def->common.next = NULL;
@@ -188,23 +302,23 @@ VarCreate(ExprDef * name, ExprDef * value)
 }
 
 VarDef *
-BoolVarCreate(xkb_atom_t nameToken, unsigned set)
+BoolVarCreate(struct ast_arena *arena, xkb_atom_t nameToken, unsigned set)
 {
     ExprDef *name, *value;
 
-    name = ExprCreate(EXPR_IDENT, EXPR_TYPE_UNKNOWN);
+    name = ExprCreate(arena, EXPR_IDENT, EXPR_TYPE_UNKNOWN);
     name->value.str = nameToken;
-    value = ExprCreate(EXPR_VALUE, EXPR_TYPE_BOOLEAN);
+    value = ExprCreate(arena, EXPR_VALUE, EXPR_TYPE_BOOLEAN);
     value->value.uval = set;
-    return VarCreate(name, value);
+    return VarCreate(arena, name, value);
 }
 
 InterpDef *
-InterpCreate(char *sym, ExprDef * match)
+InterpCreate(struct ast_arena *arena, xkb_atom_t sym, ExprDef * match)
 {
     InterpDef *def;
 
-    def = malloc_or_die(sizeof(*def));
+    def = ast_arena_alloc(arena, sizeof(*def));
 
     def->common.type = STMT_INTERP;
     def->common.next = NULL;
@@ -214,11 +328,11 @@ InterpCreate(char *sym, ExprDef * match)
 }
 
 KeyTypeDef *
-KeyTypeCreate(xkb_atom_t name, VarDef * body)
+KeyTypeCreate(struct ast_arena *arena, xkb_atom_t name, VarDef * body)
 {
     KeyTypeDef *def;
 
-    def = malloc_or_die(sizeof(*def));
+    def = ast_arena_alloc(arena, sizeof(*def));
 
     def->common.type = STMT_TYPE;
     def->common.next = NULL;
@@ -229,11 +343,11 @@ KeyTypeCreate(xkb_atom_t name, VarDef * body)
 }
 
 SymbolsDef *
-SymbolsCreate(xkb_atom_t keyName, ExprDef *symbols)
+SymbolsCreate(struct ast_arena *arena, xkb_atom_t keyName, ExprDef *symbols)
 {
     SymbolsDef *def;
 
-    def = malloc_or_die(sizeof(*def));
+    def = ast_arena_alloc(arena, sizeof(*def));
 
     def->common.type = STMT_SYMBOLS;
     def->common.next = NULL;
@@ -244,11 +358,11 @@ SymbolsCreate(xkb_atom_t keyName, ExprDef *symbols)
 }
 
 GroupCompatDef *
-GroupCompatCreate(int group, ExprDef * val)
+GroupCompatCreate(struct ast_arena *arena, int group, ExprDef * val)
 {
     GroupCompatDef *def;
 
-    def = malloc_or_die(sizeof(*def));
+    def = ast_arena_alloc(arena, sizeof(*def));
 
     def->common.type = STMT_GROUP_COMPAT;
     def->common.next = NULL;
@@ -259,11 +373,11 @@ GroupCompatCreate(int group, ExprDef * val)
 }
 
 ModMapDef *
-ModMapCreate(uint32_t modifier, ExprDef * keys)
+ModMapCreate(struct ast_arena *arena, uint32_t modifier, ExprDef * keys)
 {
     ModMapDef *def;
 
-    def = malloc_or_die(sizeof(*def));
+    def = ast_arena_alloc(arena, sizeof(*def));
 
     def->common.type = STMT_MODMAP;
     def->common.next = NULL;
@@ -274,11 +388,11 @@ ModMapCreate(uint32_t modifier, ExprDef * keys)
 }
 
 IndicatorMapDef *
-IndicatorMapCreate(xkb_atom_t name, VarDef * body)
+IndicatorMapCreate(struct ast_arena *arena, xkb_atom_t name, VarDef * body)
 {
     IndicatorMapDef *def;
 
-    def = malloc_or_die(sizeof(*def));
+    def = ast_arena_alloc(arena, sizeof(*def));
 
     def->common.type = STMT_INDICATOR_MAP;
     def->common.next = NULL;
@@ -289,11 +403,12 @@ IndicatorMapCreate(xkb_atom_t name, VarDef * body)
 }
 
 IndicatorNameDef *
-IndicatorNameCreate(int ndx, ExprDef * name, bool virtual)
+IndicatorNameCreate(struct ast_arena *arena, int ndx, ExprDef * name,
+                    bool virtual)
 {
     IndicatorNameDef *def;
 
-    def = malloc_or_die(sizeof(*def));
+    def = ast_arena_alloc(arena, sizeof(*def));
 
     def->common.type = STMT_INDICATOR_NAME;
     def->common.next = NULL;
@@ -305,11 +420,11 @@ IndicatorNameCreate(int ndx, ExprDef * name, bool virtual)
 }
 
 ExprDef *
-ActionCreate(xkb_atom_t name, ExprDef * args)
+ActionCreate(struct ast_arena *arena, xkb_atom_t name, ExprDef * args)
 {
     ExprDef *act;
 
-    act = malloc_or_die(sizeof(*act));
+    act = ast_arena_alloc(arena, sizeof(*act));
 
     act->common.type = STMT_EXPR;
     act->common.next = NULL;
@@ -319,72 +434,88 @@ ActionCreate(xkb_atom_t name, ExprDef * args)
     return act;
 }
 
+static void
+AppendKeysymLevel(struct ast_arena *arena, ExprDef *list,
+                  unsigned int index, unsigned int num)
+{
+    unsigned int num_levels = list->value.list.num_levels;
+    /* Both arrays grow together. */
+    unsigned int alloc_levels = list->value.list.alloc_levels;
+
+    list->value.list.symsMapIndex =
+        ast_arena_grow(arena, list->value.list.symsMapIndex, num_levels,
+                       &alloc_levels, sizeof(unsigned int));
+    list->value.list.symsNumEntries =
+        ast_arena_grow(arena, list->value.list.symsNumEntries, num_levels,
+                       &list->value.list.alloc_levels, sizeof(unsigned int));
+
+    list->value.list.symsMapIndex[num_levels] = index;
+    list->value.list.symsNumEntries[num_levels] = num;
+    list->value.list.num_levels++;
+}
+
+static void
+AppendKeysym(struct ast_arena *arena, ExprDef *list, xkb_atom_t sym)
+{
+    list->value.list.syms =
+        ast_arena_grow(arena, list->value.list.syms,
+                       list->value.list.num_syms,
+                       &list->value.list.alloc_syms, sizeof(xkb_atom_t));
+    list->value.list.syms[list->value.list.num_syms++] = sym;
+}
+
 ExprDef *
-CreateKeysymList(char *sym)
+CreateKeysymList(struct ast_arena *arena, xkb_atom_t sym)
 {
     ExprDef *def;
 
-    def = ExprCreate(EXPR_KEYSYM_LIST, EXPR_TYPE_SYMBOLS);
-
-    darray_init(def->value.list.syms);
-    darray_init(def->value.list.symsMapIndex);
-    darray_init(def->value.list.symsNumEntries);
+    def = ExprCreate(arena, EXPR_KEYSYM_LIST, EXPR_TYPE_SYMBOLS);
 
-    darray_append(def->value.list.syms, sym);
-    darray_append(def->value.list.symsMapIndex, 0);
-    darray_append(def->value.list.symsNumEntries, 1);
+    memset(&def->value.list, 0, sizeof(def->value.list));
+    AppendKeysymLevel(arena, def, 0, 1);
+    AppendKeysym(arena, def, sym);
 
     return def;
 }
 
 ExprDef *
-CreateMultiKeysymList(ExprDef *list)
+CreateMultiKeysymList(struct ast_arena *arena, ExprDef *list)
 {
-    size_t nLevels = darray_size(list->value.list.symsMapIndex);
+    unsigned int nLevels = list->value.list.num_levels;
 
-    darray_resize(list->value.list.symsMapIndex, 1);
-    darray_resize(list->value.list.symsNumEntries, 1);
-    darray_item(list->value.list.symsMapIndex, 0) = 0;
-    darray_item(list->value.list.symsNumEntries, 0) = nLevels;
+    list->value.list.num_levels = 1;
+    list->value.list.symsMapIndex[0] = 0;
+    list->value.list.symsNumEntries[0] = nLevels;
 
     return list;
 }
 
 ExprDef *
-AppendKeysymList(ExprDef * list, char *sym)
+AppendKeysymList(struct ast_arena *arena, ExprDef *list, xkb_atom_t sym)
 {
-    size_t nSyms = darray_size(list->value.list.syms);
-
-    darray_append(list->value.list.symsMapIndex, nSyms);
-    darray_append(list->value.list.symsNumEntries, 1);
-    darray_append(list->value.list.syms, sym);
+    AppendKeysymLevel(arena, list, list->value.list.num_syms, 1);
+    AppendKeysym(arena, list, sym);
 
     return list;
 }
 
 ExprDef *
-AppendMultiKeysymList(ExprDef * list, ExprDef * append)
+AppendMultiKeysymList(struct ast_arena *arena, ExprDef *list,
+                      ExprDef *append)
 {
-    size_t nSyms = darray_size(list->value.list.syms);
-    size_t numEntries = darray_size(append->value.list.syms);
+    unsigned int i;
 
-    darray_append(list->value.list.symsMapIndex, nSyms);
-    darray_append(list->value.list.symsNumEntries, numEntries);
-    darray_append_items(list->value.list.syms,
-                        darray_mem(append->value.list.syms, 0),
-                        numEntries);
-
-    darray_resize(append->value.list.syms, 0);
-    FreeStmt(&append->common);
+    AppendKeysymLevel(arena, list, list->value.list.num_syms,
+                      append->value.list.num_syms);
+    for (i = 0; i < append->value.list.num_syms; i++)
+        AppendKeysym(arena, list, append->value.list.syms[i]);
 
     return list;
 }
 
-static void
-FreeInclude(IncludeStmt *incl);
-
 IncludeStmt *
-IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
+IncludeCreate(struct xkb_context *ctx, struct ast_arena *arena, char *str,
+              enum merge_mode merge)
 {
     IncludeStmt *incl, *first;
     char *file, *map, *stmt, *tmp, *extra_data;
@@ -393,7 +524,7 @@ IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
     incl = first = NULL;
     file = map = NULL;
     tmp = str;
-    stmt = strdup_safe(str);
+    stmt = ast_arena_strdup(arena, str);
     while (tmp && *tmp)
     {
         if (!ParseIncludeMap(&tmp, &file, &map, &nextop, &extra_data))
@@ -413,28 +544,25 @@ IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
         }
 
         if (first == NULL) {
-            first = incl = malloc(sizeof(*first));
+            first = incl = ast_arena_alloc(arena, sizeof(*first));
         } else {
-            incl->next_incl = malloc(sizeof(*first));
+            incl->next_incl = ast_arena_alloc(arena, sizeof(*first));
             incl = incl->next_incl;
         }
 
-        if (!incl) {
-            log_wsgo(ctx,
-                     "Allocation failure in IncludeCreate; "
-                     "Using only part of the include\n");
-            break;
-        }
-
         incl->common.type = STMT_INCLUDE;
         incl->common.next = NULL;
         incl->merge = merge;
         incl->stmt = NULL;
-        incl->file = file;
-        incl->map = map;
-        incl->modifier = extra_data;
+        incl->file = ast_arena_strdup(arena, file);
+        incl->map = ast_arena_strdup(arena, map);
+        incl->modifier = ast_arena_strdup(arena, extra_data);
         incl->next_incl = NULL;
 
+        free(file);
+        free(map);
+        free(extra_data);
+
         if (nextop == '|')
             merge = MERGE_AUGMENT;
         else
@@ -443,15 +571,11 @@ IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
 
     if (first)
         first->stmt = stmt;
-    else
-        free(stmt);
 
     return first;
 
 err:
     log_err(ctx, "Illegal include statement \"%s\"; Ignored\n", stmt);
-    FreeInclude(first);
-    free(stmt);
     return NULL;
 }
 
@@ -480,210 +604,117 @@ EnsureSafeMapName(char *name)
 }
 
 XkbFile *
-XkbFileCreate(struct xkb_context *ctx, enum xkb_file_type type, char *name,
-              ParseCommon *defs, enum xkb_map_flags flags)
+XkbFileCreate(struct xkb_context *ctx, struct ast_arena *arena,
+              enum xkb_file_type type, char *name, ParseCommon *defs,
+              enum xkb_map_flags flags)
 {
-    XkbFile *file;
+    XkbFile *file, *map;
 
-    file = calloc(1, sizeof(*file));
-    if (!file)
-        return NULL;
+    file = ast_arena_alloc(arena, sizeof(*file));
+    memset(file, 0, sizeof(*file));
 
     EnsureSafeMapName(name);
     file->file_type = type;
-    file->topName = strdup_safe(name);
-    file->name = name;
+    file->name = ast_arena_strdup(arena, name);
+    file->topName = file->name;
     file->defs = defs;
     file->id = xkb_context_take_file_id(ctx);
     file->flags = flags;
+    file->refcnt = 1;
+    free(name);
+
+    /* The maps in a keymap file are reported by the name of the file. */
+    if (type == FILE_TYPE_KEYMAP) {
+        for (map = (XkbFile *) defs; map; map = (XkbFile *) map->common.next)
+            if (!map->topName)
+                map->topName = (file->name ? file->name :
+                                ast_arena_strdup(arena, "(unnamed)"));
+    }
+
     return file;
 }
 
+/*
+ * Returns a file with a new ID, which uses the names and definitions of
+ * @file without copying them.  It takes over the caller's reference to
+ * @file, which is dropped when it is freed, or right away on failure.
+ */
+XkbFile *
+XkbFileShare(struct xkb_context *ctx, XkbFile *file)
+{
+    XkbFile *shared;
+
+    shared = malloc(sizeof(*shared));
+    if (!shared) {
+        FreeXkbFile(file);
+        return NULL;
+    }
+
+    /* Not a struct copy: other users may be changing the refcnt. */
+    memset(shared, 0, sizeof(*shared));
+    shared->common.type = file->common.type;
+    shared->file_type = file->file_type;
+    shared->topName = file->topName;
+    shared->name = file->name;
+    shared->defs = file->defs;
+    shared->id = xkb_context_take_file_id(ctx);
+    shared->flags = file->flags;
+    shared->shared_from = file;
+    return shared;
+}
+
 XkbFile *
 XkbFileFromComponents(struct xkb_context *ctx,
                       struct xkb_component_names *kkctgs)
 {
+    struct ast_arena *arena;
     IncludeStmt *inc;
-    XkbFile *keycodes, *types, *compat, *symbols;
+    XkbFile *keycodes, *types, *compat, *symbols, *keymap;
 
-    inc = IncludeCreate(ctx, kkctgs->keycodes, MERGE_DEFAULT);
-    keycodes = XkbFileCreate(ctx, FILE_TYPE_KEYCODES, NULL,
+    arena = ast_arena_new();
+
+    inc = IncludeCreate(ctx, arena, kkctgs->keycodes, MERGE_DEFAULT);
+    keycodes = XkbFileCreate(ctx, arena, FILE_TYPE_KEYCODES, NULL,
                              (ParseCommon *) inc, 0);
 
-    inc = IncludeCreate(ctx, kkctgs->types, MERGE_DEFAULT);
-    types = XkbFileCreate(ctx, FILE_TYPE_TYPES, NULL,
+    inc = IncludeCreate(ctx, arena, kkctgs->types, MERGE_DEFAULT);
+    types = XkbFileCreate(ctx, arena, FILE_TYPE_TYPES, NULL,
                           (ParseCommon *) inc, 0);
     AppendStmt(&keycodes->common, &types->common);
 
-    inc = IncludeCreate(ctx, kkctgs->compat, MERGE_DEFAULT);
-    compat = XkbFileCreate(ctx, FILE_TYPE_COMPAT, NULL,
+    inc = IncludeCreate(ctx, arena, kkctgs->compat, MERGE_DEFAULT);
+    compat = XkbFileCreate(ctx, arena, FILE_TYPE_COMPAT, NULL,
                            (ParseCommon *) inc, 0);
     AppendStmt(&keycodes->common, &compat->common);
 
-    inc = IncludeCreate(ctx, kkctgs->symbols, MERGE_DEFAULT);
-    symbols = XkbFileCreate(ctx, FILE_TYPE_SYMBOLS, NULL,
+    inc = IncludeCreate(ctx, arena, kkctgs->symbols, MERGE_DEFAULT);
+    symbols = XkbFileCreate(ctx, arena, FILE_TYPE_SYMBOLS, NULL,
                             (ParseCommon *) inc, 0);
     AppendStmt(&keycodes->common, &symbols->common);
 
-    return XkbFileCreate(ctx, FILE_TYPE_KEYMAP, NULL,
-                         &keycodes->common, 0);
-}
-
-static void
-FreeExpr(ExprDef *expr)
-{
-    char **sym;
-
-    if (!expr)
-        return;
-
-    switch (expr->op) {
-    case EXPR_ACTION_LIST:
-    case EXPR_NEGATE:
-    case EXPR_UNARY_PLUS:
-    case EXPR_NOT:
-    case EXPR_INVERT:
-        FreeStmt(&expr->value.child->common);
-        break;
-
-    case EXPR_DIVIDE:
-    case EXPR_ADD:
-    case EXPR_SUBTRACT:
-    case EXPR_MULTIPLY:
-    case EXPR_ASSIGN:
-        FreeStmt(&expr->value.binary.left->common);
-        FreeStmt(&expr->value.binary.right->common);
-        break;
-
-    case EXPR_ACTION_DECL:
-        FreeStmt(&expr->value.action.args->common);
-        break;
-
-    case EXPR_ARRAY_REF:
-        FreeStmt(&expr->value.array.entry->common);
-        break;
-
-    case EXPR_KEYSYM_LIST:
-        darray_foreach(sym, expr->value.list.syms)
-            free(*sym);
-        darray_free(expr->value.list.syms);
-        darray_free(expr->value.list.symsMapIndex);
-        darray_free(expr->value.list.symsNumEntries);
-        break;
-
-    default:
-        break;
-    }
-}
-
-static void
-FreeInclude(IncludeStmt *incl)
-{
-    IncludeStmt *next;
-
-    while (incl)
-    {
-        next = incl->next_incl;
-
-        free(incl->file);
-        free(incl->map);
-        free(incl->modifier);
-        free(incl->stmt);
-
-        free(incl);
-        incl = next;
-    }
-}
-
-void
-FreeStmt(ParseCommon *stmt)
-{
-    ParseCommon *next;
-    YYSTYPE u;
-
-    while (stmt)
-    {
-        next = stmt->next;
-        u.any = stmt;
-
-        switch (stmt->type) {
-        case STMT_INCLUDE:
-            FreeInclude((IncludeStmt *) stmt);
-            /* stmt is already free'd here. */
-            stmt = NULL;
-            break;
-        case STMT_EXPR:
-            FreeExpr(u.expr);
-            break;
-        case STMT_VAR:
-            FreeStmt(&u.var->name->common);
-            FreeStmt(&u.var->value->common);
-            break;
-        case STMT_TYPE:
-            FreeStmt(&u.keyType->body->common);
-            break;
-        case STMT_INTERP:
-            free(u.interp->sym);
-            FreeStmt(&u.interp->match->common);
-            FreeStmt(&u.interp->def->common);
-            break;
-        case STMT_VMOD:
-            FreeStmt(&u.vmod->value->common);
-            break;
-        case STMT_SYMBOLS:
-            FreeStmt(&u.syms->symbols->common);
-            break;
-        case STMT_MODMAP:
-            FreeStmt(&u.modMask->keys->common);
-            break;
-        case STMT_GROUP_COMPAT:
-            FreeStmt(&u.groupCompat->def->common);
-            break;
-        case STMT_INDICATOR_MAP:
-            FreeStmt(&u.ledMap->body->common);
-            break;
-        case STMT_INDICATOR_NAME:
-            FreeStmt(&u.ledName->name->common);
-            break;
-        default:
-            break;
-        }
-
-        free(stmt);
-        stmt = next;
-    }
+    keymap = XkbFileCreate(ctx, arena, FILE_TYPE_KEYMAP, NULL,
+                           &keycodes->common, 0);
+    keymap->arena = arena;
+    return keymap;
 }
 
+/*
+ * The whole tree of a file is allocated from its arena, so there is
+ * nothing to walk here.  Shared files only own their header and a
+ * reference to the file they share.
+ */
 void
 FreeXkbFile(XkbFile *file)
 {
-    XkbFile *next;
-
-    while (file)
-    {
-        next = (XkbFile *) file->common.next;
-
-        switch (file->file_type) {
-        case FILE_TYPE_KEYMAP:
-            FreeXkbFile((XkbFile *) file->defs);
-            break;
-
-        case FILE_TYPE_TYPES:
-        case FILE_TYPE_COMPAT:
-        case FILE_TYPE_SYMBOLS:
-        case FILE_TYPE_KEYCODES:
-        case FILE_TYPE_GEOMETRY:
-            FreeStmt(file->defs);
-            break;
-
-        default:
-            break;
-        }
+    if (!file)
+        return;
 
-        free(file->name);
-        free(file->topName);
+    if (file->shared_from) {
+        FreeXkbFile(file->shared_from);
         free(file);
-        file = next;
+    }
+    else if (refcnt_dec(&file->refcnt)) {
+        ast_arena_free(file->arena);
     }
 }
 
@@ -27,78 +27,90 @@
 #ifndef XKBCOMP_AST_BUILD_H
 #define XKBCOMP_AST_BUILD_H
 
+struct ast_arena *
+ast_arena_new(void);
+
+void
+ast_arena_free(struct ast_arena *arena);
+
 ParseCommon *
 AppendStmt(ParseCommon *to, ParseCommon *append);
 
 ExprDef *
-ExprCreate(enum expr_op_type op, enum expr_value_type type);
+ExprCreate(struct ast_arena *arena, enum expr_op_type op,
+           enum expr_value_type type);
 
 ExprDef *
-ExprCreateUnary(enum expr_op_type op, enum expr_value_type type,
-                ExprDef *child);
+ExprCreateUnary(struct ast_arena *arena, enum expr_op_type op,
+                enum expr_value_type type, ExprDef *child);
 
 ExprDef *
-ExprCreateBinary(enum expr_op_type op, ExprDef *left, ExprDef *right);
+ExprCreateBinary(struct ast_arena *arena, enum expr_op_type op,
+                 ExprDef *left, ExprDef *right);
 
 KeycodeDef *
-KeycodeCreate(xkb_atom_t name, int64_t value);
+KeycodeCreate(struct ast_arena *arena, xkb_atom_t name, int64_t value);
 
 KeyAliasDef *
-KeyAliasCreate(xkb_atom_t alias, xkb_atom_t real);
+KeyAliasCreate(struct ast_arena *arena, xkb_atom_t alias, xkb_atom_t real);
 
 VModDef *
-VModCreate(xkb_atom_t name, ExprDef *value);
+VModCreate(struct ast_arena *arena, xkb_atom_t name, ExprDef *value);
 
 VarDef *
-VarCreate(ExprDef *name, ExprDef *value);
+VarCreate(struct ast_arena *arena, ExprDef *name, ExprDef *value);
 
 VarDef *
-BoolVarCreate(xkb_atom_t nameToken, unsigned set);
+BoolVarCreate(struct ast_arena *arena, xkb_atom_t nameToken, unsigned set);
 
 InterpDef *
-InterpCreate(char *sym, ExprDef *match);
+InterpCreate(struct ast_arena *arena, xkb_atom_t sym, ExprDef *match);
 
 KeyTypeDef *
-KeyTypeCreate(xkb_atom_t name, VarDef *body);
+KeyTypeCreate(struct ast_arena *arena, xkb_atom_t name, VarDef *body);
 
 SymbolsDef *
-SymbolsCreate(xkb_atom_t keyName, ExprDef *symbols);
+SymbolsCreate(struct ast_arena *arena, xkb_atom_t keyName, ExprDef *symbols);
 
 GroupCompatDef *
-GroupCompatCreate(int group, ExprDef *def);
+GroupCompatCreate(struct ast_arena *arena, int group, ExprDef *def);
 
 ModMapDef *
-ModMapCreate(uint32_t modifier, ExprDef *keys);
+ModMapCreate(struct ast_arena *arena, uint32_t modifier, ExprDef *keys);
 
 IndicatorMapDef *
-IndicatorMapCreate(xkb_atom_t name, VarDef *body);
+IndicatorMapCreate(struct ast_arena *arena, xkb_atom_t name, VarDef *body);
 
 IndicatorNameDef *
-IndicatorNameCreate(int ndx, ExprDef *name, bool virtual);
+IndicatorNameCreate(struct ast_arena *arena, int ndx, ExprDef *name,
+                    bool virtual);
 
 ExprDef *
-ActionCreate(xkb_atom_t name, ExprDef *args);
+ActionCreate(struct ast_arena *arena, xkb_atom_t name, ExprDef *args);
 
 ExprDef *
-CreateMultiKeysymList(ExprDef *list);
+CreateMultiKeysymList(struct ast_arena *arena, ExprDef *list);
 
 ExprDef *
-CreateKeysymList(char *sym);
+CreateKeysymList(struct ast_arena *arena, xkb_atom_t sym);
 
 ExprDef *
-AppendMultiKeysymList(ExprDef *list, ExprDef *append);
+AppendMultiKeysymList(struct ast_arena *arena, ExprDef *list,
+                      ExprDef *append);
 
 ExprDef *
-AppendKeysymList(ExprDef *list, char *sym);
+AppendKeysymList(struct ast_arena *arena, ExprDef *list, xkb_atom_t sym);
 
 IncludeStmt *
-IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge);
+IncludeCreate(struct xkb_context *ctx, struct ast_arena *arena, char *str,
+              enum merge_mode merge);
 
 XkbFile *
-XkbFileCreate(struct xkb_context *ctx, enum xkb_file_type type, char *name,
-              ParseCommon *defs, unsigned flags);
+XkbFileCreate(struct xkb_context *ctx, struct ast_arena *arena,
+              enum xkb_file_type type, char *name, ParseCommon *defs,
+              unsigned flags);
 
-void
-FreeStmt(ParseCommon *stmt);
+XkbFile *
+XkbFileShare(struct xkb_context *ctx, XkbFile *file);
 
 #endif
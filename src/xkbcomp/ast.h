@@ -181,9 +181,12 @@ typedef struct _Expr {
             struct _Expr *args;
         } action;
         struct {
-            darray(char *) syms;
-            darray(int) symsMapIndex;
-            darray(unsigned int) symsNumEntries;
+            xkb_atom_t *syms;
+            unsigned int num_syms, alloc_syms;
+            /* For each level, its first keysym in syms and how many. */
+            unsigned int *symsMapIndex;
+            unsigned int *symsNumEntries;
+            unsigned int num_levels, alloc_levels;
         } list;
         struct _Expr *child;
         xkb_atom_t str;
@@ -252,7 +255,7 @@ typedef struct {
 typedef struct {
     ParseCommon common;
     enum merge_mode merge;
-    char *sym;
+    xkb_atom_t sym;
     ExprDef *match;
     VarDef *def;
 } InterpDef;
@@ -283,7 +286,9 @@ enum xkb_map_flags {
     MAP_IS_ALTGR = (1 << 7),
 };
 
-typedef struct {
+struct ast_arena;
+
+typedef struct _XkbFile {
     ParseCommon common;
     enum xkb_file_type file_type;
     char *topName;
@@ -291,6 +296,15 @@ typedef struct {
     ParseCommon *defs;
     int id;
     enum xkb_map_flags flags;
+    /*
+     * Where the file and everything in it was allocated, if this is the
+     * outermost file; see FreeXkbFile().
+     */
+    struct ast_arena *arena;
+    /* References to the outermost file, e.g. from the file cache. */
+    int refcnt;
+    /* The file whose names and defs these are; see XkbFileShare(). */
+    struct _XkbFile *shared_from;
 } XkbFile;
 
 #endif
@@ -596,8 +596,12 @@ HandleIncludeCompatMap(CompatInfo *info, IncludeStmt *stmt)
     InitCompatInfo(&included, info->keymap, info->file_id, info->actions);
     if (stmt->stmt) {
         free(included.name);
-        included.name = stmt->stmt;
-        stmt->stmt = NULL;
+        included.name = strdup(stmt->stmt);
+        if (!included.name) {
+            info->errorCount += 10;
+            ClearCompatInfo(&included);
+            return false;
+        }
     }
 
     for (; stmt; stmt = stmt->next_incl) {
@@ -860,11 +864,12 @@ HandleInterpDef(CompatInfo *info, InterpDef *def, enum merge_mode merge)
     si = info->dflt;
     si.merge = merge = (def->merge == MERGE_DEFAULT ? merge : def->merge);
 
-    if (!LookupKeysym(def->sym, &si.interp.sym)) {
+    if (!LookupKeysym(xkb_atom_text(info->keymap->ctx, def->sym),
+                      &si.interp.sym)) {
         log_err(info->keymap->ctx,
                 "Could not resolve keysym %s; "
                 "Symbol interpretation ignored\n",
-                def->sym);
+                xkb_atom_text(info->keymap->ctx, def->sym));
         return false;
     }
 
@@ -0,0 +1,364 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The on-disk keymap cache.
+ *
+ * Each entry is a file in the cache directory, named by a hash of its key:
+ *
+ *   struct disk_cache_header
+ *   key            The version, RMLVO names, flags and include paths,
+ *                  each terminated by a NUL.
+ *   dependencies   num_deps records of struct disk_cache_dep, each
+ *                  followed by its NUL-terminated path and padded to 8
+ *                  bytes.
+ *   keymap         At keymap_offset, in XKB_KEYMAP_FORMAT_BINARY_V1.
+ *
+ * The key is stored in full, so that hash collisions are harmless.  The
+ * entries are written to a temporary file and renamed into place, so
+ * that concurrent readers and writers never see a partial one.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "xkbcomp-priv.h"
+#include "disk-cache.h"
+
+#define DISK_CACHE_MAGIC "xkbC"
+#define DISK_CACHE_VERSION 1
+
+struct disk_cache_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t key_size;
+    uint32_t num_deps;
+    uint32_t deps_size;
+    uint32_t keymap_offset;
+    uint64_t keymap_size;
+};
+
+struct disk_cache_dep {
+    int64_t mtime;
+    int64_t size;
+    uint32_t path_size;
+    uint32_t pad;
+};
+
+static size_t
+align8(size_t size)
+{
+    return (size + 7) & ~(size_t) 7;
+}
+
+static void
+append_key_string(darray_char *key, const char *str)
+{
+    if (!str)
+        str = "";
+    darray_append_items(*key, str, strlen(str) + 1);
+}
+
+static void
+make_key(struct xkb_context *ctx, const struct xkb_rule_names *rmlvo,
+         enum xkb_keymap_compile_flags flags, darray_char *key)
+{
+    char buf[32];
+    unsigned int i;
+
+    append_key_string(key, "xkbcommon " PACKAGE_VERSION);
+    append_key_string(key, rmlvo->rules);
+    append_key_string(key, rmlvo->model);
+    append_key_string(key, rmlvo->layout);
+    append_key_string(key, rmlvo->variant);
+    append_key_string(key, rmlvo->options);
+
+    snprintf(buf, sizeof(buf), "%#x", (unsigned int) flags);
+    append_key_string(key, buf);
+
+    for (i = 0; i < xkb_context_num_include_paths(ctx); i++)
+        append_key_string(key, xkb_context_include_path_get(ctx, i));
+}
+
+/* FNV-1a, 64 bit. */
+static uint64_t
+hash_key(const darray_char *key)
+{
+    uint64_t hash = 14695981039346656037ull;
+    size_t i;
+
+    for (i = 0; i < darray_size(*key); i++) {
+        hash ^= (unsigned char) darray_item(*key, i);
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static bool
+make_entry_path(struct xkb_context *ctx, const darray_char *key,
+                const char *suffix, char *buf, size_t size)
+{
+    int ret;
+
+    ret = snprintf(buf, size, "%s/%016llx%s",
+                   xkb_context_get_keymap_cache_dir(ctx),
+                   (unsigned long long) hash_key(key), suffix);
+    if (ret < 0 || (size_t) ret >= size) {
+        log_warn(ctx, "Keymap cache directory name too long\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+dep_is_current(const char *path, int64_t mtime, int64_t size)
+{
+    struct stat stat_buf;
+
+    if (stat(path, &stat_buf) != 0)
+        return size < 0 && errno == ENOENT;
+
+    return size >= 0 &&
+           (int64_t) stat_buf.st_mtim.tv_sec * 1000000000 +
+           stat_buf.st_mtim.tv_nsec == mtime &&
+           (int64_t) stat_buf.st_size == size;
+}
+
+/*
+ * Check that the entry is for this key, is well formed, and that the
+ * files it was compiled from didn't change.
+ */
+static bool
+check_entry(struct xkb_context *ctx, const char *path, const char *buffer,
+            size_t length, const darray_char *key)
+{
+    const struct disk_cache_header *header;
+    struct disk_cache_dep dep;
+    size_t offset, deps_end;
+    uint32_t i;
+
+    if (length < sizeof(*header))
+        goto invalid;
+
+    header = (const struct disk_cache_header *) buffer;
+    if (memcmp(header->magic, DISK_CACHE_MAGIC, 4) != 0 ||
+        header->version != DISK_CACHE_VERSION)
+        goto invalid;
+
+    if (header->key_size != darray_size(*key) ||
+        header->key_size > length - sizeof(*header) ||
+        memcmp(buffer + sizeof(*header), darray_mem(*key, 0),
+               header->key_size) != 0)
+        return false;
+
+    offset = align8(sizeof(*header) + header->key_size);
+    if (header->deps_size > length || offset > length - header->deps_size)
+        goto invalid;
+    deps_end = offset + header->deps_size;
+
+    if (header->keymap_offset % 8 != 0 ||
+        header->keymap_offset < deps_end ||
+        header->keymap_offset > length ||
+        header->keymap_size != length - header->keymap_offset)
+        goto invalid;
+
+    for (i = 0; i < header->num_deps; i++) {
+        if (deps_end - offset < sizeof(dep))
+            goto invalid;
+        memcpy(&dep, buffer + offset, sizeof(dep));
+        offset += sizeof(dep);
+
+        if (dep.path_size == 0 || dep.path_size > deps_end - offset ||
+            buffer[offset + dep.path_size - 1] != '\0')
+            goto invalid;
+
+        if (!dep_is_current(buffer + offset, dep.mtime, dep.size)) {
+            log_dbg(ctx, "Cached keymap %s is out of date (%s changed)\n",
+                    path, buffer + offset);
+            return false;
+        }
+
+        offset = align8(offset + dep.path_size);
+        if (offset > deps_end)
+            goto invalid;
+    }
+
+    return true;
+
+invalid:
+    log_warn(ctx, "Ignoring invalid cached keymap %s\n", path);
+    return false;
+}
+
+struct xkb_keymap *
+disk_cache_load(struct xkb_context *ctx, const struct xkb_rule_names *rmlvo,
+                enum xkb_keymap_compile_flags flags)
+{
+    darray_char key = darray_new();
+    char path[PATH_MAX];
+    struct stat stat_buf;
+    const struct disk_cache_header *header;
+    struct xkb_keymap *keymap = NULL;
+    char *buffer;
+    int fd;
+
+    make_key(ctx, rmlvo, flags, &key);
+
+    if (!make_entry_path(ctx, &key, ".xkbc", path, sizeof(path)))
+        goto out;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        goto out;
+
+    if (fstat(fd, &stat_buf) != 0 || stat_buf.st_size == 0) {
+        close(fd);
+        goto out;
+    }
+
+    buffer = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (buffer == MAP_FAILED)
+        goto out;
+
+    if (check_entry(ctx, path, buffer, stat_buf.st_size, &key)) {
+        header = (const struct disk_cache_header *) buffer;
+        keymap = keymap_new_from_binary(ctx, buffer + header->keymap_offset,
+                                        header->keymap_size, flags);
+        if (keymap)
+            log_dbg(ctx, "Loaded cached keymap %s\n", path);
+        else
+            log_warn(ctx, "Ignoring invalid cached keymap %s\n", path);
+    }
+
+    munmap(buffer, stat_buf.st_size);
+out:
+    darray_free(key);
+    return keymap;
+}
+
+static bool
+write_all(int fd, const char *buffer, size_t size)
+{
+    ssize_t ret;
+
+    while (size > 0) {
+        ret = write(fd, buffer, size);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        buffer += ret;
+        size -= ret;
+    }
+
+    return true;
+}
+
+void
+disk_cache_store(struct xkb_context *ctx, const struct xkb_rule_names *rmlvo,
+                 enum xkb_keymap_compile_flags flags,
+                 const darray_file_dep *deps, struct xkb_keymap *keymap)
+{
+    darray_char key = darray_new();
+    darray_char entry = darray_new();
+    struct disk_cache_header header;
+    struct disk_cache_dep dep;
+    const struct file_dep *file_dep;
+    char path[PATH_MAX], tmp_path[PATH_MAX];
+    char *binary = NULL;
+    size_t binary_size, deps_start;
+    int fd;
+    bool ok;
+
+    make_key(ctx, rmlvo, flags, &key);
+
+    if (!make_entry_path(ctx, &key, ".xkbc", path, sizeof(path)) ||
+        !make_entry_path(ctx, &key, ".XXXXXX", tmp_path, sizeof(tmp_path)))
+        goto out;
+
+    binary = keymap_get_as_binary(keymap, &binary_size);
+    if (!binary)
+        goto out;
+
+    memset(&header, 0, sizeof(header));
+    darray_append_items(entry, (const char *) &header, sizeof(header));
+    darray_append_items(entry, darray_mem(key, 0), darray_size(key));
+    darray_resize0(entry, align8(darray_size(entry)));
+    deps_start = darray_size(entry);
+
+    darray_foreach(file_dep, *deps) {
+        memset(&dep, 0, sizeof(dep));
+        dep.mtime = file_dep->mtime;
+        dep.size = file_dep->size;
+        dep.path_size = strlen(file_dep->path) + 1;
+        darray_append_items(entry, (const char *) &dep, sizeof(dep));
+        darray_append_items(entry, file_dep->path, dep.path_size);
+        darray_resize0(entry, align8(darray_size(entry)));
+    }
+
+    memcpy(header.magic, DISK_CACHE_MAGIC, 4);
+    header.version = DISK_CACHE_VERSION;
+    header.key_size = darray_size(key);
+    header.num_deps = darray_size(*deps);
+    header.deps_size = darray_size(entry) - deps_start;
+    header.keymap_offset = darray_size(entry);
+    header.keymap_size = binary_size;
+    memcpy(darray_mem(entry, 0), &header, sizeof(header));
+
+    fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        log_warn(ctx, "Couldn't create cached keymap in %s: %s\n",
+                 xkb_context_get_keymap_cache_dir(ctx), strerror(errno));
+        goto out;
+    }
+
+    ok = write_all(fd, darray_mem(entry, 0), darray_size(entry)) &&
+         write_all(fd, binary, binary_size);
+    ok = (close(fd) == 0) && ok;
+    if (ok)
+        ok = (rename(tmp_path, path) == 0);
+
+    if (!ok) {
+        log_warn(ctx, "Couldn't write cached keymap %s: %s\n",
+                 path, strerror(errno));
+        unlink(tmp_path);
+        goto out;
+    }
+
+    log_dbg(ctx, "Stored keymap in cache as %s\n", path);
+
+out:
+    free(binary);
+    darray_free(entry);
+    darray_free(key);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef XKBCOMP_DISK_CACHE_H
+#define XKBCOMP_DISK_CACHE_H
+
+#include "include.h"
+
+/*
+ * Load the keymap stored in the context's cache directory for the RMLVO
+ * names, if none of the files it was compiled from changed since.
+ */
+struct xkb_keymap *
+disk_cache_load(struct xkb_context *ctx, const struct xkb_rule_names *rmlvo,
+                enum xkb_keymap_compile_flags flags);
+
+/*
+ * Store a keymap compiled from the RMLVO names, along with the files it
+ * was compiled from, in the context's cache directory.
+ */
+void
+disk_cache_store(struct xkb_context *ctx, const struct xkb_rule_names *rmlvo,
+                 enum xkb_keymap_compile_flags flags,
+                 const darray_file_dep *deps, struct xkb_keymap *keymap);
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pthread.h>
+
+#include "xkbcomp-priv.h"
+#include "file-cache.h"
+
+struct file_cache_entry {
+    enum xkb_file_type type;
+    char *path;
+    /* NULL for the default map. */
+    char *map;
+    uint32_t hash;
+    int64_t mtime;
+    int64_t size;
+    XkbFile *file;
+
+    struct file_cache_entry *next_in_bucket;
+};
+
+struct file_cache {
+    bool thread_safe;
+    pthread_mutex_t lock;
+
+    struct file_cache_entry **buckets;
+    unsigned int num_buckets;
+    unsigned int num_entries;
+};
+
+struct file_cache *
+file_cache_new(bool thread_safe)
+{
+    struct file_cache *cache = calloc(1, sizeof(*cache));
+
+    if (!cache)
+        return NULL;
+
+    cache->thread_safe = thread_safe;
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+void
+file_cache_free(struct file_cache *cache)
+{
+    struct file_cache_entry *entry, *next;
+    unsigned int i;
+
+    if (!cache)
+        return;
+
+    for (i = 0; i < cache->num_buckets; i++) {
+        for (entry = cache->buckets[i]; entry; entry = next) {
+            next = entry->next_in_bucket;
+            FreeXkbFile(entry->file);
+            free(entry->path);
+            free(entry->map);
+            free(entry);
+        }
+    }
+    free(cache->buckets);
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+static void
+cache_lock(struct file_cache *cache)
+{
+    if (cache->thread_safe)
+        pthread_mutex_lock(&cache->lock);
+}
+
+static void
+cache_unlock(struct file_cache *cache)
+{
+    if (cache->thread_safe)
+        pthread_mutex_unlock(&cache->lock);
+}
+
+/* FNV-1a, over the type, the path and the map name. */
+static uint32_t
+hash_key(enum xkb_file_type type, const char *path, const char *map)
+{
+    uint32_t hash = 2166136261u;
+    const char *s;
+
+    hash = (hash ^ (uint32_t) type) * 16777619u;
+    for (s = path; *s; s++)
+        hash = (hash ^ (unsigned char) *s) * 16777619u;
+    hash = (hash ^ (map ? 1 : 0)) * 16777619u;
+    for (s = map; s && *s; s++)
+        hash = (hash ^ (unsigned char) *s) * 16777619u;
+
+    return hash;
+}
+
+static struct file_cache_entry *
+find_entry(struct file_cache *cache, enum xkb_file_type type,
+           const char *path, const char *map, uint32_t hash)
+{
+    struct file_cache_entry *entry;
+
+    if (cache->num_buckets == 0)
+        return NULL;
+
+    for (entry = cache->buckets[hash & (cache->num_buckets - 1)];
+         entry;
+         entry = entry->next_in_bucket)
+        if (entry->hash == hash && entry->type == type &&
+            streq(entry->path, path) &&
+            (map ? entry->map && streq(entry->map, map) : !entry->map))
+            return entry;
+
+    return NULL;
+}
+
+static bool
+grow_buckets(struct file_cache *cache)
+{
+    struct file_cache_entry **buckets, *entry, *next;
+    unsigned int num_buckets = cache->num_buckets ? cache->num_buckets * 2 : 64;
+    unsigned int i;
+
+    buckets = calloc(num_buckets, sizeof(*buckets));
+    if (!buckets)
+        return false;
+
+    for (i = 0; i < cache->num_buckets; i++) {
+        for (entry = cache->buckets[i]; entry; entry = next) {
+            next = entry->next_in_bucket;
+            entry->next_in_bucket = buckets[entry->hash & (num_buckets - 1)];
+            buckets[entry->hash & (num_buckets - 1)] = entry;
+        }
+    }
+
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->num_buckets = num_buckets;
+    return true;
+}
+
+XkbFile *
+file_cache_lookup(struct file_cache *cache, enum xkb_file_type type,
+                  const char *path, const char *map,
+                  int64_t mtime, int64_t size)
+{
+    struct file_cache_entry *entry;
+    XkbFile *file = NULL;
+
+    cache_lock(cache);
+    entry = find_entry(cache, type, path, map, hash_key(type, path, map));
+    if (entry && entry->mtime == mtime && entry->size == size) {
+        file = entry->file;
+        refcnt_inc(&file->refcnt);
+    }
+    cache_unlock(cache);
+
+    return file;
+}
+
+XkbFile *
+file_cache_add(struct file_cache *cache, enum xkb_file_type type,
+               const char *path, const char *map,
+               int64_t mtime, int64_t size, XkbFile *file)
+{
+    struct file_cache_entry *entry;
+    uint32_t hash = hash_key(type, path, map);
+    XkbFile *ret = NULL;
+
+    cache_lock(cache);
+
+    entry = find_entry(cache, type, path, map, hash);
+    if (entry) {
+        if (entry->mtime == mtime && entry->size == size) {
+            /* Someone else parsed it meanwhile. */
+            FreeXkbFile(file);
+        }
+        else {
+            /* Whoever still uses the old map holds a reference to it. */
+            FreeXkbFile(entry->file);
+            entry->file = file;
+            entry->mtime = mtime;
+            entry->size = size;
+        }
+        ret = entry->file;
+        refcnt_inc(&ret->refcnt);
+        goto out;
+    }
+
+    if (cache->num_entries >= cache->num_buckets && !grow_buckets(cache))
+        goto out;
+
+    entry = calloc(1, sizeof(*entry));
+    if (!entry)
+        goto out;
+
+    entry->type = type;
+    entry->path = strdup(path);
+    entry->map = strdup_safe(map);
+    if (!entry->path || (map && !entry->map)) {
+        free(entry->path);
+        free(entry->map);
+        free(entry);
+        goto out;
+    }
+
+    entry->hash = hash;
+    entry->mtime = mtime;
+    entry->size = size;
+    entry->file = file;
+    entry->next_in_bucket = cache->buckets[hash & (cache->num_buckets - 1)];
+    cache->buckets[hash & (cache->num_buckets - 1)] = entry;
+    cache->num_entries++;
+    ret = file;
+    refcnt_inc(&ret->refcnt);
+
+out:
+    cache_unlock(cache);
+    return ret;
+}
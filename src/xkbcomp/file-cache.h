@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef XKBCOMP_FILE_CACHE_H
+#define XKBCOMP_FILE_CACHE_H
+
+#include "ast.h"
+
+/*
+ * The maps parsed from the include files, by file type, path and map name.
+ * The cached files are never modified, other than their reference count.
+ * The cache holds a reference to each, and hands out one to each caller,
+ * to be dropped with FreeXkbFile(); a map replaced after its file changed
+ * is freed once its last user is done with it.
+ */
+struct file_cache;
+
+struct file_cache *
+file_cache_new(bool thread_safe);
+
+void
+file_cache_free(struct file_cache *cache);
+
+/*
+ * Returns a reference to the cached map, if the file still has the given
+ * modification time and size.
+ */
+XkbFile *
+file_cache_lookup(struct file_cache *cache, enum xkb_file_type type,
+                  const char *path, const char *map,
+                  int64_t mtime, int64_t size);
+
+/*
+ * Add a map parsed from the file, and take over the reference to it.
+ * Returns a reference to the cached map, which may be another one if
+ * someone added it meanwhile, or NULL if it couldn't be added, in which
+ * case @file is left to the caller.
+ */
+XkbFile *
+file_cache_add(struct file_cache *cache, enum xkb_file_type type,
+               const char *path, const char *map,
+               int64_t mtime, int64_t size, XkbFile *file);
+
+#endif
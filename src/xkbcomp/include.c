@@ -50,8 +50,12 @@
 #include <errno.h>
 #include <limits.h>
 #include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "xkbcomp-priv.h"
+#include "ast-build.h"
+#include "file-cache.h"
 #include "include.h"
 
 /**
@@ -197,6 +201,85 @@ DirectoryForInclude(enum xkb_file_type type)
 
 /***====================================================================***/
 
+void
+RecordFileDeps(struct xkb_context *ctx, darray_file_dep *deps)
+{
+    *xkb_context_recorded_deps(ctx) = deps;
+}
+
+static void
+AppendFileDep(darray_file_dep *deps, const char *path,
+              int64_t mtime, int64_t size)
+{
+    struct file_dep *dep;
+    struct file_dep new;
+
+    /* The same files are usually included many times over. */
+    darray_foreach(dep, *deps)
+        if (streq(dep->path, path))
+            return;
+
+    new.path = strdup(path);
+    if (!new.path)
+        return;
+    new.mtime = mtime;
+    new.size = size;
+    darray_append(*deps, new);
+}
+
+void
+AppendFileDeps(darray_file_dep *to, const darray_file_dep *from)
+{
+    struct file_dep *dep;
+
+    darray_foreach(dep, *from)
+        AppendFileDep(to, dep->path, dep->mtime, dep->size);
+}
+
+void
+FreeFileDeps(darray_file_dep *deps)
+{
+    struct file_dep *dep;
+
+    darray_foreach(dep, *deps)
+        free(dep->path);
+    darray_free(*deps);
+}
+
+bool
+GetFileStamp(FILE *file, int64_t *mtime, int64_t *size)
+{
+    struct stat stat_buf;
+
+    if (!file || fstat(fileno(file), &stat_buf) != 0 ||
+        !S_ISREG(stat_buf.st_mode))
+        return false;
+
+    *mtime = (int64_t) stat_buf.st_mtim.tv_sec * 1000000000 +
+             stat_buf.st_mtim.tv_nsec;
+    *size = stat_buf.st_size;
+    return true;
+}
+
+static void
+RecordFileDep(struct xkb_context *ctx, const char *path, FILE *file)
+{
+    darray_file_dep *recorded_deps = *xkb_context_recorded_deps(ctx);
+    int64_t mtime, size;
+
+    if (!recorded_deps)
+        return;
+
+    if (!GetFileStamp(file, &mtime, &size)) {
+        AppendFileDep(recorded_deps, path, 0, -1);
+        return;
+    }
+
+    AppendFileDep(recorded_deps, path, mtime, size);
+}
+
+/***====================================================================***/
+
 /**
  * Search for the given file name in the include directories.
  *
@@ -230,6 +313,7 @@ FindFileInXkbPath(struct xkb_context *ctx, const char *name,
         }
 
         file = fopen(buf, "r");
+        RecordFileDep(ctx, buf, file);
         if (file)
             break;
     }
@@ -265,6 +349,46 @@ FindFileInXkbPath(struct xkb_context *ctx, const char *name,
     return file;
 }
 
+/*
+ * Parse the map from the file, or take it from the context's file cache if
+ * it was parsed before and the file didn't change since.  Cached maps are
+ * returned through XkbFileShare(), so that FreeXkbFile() only drops the
+ * reference the cache gave us.
+ */
+static XkbFile *
+ParseIncludeFile(struct xkb_context *ctx, FILE *file, const char *path,
+                 IncludeStmt *stmt, enum xkb_file_type file_type)
+{
+    struct file_cache *cache = xkb_context_get_file_cache(ctx);
+    XkbFile *cached = NULL;
+    XkbFile *xkb_file;
+    int64_t mtime, size;
+
+    if (!path || !GetFileStamp(file, &mtime, &size))
+        cache = NULL;
+
+    if (cache) {
+        cached = file_cache_lookup(cache, file_type, path, stmt->map,
+                                   mtime, size);
+        if (cached) {
+            log_dbg(ctx, "Using cached map \"%s\" of %s\n",
+                    stmt->map ? stmt->map : "(default)", path);
+            return XkbFileShare(ctx, cached);
+        }
+    }
+
+    xkb_file = XkbParseFile(ctx, file, stmt->file, stmt->map);
+    if (!xkb_file || !cache)
+        return xkb_file;
+
+    cached = file_cache_add(cache, file_type, path, stmt->map, mtime, size,
+                            xkb_file);
+    if (!cached)
+        return xkb_file;
+
+    return XkbFileShare(ctx, cached);
+}
+
 /**
  * Open the file given in the include statement and parse it's content.
  * If the statement defines a specific map to use, this map is returned in
@@ -286,12 +410,15 @@ ProcessIncludeFile(struct xkb_context *ctx,
 {
     FILE *file;
     XkbFile *xkb_file;
+    char *path = NULL;
 
-    file = FindFileInXkbPath(ctx, stmt->file, file_type, NULL);
+    file = FindFileInXkbPath(ctx, stmt->file, file_type,
+                             xkb_context_get_file_cache(ctx) ? &path : NULL);
     if (!file)
         return false;
 
-    xkb_file = XkbParseFile(ctx, file, stmt->file, stmt->map);
+    xkb_file = ParseIncludeFile(ctx, file, path, stmt, file_type);
+    free(path);
     if (!xkb_file) {
         if (stmt->map)
             log_err(ctx, "Couldn't process include statement for '%s(%s)'\n",
@@ -310,6 +437,7 @@ ProcessIncludeFile(struct xkb_context *ctx,
                 "Include file \"%s\" ignored\n",
                 xkb_file_type_to_string(file_type),
                 xkb_file_type_to_string(xkb_file->file_type), stmt->file);
+        FreeXkbFile(xkb_file);
         return false;
     }
 
@@ -27,6 +27,20 @@
 #ifndef XKBCOMP_INCLUDE_H
 #define XKBCOMP_INCLUDE_H
 
+/*
+ * A file which the result of a compilation depends on, as it was when it
+ * was looked up.  A size of -1 means the file didn't exist; a file
+ * created there later would be found before the ones in later include
+ * paths.
+ */
+struct file_dep {
+    char *path;
+    int64_t mtime;
+    int64_t size;
+};
+
+typedef darray(struct file_dep) darray_file_dep;
+
 bool
 ParseIncludeMap(char **str_inout, char **file_rtrn, char **map_rtrn,
                 char *nextop_rtrn, char **extra_data);
@@ -35,6 +49,31 @@ FILE *
 FindFileInXkbPath(struct xkb_context *ctx, const char *name,
                   enum xkb_file_type type, char **pathRtrn);
 
+/*
+ * The modification time in nanoseconds and size of the file, if open and
+ * a regular file; anything else may change without either showing it.
+ */
+bool
+GetFileStamp(FILE *file, int64_t *mtime, int64_t *size);
+
+/*
+ * Record every file looked up by FindFileInXkbPath() in the context into
+ * @deps, until called again with NULL.  For a thread-safe context, only
+ * the lookups from the calling thread are recorded.
+ */
+void
+RecordFileDeps(struct xkb_context *ctx, darray_file_dep *deps);
+
+/* Where RecordFileDeps() keeps @deps; implemented in context.c. */
+darray_file_dep **
+xkb_context_recorded_deps(struct xkb_context *ctx);
+
+void
+AppendFileDeps(darray_file_dep *to, const darray_file_dep *from);
+
+void
+FreeFileDeps(darray_file_dep *deps);
+
 bool
 ProcessIncludeFile(struct xkb_context *ctx, IncludeStmt *stmt,
                    enum xkb_file_type file_type, XkbFile **file_rtrn,
@@ -98,9 +98,10 @@
  *      darray(struct xkb_indicator_map) indicators;
  * Further, the array of keys:
  *      struct xkb_key *keys;
- * had been resized to its final size (i.e. all of the xkb_key objects are
- * referable by their keycode). However the objects themselves do not
- * contain any useful information besides the key name at this point.
+ * had been allocated with one key for each named keycode, in keycode
+ * order, and indexed so that XkbKey() finds them. However the objects
+ * themselves do not contain any useful information besides the key name
+ * at this point.
  */
 
 typedef struct {
@@ -116,6 +117,17 @@ typedef struct {
     xkb_atom_t name;
 } KeyNameInfo;
 
+/*
+ * The key names of XKB_KEY_PAGE_SIZE consecutive keycodes, starting from
+ * page_idx * XKB_KEY_PAGE_SIZE. They are only allocated once a keycode in
+ * them is named, so that a few high keycodes don't take a name for every
+ * keycode below them.
+ */
+typedef struct {
+    xkb_keycode_t page_idx;
+    KeyNameInfo names[XKB_KEY_PAGE_SIZE];
+} KeyNamePage;
+
 typedef struct {
     enum merge_mode merge;
     unsigned file_id;
@@ -131,9 +143,14 @@ typedef struct {
 
     xkb_keycode_t min_key_code;
     xkb_keycode_t max_key_code;
-    darray(KeyNameInfo) key_names;
+    /* The pages which have names, sorted by page_idx; see GetKeyName(). */
+    darray(KeyNamePage *) key_names;
+    /* The keycode of each name in key_names. */
+    struct atom_map keycodes_by_name;
     darray(IndicatorNameInfo) indicator_names;
     darray(AliasInfo) aliases;
+    /* The index in aliases of each alias name. */
+    struct atom_map aliases_by_name;
 
     struct xkb_context *ctx;
 } KeyNamesInfo;
@@ -238,9 +255,15 @@ AddIndicatorName(KeyNamesInfo *info, enum merge_mode merge,
 static void
 ClearKeyNamesInfo(KeyNamesInfo *info)
 {
+    KeyNamePage **page;
+
     free(info->name);
+    darray_foreach(page, info->key_names)
+        free(*page);
     darray_free(info->key_names);
+    atom_map_free(&info->keycodes_by_name);
     darray_free(info->aliases);
+    atom_map_free(&info->aliases_by_name);
     darray_free(info->indicator_names);
 }
 
@@ -255,16 +278,60 @@ InitKeyNamesInfo(KeyNamesInfo *info, struct xkb_context *ctx,
     info->min_key_code = XKB_KEYCODE_MAX;
 }
 
+/*
+ * Returns the name of the keycode, or NULL if it has none. If @create is
+ * set, the name is allocated instead if needed, and only NULL is returned
+ * if that fails.
+ */
+static KeyNameInfo *
+GetKeyName(KeyNamesInfo *info, xkb_keycode_t kc, bool create)
+{
+    xkb_keycode_t page_idx = kc >> XKB_KEY_PAGE_BITS;
+    unsigned int lo = 0, hi = darray_size(info->key_names), mid;
+    KeyNamePage *page;
+
+    /* The keycodes are mostly named in order, so try the last page first. */
+    if (hi > 0 && darray_item(info->key_names, hi - 1)->page_idx < page_idx)
+        lo = hi;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        page = darray_item(info->key_names, mid);
+        if (page->page_idx == page_idx)
+            return &page->names[kc & (XKB_KEY_PAGE_SIZE - 1)];
+        if (page->page_idx < page_idx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (!create)
+        return NULL;
+
+    page = calloc(1, sizeof(*page));
+    if (!page)
+        return NULL;
+    page->page_idx = page_idx;
+
+    /* Insert it at lo, to keep the pages sorted. */
+    darray_append(info->key_names, page);
+    memmove(darray_mem(info->key_names, lo + 1),
+            darray_mem(info->key_names, lo),
+            (darray_size(info->key_names) - lo - 1) * sizeof(page));
+    darray_item(info->key_names, lo) = page;
+
+    return &page->names[kc & (XKB_KEY_PAGE_SIZE - 1)];
+}
+
 static xkb_keycode_t
 FindKeyByName(KeyNamesInfo * info, xkb_atom_t name)
 {
-    xkb_keycode_t i;
+    unsigned int kc;
 
-    for (i = info->min_key_code; i <= info->max_key_code; i++)
-        if (darray_item(info->key_names, i).name == name)
-            return i;
+    if (!atom_map_lookup(&info->keycodes_by_name, name, &kc))
+        return XKB_KEYCODE_INVALID;
 
-    return XKB_KEYCODE_INVALID;
+    return kc;
 }
 
 static bool
@@ -275,14 +342,15 @@ AddKeyName(KeyNamesInfo *info, xkb_keycode_t kc, xkb_atom_t name,
     xkb_keycode_t old;
     int verbosity = xkb_context_get_log_verbosity(info->ctx);
 
-    if (kc >= darray_size(info->key_names))
-        darray_resize0(info->key_names, kc + 1);
+    namei = GetKeyName(info, kc, true);
+    if (!namei) {
+        log_err(info->ctx, "Couldn't allocate key name for keycode %d\n", kc);
+        return false;
+    }
 
     info->min_key_code = MIN(info->min_key_code, kc);
     info->max_key_code = MAX(info->max_key_code, kc);
 
-    namei = &darray_item(info->key_names, kc);
-
     report = report && ((verbosity > 0 && file_id == namei->file_id) ||
                         verbosity > 7);
 
@@ -310,6 +378,7 @@ AddKeyName(KeyNamesInfo *info, xkb_keycode_t kc, xkb_atom_t name,
                 log_warn(info->ctx,
                          "Multiple names for keycode %d; "
                          "Using %s, ignoring %s\n", kc, kname, lname);
+            atom_map_remove(&info->keycodes_by_name, namei->name);
             namei->name = 0;
             namei->file_id = 0;
         }
@@ -320,8 +389,10 @@ AddKeyName(KeyNamesInfo *info, xkb_keycode_t kc, xkb_atom_t name,
         const char *kname = KeyNameText(info->ctx, name);
 
         if (merge == MERGE_OVERRIDE) {
-            darray_item(info->key_names, old).name = 0;
-            darray_item(info->key_names, old).file_id = 0;
+            KeyNameInfo *oldi = GetKeyName(info, old, false);
+
+            oldi->name = 0;
+            oldi->file_id = 0;
             if (report)
                 log_warn(info->ctx,
                          "Key name %s assigned to multiple keys; "
@@ -336,6 +407,11 @@ AddKeyName(KeyNamesInfo *info, xkb_keycode_t kc, xkb_atom_t name,
         }
     }
 
+    if (!atom_map_insert(&info->keycodes_by_name, name, kc)) {
+        log_err(info->ctx, "Couldn't allocate key name for keycode %d\n", kc);
+        return false;
+    }
+
     namei->name = name;
     namei->file_id = file_id;
     return true;
@@ -359,6 +435,9 @@ MergeAliases(KeyNamesInfo *into, KeyNamesInfo *from, enum merge_mode merge)
     if (darray_empty(into->aliases)) {
         into->aliases = from->aliases;
         darray_init(from->aliases);
+        atom_map_free(&into->aliases_by_name);
+        into->aliases_by_name = from->aliases_by_name;
+        memset(&from->aliases_by_name, 0, sizeof(from->aliases_by_name));
         return true;
     }
 
@@ -380,7 +459,8 @@ static void
 MergeIncludedKeycodes(KeyNamesInfo *into, KeyNamesInfo *from,
                       enum merge_mode merge)
 {
-    xkb_keycode_t i;
+    KeyNamePage **page;
+    unsigned int i;
     xkb_led_index_t idx;
     IndicatorNameInfo *led;
 
@@ -394,16 +474,16 @@ MergeIncludedKeycodes(KeyNamesInfo *into, KeyNamesInfo *from,
         from->name = NULL;
     }
 
-    if (darray_size(into->key_names) < darray_size(from->key_names))
-        darray_resize0(into->key_names, darray_size(from->key_names));
-
-    for (i = from->min_key_code; i <= from->max_key_code; i++) {
-        xkb_atom_t name = darray_item(from->key_names, i).name;
-        if (name == XKB_ATOM_NONE)
-            continue;
+    darray_foreach(page, from->key_names) {
+        for (i = 0; i < XKB_KEY_PAGE_SIZE; i++) {
+            xkb_atom_t name = (*page)->names[i].name;
+            if (name == XKB_ATOM_NONE)
+                continue;
 
-        if (!AddKeyName(into, i, name, merge, from->file_id, false))
-            into->errorCount++;
+            if (!AddKeyName(into, (*page)->page_idx * XKB_KEY_PAGE_SIZE + i,
+                            name, merge, from->file_id, false))
+                into->errorCount++;
+        }
     }
 
     darray_enumerate(idx, led, from->indicator_names) {
@@ -432,8 +512,12 @@ HandleIncludeKeycodes(KeyNamesInfo *info, IncludeStmt *stmt)
     InitKeyNamesInfo(&included, info->ctx, info->file_id);
     if (stmt->stmt) {
         free(included.name);
-        included.name = stmt->stmt;
-        stmt->stmt = NULL;
+        included.name = strdup(stmt->stmt);
+        if (!included.name) {
+            info->errorCount += 10;
+            ClearKeyNamesInfo(&included);
+            return false;
+        }
     }
 
     for (; stmt; stmt = stmt->next_incl) {
@@ -519,17 +603,23 @@ static int
 HandleAliasDef(KeyNamesInfo *info, KeyAliasDef *def, enum merge_mode merge,
                unsigned file_id)
 {
-    AliasInfo *alias, new;
+    AliasInfo new;
+    unsigned int idx;
 
-    darray_foreach(alias, info->aliases) {
-        if (alias->alias == def->alias) {
-            InitAliasInfo(&new, merge, file_id, def->alias, def->real);
-            HandleAliasCollision(info, alias, &new);
-            return true;
-        }
+    InitAliasInfo(&new, merge, file_id, def->alias, def->real);
+
+    if (atom_map_lookup(&info->aliases_by_name, def->alias, &idx)) {
+        HandleAliasCollision(info, &darray_item(info->aliases, idx), &new);
+        return true;
+    }
+
+    if (!atom_map_insert(&info->aliases_by_name, def->alias,
+                         darray_size(info->aliases))) {
+        log_err(info->ctx, "Couldn't allocate alias %s\n",
+                KeyNameText(info->ctx, def->alias));
+        return false;
     }
 
-    InitAliasInfo(&new, merge, file_id, def->alias, def->real);
     darray_append(info->aliases, new);
     return true;
 }
@@ -635,12 +725,13 @@ HandleKeycodesFile(KeyNamesInfo *info, XkbFile *file, enum merge_mode merge)
     }
 }
 
-static void
+static bool
 ApplyAliases(KeyNamesInfo *info, struct xkb_keymap *keymap)
 {
     struct xkb_key *key;
     struct xkb_key_alias *a, new;
     AliasInfo *alias;
+    unsigned int idx;
 
     darray_foreach(alias, info->aliases) {
         /* Check that ->real is a key. */
@@ -665,49 +756,70 @@ ApplyAliases(KeyNamesInfo *info, struct xkb_keymap *keymap)
         }
 
         /* Check that ->alias in not already an alias, and if so handle it. */
-        darray_foreach(a, keymap->key_aliases) {
+        if (atom_map_lookup(&keymap->key_aliases_index, alias->alias, &idx)) {
             AliasInfo old_alias;
 
-            if (a->alias != alias->alias)
-                continue;
-
+            a = &darray_item(keymap->key_aliases, idx);
             InitAliasInfo(&old_alias, MERGE_AUGMENT, 0, a->alias, a->real);
             HandleAliasCollision(info, &old_alias, alias);
             a->alias = old_alias.alias;
             a->real = old_alias.real;
-            alias->alias = 0;
-        }
-        if (alias->alias == 0)
             continue;
+        }
 
         /* Add the alias. */
         new.alias = alias->alias;
         new.real = alias->real;
+        if (!atom_map_insert(&keymap->key_aliases_index, new.alias,
+                             darray_size(keymap->key_aliases)))
+            return false;
         darray_append(keymap->key_aliases, new);
     }
 
     darray_free(info->aliases);
+    return true;
 }
 
 static bool
 CopyKeyNamesToKeymap(struct xkb_keymap *keymap, KeyNamesInfo *info)
 {
-    xkb_keycode_t kc;
+    KeyNamePage **page;
+    unsigned int i, num_keys = 0;
     xkb_led_index_t idx;
     IndicatorNameInfo *led;
 
-    keymap->keys = calloc(info->max_key_code + 1, sizeof(*keymap->keys));
-    if (!keymap->keys)
+    darray_foreach(page, info->key_names)
+        for (i = 0; i < XKB_KEY_PAGE_SIZE; i++)
+            if ((*page)->names[i].name != XKB_ATOM_NONE)
+                num_keys++;
+
+    keymap->keys = calloc(MAX(num_keys, 1), sizeof(*keymap->keys));
+    keymap->key_aux = calloc(MAX(num_keys, 1), sizeof(*keymap->key_aux));
+    if (!keymap->keys || !keymap->key_aux)
         return false;
 
     keymap->min_key_code = info->min_key_code;
     keymap->max_key_code = info->max_key_code;
 
-    for (kc = info->min_key_code; kc <= info->max_key_code; kc++) {
-        keymap->keys[kc].keycode = kc;
-        keymap->keys[kc].name = darray_item(info->key_names, kc).name;
+    darray_foreach(page, info->key_names) {
+        for (i = 0; i < XKB_KEY_PAGE_SIZE; i++) {
+            struct xkb_key_aux *aux = &keymap->key_aux[keymap->num_keys];
+
+            if ((*page)->names[i].name == XKB_ATOM_NONE)
+                continue;
+
+            aux->keycode = (*page)->page_idx * XKB_KEY_PAGE_SIZE + i;
+            aux->name = (*page)->names[i].name;
+            if (!atom_map_insert(&keymap->key_names_index, aux->name,
+                                 keymap->num_keys))
+                return false;
+            keymap->num_keys++;
+        }
     }
 
+    if (!keymap_index_keys(keymap))
+        return false;
+
     keymap->keycodes_section_name = strdup_safe(info->name);
 
     darray_resize0(keymap->indicators, darray_size(info->indicator_names));
@@ -718,9 +830,7 @@ CopyKeyNamesToKeymap(struct xkb_keymap *keymap, KeyNamesInfo *info)
         darray_item(keymap->indicators, idx).name = led->name;
     }
 
-    ApplyAliases(info, keymap);
-
-    return true;
+    return ApplyAliases(info, keymap);
 }
 
 bool
@@ -749,11 +859,10 @@ err_info:
 struct xkb_key *
 FindNamedKey(struct xkb_keymap *keymap, xkb_atom_t name, bool use_aliases)
 {
-    struct xkb_key *key;
+    unsigned int idx;
 
-    xkb_foreach_key(key, keymap)
-        if (key->name == name)
-            return key;
+    if (atom_map_lookup(&keymap->key_names_index, name, &idx))
+        return &keymap->keys[idx];
 
     if (use_aliases) {
         xkb_atom_t new_name;
@@ -768,14 +877,11 @@ bool
 FindKeyNameForAlias(struct xkb_keymap *keymap, xkb_atom_t name,
                     xkb_atom_t *real_name)
 {
-    struct xkb_key_alias *a;
+    unsigned int idx;
 
-    darray_foreach(a, keymap->key_aliases) {
-        if (name == a->alias) {
-            *real_name = a->real;
-            return true;
-        }
-    }
+    if (!atom_map_lookup(&keymap->key_aliases_index, name, &idx))
+        return false;
 
-    return false;
+    *real_name = darray_item(keymap->key_aliases, idx).real;
+    return true;
 }
@@ -47,13 +47,17 @@ static void
 UpdateActionMods(struct xkb_keymap *keymap, union xkb_action *act,
                  xkb_mod_mask_t modmap)
 {
+    struct xkb_mods mods;
+
     switch (act->type) {
     case ACTION_TYPE_MOD_SET:
     case ACTION_TYPE_MOD_LATCH:
     case ACTION_TYPE_MOD_LOCK:
         if (act->mods.flags & ACTION_MODS_LOOKUP_MODMAP)
-            act->mods.mods.mods = modmap;
-        ComputeEffectiveMask(keymap, &act->mods.mods);
+            act->mods.mods = modmap;
+        mods.mods = act->mods.mods;
+        ComputeEffectiveMask(keymap, &mods);
+        act->mods.mask = mods.mask;
         break;
     default:
         break;
@@ -69,90 +73,216 @@ static const struct xkb_sym_interpret default_interpret = {
     .action = { .type = ACTION_TYPE_NONE },
 };
 
+/*
+ * The interprets which may apply to each keysym, so that finding the one
+ * for a level doesn't go through all of them.  compat.c sets up the
+ * sym_interprets array with the interprets for a keysym first and the
+ * XKB_KEY_NoSymbol ones last, each from the most specific to the least
+ * specific.  So the chain for a keysym is its own interprets, followed by
+ * the NoSymbol ones.
+ */
+struct interp_chain {
+    xkb_keysym_t sym;
+    unsigned int first;
+    unsigned int num;
+};
+
+struct interp_index {
+    /* The interprets, by keysym, each keysym's in their original order. */
+    const struct xkb_sym_interpret **interps;
+    /* Open addressing, by keysym; a power of 2, or 0 if empty. */
+    struct interp_chain *chains;
+    unsigned int num_chains;
+    struct interp_chain nosym_chain;
+};
+
+static unsigned int
+hash_keysym(xkb_keysym_t sym)
+{
+    return sym * 2654435761u;
+}
+
+static int
+cmp_interp_ptr(const void *a, const void *b)
+{
+    const struct xkb_sym_interpret *ia = *(const struct xkb_sym_interpret **) a;
+    const struct xkb_sym_interpret *ib = *(const struct xkb_sym_interpret **) b;
+
+    if (ia->sym != ib->sym)
+        return (ia->sym > ib->sym) - (ia->sym < ib->sym);
+    return (ia > ib) - (ia < ib);
+}
+
+static bool
+InterpIndexInit(struct interp_index *index, struct xkb_keymap *keymap)
+{
+    unsigned int i, j, num_interps, num_syms = 0;
+    struct interp_chain chain;
+
+    memset(index, 0, sizeof(*index));
+
+    num_interps = darray_size(keymap->sym_interprets);
+    if (num_interps == 0)
+        return true;
+
+    index->interps = calloc(num_interps, sizeof(*index->interps));
+    if (!index->interps)
+        return false;
+
+    for (i = 0; i < num_interps; i++)
+        index->interps[i] = &darray_item(keymap->sym_interprets, i);
+    qsort(index->interps, num_interps, sizeof(*index->interps),
+          cmp_interp_ptr);
+
+    for (i = 0; i < num_interps; i++)
+        if (i == 0 || index->interps[i]->sym != index->interps[i - 1]->sym)
+            num_syms++;
+
+    index->num_chains = 8;
+    while (index->num_chains < num_syms * 2)
+        index->num_chains *= 2;
+    index->chains = calloc(index->num_chains, sizeof(*index->chains));
+    if (!index->chains)
+        return false;
+
+    for (i = 0; i < num_interps; i += chain.num) {
+        chain.sym = index->interps[i]->sym;
+        chain.first = i;
+        chain.num = 1;
+        while (i + chain.num < num_interps &&
+               index->interps[i + chain.num]->sym == chain.sym)
+            chain.num++;
+
+        if (chain.sym == XKB_KEY_NoSymbol) {
+            index->nosym_chain = chain;
+            continue;
+        }
+
+        for (j = hash_keysym(chain.sym) & (index->num_chains - 1);
+             index->chains[j].num != 0;
+             j = (j + 1) & (index->num_chains - 1));
+        index->chains[j] = chain;
+    }
+
+    return true;
+}
+
+static void
+InterpIndexFree(struct interp_index *index)
+{
+    free(index->interps);
+    free(index->chains);
+}
+
+static const struct interp_chain *
+InterpIndexFind(const struct interp_index *index, xkb_keysym_t sym)
+{
+    unsigned int i;
+
+    if (index->num_chains == 0)
+        return NULL;
+
+    for (i = hash_keysym(sym) & (index->num_chains - 1);
+         index->chains[i].num != 0;
+         i = (i + 1) & (index->num_chains - 1))
+        if (index->chains[i].sym == sym)
+            return &index->chains[i];
+
+    return NULL;
+}
+
+static bool
+InterpMatchesMods(const struct xkb_sym_interpret *interp,
+                  xkb_level_index_t level, xkb_mod_mask_t modmap)
+{
+    xkb_mod_mask_t mods;
+
+    if (interp->level_one_only && level != 0)
+        mods = 0;
+    else
+        mods = modmap;
+
+    switch (interp->match) {
+    case MATCH_NONE:
+        return !(interp->mods & mods);
+    case MATCH_ANY_OR_NONE:
+        return (!mods || (interp->mods & mods));
+    case MATCH_ANY:
+        return !!(interp->mods & mods);
+    case MATCH_ALL:
+        return ((interp->mods & mods) == interp->mods);
+    case MATCH_EXACTLY:
+        return (interp->mods == mods);
+    }
+
+    return false;
+}
+
 /**
  * Find an interpretation which applies to this particular level, either by
  * finding an exact match for the symbol and modifier combination, or a
  * generic XKB_KEY_NoSymbol match.
  */
 static const struct xkb_sym_interpret *
-FindInterpForKey(struct xkb_keymap *keymap, const struct xkb_key *key,
-                 xkb_layout_index_t group, xkb_level_index_t level)
+FindInterpForKey(struct xkb_keymap *keymap, const struct interp_index *index,
+                 const struct xkb_key *key, xkb_layout_index_t group,
+                 xkb_level_index_t level)
 {
-    const struct xkb_sym_interpret *interp;
+    const struct xkb_key_aux *aux = XkbKeyAux(keymap, key);
+    const struct interp_chain *chain;
     const xkb_keysym_t *syms;
+    unsigned int i;
     int num_syms;
 
-    num_syms = xkb_keymap_key_get_syms_by_level(keymap, key->keycode, group,
+    num_syms = xkb_keymap_key_get_syms_by_level(keymap, aux->keycode, group,
                                                 level, &syms);
     if (num_syms == 0)
         return NULL;
 
     /*
      * There may be multiple matchings interprets; we should always return
-     * the most specific. Here we rely on compat.c to set up the
-     * sym_interprets array from the most specific to the least specific,
-     * such that when we find a match we return immediately.
+     * the most specific, which is the first one in the chains.
      */
-    darray_foreach(interp, keymap->sym_interprets) {
-        xkb_mod_mask_t mods;
-        bool found;
-
-        if ((num_syms > 1 || interp->sym != syms[0]) &&
-            interp->sym != XKB_KEY_NoSymbol)
-            continue;
-
-        if (interp->level_one_only && level != 0)
-            mods = 0;
-        else
-            mods = key->modmap;
-
-        switch (interp->match) {
-        case MATCH_NONE:
-            found = !(interp->mods & mods);
-            break;
-        case MATCH_ANY_OR_NONE:
-            found = (!mods || (interp->mods & mods));
-            break;
-        case MATCH_ANY:
-            found = !!(interp->mods & mods);
-            break;
-        case MATCH_ALL:
-            found = ((interp->mods & mods) == interp->mods);
-            break;
-        case MATCH_EXACTLY:
-            found = (interp->mods == mods);
-            break;
-        }
-
-        if (found)
-            return interp;
+    if (num_syms == 1) {
+        chain = InterpIndexFind(index, syms[0]);
+        if (chain)
+            for (i = chain->first; i < chain->first + chain->num; i++)
+                if (InterpMatchesMods(index->interps[i], level, aux->modmap))
+                    return index->interps[i];
     }
 
+    chain = &index->nosym_chain;
+    for (i = chain->first; i < chain->first + chain->num; i++)
+        if (InterpMatchesMods(index->interps[i], level, aux->modmap))
+            return index->interps[i];
+
     return &default_interpret;
 }
 
 static bool
-ApplyInterpsToKey(struct xkb_keymap *keymap, struct xkb_key *key)
+ApplyInterpsToKey(struct xkb_keymap *keymap, const struct interp_index *index,
+                  struct xkb_key *key)
 {
+    struct xkb_key_aux *aux = XkbKeyAux(keymap, key);
     xkb_mod_mask_t vmodmap = 0;
     xkb_layout_index_t group;
     xkb_level_index_t level;
 
     /* If we've been told not to bind interps to this key, then don't. */
-    if (key->explicit & EXPLICIT_INTERP)
+    if (aux->explicit & EXPLICIT_INTERP)
         return true;
 
     for (group = 0; group < key->num_groups; group++) {
         for (level = 0; level < XkbKeyGroupWidth(key, group); level++) {
             const struct xkb_sym_interpret *interp;
 
-            interp = FindInterpForKey(keymap, key, group, level);
+            interp = FindInterpForKey(keymap, index, key, group, level);
             if (!interp)
                 continue;
 
             /* Infer default key behaviours from the base level. */
             if (group == 0 && level == 0)
-                if (!(key->explicit & EXPLICIT_REPEAT) && interp->repeat)
+                if (!(aux->explicit & EXPLICIT_REPEAT) && interp->repeat)
                     key->repeats = true;
 
             if ((group == 0 && level == 0) || !interp->level_one_only)
@@ -164,8 +294,62 @@ ApplyInterpsToKey(struct xkb_keymap *keymap, struct xkb_key *key)
         }
     }
 
-    if (!(key->explicit & EXPLICIT_VMODMAP))
-        key->vmodmap = vmodmap;
+    if (!(aux->explicit & EXPLICIT_VMODMAP))
+        aux->vmodmap = vmodmap;
+
+    return true;
+}
+
+/**
+ * Fill in the lookup table of a key type, such that finding the level for
+ * a modifier state doesn't require going through the type's map entries.
+ * Must be called after the effective masks of the type are computed.
+ */
+static bool
+ComputeKeyTypeLookup(struct xkb_key_type *type)
+{
+    xkb_mod_index_t bits[8];
+    unsigned int num_bits = 0;
+    unsigned int i, j, idx;
+    xkb_mod_mask_t mods;
+
+    for (i = 0; i < ARRAY_SIZE(bits); i++)
+        if (type->mods.mask & (1 << i))
+            bits[num_bits++] = i;
+
+    /* Compress the bits of each nibble of the mask to consecutive bits. */
+    for (i = 0; i < 16; i++) {
+        type->lookup_index_lo[i] = type->lookup_index_hi[i] = 0;
+        for (j = 0; j < num_bits; j++) {
+            if (bits[j] < 4 && (i & (1 << bits[j])))
+                type->lookup_index_lo[i] |= (1 << j);
+            if (bits[j] >= 4 && (i & (1 << (bits[j] - 4))))
+                type->lookup_index_hi[i] |= (1 << j);
+        }
+    }
+
+    type->lookup = calloc(1 << num_bits, sizeof(*type->lookup));
+    if (!type->lookup)
+        return false;
+
+    for (idx = 0; idx < (1u << num_bits); idx++) {
+        mods = 0;
+        for (j = 0; j < num_bits; j++)
+            if (idx & (1 << j))
+                mods |= (1 << bits[j]);
+
+        /* The first matching entry wins; no match means level 0. */
+        for (i = 0; i < type->num_entries; i++) {
+            const struct xkb_kt_map_entry *entry = &type->map[i];
+
+            if (entry->mods.mask == mods) {
+                type->lookup[idx].level = entry->level;
+                type->lookup[idx].consumed =
+                    entry->mods.mask & ~entry->preserve.mask;
+                break;
+            }
+        }
+    }
 
     return true;
 }
@@ -183,18 +367,29 @@ UpdateDerivedKeymapFields(struct xkb_keymap *keymap)
     struct xkb_indicator_map *im;
     unsigned int i, j;
     struct xkb_key *key;
+    struct interp_index index;
 
     /* Find all the interprets for the key and bind them to actions,
      * which will also update the vmodmap. */
-    xkb_foreach_key(key, keymap)
-        if (!ApplyInterpsToKey(keymap, key))
+    if (!InterpIndexInit(&index, keymap)) {
+        InterpIndexFree(&index);
+        return false;
+    }
+
+    xkb_foreach_key(key, keymap) {
+        if (!ApplyInterpsToKey(keymap, &index, key)) {
+            InterpIndexFree(&index);
             return false;
+        }
+    }
+
+    InterpIndexFree(&index);
 
     /* Update keymap->mods, the virtual -> real mod mapping. */
     xkb_foreach_key(key, keymap)
         darray_enumerate(i, mod, keymap->mods)
-            if (key->vmodmap & (1 << i))
-                mod->mapping |= key->modmap;
+            if (XkbKeyAux(keymap, key)->vmodmap & (1 << i))
+                mod->mapping |= XkbKeyAux(keymap, key)->modmap;
 
     /* Now update the level masks for all the types to reflect the vmods. */
     for (i = 0; i < keymap->num_types; i++) {
@@ -204,6 +399,9 @@ UpdateDerivedKeymapFields(struct xkb_keymap *keymap)
             ComputeEffectiveMask(keymap, &keymap->types[i].map[j].mods);
             ComputeEffectiveMask(keymap, &keymap->types[i].map[j].preserve);
         }
+
+        if (!ComputeKeyTypeLookup(&keymap->types[i]))
+            return false;
     }
 
     /* Update action modifiers. */
@@ -211,12 +409,20 @@ UpdateDerivedKeymapFields(struct xkb_keymap *keymap)
         for (i = 0; i < key->num_groups; i++)
             for (j = 0; j < XkbKeyGroupWidth(key, i); j++)
                 UpdateActionMods(keymap, &key->groups[i].levels[j].action,
-                                 key->modmap);
+                                 XkbKeyAux(keymap, key)->modmap);
 
-    /* Update vmod -> indicator maps. */
-    darray_foreach(im, keymap->indicators)
+    /* Update vmod -> indicator maps, and find what they depend on. */
+    darray_enumerate(i, im, keymap->indicators) {
         ComputeEffectiveMask(keymap, &im->mods);
 
+        if (im->mods.mask)
+            keymap->indicator_deps |= im->which_mods;
+        if (im->groups)
+            keymap->indicator_deps |= im->which_groups;
+        if (im->ctrls & keymap->enabled_ctrls)
+            keymap->ctrl_indicators |= (1 << i);
+    }
+
     /* Find maximum number of groups out of all keys in the keymap. */
     xkb_foreach_key(key, keymap)
         keymap->num_groups = MAX(keymap->num_groups, key->num_groups);
@@ -261,13 +467,10 @@ bool
 CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
 {
     bool ok;
-    const char *main_name;
     XkbFile *files[LAST_KEYMAP_FILE_TYPE + 1] = { NULL };
     enum xkb_file_type type;
     struct xkb_context *ctx = keymap->ctx;
 
-    main_name = file->name ? file->name : "(unnamed)";
-
     /* Collect section files and check for duplicates. */
     for (file = (XkbFile *) file->defs; file;
          file = (XkbFile *) file->common.next) {
@@ -286,11 +489,6 @@ CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
             continue;
         }
 
-        if (!file->topName) {
-            free(file->topName);
-            file->topName = strdup(main_name);
-        }
-
         files[file->file_type] = file;
     }
 
@@ -329,5 +527,12 @@ CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
         }
     }
 
-    return UpdateDerivedKeymapFields(keymap);
+    if (!UpdateDerivedKeymapFields(keymap))
+        return false;
+
+    atom_map_free(&keymap->key_names_index);
+    atom_map_free(&keymap->key_aliases_index);
+
+    keymap_pack(keymap);
+    return true;
 }
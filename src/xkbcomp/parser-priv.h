@@ -27,7 +27,7 @@
 #ifndef XKBCOMP_PARSER_PRIV_H
 #define XKBCOMP_PARSER_PRIV_H
 
-struct scanner_extra;
+struct scanner;
 struct parser_param;
 
 #pragma GCC diagnostic ignored "-Wredundant-decls"
@@ -31,6 +31,7 @@
 
 struct parser_param {
     struct xkb_context *ctx;
+    struct ast_arena *arena;
     void *scanner;
     XkbFile *rtrn;
     bool more_maps;
@@ -151,16 +152,16 @@ _xkbcommon_error(struct YYLTYPE *loc, struct parser_param *param, const char *ms
 }
 
 %type <num>     INTEGER FLOAT
-%type <str>     IDENT STRING
-%type <sval>    KEYNAME
+%type <str>     STRING
+%type <sval>    IDENT KEYNAME
 %type <num>     KeyCode
 %type <ival>    Number Integer Float SignedNumber
 %type <merge>   MergeMode OptMergeMode
 %type <file_type> XkbCompositeType FileType
 %type <uval>    DoodadType
 %type <mapFlags> Flag Flags OptFlags
-%type <str>     MapName OptMapName KeySym
-%type <sval>    FieldSpec Ident Element String
+%type <str>     MapName OptMapName
+%type <sval>    FieldSpec Ident Element String KeySym
 %type <any>     DeclList Decl
 %type <expr>    OptExprList ExprList Expr Term Lhs Terminal ArrayInit KeySyms
 %type <expr>    OptKeySymList KeySymList Action ActionList Coord CoordList
@@ -181,6 +182,8 @@ _xkbcommon_error(struct YYLTYPE *loc, struct parser_param *param, const char *ms
 %type <file>    XkbFile XkbMapConfigList XkbMapConfig
 %type <file>    XkbCompositeMap
 
+%destructor { free($$); } <str>
+
 %%
 
 /*
@@ -206,7 +209,7 @@ XkbFile         :       XkbCompositeMap
 XkbCompositeMap :       OptFlags XkbCompositeType OptMapName OBRACE
                             XkbMapConfigList
                         CBRACE SEMI
-                        { $$ = XkbFileCreate(param->ctx, $2, $3, &$5->common, $1); }
+                        { $$ = XkbFileCreate(param->ctx, param->arena, $2, $3, &$5->common, $1); }
                 ;
 
 XkbCompositeType:       XKB_KEYMAP      { $$ = FILE_TYPE_KEYMAP; }
@@ -231,11 +234,10 @@ XkbMapConfig    :       OptFlags FileType OptMapName OBRACE
                         {
                             if ($2 == FILE_TYPE_GEOMETRY) {
                                 free($3);
-                                FreeStmt($5);
                                 $$ = NULL;
                             }
                             else {
-                                $$ = XkbFileCreate(param->ctx, $2, $3, $5, $1);
+                                $$ = XkbFileCreate(param->ctx, param->arena, $2, $3, $5, $1);
                             }
                         }
                 ;
@@ -325,30 +327,30 @@ Decl            :       OptMergeMode VarDecl
                             $2->merge = $1;
                             $$ = &$2->common;
                         }
-                |       OptMergeMode ShapeDecl          { }
-                |       OptMergeMode SectionDecl        { }
-                |       OptMergeMode DoodadDecl         { }
+                |       OptMergeMode ShapeDecl          { $$ = NULL; }
+                |       OptMergeMode SectionDecl        { $$ = NULL; }
+                |       OptMergeMode DoodadDecl         { $$ = NULL; }
                 |       MergeMode STRING
                         {
-                            $$ = &IncludeCreate(param->ctx, $2, $1)->common;
+                            $$ = &IncludeCreate(param->ctx, param->arena, $2, $1)->common;
                             free($2);
                         }
                 ;
 
 VarDecl         :       Lhs EQUALS Expr SEMI
-                        { $$ = VarCreate($1, $3); }
+                        { $$ = VarCreate(param->arena, $1, $3); }
                 |       Ident SEMI
-                        { $$ = BoolVarCreate($1, 1); }
+                        { $$ = BoolVarCreate(param->arena, $1, 1); }
                 |       EXCLAM Ident SEMI
-                        { $$ = BoolVarCreate($2, 0); }
+                        { $$ = BoolVarCreate(param->arena, $2, 0); }
                 ;
 
 KeyNameDecl     :       KEYNAME EQUALS KeyCode SEMI
-                        { $$ = KeycodeCreate($1, $3); }
+                        { $$ = KeycodeCreate(param->arena, $1, $3); }
                 ;
 
 KeyAliasDecl    :       ALIAS KEYNAME EQUALS KEYNAME SEMI
-                        { $$ = KeyAliasCreate($2, $4); }
+                        { $$ = KeyAliasCreate(param->arena, $2, $4); }
                 ;
 
 VModDecl        :       VIRTUAL_MODS VModDefList SEMI
@@ -362,9 +364,9 @@ VModDefList     :       VModDefList COMMA VModDef
                 ;
 
 VModDef         :       Ident
-                        { $$ = VModCreate($1, NULL); }
+                        { $$ = VModCreate(param->arena, $1, NULL); }
                 |       Ident EQUALS Expr
-                        { $$ = VModCreate($1, $3); }
+                        { $$ = VModCreate(param->arena, $1, $3); }
                 ;
 
 InterpretDecl   :       INTERPRET InterpretMatch OBRACE
@@ -374,9 +376,9 @@ InterpretDecl   :       INTERPRET InterpretMatch OBRACE
                 ;
 
 InterpretMatch  :       KeySym PLUS Expr
-                        { $$ = InterpCreate($1, $3); }
+                        { $$ = InterpCreate(param->arena, $1, $3); }
                 |       KeySym
-                        { $$ = InterpCreate($1, NULL); }
+                        { $$ = InterpCreate(param->arena, $1, NULL); }
                 ;
 
 VarDeclList     :       VarDeclList VarDecl
@@ -388,13 +390,13 @@ VarDeclList     :       VarDeclList VarDecl
 KeyTypeDecl     :       TYPE String OBRACE
                             VarDeclList
                         CBRACE SEMI
-                        { $$ = KeyTypeCreate($2, $4); }
+                        { $$ = KeyTypeCreate(param->arena, $2, $4); }
                 ;
 
 SymbolsDecl     :       KEY KEYNAME OBRACE
                             SymbolsBody
                         CBRACE SEMI
-                        { $$ = SymbolsCreate($2, (ExprDef *)$4); }
+                        { $$ = SymbolsCreate(param->arena, $2, (ExprDef *)$4); }
                 ;
 
 SymbolsBody     :       SymbolsBody COMMA SymbolsVarDecl
@@ -404,35 +406,35 @@ SymbolsBody     :       SymbolsBody COMMA SymbolsVarDecl
                 |       { $$ = NULL; }
                 ;
 
-SymbolsVarDecl  :       Lhs EQUALS Expr         { $$ = VarCreate($1, $3); }
-                |       Lhs EQUALS ArrayInit    { $$ = VarCreate($1, $3); }
-                |       Ident                   { $$ = BoolVarCreate($1, 1); }
-                |       EXCLAM Ident            { $$ = BoolVarCreate($2, 0); }
-                |       ArrayInit               { $$ = VarCreate(NULL, $1); }
+SymbolsVarDecl  :       Lhs EQUALS Expr         { $$ = VarCreate(param->arena, $1, $3); }
+                |       Lhs EQUALS ArrayInit    { $$ = VarCreate(param->arena, $1, $3); }
+                |       Ident                   { $$ = BoolVarCreate(param->arena, $1, 1); }
+                |       EXCLAM Ident            { $$ = BoolVarCreate(param->arena, $2, 0); }
+                |       ArrayInit               { $$ = VarCreate(param->arena, NULL, $1); }
                 ;
 
 ArrayInit       :       OBRACKET OptKeySymList CBRACKET
                         { $$ = $2; }
                 |       OBRACKET ActionList CBRACKET
-                        { $$ = ExprCreateUnary(EXPR_ACTION_LIST, EXPR_TYPE_ACTION, $2); }
+                        { $$ = ExprCreateUnary(param->arena, EXPR_ACTION_LIST, EXPR_TYPE_ACTION, $2); }
                 ;
 
 GroupCompatDecl :       GROUP Integer EQUALS Expr SEMI
-                        { $$ = GroupCompatCreate($2, $4); }
+                        { $$ = GroupCompatCreate(param->arena, $2, $4); }
                 ;
 
 ModMapDecl      :       MODIFIER_MAP Ident OBRACE ExprList CBRACE SEMI
-                        { $$ = ModMapCreate($2, $4); }
+                        { $$ = ModMapCreate(param->arena, $2, $4); }
                 ;
 
 IndicatorMapDecl:       INDICATOR String OBRACE VarDeclList CBRACE SEMI
-                        { $$ = IndicatorMapCreate($2, $4); }
+                        { $$ = IndicatorMapCreate(param->arena, $2, $4); }
                 ;
 
 IndicatorNameDecl:      INDICATOR Integer EQUALS Expr SEMI
-                        { $$ = IndicatorNameCreate($2, $4, false); }
+                        { $$ = IndicatorNameCreate(param->arena, $2, $4, false); }
                 |       VIRTUAL INDICATOR Integer EQUALS Expr SEMI
-                        { $$ = IndicatorNameCreate($3, $5, true); }
+                        { $$ = IndicatorNameCreate(param->arena, $3, $5, true); }
                 ;
 
 ShapeDecl       :       SHAPE String OBRACE OutlineList CBRACE SEMI
@@ -452,11 +454,11 @@ SectionBody     :       SectionBody SectionBodyItem     { $$ = NULL;}
 SectionBodyItem :       ROW OBRACE RowBody CBRACE SEMI
                         { $$ = NULL; }
                 |       VarDecl
-                        { FreeStmt(&$1->common); $$ = NULL; }
+                        { $$ = NULL; }
                 |       DoodadDecl
                         { $$ = NULL; }
                 |       IndicatorMapDecl
-                        { FreeStmt(&$1->common); $$ = NULL; }
+                        { $$ = NULL; }
                 |       OverlayDecl
                         { $$ = NULL; }
                 ;
@@ -467,7 +469,7 @@ RowBody         :       RowBody RowBodyItem     { $$ = NULL;}
 
 RowBodyItem     :       KEYS OBRACE Keys CBRACE SEMI { $$ = NULL; }
                 |       VarDecl
-                        { FreeStmt(&$1->common); $$ = NULL; }
+                        { $$ = NULL; }
                 ;
 
 Keys            :       Keys COMMA Key          { $$ = NULL; }
@@ -477,7 +479,7 @@ Keys            :       Keys COMMA Key          { $$ = NULL; }
 Key             :       KEYNAME
                         { $$ = NULL; }
                 |       OBRACE ExprList CBRACE
-                        { FreeStmt(&$2->common); $$ = NULL; }
+                        { $$ = NULL; }
                 ;
 
 OverlayDecl     :       OVERLAY String OBRACE OverlayKeyList CBRACE SEMI
@@ -502,7 +504,7 @@ OutlineInList   :       OBRACE CoordList CBRACE
                 |       Ident EQUALS OBRACE CoordList CBRACE
                         { $$ = NULL; }
                 |       Ident EQUALS Expr
-                        { FreeStmt(&$3->common); $$ = NULL; }
+                        { $$ = NULL; }
                 ;
 
 CoordList       :       CoordList COMMA Coord
@@ -516,7 +518,7 @@ Coord           :       OBRACKET SignedNumber COMMA SignedNumber CBRACKET
                 ;
 
 DoodadDecl      :       DoodadType String OBRACE VarDeclList CBRACE SEMI
-                        { FreeStmt(&$4->common); $$ = NULL; }
+                        { $$ = NULL; }
                 ;
 
 DoodadType      :       TEXT    { $$ = 0; }
@@ -582,31 +584,31 @@ ExprList        :       ExprList COMMA Expr
                 ;
 
 Expr            :       Expr DIVIDE Expr
-                        { $$ = ExprCreateBinary(EXPR_DIVIDE, $1, $3); }
+                        { $$ = ExprCreateBinary(param->arena, EXPR_DIVIDE, $1, $3); }
                 |       Expr PLUS Expr
-                        { $$ = ExprCreateBinary(EXPR_ADD, $1, $3); }
+                        { $$ = ExprCreateBinary(param->arena, EXPR_ADD, $1, $3); }
                 |       Expr MINUS Expr
-                        { $$ = ExprCreateBinary(EXPR_SUBTRACT, $1, $3); }
+                        { $$ = ExprCreateBinary(param->arena, EXPR_SUBTRACT, $1, $3); }
                 |       Expr TIMES Expr
-                        { $$ = ExprCreateBinary(EXPR_MULTIPLY, $1, $3); }
+                        { $$ = ExprCreateBinary(param->arena, EXPR_MULTIPLY, $1, $3); }
                 |       Lhs EQUALS Expr
-                        { $$ = ExprCreateBinary(EXPR_ASSIGN, $1, $3); }
+                        { $$ = ExprCreateBinary(param->arena, EXPR_ASSIGN, $1, $3); }
                 |       Term
                         { $$ = $1; }
                 ;
 
 Term            :       MINUS Term
-                        { $$ = ExprCreateUnary(EXPR_NEGATE, $2->value_type, $2); }
+                        { $$ = ExprCreateUnary(param->arena, EXPR_NEGATE, $2->value_type, $2); }
                 |       PLUS Term
-                        { $$ = ExprCreateUnary(EXPR_UNARY_PLUS, $2->value_type, $2); }
+                        { $$ = ExprCreateUnary(param->arena, EXPR_UNARY_PLUS, $2->value_type, $2); }
                 |       EXCLAM Term
-                        { $$ = ExprCreateUnary(EXPR_NOT, EXPR_TYPE_BOOLEAN, $2); }
+                        { $$ = ExprCreateUnary(param->arena, EXPR_NOT, EXPR_TYPE_BOOLEAN, $2); }
                 |       INVERT Term
-                        { $$ = ExprCreateUnary(EXPR_INVERT, $2->value_type, $2); }
+                        { $$ = ExprCreateUnary(param->arena, EXPR_INVERT, $2->value_type, $2); }
                 |       Lhs
                         { $$ = $1;  }
                 |       FieldSpec OPAREN OptExprList CPAREN %prec OPAREN
-                        { $$ = ActionCreate($1, $3); }
+                        { $$ = ActionCreate(param->arena, $1, $3); }
                 |       Terminal
                         { $$ = $1;  }
                 |       OPAREN Expr CPAREN
@@ -620,20 +622,20 @@ ActionList      :       ActionList COMMA Action
                 ;
 
 Action          :       FieldSpec OPAREN OptExprList CPAREN
-                        { $$ = ActionCreate($1, $3); }
+                        { $$ = ActionCreate(param->arena, $1, $3); }
                 ;
 
 Lhs             :       FieldSpec
                         {
                             ExprDef *expr;
-                            expr = ExprCreate(EXPR_IDENT, EXPR_TYPE_UNKNOWN);
+                            expr = ExprCreate(param->arena, EXPR_IDENT, EXPR_TYPE_UNKNOWN);
                             expr->value.str = $1;
                             $$ = expr;
                         }
                 |       FieldSpec DOT FieldSpec
                         {
                             ExprDef *expr;
-                            expr = ExprCreate(EXPR_FIELD_REF, EXPR_TYPE_UNKNOWN);
+                            expr = ExprCreate(param->arena, EXPR_FIELD_REF, EXPR_TYPE_UNKNOWN);
                             expr->value.field.element = $1;
                             expr->value.field.field = $3;
                             $$ = expr;
@@ -641,7 +643,7 @@ Lhs             :       FieldSpec
                 |       FieldSpec OBRACKET Expr CBRACKET
                         {
                             ExprDef *expr;
-                            expr = ExprCreate(EXPR_ARRAY_REF, EXPR_TYPE_UNKNOWN);
+                            expr = ExprCreate(param->arena, EXPR_ARRAY_REF, EXPR_TYPE_UNKNOWN);
                             expr->value.array.element = XKB_ATOM_NONE;
                             expr->value.array.field = $1;
                             expr->value.array.entry = $3;
@@ -650,7 +652,7 @@ Lhs             :       FieldSpec
                 |       FieldSpec DOT FieldSpec OBRACKET Expr CBRACKET
                         {
                             ExprDef *expr;
-                            expr = ExprCreate(EXPR_ARRAY_REF, EXPR_TYPE_UNKNOWN);
+                            expr = ExprCreate(param->arena, EXPR_ARRAY_REF, EXPR_TYPE_UNKNOWN);
                             expr->value.array.element = $1;
                             expr->value.array.field = $3;
                             expr->value.array.entry = $5;
@@ -661,14 +663,14 @@ Lhs             :       FieldSpec
 Terminal        :       String
                         {
                             ExprDef *expr;
-                            expr = ExprCreate(EXPR_VALUE, EXPR_TYPE_STRING);
+                            expr = ExprCreate(param->arena, EXPR_VALUE, EXPR_TYPE_STRING);
                             expr->value.str = $1;
                             $$ = expr;
                         }
                 |       Integer
                         {
                             ExprDef *expr;
-                            expr = ExprCreate(EXPR_VALUE, EXPR_TYPE_INT);
+                            expr = ExprCreate(param->arena, EXPR_VALUE, EXPR_TYPE_INT);
                             expr->value.ival = $1;
                             $$ = expr;
                         }
@@ -679,7 +681,7 @@ Terminal        :       String
                 |       KEYNAME
                         {
                             ExprDef *expr;
-                            expr = ExprCreate(EXPR_VALUE, EXPR_TYPE_KEYNAME);
+                            expr = ExprCreate(param->arena, EXPR_VALUE, EXPR_TYPE_KEYNAME);
                             expr->value.keyName = $1;
                             $$ = expr;
                         }
@@ -690,13 +692,13 @@ OptKeySymList   :       KeySymList      { $$ = $1; }
                 ;
 
 KeySymList      :       KeySymList COMMA KeySym
-                        { $$ = AppendKeysymList($1, $3); }
+                        { $$ = AppendKeysymList(param->arena, $1, $3); }
                 |       KeySymList COMMA KeySyms
-                        { $$ = AppendMultiKeysymList($1, $3); }
+                        { $$ = AppendMultiKeysymList(param->arena, $1, $3); }
                 |       KeySym
-                        { $$ = CreateKeysymList($1); }
+                        { $$ = CreateKeysymList(param->arena, $1); }
                 |       KeySyms
-                        { $$ = CreateMultiKeysymList($1); }
+                        { $$ = CreateMultiKeysymList(param->arena, $1); }
                 ;
 
 KeySyms         :       OBRACE KeySymList CBRACE
@@ -704,18 +706,16 @@ KeySyms         :       OBRACE KeySymList CBRACE
                 ;
 
 KeySym          :       IDENT   { $$ = $1; }
-                |       SECTION { $$ = strdup("section"); }
+                |       SECTION { $$ = xkb_atom_intern(param->ctx, "section"); }
                 |       Integer
                         {
-                            if ($1 < 10) {      /* XK_0 .. XK_9 */
-                                $$ = malloc(2);
-                                $$[0] = $1 + '0';
-                                $$[1] = '\0';
-                            }
-                            else {
-                                $$ = malloc(17);
-                                snprintf($$, 17, "0x%x", $1);
-                            }
+                            char buf[17];
+
+                            if ($1 < 10)        /* XK_0 .. XK_9 */
+                                snprintf(buf, sizeof(buf), "%d", $1);
+                            else
+                                snprintf(buf, sizeof(buf), "0x%x", $1);
+                            $$ = xkb_atom_intern(param->ctx, buf);
                         }
                 ;
 
@@ -736,7 +736,7 @@ Integer         :       INTEGER { $$ = $1; }
 KeyCode         :       INTEGER { $$ = $1; }
                 ;
 
-Ident           :       IDENT   { $$ = xkb_atom_steal(param->ctx, $1); }
+Ident           :       IDENT   { $$ = $1; }
                 |       DEFAULT { $$ = xkb_atom_intern(param->ctx, "default"); }
                 ;
 
@@ -772,7 +772,23 @@ parse(struct xkb_context *ctx, void *scanner, const char *map)
      * the first map in the file.
      */
 
-    while ((ret = yyparse(&param)) == 0 && param.more_maps) {
+    while (true) {
+        /* Every map gets its own arena, so that it can be freed alone. */
+        param.arena = ast_arena_new();
+
+        ret = yyparse(&param);
+        if (ret != 0 || !param.more_maps) {
+            ast_arena_free(param.arena);
+            break;
+        }
+
+        if (!param.rtrn) {
+            ast_arena_free(param.arena);
+            continue;
+        }
+
+        param.rtrn->arena = param.arena;
+
         if (map) {
             if (streq_not_null(map, param.rtrn->name))
                 return param.rtrn;
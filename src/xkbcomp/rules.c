@@ -48,11 +48,9 @@
  */
 
 #include <ctype.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/mman.h>
-#include <sys/stat.h>
-#include <sys/types.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 
 #include "xkbcomp-priv.h"
 #include "rules.h"
@@ -380,21 +378,33 @@ static const struct sval rules_kccgst_svals[_KCCGST_NUM_ENTRIES] = {
     [KCCGST_GEOMETRY] = SVAL_LIT("geometry"),
 };
 
+/*
+ * A value from the RMLVO names, with its atom (XKB_ATOM_NONE if no rule
+ * can have it), and the bitset of groups it is in (NULL if none).
+ */
+struct mlvo_value {
+    struct sval sval;
+    xkb_atom_t atom;
+    const uint64_t *groups;
+};
+typedef darray(struct mlvo_value) darray_mlvo_value;
+
 /*
  * A broken-down version of xkb_rule_names (without the rules,
  * obviously).
  */
 struct rule_names {
-    struct sval model;
-    darray_sval layouts;
-    darray_sval variants;
-    darray_sval options;
+    struct mlvo_value model;
+    darray_mlvo_value layouts;
+    darray_mlvo_value variants;
+    darray_mlvo_value options;
 };
 
 struct group {
-    struct sval name;
-    darray_sval elements;
+    xkb_atom_t name;
+    darray(xkb_atom_t) elements;
 };
+typedef darray(struct group) darray_group;
 
 struct mapping {
     int mlvo_at_pos[_MLVO_NUM_ENTRIES];
@@ -413,142 +423,282 @@ enum mlvo_match_type {
     MLVO_MATCH_GROUP,
 };
 
+#define RULE_NONE UINT_MAX
+
 struct rule {
-    struct sval mlvo_value_at_pos[_MLVO_NUM_ENTRIES];
+    /* For plain matches, the value. */
+    xkb_atom_t mlvo_value_at_pos[_MLVO_NUM_ENTRIES];
     enum mlvo_match_type match_type_at_pos[_MLVO_NUM_ENTRIES];
+    /* For group matches, the index of the group, or -1 if undeclared. */
+    int group_at_pos[_MLVO_NUM_ENTRIES];
     unsigned int num_mlvo_values;
     struct sval kccgst_value_at_pos[_KCCGST_NUM_ENTRIES];
     unsigned int num_kccgst_values;
+    /* Where the rule is, for warnings when it is applied. */
+    struct location loc;
+    /* The next rule in the same index bucket, or RULE_NONE. */
+    unsigned int next_in_bucket;
     bool skip;
 };
 
 /*
- * This is the main object used to match a given RMLVO against a rules
- * file and aggragate the results in a KcCGST. It goes through a simple
- * matching state machine, with tokens as transitions (see
- * matcher_match()).
+ * A mapping and the rules following it.  The rules whose first value is
+ * a plain one are indexed by it, so that matching only needs to try
+ * those which can match, along with the wildcard and group ones.
  */
-struct matcher {
-    struct xkb_context *ctx;
-    /* Input.*/
-    struct rule_names rmlvo;
-    struct location loc;
-    union lvalue val;
-    struct scanner scanner;
-    darray(struct group) groups;
-    /* Current mapping. */
+struct rule_set {
     struct mapping mapping;
-    /* Current rule. */
-    struct rule rule;
-    /* Output. */
-    darray_char kccgst[_KCCGST_NUM_ENTRIES];
+    darray(struct rule) rules;
+    /* The first rule in each bucket, or RULE_NONE. A power of 2. */
+    unsigned int *buckets;
+    unsigned int num_buckets;
+    /* The rules whose first value isn't a plain one, in order. */
+    darray_uint unindexed;
 };
 
-static struct sval
-strip_spaces(struct sval v)
+/*
+ * A rules file compiled for matching. It doesn't depend on the RMLVO
+ * names, and is never modified once compiled, other than its reference
+ * count, so it is kept in the context and shared by all threads.
+ *
+ * The values to match are interned, so that matching a rule only
+ * compares atoms, and tests bits for group matches.
+ */
+struct rules_file {
+    /* The name the file was looked up by, for messages. */
+    char *name;
+    char *path;
+    int64_t mtime;
+    int64_t size;
+    /* The context's cache and each user hold a reference. */
+    int refcnt;
+    /* A copy of the file; the KcCGST values point into it. */
+    char *text;
+    darray(struct rule_set) rule_sets;
+    /*
+     * The values which are in some group, in a hash table by atom, with
+     * the bitset of the groups each is in.  The bitsets are
+     * num_group_words long.  A power of 2, or 0 if there are no groups.
+     */
+    xkb_atom_t *member_slots;
+    uint64_t *member_groups;
+    unsigned int num_member_slots;
+    unsigned int num_group_words;
+};
+
+/* The atoms are consecutive, so this spreads them well enough. */
+static unsigned int
+hash_atom(xkb_atom_t atom)
 {
-    while (v.len > 0 && isspace(v.start[0])) { v.len--; v.start++; }
-    while (v.len > 0 && isspace(v.start[v.len - 1])) v.len--;
-    return v;
+    return atom * 2654435761u;
 }
 
-static darray_sval
-split_comma_separated_string(const char *s)
+static void
+rule_set_finish(struct rule_set *set)
 {
-    darray_sval arr = darray_new();
-    struct sval val = { NULL, 0 };
+    struct rule *rule;
+    unsigned int i, bucket, num_indexed = 0;
+
+    darray_foreach(rule, set->rules)
+        if (rule->match_type_at_pos[0] == MLVO_MATCH_NORMAL)
+            num_indexed++;
+
+    if (num_indexed > 0) {
+        set->num_buckets = 8;
+        while (set->num_buckets < num_indexed * 2)
+            set->num_buckets *= 2;
+        set->buckets = malloc(set->num_buckets * sizeof(*set->buckets));
+        if (!set->buckets)
+            set->num_buckets = 0;
+        for (i = 0; i < set->num_buckets; i++)
+            set->buckets[i] = RULE_NONE;
+    }
 
-    /*
-     * Make sure the array returned by this function always includes at
-     * least one value, e.g. "" -> { "" } and "," -> { "", "" }.
-     */
+    for (i = 0; i < darray_size(set->rules); i++) {
+        rule = &darray_item(set->rules, i);
+        rule->next_in_bucket = RULE_NONE;
+        if (rule->match_type_at_pos[0] != MLVO_MATCH_NORMAL ||
+            set->num_buckets == 0)
+            darray_append(set->unindexed, i);
+    }
 
-    if (!s) {
-        darray_append(arr, val);
-        return arr;
+    if (set->num_buckets == 0)
+        return;
+
+    /* Go backwards, so that the rules in each bucket are in order. */
+    for (i = darray_size(set->rules); i-- > 0; ) {
+        rule = &darray_item(set->rules, i);
+        if (rule->match_type_at_pos[0] != MLVO_MATCH_NORMAL)
+            continue;
+
+        bucket = hash_atom(rule->mlvo_value_at_pos[0]) &
+                 (set->num_buckets - 1);
+        rule->next_in_bucket = set->buckets[bucket];
+        set->buckets[bucket] = i;
     }
+}
 
-    while (true) {
-        val.start = s; val.len = 0;
-        while (*s != '\0' && *s != ',') { s++; val.len++; }
-        darray_append(arr, strip_spaces(val));
-        if (*s == '\0') break;
-        if (*s == ',') s++;
+static bool
+rules_file_index_groups(struct rules_file *rf, darray_group *groups)
+{
+    struct group *group;
+    xkb_atom_t *element;
+    unsigned int i, num_elements = 0, group_idx;
+
+    darray_foreach(group, *groups)
+        num_elements += darray_size(group->elements);
+
+    if (num_elements == 0)
+        return true;
+
+    rf->num_group_words = (darray_size(*groups) + 63) / 64;
+    rf->num_member_slots = 8;
+    while (rf->num_member_slots < num_elements * 2)
+        rf->num_member_slots *= 2;
+
+    rf->member_slots = calloc(rf->num_member_slots,
+                              sizeof(*rf->member_slots));
+    rf->member_groups = calloc(rf->num_member_slots * rf->num_group_words,
+                               sizeof(*rf->member_groups));
+    if (!rf->member_slots || !rf->member_groups)
+        return false;
+
+    darray_foreach(group, *groups) {
+        group_idx = group - darray_mem(*groups, 0);
+
+        darray_foreach(element, group->elements) {
+            for (i = hash_atom(*element) & (rf->num_member_slots - 1);
+                 rf->member_slots[i] != XKB_ATOM_NONE &&
+                 rf->member_slots[i] != *element;
+                 i = (i + 1) & (rf->num_member_slots - 1));
+
+            rf->member_slots[i] = *element;
+            rf->member_groups[i * rf->num_group_words + group_idx / 64] |=
+                UINT64_C(1) << (group_idx % 64);
+        }
     }
 
-    return arr;
+    return true;
 }
 
-static struct matcher *
-matcher_new(struct xkb_context *ctx,
-            const struct xkb_rule_names *rmlvo)
+/* The bitset of the groups @atom is in, or NULL if it isn't in any. */
+static const uint64_t *
+rules_file_value_groups(const struct rules_file *rf, xkb_atom_t atom)
 {
-    struct matcher *m = calloc(1, sizeof(*m));
-    if (!m)
+    unsigned int i;
+
+    if (rf->num_member_slots == 0 || atom == XKB_ATOM_NONE)
         return NULL;
 
-    m->ctx = ctx;
-    m->rmlvo.model.start = rmlvo->model;
-    m->rmlvo.model.len = rmlvo->model ? strlen(rmlvo->model) : 0;
-    m->rmlvo.layouts = split_comma_separated_string(rmlvo->layout);
-    m->rmlvo.variants = split_comma_separated_string(rmlvo->variant);
-    m->rmlvo.options = split_comma_separated_string(rmlvo->options);
+    for (i = hash_atom(atom) & (rf->num_member_slots - 1);
+         rf->member_slots[i] != XKB_ATOM_NONE;
+         i = (i + 1) & (rf->num_member_slots - 1))
+        if (rf->member_slots[i] == atom)
+            return &rf->member_groups[i * rf->num_group_words];
 
-    return m;
+    return NULL;
 }
 
 static void
-matcher_free(struct matcher *m)
+rules_file_free(struct rules_file *rf)
 {
-    struct group *group;
-    if (!m)
+    struct rule_set *set;
+
+    if (!rf)
         return;
-    darray_free(m->rmlvo.layouts);
-    darray_free(m->rmlvo.variants);
-    darray_free(m->rmlvo.options);
-    darray_foreach(group, m->groups)
-        darray_free(group->elements);
-    darray_free(m->groups);
-    free(m);
+
+    darray_foreach(set, rf->rule_sets) {
+        darray_free(set->rules);
+        free(set->buckets);
+        darray_free(set->unindexed);
+    }
+    darray_free(rf->rule_sets);
+    free(rf->member_slots);
+    free(rf->member_groups);
+    free(rf->name);
+    free(rf->path);
+    free(rf->text);
+    free(rf);
 }
 
+/*
+ * The rules file is compiled with a simple state machine, with tokens as
+ * transitions (see compiler_compile()).
+ */
+struct compiler {
+    struct xkb_context *ctx;
+    struct location loc;
+    union lvalue val;
+    struct scanner scanner;
+    struct rules_file *rf;
+    /* The groups defined so far. */
+    darray_group groups;
+    /* Current rule set, if there is one. */
+    struct rule_set set;
+    bool in_set;
+    /* Current rule. */
+    struct rule rule;
+};
+
 /* C99 is stupid. Just use the 1 variant when there are no args. */
-#define matcher_error1(matcher, msg) \
-    log_warn(matcher->ctx, "rules/%s:%d:%d: " msg "\n", \
-             matcher->scanner.file_name, matcher->loc.line, \
-             matcher->loc.column)
-#define matcher_error(matcher, fmt, ...) \
-    log_warn(matcher->ctx, "rules/%s:%d:%d: " fmt "\n", \
-             matcher->scanner.file_name, matcher->loc.line, \
-             matcher->loc.column, __VA_ARGS__)
+#define compiler_error1(compiler, msg) \
+    log_warn(compiler->ctx, "rules/%s:%d:%d: " msg "\n", \
+             compiler->scanner.file_name, compiler->loc.line, \
+             compiler->loc.column)
+#define compiler_error(compiler, fmt, ...) \
+    log_warn(compiler->ctx, "rules/%s:%d:%d: " fmt "\n", \
+             compiler->scanner.file_name, compiler->loc.line, \
+             compiler->loc.column, __VA_ARGS__)
+
+static void
+compiler_group_start_new(struct compiler *c, struct sval name)
+{
+    struct group group = { .elements = darray_new() };
+    group.name = xkb_atom_intern_len(c->ctx, name.start, name.len);
+    darray_append(c->groups, group);
+}
 
 static void
-matcher_group_start_new(struct matcher *m, struct sval name)
+compiler_group_add_element(struct compiler *c, struct sval element)
 {
-    struct group group = { .name = name, .elements = darray_new() };
-    darray_append(m->groups, group);
+    xkb_atom_t atom = xkb_atom_intern_len(c->ctx, element.start, element.len);
+    darray_append(darray_item(c->groups, darray_size(c->groups) - 1).elements,
+                  atom);
 }
 
 static void
-matcher_group_add_element(struct matcher *m, struct sval element)
+compiler_set_finish(struct compiler *c)
 {
-    darray_append(darray_item(m->groups, darray_size(m->groups) - 1).elements,
-                  element);
+    if (!c->in_set)
+        return;
+
+    c->in_set = false;
+
+    /* Nothing can match, so don't keep it around. */
+    if (c->set.mapping.skip || darray_empty(c->set.rules)) {
+        darray_free(c->set.rules);
+        return;
+    }
+
+    rule_set_finish(&c->set);
+    darray_append(c->rf->rule_sets, c->set);
 }
 
 static void
-matcher_mapping_start_new(struct matcher *m)
+compiler_mapping_start_new(struct compiler *c)
 {
     unsigned int i;
+
+    compiler_set_finish(c);
+
+    memset(&c->set, 0, sizeof(c->set));
+    c->in_set = true;
     for (i = 0; i < _MLVO_NUM_ENTRIES; i++)
-        m->mapping.mlvo_at_pos[i] = -1;
+        c->set.mapping.mlvo_at_pos[i] = -1;
     for (i = 0; i < _KCCGST_NUM_ENTRIES; i++)
-        m->mapping.kccgst_at_pos[i] = -1;
-    m->mapping.layout_idx = m->mapping.variant_idx = XKB_LAYOUT_INVALID;
-    m->mapping.num_mlvo = m->mapping.num_kccgst = 0;
-    m->mapping.defined_mlvo_mask = 0;
-    m->mapping.defined_kccgst_mask = 0;
-    m->mapping.skip = false;
+        c->set.mapping.kccgst_at_pos[i] = -1;
+    c->set.mapping.layout_idx = c->set.mapping.variant_idx =
+        XKB_LAYOUT_INVALID;
 }
 
 static int
@@ -567,8 +717,9 @@ extract_layout_index(const char *s, size_t max_len, xkb_layout_index_t *out)
 }
 
 static void
-matcher_mapping_set_mlvo(struct matcher *m, struct sval ident)
+compiler_mapping_set_mlvo(struct compiler *c, struct sval ident)
 {
+    struct mapping *mapping = &c->set.mapping;
     enum rules_mlvo mlvo;
     struct sval mlvo_sval;
     xkb_layout_index_t idx;
@@ -583,20 +734,20 @@ matcher_mapping_set_mlvo(struct matcher *m, struct sval ident)
 
     /* Not found. */
     if (mlvo >= _MLVO_NUM_ENTRIES) {
-        matcher_error(m,
-                      "invalid mapping: %.*s is not a valid value here; "
-                      "ignoring rule set",
-                      ident.len, ident.start);
-        m->mapping.skip = true;
+        compiler_error(c,
+                       "invalid mapping: %.*s is not a valid value here; "
+                       "ignoring rule set",
+                       ident.len, ident.start);
+        mapping->skip = true;
         return;
     }
 
-    if (m->mapping.defined_mlvo_mask & (1 << mlvo)) {
-        matcher_error(m,
-                      "invalid mapping: %.*s appears twice on the same line; "
-                      "ignoring rule set",
-                      mlvo_sval.len, mlvo_sval.start);
-        m->mapping.skip = true;
+    if (mapping->defined_mlvo_mask & (1 << mlvo)) {
+        compiler_error(c,
+                       "invalid mapping: %.*s appears twice on the same line; "
+                       "ignoring rule set",
+                       mlvo_sval.len, mlvo_sval.start);
+        mapping->skip = true;
         return;
     }
 
@@ -605,38 +756,39 @@ matcher_mapping_set_mlvo(struct matcher *m, struct sval ident)
         consumed = extract_layout_index(ident.start + mlvo_sval.len,
                                        ident.len - mlvo_sval.len, &idx);
         if ((int) (ident.len - mlvo_sval.len) != consumed) {
-            matcher_error(m,
-                          "invalid mapping:\" %.*s\" may only be followed by a valid group index; "
-                          "ignoring rule set",
-                          mlvo_sval.len, mlvo_sval.start);
-            m->mapping.skip = true;
+            compiler_error(c,
+                           "invalid mapping:\" %.*s\" may only be followed by a valid group index; "
+                           "ignoring rule set",
+                           mlvo_sval.len, mlvo_sval.start);
+            mapping->skip = true;
             return;
         }
 
         if (mlvo == MLVO_LAYOUT) {
-            m->mapping.layout_idx = idx;
+            mapping->layout_idx = idx;
         }
         else if (mlvo == MLVO_VARIANT) {
-            m->mapping.variant_idx = idx;
+            mapping->variant_idx = idx;
         }
         else {
-            matcher_error(m,
-                          "invalid mapping: \"%.*s\" cannot be followed by a group index; "
-                          "ignoring rule set",
-                          mlvo_sval.len, mlvo_sval.start);
-            m->mapping.skip = true;
+            compiler_error(c,
+                           "invalid mapping: \"%.*s\" cannot be followed by a group index; "
+                           "ignoring rule set",
+                           mlvo_sval.len, mlvo_sval.start);
+            mapping->skip = true;
             return;
         }
     }
 
-    m->mapping.mlvo_at_pos[m->mapping.num_mlvo] = mlvo;
-    m->mapping.defined_mlvo_mask |= 1 << mlvo;
-    m->mapping.num_mlvo++;
+    mapping->mlvo_at_pos[mapping->num_mlvo] = mlvo;
+    mapping->defined_mlvo_mask |= 1 << mlvo;
+    mapping->num_mlvo++;
 }
 
 static void
-matcher_mapping_set_kccgst(struct matcher *m, struct sval ident)
+compiler_mapping_set_kccgst(struct compiler *c, struct sval ident)
 {
+    struct mapping *mapping = &c->set.mapping;
     enum rules_kccgst kccgst;
     struct sval kccgst_sval;
 
@@ -649,240 +801,598 @@ matcher_mapping_set_kccgst(struct matcher *m, struct sval ident)
 
     /* Not found. */
     if (kccgst >= _KCCGST_NUM_ENTRIES) {
-        matcher_error(m,
-                      "invalid mapping: %.*s is not a valid value here; "
-                      "ignoring rule set",
-                      ident.len, ident.start);
-        m->mapping.skip = true;
+        compiler_error(c,
+                       "invalid mapping: %.*s is not a valid value here; "
+                       "ignoring rule set",
+                       ident.len, ident.start);
+        mapping->skip = true;
         return;
     }
 
-    if (m->mapping.defined_kccgst_mask & (1 << kccgst)) {
-        matcher_error(m,
-                      "invalid mapping: %.*s appears twice on the same line; "
-                      "ignoring rule set",
-                      kccgst_sval.len, kccgst_sval.start);
-        m->mapping.skip = true;
+    if (mapping->defined_kccgst_mask & (1 << kccgst)) {
+        compiler_error(c,
+                       "invalid mapping: %.*s appears twice on the same line; "
+                       "ignoring rule set",
+                       kccgst_sval.len, kccgst_sval.start);
+        mapping->skip = true;
         return;
     }
 
-    m->mapping.kccgst_at_pos[m->mapping.num_kccgst] = kccgst;
-    m->mapping.defined_kccgst_mask |= 1 << kccgst;
-    m->mapping.num_kccgst++;
+    mapping->kccgst_at_pos[mapping->num_kccgst] = kccgst;
+    mapping->defined_kccgst_mask |= 1 << kccgst;
+    mapping->num_kccgst++;
 }
 
 static void
-matcher_mapping_verify(struct matcher *m)
+compiler_mapping_verify(struct compiler *c)
 {
-    if (m->mapping.num_mlvo == 0) {
-        matcher_error1(m,
-                       "invalid mapping: must have at least one value on the left hand side; "
-                       "ignoring rule set");
-        goto skip;
-    }
-
-    if (m->mapping.num_kccgst == 0) {
-        matcher_error1(m,
-                       "invalid mapping: must have at least one value on the right hand side; "
-                       "ignoring rule set");
-        goto skip;
-    }
-
-    /*
-     * This following is very stupid, but this is how it works.
-     * See the "Notes" section in the overview above.
-     */
-
-    if (m->mapping.defined_mlvo_mask & (1 << MLVO_LAYOUT)) {
-        if (m->mapping.layout_idx == XKB_LAYOUT_INVALID) {
-            if (darray_size(m->rmlvo.layouts) > 1)
-                goto skip;
-        }
-        else {
-            if (darray_size(m->rmlvo.layouts) == 1 ||
-                m->mapping.layout_idx >= darray_size(m->rmlvo.layouts))
-                goto skip;
-        }
+    if (c->set.mapping.num_mlvo == 0) {
+        compiler_error1(c,
+                        "invalid mapping: must have at least one value on the left hand side; "
+                        "ignoring rule set");
+        c->set.mapping.skip = true;
+        return;
     }
 
-    if (m->mapping.defined_mlvo_mask & (1 << MLVO_VARIANT)) {
-        if (m->mapping.variant_idx == XKB_LAYOUT_INVALID) {
-            if (darray_size(m->rmlvo.variants) > 1)
-                goto skip;
-        }
-        else {
-            if (darray_size(m->rmlvo.variants) == 1 ||
-                m->mapping.variant_idx >= darray_size(m->rmlvo.variants))
-                goto skip;
-        }
+    if (c->set.mapping.num_kccgst == 0) {
+        compiler_error1(c,
+                        "invalid mapping: must have at least one value on the right hand side; "
+                        "ignoring rule set");
+        c->set.mapping.skip = true;
+        return;
     }
-
-    return;
-
-skip:
-    m->mapping.skip = true;
 }
 
 static void
-matcher_rule_start_new(struct matcher *m)
+compiler_rule_start_new(struct compiler *c)
 {
-    memset(&m->rule, 0, sizeof(m->rule));
-    m->rule.skip = m->mapping.skip;
+    memset(&c->rule, 0, sizeof(c->rule));
+    c->rule.skip = c->set.mapping.skip;
+    c->rule.loc = c->loc;
 }
 
 static void
-matcher_rule_set_mlvo_common(struct matcher *m, struct sval ident,
-                             enum mlvo_match_type match_type)
+compiler_rule_set_mlvo_common(struct compiler *c, xkb_atom_t value,
+                              enum mlvo_match_type match_type)
 {
-    if (m->rule.num_mlvo_values + 1 > m->mapping.num_mlvo) {
-        matcher_error1(m,
-                       "invalid rule: has more values than the mapping line; "
-                       "ignoring rule");
-        m->rule.skip = true;
+    if (c->rule.num_mlvo_values + 1 > c->set.mapping.num_mlvo) {
+        compiler_error1(c,
+                        "invalid rule: has more values than the mapping line; "
+                        "ignoring rule");
+        c->rule.skip = true;
         return;
     }
-    m->rule.match_type_at_pos[m->rule.num_mlvo_values] = match_type;
-    m->rule.mlvo_value_at_pos[m->rule.num_mlvo_values] = ident;
-    m->rule.num_mlvo_values++;
+    c->rule.match_type_at_pos[c->rule.num_mlvo_values] = match_type;
+    c->rule.mlvo_value_at_pos[c->rule.num_mlvo_values] = value;
+    c->rule.num_mlvo_values++;
 }
 
 static void
-matcher_rule_set_mlvo_wildcard(struct matcher *m)
+compiler_rule_set_mlvo_wildcard(struct compiler *c)
 {
-    struct sval dummy = { NULL, 0 };
-    matcher_rule_set_mlvo_common(m, dummy, MLVO_MATCH_WILDCARD);
+    compiler_rule_set_mlvo_common(c, XKB_ATOM_NONE, MLVO_MATCH_WILDCARD);
 }
 
+/*
+ * The group is looked up now, so that only the groups defined before the
+ * rule are seen, as when the file was matched while reading it.
+ */
 static void
-matcher_rule_set_mlvo_group(struct matcher *m, struct sval ident)
+compiler_rule_set_mlvo_group(struct compiler *c, struct sval ident)
 {
-    matcher_rule_set_mlvo_common(m, ident, MLVO_MATCH_GROUP);
+    struct group *group;
+    xkb_atom_t name = xkb_atom_lookup_len(c->ctx, ident.start, ident.len);
+    int group_idx = -1;
+
+    darray_foreach(group, c->groups) {
+        if (name != XKB_ATOM_NONE && group->name == name) {
+            group_idx = group - darray_mem(c->groups, 0);
+            break;
+        }
+    }
+
+    /*
+     * rules/evdev intentionally uses some undeclared group names
+     * in rules (e.g. commented group definitions which may be
+     * uncommented if needed). So we continue silently.
+     */
+
+    if (c->rule.num_mlvo_values < _MLVO_NUM_ENTRIES)
+        c->rule.group_at_pos[c->rule.num_mlvo_values] = group_idx;
+    compiler_rule_set_mlvo_common(c, XKB_ATOM_NONE, MLVO_MATCH_GROUP);
 }
 
 static void
-matcher_rule_set_mlvo(struct matcher *m, struct sval ident)
+compiler_rule_set_mlvo(struct compiler *c, struct sval ident)
 {
-    matcher_rule_set_mlvo_common(m, ident, MLVO_MATCH_NORMAL);
+    compiler_rule_set_mlvo_common(c,
+                                  xkb_atom_intern_len(c->ctx, ident.start,
+                                                      ident.len),
+                                  MLVO_MATCH_NORMAL);
 }
 
 static void
-matcher_rule_set_kccgst(struct matcher *m, struct sval ident)
+compiler_rule_set_kccgst(struct compiler *c, struct sval ident)
 {
-    if (m->rule.num_kccgst_values + 1 > m->mapping.num_kccgst) {
-        matcher_error1(m,
-                       "invalid rule: has more values than the mapping line; "
-                       "ignoring rule");
-        m->rule.skip = true;
+    if (c->rule.num_kccgst_values + 1 > c->set.mapping.num_kccgst) {
+        compiler_error1(c,
+                        "invalid rule: has more values than the mapping line; "
+                        "ignoring rule");
+        c->rule.skip = true;
         return;
     }
-    m->rule.kccgst_value_at_pos[m->rule.num_kccgst_values] = ident;
-    m->rule.num_kccgst_values++;
+    c->rule.kccgst_value_at_pos[c->rule.num_kccgst_values] = ident;
+    c->rule.num_kccgst_values++;
 }
 
-static bool
-match_group(struct matcher *m, struct sval group_name, struct sval to)
+static void
+compiler_rule_verify(struct compiler *c)
 {
-    struct group *group;
-    struct sval *element;
-    bool found = false;
-
-    darray_foreach(group, m->groups) {
-        if (svaleq(group->name, group_name)) {
-            found = true;
-            break;
-        }
-    }
-
-    if (!found) {
-        /*
-         * rules/evdev intentionally uses some undeclared group names
-         * in rules (e.g. commented group definitions which may be
-         * uncommented if needed). So we continue silently.
-         */
-        return false;
+    if (c->rule.num_mlvo_values != c->set.mapping.num_mlvo ||
+        c->rule.num_kccgst_values != c->set.mapping.num_kccgst) {
+        compiler_error1(c,
+                        "invalid rule: must have same number of values as mapping line;"
+                        "ignoring rule");
+        c->rule.skip = true;
     }
+}
 
-    darray_foreach(element, group->elements)
-        if (svaleq(to, *element))
-            return true;
-
-    return false;
+static void
+compiler_rule_add(struct compiler *c)
+{
+    darray_append(c->set.rules, c->rule);
 }
 
-static bool
-match_value(struct matcher *m, struct sval val, struct sval to,
-          enum mlvo_match_type match_type)
+static enum rules_token
+gettok(struct compiler *c)
 {
-    if (match_type == MLVO_MATCH_WILDCARD)
-        return true;
-    if (match_type == MLVO_MATCH_GROUP)
-        return match_group(m, val, to);
-    return svaleq(val, to);
+    return lex(&c->scanner, &c->val, &c->loc);
 }
 
-/*
- * This function performs %-expansion on @value (see overview above),
- * and appends the result to @to.
- */
 static bool
-append_expanded_kccgst_value(struct matcher *m, darray_char *to,
-                             struct sval value)
+compiler_compile(struct compiler *c, size_t len)
 {
-    unsigned int i;
-    size_t original_size = darray_size(*to);
-    const char *s = value.start;
-    xkb_layout_index_t idx;
-    int consumed;
-    enum rules_mlvo mlv;
-    struct sval expanded;
-    char pfx, sfx;
+    enum rules_token tok;
 
-    /*
-     * Appending  bar to  foo ->  foo (not an error if this happens)
-     * Appending +bar to  foo ->  foo+bar
-     * Appending  bar to +foo ->  bar+foo
-     * Appending +bar to +foo -> +foo+bar
-     */
-    if (!darray_empty(*to) && s[0] != '+' && s[0] != '|') {
-        if (darray_item(*to, 0) == '+' || darray_item(*to, 0) == '|')
-            darray_prepend_items_nullterminate(*to, value.start, value.len);
-        return true;
+    scanner_init(&c->scanner, c->ctx, c->rf->text, len, c->rf->name);
+
+initial:
+    switch (tok = gettok(c)) {
+    case TOK_BANG:
+        goto bang;
+    case TOK_END_OF_LINE:
+        goto initial;
+    case TOK_END_OF_FILE:
+        goto finish;
+    default:
+        goto unexpected;
     }
 
-    /*
-     * Some ugly hand-lexing here, but going through the scanner is more
-     * trouble than it's worth, and the format is ugly on its own merit.
-     */
-    for (i = 0; i < value.len; ) {
-        /* Check if that's a start of an expansion. */
-        if (s[i] != '%') {
-            /* Just a normal character. */
-            darray_append_items_nullterminate(*to, &s[i++], 1);
-            continue;
-        }
-        if (++i >= value.len) goto error;
+bang:
+    switch (tok = gettok(c)) {
+    case TOK_GROUP_NAME:
+        compiler_set_finish(c);
+        compiler_group_start_new(c, c->val.string);
+        goto group_name;
+    case TOK_IDENTIFIER:
+        compiler_mapping_start_new(c);
+        compiler_mapping_set_mlvo(c, c->val.string);
+        goto mapping_mlvo;
+    default:
+        goto unexpected;
+    }
 
-        pfx = sfx = 0;
+group_name:
+    switch (tok = gettok(c)) {
+    case TOK_EQUALS:
+        goto group_element;
+    default:
+        goto unexpected;
+    }
 
-        /* Check for prefix. */
-        if (s[i] == '(' || s[i] == '+' || s[i] == '|' ||
-            s[i] == '_' || s[i] == '-') {
-            pfx = s[i];
-            if (s[i] == '(') sfx = ')';
-            if (++i >= value.len) goto error;
-        }
+group_element:
+    switch (tok = gettok(c)) {
+    case TOK_IDENTIFIER:
+        compiler_group_add_element(c, c->val.string);
+        goto group_element;
+    case TOK_END_OF_LINE:
+        goto initial;
+    default:
+        goto unexpected;
+    }
 
-        /* Mandatory model/layout/variant specifier. */
-        switch (s[i++]) {
-        case 'm': mlv = MLVO_MODEL; break;
-        case 'l': mlv = MLVO_LAYOUT; break;
-        case 'v': mlv = MLVO_VARIANT; break;
-        default: goto error;
-        }
+mapping_mlvo:
+    switch (tok = gettok(c)) {
+    case TOK_IDENTIFIER:
+        if (!c->set.mapping.skip)
+            compiler_mapping_set_mlvo(c, c->val.string);
+        goto mapping_mlvo;
+    case TOK_EQUALS:
+        goto mapping_kccgst;
+    default:
+        goto unexpected;
+    }
 
-        /* Check for index. */
-        idx = XKB_LAYOUT_INVALID;
-        if (i < value.len) {
+mapping_kccgst:
+    switch (tok = gettok(c)) {
+    case TOK_IDENTIFIER:
+        if (!c->set.mapping.skip)
+            compiler_mapping_set_kccgst(c, c->val.string);
+        goto mapping_kccgst;
+    case TOK_END_OF_LINE:
+        if (!c->set.mapping.skip)
+            compiler_mapping_verify(c);
+        goto rule_mlvo_first;
+    default:
+        goto unexpected;
+    }
+
+rule_mlvo_first:
+    switch (tok = gettok(c)) {
+    case TOK_BANG:
+        goto bang;
+    case TOK_END_OF_LINE:
+        goto rule_mlvo_first;
+    case TOK_END_OF_FILE:
+        goto finish;
+    default:
+        compiler_rule_start_new(c);
+        goto rule_mlvo_no_tok;
+    }
+
+rule_mlvo:
+    tok = gettok(c);
+rule_mlvo_no_tok:
+    switch (tok) {
+    case TOK_IDENTIFIER:
+        if (!c->rule.skip)
+            compiler_rule_set_mlvo(c, c->val.string);
+        goto rule_mlvo;
+    case TOK_STAR:
+        if (!c->rule.skip)
+            compiler_rule_set_mlvo_wildcard(c);
+        goto rule_mlvo;
+    case TOK_GROUP_NAME:
+        if (!c->rule.skip)
+            compiler_rule_set_mlvo_group(c, c->val.string);
+        goto rule_mlvo;
+    case TOK_EQUALS:
+        goto rule_kccgst;
+    default:
+        goto unexpected;
+    }
+
+rule_kccgst:
+    switch (tok = gettok(c)) {
+    case TOK_IDENTIFIER:
+        if (!c->rule.skip)
+            compiler_rule_set_kccgst(c, c->val.string);
+        goto rule_kccgst;
+    case TOK_END_OF_LINE:
+        if (!c->rule.skip)
+            compiler_rule_verify(c);
+        if (!c->rule.skip)
+            compiler_rule_add(c);
+        goto rule_mlvo_first;
+    default:
+        goto unexpected;
+    }
+
+unexpected:
+    switch (tok) {
+    case TOK_ERROR:
+        goto error;
+    default:
+        goto state_error;
+    }
+
+finish:
+    compiler_set_finish(c);
+    return true;
+
+state_error:
+    compiler_error1(c, "unexpected token");
+error:
+    compiler_set_finish(c);
+    return false;
+}
+
+static struct rules_file *
+rules_file_compile(struct xkb_context *ctx, const char *name,
+                   const char *string, size_t len)
+{
+    struct compiler c;
+    struct rules_file *rf;
+    struct group *group;
+    bool ok;
+
+    rf = calloc(1, sizeof(*rf));
+    if (!rf)
+        return NULL;
+
+    rf->refcnt = 1;
+    rf->name = strdup(name);
+    rf->text = malloc(len + 1);
+    if (!rf->name || !rf->text) {
+        rules_file_free(rf);
+        return NULL;
+    }
+    memcpy(rf->text, string, len);
+    rf->text[len] = '\0';
+
+    memset(&c, 0, sizeof(c));
+    c.ctx = ctx;
+    c.rf = rf;
+
+    ok = compiler_compile(&c, len) && rules_file_index_groups(rf, &c.groups);
+
+    darray_foreach(group, c.groups)
+        darray_free(group->elements);
+    darray_free(c.groups);
+
+    if (!ok) {
+        rules_file_free(rf);
+        return NULL;
+    }
+
+    return rf;
+}
+
+/***====================================================================***/
+
+/*
+ * This is the object used to match a given RMLVO against a compiled
+ * rules file and aggragate the results in a KcCGST.
+ */
+struct matcher {
+    struct xkb_context *ctx;
+    const struct rules_file *rf;
+    /* Input.*/
+    struct rule_names rmlvo;
+    /* The rule being applied. */
+    const struct rule *rule;
+    /* The rules of the current rule set which may match. */
+    darray_uint candidates;
+    /* Output. */
+    darray_char kccgst[_KCCGST_NUM_ENTRIES];
+};
+
+static struct sval
+strip_spaces(struct sval v)
+{
+    while (v.len > 0 && isspace(v.start[0])) { v.len--; v.start++; }
+    while (v.len > 0 && isspace(v.start[v.len - 1])) v.len--;
+    return v;
+}
+
+static darray_mlvo_value
+split_comma_separated_string(const char *s)
+{
+    darray_mlvo_value arr = darray_new();
+    struct mlvo_value val = { { NULL, 0 }, XKB_ATOM_NONE, NULL };
+
+    /*
+     * Make sure the array returned by this function always includes at
+     * least one value, e.g. "" -> { "" } and "," -> { "", "" }.
+     */
+
+    if (!s) {
+        darray_append(arr, val);
+        return arr;
+    }
+
+    while (true) {
+        val.sval.start = s; val.sval.len = 0;
+        while (*s != '\0' && *s != ',') { s++; val.sval.len++; }
+        val.sval = strip_spaces(val.sval);
+        darray_append(arr, val);
+        if (*s == '\0') break;
+        if (*s == ',') s++;
+    }
+
+    return arr;
+}
+
+/*
+ * Find the atom of @val, without interning it: if it isn't interned yet,
+ * no rule has it.
+ */
+static void
+matcher_resolve_value(struct matcher *m, struct mlvo_value *val)
+{
+    val->atom = xkb_atom_lookup_len(m->ctx, val->sval.start, val->sval.len);
+    val->groups = rules_file_value_groups(m->rf, val->atom);
+}
+
+static struct matcher *
+matcher_new(struct xkb_context *ctx, const struct rules_file *rf,
+            const struct xkb_rule_names *rmlvo)
+{
+    struct mlvo_value *val;
+    struct matcher *m = calloc(1, sizeof(*m));
+    if (!m)
+        return NULL;
+
+    m->ctx = ctx;
+    m->rf = rf;
+    m->rmlvo.model.sval.start = rmlvo->model;
+    m->rmlvo.model.sval.len = rmlvo->model ? strlen(rmlvo->model) : 0;
+    m->rmlvo.layouts = split_comma_separated_string(rmlvo->layout);
+    m->rmlvo.variants = split_comma_separated_string(rmlvo->variant);
+    m->rmlvo.options = split_comma_separated_string(rmlvo->options);
+
+    matcher_resolve_value(m, &m->rmlvo.model);
+    darray_foreach(val, m->rmlvo.layouts)
+        matcher_resolve_value(m, val);
+    darray_foreach(val, m->rmlvo.variants)
+        matcher_resolve_value(m, val);
+    darray_foreach(val, m->rmlvo.options)
+        matcher_resolve_value(m, val);
+
+    return m;
+}
+
+static void
+matcher_free(struct matcher *m)
+{
+    enum rules_kccgst kccgst;
+
+    if (!m)
+        return;
+    darray_free(m->rmlvo.layouts);
+    darray_free(m->rmlvo.variants);
+    darray_free(m->rmlvo.options);
+    darray_free(m->candidates);
+    for (kccgst = 0; kccgst < _KCCGST_NUM_ENTRIES; kccgst++)
+        darray_free(m->kccgst[kccgst]);
+    free(m);
+}
+
+#define matcher_error1(matcher, msg) \
+    log_warn(matcher->ctx, "rules/%s:%d:%d: " msg "\n", \
+             matcher->rf->name, matcher->rule->loc.line, \
+             matcher->rule->loc.column)
+
+/*
+ * This following is very stupid, but this is how it works.
+ * See the "Notes" section in the overview above.
+ */
+static bool
+matcher_mapping_applies(struct matcher *m, const struct mapping *mapping)
+{
+    if (mapping->defined_mlvo_mask & (1 << MLVO_LAYOUT)) {
+        if (mapping->layout_idx == XKB_LAYOUT_INVALID) {
+            if (darray_size(m->rmlvo.layouts) > 1)
+                return false;
+        }
+        else {
+            if (darray_size(m->rmlvo.layouts) == 1 ||
+                mapping->layout_idx >= darray_size(m->rmlvo.layouts))
+                return false;
+        }
+    }
+
+    if (mapping->defined_mlvo_mask & (1 << MLVO_VARIANT)) {
+        if (mapping->variant_idx == XKB_LAYOUT_INVALID) {
+            if (darray_size(m->rmlvo.variants) > 1)
+                return false;
+        }
+        else {
+            if (darray_size(m->rmlvo.variants) == 1 ||
+                mapping->variant_idx >= darray_size(m->rmlvo.variants))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/* The value to match against, for values other than options. */
+static const struct mlvo_value *
+matcher_mlvo_value(struct matcher *m, const struct mapping *mapping,
+                   enum rules_mlvo mlvo)
+{
+    xkb_layout_index_t idx;
+
+    if (mlvo == MLVO_LAYOUT) {
+        idx = mapping->layout_idx;
+        idx = (idx == XKB_LAYOUT_INVALID ? 0 : idx);
+        return &darray_item(m->rmlvo.layouts, idx);
+    }
+
+    if (mlvo == MLVO_VARIANT) {
+        idx = mapping->variant_idx;
+        idx = (idx == XKB_LAYOUT_INVALID ? 0 : idx);
+        return &darray_item(m->rmlvo.variants, idx);
+    }
+
+    return &m->rmlvo.model;
+}
+
+static bool
+match_group(int group_idx, const struct mlvo_value *to)
+{
+    if (group_idx < 0 || !to->groups)
+        return false;
+
+    return (to->groups[group_idx / 64] >> (group_idx % 64)) & 1;
+}
+
+static bool
+match_value(const struct rule *rule, unsigned int pos,
+            const struct mlvo_value *to)
+{
+    if (rule->match_type_at_pos[pos] == MLVO_MATCH_WILDCARD)
+        return true;
+    if (rule->match_type_at_pos[pos] == MLVO_MATCH_GROUP)
+        return match_group(rule->group_at_pos[pos], to);
+    return to->atom != XKB_ATOM_NONE &&
+           rule->mlvo_value_at_pos[pos] == to->atom;
+}
+
+/*
+ * This function performs %-expansion on @value (see overview above),
+ * and appends the result to @to.
+ */
+static bool
+append_expanded_kccgst_value(struct matcher *m, darray_char *to,
+                             struct sval value)
+{
+    unsigned int i;
+    size_t original_size = darray_size(*to);
+    const char *s = value.start;
+    xkb_layout_index_t idx;
+    int consumed;
+    enum rules_mlvo mlv;
+    struct sval expanded;
+    char pfx, sfx;
+
+    /*
+     * Appending  bar to  foo ->  foo (not an error if this happens)
+     * Appending +bar to  foo ->  foo+bar
+     * Appending  bar to +foo ->  bar+foo
+     * Appending +bar to +foo -> +foo+bar
+     */
+    if (!darray_empty(*to) && s[0] != '+' && s[0] != '|') {
+        if (darray_item(*to, 0) == '+' || darray_item(*to, 0) == '|')
+            darray_prepend_items_nullterminate(*to, value.start, value.len);
+        return true;
+    }
+
+    /*
+     * Some ugly hand-lexing here, but going through the scanner is more
+     * trouble than it's worth, and the format is ugly on its own merit.
+     */
+    for (i = 0; i < value.len; ) {
+        /* Check if that's a start of an expansion. */
+        if (s[i] != '%') {
+            /* Just a normal character. */
+            darray_append_items_nullterminate(*to, &s[i++], 1);
+            continue;
+        }
+        if (++i >= value.len) goto error;
+
+        pfx = sfx = 0;
+
+        /* Check for prefix. */
+        if (s[i] == '(' || s[i] == '+' || s[i] == '|' ||
+            s[i] == '_' || s[i] == '-') {
+            pfx = s[i];
+            if (s[i] == '(') sfx = ')';
+            if (++i >= value.len) goto error;
+        }
+
+        /* Mandatory model/layout/variant specifier. */
+        switch (s[i++]) {
+        case 'm': mlv = MLVO_MODEL; break;
+        case 'l': mlv = MLVO_LAYOUT; break;
+        case 'v': mlv = MLVO_VARIANT; break;
+        default: goto error;
+        }
+
+        /* Check for index. */
+        idx = XKB_LAYOUT_INVALID;
+        if (i < value.len) {
             if (s[i] == '[') {
                 if (mlv != MLVO_LAYOUT && mlv != MLVO_VARIANT) {
                     matcher_error1(m,
@@ -913,22 +1423,22 @@ append_expanded_kccgst_value(struct matcher *m, darray_char *to,
             if (idx != XKB_LAYOUT_INVALID &&
                 idx < darray_size(m->rmlvo.layouts) &&
                 darray_size(m->rmlvo.layouts) > 1)
-                expanded = darray_item(m->rmlvo.layouts, idx);
+                expanded = darray_item(m->rmlvo.layouts, idx).sval;
             else if (idx == XKB_LAYOUT_INVALID &&
                      darray_size(m->rmlvo.layouts) == 1)
-                expanded = darray_item(m->rmlvo.layouts, 0);
+                expanded = darray_item(m->rmlvo.layouts, 0).sval;
         }
         else if (mlv == MLVO_VARIANT) {
             if (idx != XKB_LAYOUT_INVALID &&
                 idx < darray_size(m->rmlvo.variants) &&
                 darray_size(m->rmlvo.variants) > 1)
-                expanded = darray_item(m->rmlvo.variants, idx);
+                expanded = darray_item(m->rmlvo.variants, idx).sval;
             else if (idx == XKB_LAYOUT_INVALID &&
                      darray_size(m->rmlvo.variants) == 1)
-                expanded = darray_item(m->rmlvo.variants, 0);
+                expanded = darray_item(m->rmlvo.variants, 0).sval;
         }
         else if (mlv == MLVO_MODEL) {
-            expanded = m->rmlvo.model;
+            expanded = m->rmlvo.model.sval;
         }
 
         /* If we didn't get one, skip silently. */
@@ -950,288 +1460,467 @@ error:
     return false;
 }
 
-static void
-matcher_rule_verify(struct matcher *m)
-{
-    if (m->rule.num_mlvo_values != m->mapping.num_mlvo ||
-        m->rule.num_kccgst_values != m->mapping.num_kccgst) {
-        matcher_error1(m,
-                       "invalid rule: must have same number of values as mapping line;"
-                       "ignoring rule");
-        m->rule.skip = true;
-    }
-}
-
-static void
-matcher_rule_apply_if_matches(struct matcher *m)
+static bool
+matcher_rule_apply_if_matches(struct matcher *m, const struct mapping *mapping,
+                              const struct rule *rule)
 {
     unsigned int i;
     enum rules_mlvo mlvo;
     enum rules_kccgst kccgst;
-    struct sval value, *option;
-    enum mlvo_match_type match_type;
+    const struct mlvo_value *option;
     bool matched = false;
-    xkb_layout_index_t idx;
 
-    for (i = 0; i < m->mapping.num_mlvo; i++) {
-        mlvo = m->mapping.mlvo_at_pos[i];
-        value = m->rule.mlvo_value_at_pos[i];
-        match_type = m->rule.match_type_at_pos[i];
+    for (i = 0; i < mapping->num_mlvo; i++) {
+        mlvo = mapping->mlvo_at_pos[i];
 
-        if (mlvo == MLVO_MODEL) {
-            matched = match_value(m, value, m->rmlvo.model, match_type);
-        }
-        else if (mlvo == MLVO_LAYOUT) {
-            idx = m->mapping.layout_idx;
-            idx = (idx == XKB_LAYOUT_INVALID ? 0 : idx);
-            matched = match_value(m, value,
-                                  darray_item(m->rmlvo.layouts, idx),
-                                  match_type);
-        }
-        else if (mlvo == MLVO_VARIANT) {
-            idx = m->mapping.layout_idx;
-            idx = (idx == XKB_LAYOUT_INVALID ? 0 : idx);
-            matched = match_value(m, value,
-                                  darray_item(m->rmlvo.variants, idx),
-                                  match_type);
-        }
-        else if (mlvo == MLVO_OPTION) {
+        if (mlvo == MLVO_OPTION) {
             darray_foreach(option, m->rmlvo.options) {
-                matched = match_value(m, value, *option, match_type);
+                matched = match_value(rule, i, option);
                 if (matched)
                     break;
             }
         }
+        else {
+            matched = match_value(rule, i,
+                                  matcher_mlvo_value(m, mapping, mlvo));
+        }
 
         if (!matched)
-            return;
+            return false;
     }
 
-    for (i = 0; i < m->mapping.num_kccgst; i++) {
-        kccgst = m->mapping.kccgst_at_pos[i];
-        value = m->rule.kccgst_value_at_pos[i];
-        append_expanded_kccgst_value(m, &m->kccgst[kccgst], value);
+    m->rule = rule;
+    for (i = 0; i < mapping->num_kccgst; i++) {
+        kccgst = mapping->kccgst_at_pos[i];
+        append_expanded_kccgst_value(m, &m->kccgst[kccgst],
+                                     rule->kccgst_value_at_pos[i]);
     }
 
-    /*
-     * If a rule matches in a rule set, the rest of the set should be
-     * skipped. However, rule sets matching against options may contain
-     * several legitimate rules, so they are processed entirely.
-     */
-    if (!(m->mapping.defined_mlvo_mask & (1 << MLVO_OPTION)))
-        m->mapping.skip = true;
-}
-
-static enum rules_token
-gettok(struct matcher *m)
-{
-    return lex(&m->scanner, &m->val, &m->loc);
+    return true;
 }
 
-static bool
-matcher_match(struct matcher *m, const char *string, size_t len,
-              const char *file_name, struct xkb_component_names *out)
+static void
+matcher_add_bucket(struct matcher *m, const struct rule_set *set,
+                   const struct mlvo_value *value)
 {
-    enum rules_token tok;
+    unsigned int i;
 
-    if (!m)
-        return false;
+    if (set->num_buckets == 0 || value->atom == XKB_ATOM_NONE)
+        return;
 
-    scanner_init(&m->scanner, m->ctx, string, len, file_name);
+    for (i = set->buckets[hash_atom(value->atom) & (set->num_buckets - 1)];
+         i != RULE_NONE;
+         i = darray_item(set->rules, i).next_in_bucket)
+        darray_append(m->candidates, i);
+}
 
-initial:
-    switch (tok = gettok(m)) {
-    case TOK_BANG:
-        goto bang;
-    case TOK_END_OF_LINE:
-        goto initial;
-    case TOK_END_OF_FILE:
-        goto finish;
-    default:
-        goto unexpected;
-    }
+static int
+cmp_rule_index(const void *a, const void *b)
+{
+    unsigned int ia = *(const unsigned int *) a;
+    unsigned int ib = *(const unsigned int *) b;
 
-bang:
-    switch (tok = gettok(m)) {
-    case TOK_GROUP_NAME:
-        matcher_group_start_new(m, m->val.string);
-        goto group_name;
-    case TOK_IDENTIFIER:
-        matcher_mapping_start_new(m);
-        matcher_mapping_set_mlvo(m, m->val.string);
-        goto mapping_mlvo;
-    default:
-        goto unexpected;
-    }
+    return (ia > ib) - (ia < ib);
+}
 
-group_name:
-    switch (tok = gettok(m)) {
-    case TOK_EQUALS:
-        goto group_element;
-    default:
-        goto unexpected;
-    }
+static void
+matcher_match_rule_set(struct matcher *m, const struct rule_set *set)
+{
+    const struct mapping *mapping = &set->mapping;
+    const struct rule *rule;
+    unsigned int i, *candidate, num_candidates;
+    const struct mlvo_value *option;
+    bool sorted = true;
 
-group_element:
-    switch (tok = gettok(m)) {
-    case TOK_IDENTIFIER:
-        matcher_group_add_element(m, m->val.string);
-        goto group_element;
-    case TOK_END_OF_LINE:
-        goto initial;
-    default:
-        goto unexpected;
-    }
+    if (!matcher_mapping_applies(m, mapping))
+        return;
 
-mapping_mlvo:
-    switch (tok = gettok(m)) {
-    case TOK_IDENTIFIER:
-        if (!m->mapping.skip)
-            matcher_mapping_set_mlvo(m, m->val.string);
-        goto mapping_mlvo;
-    case TOK_EQUALS:
-        goto mapping_kccgst;
-    default:
-        goto unexpected;
+    /*
+     * Gather the rules which may match, in the order they appear in the
+     * file, which is the order they must be applied in.
+     */
+    darray_resize(m->candidates, 0);
+    if (mapping->mlvo_at_pos[0] == MLVO_OPTION) {
+        darray_foreach(option, m->rmlvo.options)
+            matcher_add_bucket(m, set, option);
+        sorted = (darray_size(m->rmlvo.options) <= 1);
     }
-
-mapping_kccgst:
-    switch (tok = gettok(m)) {
-    case TOK_IDENTIFIER:
-        if (!m->mapping.skip)
-            matcher_mapping_set_kccgst(m, m->val.string);
-        goto mapping_kccgst;
-    case TOK_END_OF_LINE:
-        if (!m->mapping.skip)
-            matcher_mapping_verify(m);
-        goto rule_mlvo_first;
-    default:
-        goto unexpected;
+    else {
+        matcher_add_bucket(m, set,
+                           matcher_mlvo_value(m, mapping,
+                                              mapping->mlvo_at_pos[0]));
     }
 
-rule_mlvo_first:
-    switch (tok = gettok(m)) {
-    case TOK_BANG:
-        goto bang;
-    case TOK_END_OF_LINE:
-        goto rule_mlvo_first;
-    case TOK_END_OF_FILE:
-        goto finish;
-    default:
-        matcher_rule_start_new(m);
-        goto rule_mlvo_no_tok;
+    if (!darray_empty(set->unindexed)) {
+        sorted = sorted && darray_empty(m->candidates);
+        darray_append_items(m->candidates,
+                            darray_mem(set->unindexed, 0),
+                            darray_size(set->unindexed));
     }
 
-rule_mlvo:
-    tok = gettok(m);
-rule_mlvo_no_tok:
-    switch (tok) {
-    case TOK_IDENTIFIER:
-        if (!m->rule.skip)
-            matcher_rule_set_mlvo(m, m->val.string);
-        goto rule_mlvo;
-    case TOK_STAR:
-        if (!m->rule.skip)
-            matcher_rule_set_mlvo_wildcard(m);
-        goto rule_mlvo;
-    case TOK_GROUP_NAME:
-        if (!m->rule.skip)
-            matcher_rule_set_mlvo_group(m, m->val.string);
-        goto rule_mlvo;
-    case TOK_EQUALS:
-        goto rule_kccgst;
-    default:
-        goto unexpected;
+    if (!sorted) {
+        qsort(darray_mem(m->candidates, 0), darray_size(m->candidates),
+              sizeof(unsigned int), cmp_rule_index);
+
+        /* Several options may share a bucket. */
+        num_candidates = 0;
+        for (i = 0; i < darray_size(m->candidates); i++)
+            if (i == 0 || darray_item(m->candidates, i) !=
+                          darray_item(m->candidates, i - 1))
+                darray_item(m->candidates, num_candidates++) =
+                    darray_item(m->candidates, i);
+        darray_resize(m->candidates, num_candidates);
     }
 
-rule_kccgst:
-    switch (tok = gettok(m)) {
-    case TOK_IDENTIFIER:
-        if (!m->rule.skip)
-            matcher_rule_set_kccgst(m, m->val.string);
-        goto rule_kccgst;
-    case TOK_END_OF_LINE:
-        if (!m->rule.skip)
-            matcher_rule_verify(m);
-        if (!m->rule.skip)
-            matcher_rule_apply_if_matches(m);
-        goto rule_mlvo_first;
-    default:
-        goto unexpected;
-    }
+    darray_foreach(candidate, m->candidates) {
+        rule = &darray_item(set->rules, *candidate);
 
-unexpected:
-    switch (tok) {
-    case TOK_ERROR:
-        goto error;
-    default:
-        goto state_error;
+        /*
+         * If a rule matches in a rule set, the rest of the set should be
+         * skipped. However, rule sets matching against options may contain
+         * several legitimate rules, so they are processed entirely.
+         */
+        if (matcher_rule_apply_if_matches(m, mapping, rule) &&
+            !(mapping->defined_mlvo_mask & (1 << MLVO_OPTION)))
+            break;
     }
+}
 
-finish:
+static bool
+matcher_finish(struct matcher *m, struct xkb_component_names *out)
+{
     if (darray_empty(m->kccgst[KCCGST_KEYCODES]) ||
         darray_empty(m->kccgst[KCCGST_TYPES]) ||
         darray_empty(m->kccgst[KCCGST_COMPAT]) ||
         /* darray_empty(m->kccgst[KCCGST_GEOMETRY]) || */
         darray_empty(m->kccgst[KCCGST_SYMBOLS]))
-        goto error;
+        return false;
 
     out->keycodes = darray_mem(m->kccgst[KCCGST_KEYCODES], 0);
     out->types = darray_mem(m->kccgst[KCCGST_TYPES], 0);
     out->compat = darray_mem(m->kccgst[KCCGST_COMPAT], 0);
     /* out->geometry = darray_mem(m->kccgst[KCCGST_GEOMETRY], 0); */
-    darray_free(m->kccgst[KCCGST_GEOMETRY]);
     out->symbols = darray_mem(m->kccgst[KCCGST_SYMBOLS], 0);
 
+    /* They are the caller's now. */
+    darray_init(m->kccgst[KCCGST_KEYCODES]);
+    darray_init(m->kccgst[KCCGST_TYPES]);
+    darray_init(m->kccgst[KCCGST_COMPAT]);
+    darray_init(m->kccgst[KCCGST_SYMBOLS]);
+
     return true;
+}
 
-state_error:
-    matcher_error1(m, "unexpected token");
-error:
-    return false;
+/***====================================================================***/
+
+struct rules_cache {
+    bool thread_safe;
+    pthread_mutex_t lock;
+
+    darray(struct rules_file *) files;
+};
+
+struct rules_cache *
+rules_cache_new(bool thread_safe)
+{
+    struct rules_cache *cache = calloc(1, sizeof(*cache));
+
+    if (!cache)
+        return NULL;
+
+    cache->thread_safe = thread_safe;
+    pthread_mutex_init(&cache->lock, NULL);
+    darray_init(cache->files);
+    return cache;
 }
 
-bool
-xkb_components_from_rules(struct xkb_context *ctx,
-                          const struct xkb_rule_names *rmlvo,
-                          struct xkb_component_names *out)
+void
+rules_cache_free(struct rules_cache *cache)
 {
-    bool ret = false;
+    struct rules_file **rf;
+
+    if (!cache)
+        return;
+
+    darray_foreach(rf, cache->files)
+        rules_file_put(*rf);
+    darray_free(cache->files);
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+static void
+cache_lock(struct rules_cache *cache)
+{
+    if (cache->thread_safe)
+        pthread_mutex_lock(&cache->lock);
+}
+
+static void
+cache_unlock(struct rules_cache *cache)
+{
+    if (cache->thread_safe)
+        pthread_mutex_unlock(&cache->lock);
+}
+
+static struct rules_file *
+rules_cache_lookup(struct rules_cache *cache, const char *path,
+                   int64_t mtime, int64_t size)
+{
+    struct rules_file **rf, *ret = NULL;
+
+    cache_lock(cache);
+    darray_foreach(rf, cache->files) {
+        if (streq((*rf)->path, path)) {
+            if ((*rf)->mtime == mtime && (*rf)->size == size) {
+                ret = *rf;
+                refcnt_inc(&ret->refcnt);
+            }
+            break;
+        }
+    }
+    cache_unlock(cache);
+
+    return ret;
+}
+
+/*
+ * Add a compiled file and take over the reference to it. Returns a
+ * reference to the cached file, which may be another one if someone added
+ * it meanwhile.
+ */
+static struct rules_file *
+rules_cache_add(struct rules_cache *cache, struct rules_file *new)
+{
+    struct rules_file **rf;
+
+    cache_lock(cache);
+
+    darray_foreach(rf, cache->files) {
+        if (!streq((*rf)->path, new->path))
+            continue;
+
+        if ((*rf)->mtime == new->mtime && (*rf)->size == new->size) {
+            /* Someone else compiled it meanwhile. */
+            rules_file_put(new);
+        }
+        else {
+            /* Whoever still uses the old file holds a reference to it. */
+            rules_file_put(*rf);
+            *rf = new;
+        }
+        new = *rf;
+        goto out;
+    }
+
+    darray_append(cache->files, new);
+
+out:
+    refcnt_inc(&new->refcnt);
+    cache_unlock(cache);
+    return new;
+}
+
+/*
+ * Returns the rules file compiled from the file named @name, taking it
+ * from the context's cache if the file didn't change since it was
+ * compiled.  Release it with rules_file_put() when done.
+ */
+const struct rules_file *
+rules_file_get(struct xkb_context *ctx, const char *name)
+{
+    struct rules_cache *cache = xkb_context_get_rules_cache(ctx);
+    struct rules_file *rf = NULL;
+    struct mapped_file map;
     FILE *file;
     char *path;
-    int fd;
-    struct stat stat_buf;
-    char *string;
-    struct matcher *matcher;
+    int64_t mtime, size;
 
-    file = FindFileInXkbPath(ctx, rmlvo->rules, FILE_TYPE_RULES, &path);
+    file = FindFileInXkbPath(ctx, name, FILE_TYPE_RULES, &path);
     if (!file)
-        goto err_out;
+        return NULL;
 
-    fd = fileno(file);
+    /*
+     * Without a stamp, e.g. for a pipe, there is no telling whether the
+     * file changed, so it is neither looked up nor kept.
+     */
+    if (!GetFileStamp(file, &mtime, &size))
+        cache = NULL;
+
+    if (cache) {
+        rf = rules_cache_lookup(cache, path, mtime, size);
+        if (rf) {
+            log_dbg(ctx, "Using cached rules file %s\n", path);
+            goto out;
+        }
+    }
 
-    if (fstat(fd, &stat_buf) != 0) {
-        log_err(ctx, "Couldn't stat rules file\n");
-        goto err_file;
+    if (!map_file(file, &map)) {
+        log_err(ctx, "Couldn't read rules file %s: %s\n",
+                path, strerror(errno));
+        goto out;
     }
 
-    string = mmap(NULL, stat_buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
-    if (string == MAP_FAILED) {
-        log_err(ctx, "Couldn't mmap rules file (%lld bytes)\n",
-                (long long) stat_buf.st_size);
-        goto err_file;
+    rf = rules_file_compile(ctx, name, map.string, map.size);
+    unmap_file(&map);
+    if (!rf) {
+        log_err(ctx, "Couldn't compile rules file %s\n", path);
+        goto out;
     }
 
-    matcher = matcher_new(ctx, rmlvo);
-    ret = matcher_match(matcher, string, stat_buf.st_size, rmlvo->rules, out);
-    if (!ret)
-        log_err(ctx, "No components returned from XKB rules \"%s\"\n", path);
-    matcher_free(matcher);
+    rf->path = path;
+    path = NULL;
+    if (cache) {
+        rf->mtime = mtime;
+        rf->size = size;
+        rf = rules_cache_add(cache, rf);
+    }
 
-    munmap(string, stat_buf.st_size);
-err_file:
+out:
     free(path);
     fclose(file);
-err_out:
+    return rf;
+}
+
+void
+rules_file_put(const struct rules_file *rf)
+{
+    struct rules_file *mut = (struct rules_file *) rf;
+
+    if (mut && refcnt_dec(&mut->refcnt))
+        rules_file_free(mut);
+}
+
+bool
+xkb_components_from_rules_file(struct xkb_context *ctx,
+                               const struct rules_file *rf,
+                               const struct xkb_rule_names *rmlvo,
+                               struct xkb_component_names *out)
+{
+    bool ret = false;
+    struct matcher *matcher;
+    const struct rule_set *set;
+
+    matcher = matcher_new(ctx, rf, rmlvo);
+    if (matcher) {
+        darray_foreach(set, rf->rule_sets)
+            matcher_match_rule_set(matcher, set);
+        ret = matcher_finish(matcher, out);
+    }
+    if (!ret)
+        log_err(ctx, "No components returned from XKB rules \"%s\"\n",
+                rf->path);
+    matcher_free(matcher);
+
     return ret;
 }
+
+bool
+xkb_components_from_rules(struct xkb_context *ctx,
+                          const struct xkb_rule_names *rmlvo,
+                          struct xkb_component_names *out)
+{
+    const struct rules_file *rf;
+    bool ok;
+
+    rf = rules_file_get(ctx, rmlvo->rules);
+    if (!rf)
+        return false;
+
+    ok = xkb_components_from_rules_file(ctx, rf, rmlvo, out);
+    rules_file_put(rf);
+    return ok;
+}
+
+/*
+ * Match all the names against a rules file in one pass over its rule
+ * sets, so that each rule set is only brought in once for all of them.
+ */
+static size_t
+components_from_rules_file_batch(struct xkb_context *ctx,
+                                 const struct rules_file *rf,
+                                 const struct xkb_rule_names *rmlvo,
+                                 const size_t *indices, size_t num_indices,
+                                 struct xkb_component_names *out)
+{
+    struct matcher **matchers;
+    const struct rule_set *set;
+    size_t i, num_matched = 0;
+
+    matchers = calloc(num_indices, sizeof(*matchers));
+    if (!matchers) {
+        log_err(ctx, "Couldn't allocate rules matchers\n");
+        return 0;
+    }
+
+    for (i = 0; i < num_indices; i++)
+        matchers[i] = matcher_new(ctx, rf, &rmlvo[indices[i]]);
+
+    darray_foreach(set, rf->rule_sets)
+        for (i = 0; i < num_indices; i++)
+            if (matchers[i])
+                matcher_match_rule_set(matchers[i], set);
+
+    for (i = 0; i < num_indices; i++) {
+        if (matchers[i] && matcher_finish(matchers[i], &out[indices[i]]))
+            num_matched++;
+        else
+            log_err(ctx, "No components returned from XKB rules \"%s\"\n",
+                    rf->path);
+        matcher_free(matchers[i]);
+    }
+
+    free(matchers);
+    return num_matched;
+}
+
+size_t
+xkb_components_from_rules_batch(struct xkb_context *ctx,
+                                const struct xkb_rule_names *rmlvo,
+                                size_t num_names,
+                                struct xkb_component_names *out)
+{
+    const struct rules_file *rf;
+    size_t *indices;
+    bool *done;
+    size_t i, j, num_indices, num_matched = 0;
+
+    memset(out, 0, num_names * sizeof(*out));
+
+    indices = calloc(num_names, sizeof(*indices));
+    done = calloc(num_names, sizeof(*done));
+    if (!indices || !done) {
+        log_err(ctx, "Couldn't allocate rules batch\n");
+        goto out;
+    }
+
+    /* There is rarely more than one or two rules files. */
+    for (i = 0; i < num_names; i++) {
+        if (done[i])
+            continue;
+
+        indices[0] = i;
+        num_indices = 1;
+        for (j = i + 1; j < num_names; j++) {
+            if (!done[j] && streq_not_null(rmlvo[j].rules, rmlvo[i].rules)) {
+                indices[num_indices++] = j;
+                done[j] = true;
+            }
+        }
+
+        rf = rules_file_get(ctx, rmlvo[i].rules);
+        if (!rf)
+            continue;
+
+        num_matched += components_from_rules_file_batch(ctx, rf, rmlvo,
+                                                        indices, num_indices,
+                                                        out);
+        rules_file_put(rf);
+    }
+
+out:
+    free(indices);
+    free(done);
+    return num_matched;
+}
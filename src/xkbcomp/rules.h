@@ -24,9 +24,47 @@
 #ifndef XKBCOMP_RULES_H
 #define XKBCOMP_RULES_H
 
+/*
+ * A rules file compiled for matching, which may be matched against many
+ * times.  The compiled files are kept in a cache in the context.
+ */
+struct rules_file;
+
+struct rules_cache;
+
+struct rules_cache *
+rules_cache_new(bool thread_safe);
+
+void
+rules_cache_free(struct rules_cache *cache);
+
+const struct rules_file *
+rules_file_get(struct xkb_context *ctx, const char *name);
+
+void
+rules_file_put(const struct rules_file *rf);
+
+bool
+xkb_components_from_rules_file(struct xkb_context *ctx,
+                               const struct rules_file *rf,
+                               const struct xkb_rule_names *rmlvo,
+                               struct xkb_component_names *out);
+
 bool
 xkb_components_from_rules(struct xkb_context *ctx,
                           const struct xkb_rule_names *rmlvo,
                           struct xkb_component_names *out);
 
+/*
+ * Like xkb_components_from_rules(), for many names at once.  Each rules
+ * file is only gone over once for all the names which use it.  Returns
+ * the number of names which got components; the components of the
+ * others are left NULL.
+ */
+size_t
+xkb_components_from_rules_batch(struct xkb_context *ctx,
+                                const struct xkb_rule_names *rmlvo,
+                                size_t num_names,
+                                struct xkb_component_names *out);
+
 #endif
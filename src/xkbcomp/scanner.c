@@ -0,0 +1,499 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The XKB file scanner.
+ *
+ * The input is scanned in place, without copying it: identifiers and key
+ * names are interned into atoms straight from it, and only strings are
+ * copied out, as they may contain escape sequences.
+ */
+
+#include <errno.h>
+#include <limits.h>
+
+#include "xkbcomp-priv.h"
+#include "parser-priv.h"
+
+struct scanner {
+    const char *s;
+    size_t pos;
+    size_t len;
+    int line, column;
+    const char *file_name;
+    struct xkb_context *ctx;
+};
+
+static void
+scanner_init(struct scanner *s, struct xkb_context *ctx,
+             const char *string, size_t len, const char *file_name)
+{
+    s->s = string;
+    s->len = len;
+    s->pos = 0;
+    s->line = s->column = 1;
+    s->file_name = file_name;
+    s->ctx = ctx;
+}
+
+static void
+scanner_error_loc(struct scanner *s, const YYLTYPE *loc, const char *msg)
+{
+    log_err(s->ctx, "%s: line %d, column %d of %s\n", msg,
+            loc->first_line, loc->first_column,
+            s->file_name ? s->file_name : "(unknown)");
+}
+
+void
+scanner_error(YYLTYPE *loc, void *scanner, const char *msg)
+{
+    scanner_error_loc(scanner, loc, msg);
+}
+
+static inline bool
+eof(struct scanner *s)
+{
+    return s->pos >= s->len;
+}
+
+/* The character @offset characters ahead, or NUL past the end. */
+static inline char
+peek_at(struct scanner *s, size_t offset)
+{
+    return s->len - s->pos > offset ? s->s[s->pos + offset] : '\0';
+}
+
+static inline char
+peek(struct scanner *s)
+{
+    return peek_at(s, 0);
+}
+
+static inline char
+next(struct scanner *s)
+{
+    char ch = s->s[s->pos++];
+
+    if (ch == '\n') {
+        s->line++;
+        s->column = 1;
+    }
+    else {
+        s->column++;
+    }
+
+    return ch;
+}
+
+/* The scanner is case-insensitive, and only deals with ASCII. */
+static inline char
+lower(char ch)
+{
+    return ch >= 'A' && ch <= 'Z' ? ch - 'A' + 'a' : ch;
+}
+
+static inline bool
+is_space(char ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n' || ch == '\v';
+}
+
+static inline bool
+is_digit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+static inline bool
+is_xdigit(char ch)
+{
+    return is_digit(ch) || (lower(ch) >= 'a' && lower(ch) <= 'f');
+}
+
+static inline bool
+is_ident_start(char ch)
+{
+    return (lower(ch) >= 'a' && lower(ch) <= 'z') || ch == '_';
+}
+
+static inline bool
+is_ident(char ch)
+{
+    return is_ident_start(ch) || is_digit(ch);
+}
+
+static inline bool
+is_keyname(char ch)
+{
+    return is_ident(ch) || ch == '+' || ch == '-';
+}
+
+/*
+ * The keywords, in a perfect hash table: every keyword hashes to a slot
+ * of its own, so an identifier is a keyword only if it matches the one
+ * in its slot.
+ *
+ * The hash is the length plus the values below for the first, the fifth
+ * (or last, if shorter) and the last characters, all lowercase, modulo
+ * the table size. The values were found by a search; adding a keyword
+ * means finding new ones.
+ */
+#define KEYWORD_TABLE_SIZE 64
+#define KEYWORD_MIN_LEN 3
+#define KEYWORD_MAX_LEN 21
+
+struct keyword {
+    const char *name;
+    size_t len;
+    int token;
+};
+
+#define KEYWORD(name, token) { name, sizeof(name) - 1, token }
+
+static const unsigned char keyword_asso[128] = {
+    ['a'] = 49, ['c'] = 53, ['d'] = 41, ['e'] = 61, ['f'] = 62, ['g'] = 25,
+    ['h'] = 10, ['i'] = 18, ['k'] = 45, ['l'] = 35, ['m'] = 17, ['n'] = 61,
+    ['o'] = 36, ['p'] = 12, ['r'] = 11, ['s'] = 18, ['t'] = 39, ['u'] = 13,
+    ['v'] = 47, ['w'] = 28, ['x'] = 60, ['y'] = 46,
+};
+
+static const struct keyword keywords[KEYWORD_TABLE_SIZE] = {
+    [0] = KEYWORD("replace", REPLACE),
+    [2] = KEYWORD("alternate", ALTERNATE),
+    [4] = KEYWORD("function_keys", FUNCTION_KEYS),
+    [5] = KEYWORD("alphanumeric_keys", ALPHANUMERIC_KEYS),
+    [6] = KEYWORD("row", ROW),
+    [7] = KEYWORD("xkb_keycodes", XKB_KEYCODES),
+    [8] = KEYWORD("partial", PARTIAL),
+    [10] = KEYWORD("hidden", HIDDEN),
+    [11] = KEYWORD("xkb_compat_map", XKB_COMPATMAP),
+    [12] = KEYWORD("key", KEY),
+    [13] = KEYWORD("interpret", INTERPRET),
+    [15] = KEYWORD("xkb_geometry", XKB_GEOMETRY),
+    [16] = KEYWORD("xkb_layout", XKB_LAYOUT),
+    [17] = KEYWORD("shape", SHAPE),
+    [18] = KEYWORD("xkb_compatibility_map", XKB_COMPATMAP),
+    [20] = KEYWORD("modmap", MODIFIER_MAP),
+    [21] = KEYWORD("keys", KEYS),
+    [23] = KEYWORD("alternate_group", ALTERNATE_GROUP),
+    [24] = KEYWORD("action", ACTION_TOK),
+    [26] = KEYWORD("alias", ALIAS),
+    [27] = KEYWORD("indicator", INDICATOR),
+    [28] = KEYWORD("augment", AUGMENT),
+    [31] = KEYWORD("virtual_modifiers", VIRTUAL_MODS),
+    [34] = KEYWORD("xkb_compat", XKB_COMPATMAP),
+    [35] = KEYWORD("include", INCLUDE),
+    [36] = KEYWORD("default", DEFAULT),
+    [37] = KEYWORD("type", TYPE),
+    [38] = KEYWORD("virtual", VIRTUAL),
+    [39] = KEYWORD("modifier_map", MODIFIER_MAP),
+    [40] = KEYWORD("section", SECTION),
+    [41] = KEYWORD("solid", SOLID),
+    [43] = KEYWORD("xkb_symbols", XKB_SYMBOLS),
+    [45] = KEYWORD("xkb_semantics", XKB_SEMANTICS),
+    [46] = KEYWORD("modifier_keys", MODIFIER_KEYS),
+    [47] = KEYWORD("logo", LOGO),
+    [48] = KEYWORD("xkb_compatibility", XKB_COMPATMAP),
+    [52] = KEYWORD("override", OVERRIDE),
+    [53] = KEYWORD("mod_map", MODIFIER_MAP),
+    [54] = KEYWORD("group", GROUP),
+    [57] = KEYWORD("text", TEXT),
+    [58] = KEYWORD("outline", OUTLINE),
+    [59] = KEYWORD("keypad_keys", KEYPAD_KEYS),
+    [60] = KEYWORD("overlay", OVERLAY),
+    [62] = KEYWORD("xkb_types", XKB_TYPES),
+    [63] = KEYWORD("xkb_keymap", XKB_KEYMAP),
+};
+
+/* The identifier's token if it is a keyword, or -1. */
+static int
+keyword_to_token(const char *string, size_t len)
+{
+    const struct keyword *keyword;
+    unsigned int hash;
+
+    if (len < KEYWORD_MIN_LEN || len > KEYWORD_MAX_LEN)
+        return -1;
+
+    hash = len +
+           keyword_asso[(unsigned char) lower(string[0])] +
+           keyword_asso[(unsigned char) lower(string[MIN(4, len - 1)])] +
+           keyword_asso[(unsigned char) lower(string[len - 1])];
+    keyword = &keywords[hash % KEYWORD_TABLE_SIZE];
+
+    if (keyword->len != len || strncasecmp(keyword->name, string, len) != 0)
+        return -1;
+
+    return keyword->token;
+}
+
+/*
+ * Like strtoul(), saturating on overflow, but the digits needn't be
+ * followed by anything.
+ */
+static unsigned long
+parse_number(const char *string, size_t len, unsigned int base)
+{
+    unsigned long value = 0;
+    unsigned int digit;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        digit = is_digit(string[i]) ? string[i] - '0' :
+                                      lower(string[i]) - 'a' + 10;
+        if (digit >= base)
+            break;
+        if (value > (ULONG_MAX - digit) / base)
+            return ULONG_MAX;
+        value = value * base + digit;
+    }
+
+    return value;
+}
+
+static int
+lex_number(struct scanner *s, YYSTYPE *val)
+{
+    const char *start = s->s + s->pos;
+    size_t len = 0;
+
+    if (peek(s) == '0' && lower(peek_at(s, 1)) == 'x' &&
+        is_xdigit(peek_at(s, 2))) {
+        next(s); next(s);
+        start += 2;
+        while (is_xdigit(peek(s))) {
+            next(s);
+            len++;
+        }
+        val->num = parse_number(start, len, 16);
+        return INTEGER;
+    }
+
+    while (is_digit(peek(s))) {
+        next(s);
+        len++;
+    }
+
+    if (peek(s) == '.' && is_digit(peek_at(s, 1))) {
+        next(s);
+        while (is_digit(peek(s)))
+            next(s);
+        /* Floats are truncated. */
+        val->num = parse_number(start, len, 10);
+        return FLOAT;
+    }
+
+    /* A leading 0 means octal, as in C. */
+    val->num = parse_number(start, len, start[0] == '0' ? 8 : 10);
+    return INTEGER;
+}
+
+/*
+ * Copy out the string, up to the closing quote, handling escape
+ * sequences.
+ */
+static int
+lex_string(struct scanner *s, YYSTYPE *val, const YYLTYPE *loc)
+{
+    const char *end;
+    char *str, *out;
+    unsigned int digits, value, i;
+    char ch;
+
+    end = memchr(s->s + s->pos, '"', s->len - s->pos);
+    if (!end) {
+        scanner_error_loc(s, loc, "Unterminated string");
+        return ERROR_TOK;
+    }
+
+    str = out = malloc(end - (s->s + s->pos) + 1);
+    if (!str) {
+        scanner_error_loc(s, loc, "Couldn't allocate string");
+        return ERROR_TOK;
+    }
+
+    while (s->s + s->pos < end) {
+        ch = next(s);
+        if (ch != '\\') {
+            *out++ = ch;
+            continue;
+        }
+
+        /* Octal escape, of up to 3 digits. */
+        for (digits = 0; is_digit(peek_at(s, digits)); digits++);
+        if (digits > 0) {
+            value = 0;
+            for (i = 0; i < digits && i < 3; i++) {
+                ch = next(s);
+                if (ch > '7')
+                    break;
+                value = value * 8 + (ch - '0');
+            }
+            if (i < digits || value > 0xff) {
+                scanner_error_loc(s, loc, "Illegal octal escape");
+                free(str);
+                return ERROR_TOK;
+            }
+            *out++ = value;
+            continue;
+        }
+
+        switch (lower(peek(s))) {
+        case 'n': *out++ = '\n'; break;
+        case 't': *out++ = '\t'; break;
+        case 'r': *out++ = '\r'; break;
+        case 'b': *out++ = '\b'; break;
+        case 'f': *out++ = '\f'; break;
+        case 'v': *out++ = '\v'; break;
+        case 'e': *out++ = '\033'; break;
+        default:
+            /* Not an escape sequence; keep the backslash. */
+            if (s->s + s->pos < end)
+                log_warn(s->ctx,
+                         "Unknown escape sequence \\%c in string: "
+                         "line %d, column %d of %s\n",
+                         peek(s), s->line, s->column - 1,
+                         s->file_name ? s->file_name : "(unknown)");
+            *out++ = '\\';
+            continue;
+        }
+        next(s);
+    }
+
+    /* The closing quote. */
+    next(s);
+
+    *out = '\0';
+    val->str = str;
+    return STRING;
+}
+
+int
+_xkbcommon_lex(YYSTYPE *val, YYLTYPE *loc, void *scanner)
+{
+    struct scanner *s = scanner;
+    const char *start;
+    size_t len;
+    int token;
+
+skip_more_whitespace_and_comments:
+    while (!eof(s) && is_space(peek(s)))
+        next(s);
+
+    if (peek(s) == '#' || (peek(s) == '/' && peek_at(s, 1) == '/')) {
+        while (!eof(s) && peek(s) != '\n')
+            next(s);
+        goto skip_more_whitespace_and_comments;
+    }
+
+    if (eof(s))
+        return END_OF_FILE;
+
+    loc->first_line = loc->last_line = s->line;
+    loc->first_column = loc->last_column = s->column;
+
+    start = s->s + s->pos;
+
+    /* Key name, without the brackets. */
+    if (peek(s) == '<' && is_keyname(peek_at(s, 1))) {
+        for (len = 1; is_keyname(peek_at(s, len)); len++);
+        if (peek_at(s, len) == '>') {
+            s->pos += len + 1;
+            s->column += len + 1;
+            val->sval = xkb_atom_intern_len(s->ctx, start + 1, len - 1);
+            return KEYNAME;
+        }
+        scanner_error_loc(s, loc, "Unterminated key name");
+        return ERROR_TOK;
+    }
+
+    /* Keyword or identifier. */
+    if (is_ident_start(peek(s))) {
+        for (len = 1; is_ident(peek_at(s, len)); len++);
+        s->pos += len;
+        s->column += len;
+
+        token = keyword_to_token(start, len);
+        if (token >= 0)
+            return token;
+
+        val->sval = xkb_atom_intern_len(s->ctx, start, len);
+        return IDENT;
+    }
+
+    if (is_digit(peek(s)))
+        return lex_number(s, val);
+
+    switch (next(s)) {
+    case '"': return lex_string(s, val, loc);
+    case '=': return EQUALS;
+    case '+': return PLUS;
+    case '-': return MINUS;
+    case '/': return DIVIDE;
+    case '*': return TIMES;
+    case '{': return OBRACE;
+    case '}': return CBRACE;
+    case '(': return OPAREN;
+    case ')': return CPAREN;
+    case '[': return OBRACKET;
+    case ']': return CBRACKET;
+    case '.': return DOT;
+    case ',': return COMMA;
+    case ';': return SEMI;
+    case '!': return EXCLAM;
+    case '~': return INVERT;
+    }
+
+    return ERROR_TOK;
+}
+
+XkbFile *
+XkbParseString(struct xkb_context *ctx, const char *string, size_t len,
+               const char *file_name)
+{
+    struct scanner scanner;
+
+    scanner_init(&scanner, ctx, string, len, file_name);
+    return parse(ctx, &scanner, NULL);
+}
+
+XkbFile *
+XkbParseFile(struct xkb_context *ctx, FILE *file,
+             const char *file_name, const char *map)
+{
+    struct scanner scanner;
+    struct mapped_file mf;
+    XkbFile *xkb_file;
+
+    if (!map_file(file, &mf)) {
+        log_err(ctx, "Couldn't read XKB file %s: %s\n",
+                file_name, strerror(errno));
+        return NULL;
+    }
+
+    scanner_init(&scanner, ctx, mf.string, mf.size, file_name);
+    xkb_file = parse(ctx, &scanner, map);
+
+    unmap_file(&mf);
+    return xkb_file;
+}
@@ -178,6 +178,8 @@ typedef struct {
     enum merge_mode merge;
     xkb_layout_index_t explicit_group;
     darray(KeyInfo) keys;
+    /* The index in keys of each key name. */
+    struct atom_map keys_by_name;
     KeyInfo dflt;
     ActionsInfo *actions;
     darray(xkb_atom_t) group_names;
@@ -207,6 +209,7 @@ ClearSymbolsInfo(SymbolsInfo * info)
     darray_foreach(keyi, info->keys)
         ClearKeyInfo(keyi);
     darray_free(info->keys);
+    atom_map_free(&info->keys_by_name);
     darray_free(info->group_names);
     darray_free(info->modMaps);
     ClearKeyInfo(&info->dflt);
@@ -419,20 +422,26 @@ static bool
 AddKeySymbols(SymbolsInfo *info, KeyInfo *keyi)
 {
     xkb_atom_t real_name;
-    KeyInfo *iter;
+    unsigned int idx;
 
     /*
      * Don't keep aliases in the keys array; this guarantees that
-     * searching for keys to merge with by straight comparison (see the
-     * following loop) is enough, and we won't get multiple KeyInfo's
-     * for the same key because of aliases.
+     * looking up keys to merge with by name is enough, and we won't get
+     * multiple KeyInfo's for the same key because of aliases.
      */
     if (FindKeyNameForAlias(info->keymap, keyi->name, &real_name))
         keyi->name = real_name;
 
-    darray_foreach(iter, info->keys)
-        if (iter->name == keyi->name)
-            return MergeKeys(info, iter, keyi);
+    if (atom_map_lookup(&info->keys_by_name, keyi->name, &idx))
+        return MergeKeys(info, &darray_item(info->keys, idx), keyi);
+
+    if (!atom_map_insert(&info->keys_by_name, keyi->name,
+                         darray_size(info->keys))) {
+        log_err(info->keymap->ctx,
+                "Couldn't allocate symbols for key %s\n",
+                KeyInfoText(info, keyi));
+        return false;
+    }
 
     darray_append(info->keys, *keyi);
     InitKeyInfo(info->keymap->ctx, keyi, info->file_id);
@@ -545,8 +554,12 @@ HandleIncludeSymbols(SymbolsInfo *info, IncludeStmt *stmt)
     InitSymbolsInfo(&included, info->keymap, info->file_id, info->actions);
     if (stmt->stmt) {
         free(included.name);
-        included.name = stmt->stmt;
-        stmt->stmt = NULL;
+        included.name = strdup(stmt->stmt);
+        if (!included.name) {
+            info->errorCount += 10;
+            ClearSymbolsInfo(&included);
+            return false;
+        }
     }
 
     for (; stmt; stmt = stmt->next_incl) {
@@ -698,7 +711,7 @@ AddSymbolsToKey(SymbolsInfo *info, KeyInfo *keyi, ExprDef *arrayNdx,
         return false;
     }
 
-    nLevels = darray_size(value->value.list.symsMapIndex);
+    nLevels = value->value.list.num_levels;
     if (darray_size(groupi->levels) < nLevels)
         darray_resize0(groupi->levels, nLevels);
 
@@ -708,14 +721,15 @@ AddSymbolsToKey(SymbolsInfo *info, KeyInfo *keyi, ExprDef *arrayNdx,
         unsigned int sym_index;
         struct xkb_level *leveli = &darray_item(groupi->levels, i);
 
-        sym_index = darray_item(value->value.list.symsMapIndex, i);
-        leveli->num_syms = darray_item(value->value.list.symsNumEntries, i);
+        sym_index = value->value.list.symsMapIndex[i];
+        leveli->num_syms = value->value.list.symsNumEntries[i];
         if (leveli->num_syms > 1)
             leveli->u.syms = calloc(leveli->num_syms, sizeof(*leveli->u.syms));
 
         for (j = 0; j < leveli->num_syms; j++) {
-            char *sym_name = darray_item(value->value.list.syms,
-                                         sym_index + j);
+            const char *sym_name =
+                xkb_atom_text(info->keymap->ctx,
+                              value->value.list.syms[sym_index + j]);
             xkb_keysym_t keysym;
 
             if (!LookupKeysym(sym_name, &keysym)) {
@@ -1447,6 +1461,7 @@ CopySymbolsDef(SymbolsInfo *info, KeyInfo *keyi)
 {
     struct xkb_keymap *keymap = info->keymap;
     struct xkb_key *key;
+    struct xkb_key_aux *aux;
     GroupInfo *groupi;
     const GroupInfo *group0;
     xkb_layout_index_t i;
@@ -1462,6 +1477,7 @@ CopySymbolsDef(SymbolsInfo *info, KeyInfo *keyi)
                 KeyInfoText(info, keyi));
         return false;
     }
+    aux = XkbKeyAux(keymap, key);
 
     /* Find the range of groups we need. */
     key->num_groups = 0;
@@ -1512,7 +1528,8 @@ CopySymbolsDef(SymbolsInfo *info, KeyInfo *keyi)
         }
         darray_resize0(groupi->levels, type->num_levels);
 
-        key->groups[i].explicit_type = explicit_type;
+        if (explicit_type)
+            aux->explicit_types |= (1u << i);
         key->groups[i].type = type;
     }
 
@@ -1526,18 +1543,18 @@ CopySymbolsDef(SymbolsInfo *info, KeyInfo *keyi)
     key->out_of_range_group_action = keyi->out_of_range_group_action;
 
     if (keyi->defined & KEY_FIELD_VMODMAP) {
-        key->vmodmap = keyi->vmodmap;
-        key->explicit |= EXPLICIT_VMODMAP;
+        aux->vmodmap = keyi->vmodmap;
+        aux->explicit |= EXPLICIT_VMODMAP;
     }
 
     if (keyi->repeat != KEY_REPEAT_UNDEFINED) {
         key->repeats = (keyi->repeat == KEY_REPEAT_YES);
-        key->explicit |= EXPLICIT_REPEAT;
+        aux->explicit |= EXPLICIT_REPEAT;
     }
 
     darray_foreach(groupi, keyi->groups) {
         if (groupi->defined & GROUP_FIELD_ACTS) {
-            key->explicit |= EXPLICIT_INTERP;
+            aux->explicit |= EXPLICIT_INTERP;
             break;
         }
     }
@@ -1574,7 +1591,7 @@ CopyModMapDef(SymbolsInfo *info, ModMapEntry *entry)
         }
     }
 
-    key->modmap |= (1 << entry->modifier);
+    XkbKeyAux(keymap, key)->modmap |= (1 << entry->modifier);
     return true;
 }
 
@@ -1597,13 +1614,15 @@ CopySymbolsToKeymap(struct xkb_keymap *keymap, SymbolsInfo *info)
 
     if (xkb_context_get_log_verbosity(keymap->ctx) > 3) {
         xkb_foreach_key(key, keymap) {
-            if (key->name == XKB_ATOM_NONE)
+            xkb_atom_t name = XkbKeyAux(keymap, key)->name;
+
+            if (name == XKB_ATOM_NONE)
                 continue;
 
             if (key->num_groups < 1)
                 log_info(keymap->ctx,
                          "No symbols defined for %s\n",
-                         KeyNameText(keymap->ctx, key->name));
+                         KeyNameText(keymap->ctx, name));
         }
     }
 
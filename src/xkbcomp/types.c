@@ -323,8 +323,12 @@ HandleIncludeKeyTypes(KeyTypesInfo *info, IncludeStmt *stmt)
     InitKeyTypesInfo(&included, info->keymap, info->file_id);
     if (stmt->stmt) {
         free(included.name);
-        included.name = stmt->stmt;
-        stmt->stmt = NULL;
+        included.name = strdup(stmt->stmt);
+        if (!included.name) {
+            info->errorCount += 10;
+            ClearKeyTypesInfo(&included);
+            return false;
+        }
     }
 
     for (; stmt; stmt = stmt->next_incl) {
@@ -788,6 +792,7 @@ CopyDefToKeyType(KeyTypeInfo *def, struct xkb_key_type *type)
     type->num_entries = darray_size(def->entries);
     darray_init(def->entries);
     type->name = def->name;
+    type->num_level_names = darray_size(def->level_names);
     type->level_names = darray_mem(def->level_names, 0);
     darray_init(def->level_names);
 }
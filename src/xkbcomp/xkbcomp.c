@@ -27,8 +27,12 @@
  *          Daniel Stone <daniel@fooishbar.org>
  */
 
+#include <pthread.h>
+#include <unistd.h>
+
 #include "xkbcomp-priv.h"
 #include "rules.h"
+#include "disk-cache.h"
 
 static struct xkb_keymap *
 compile_keymap_file(struct xkb_context *ctx, XkbFile *file,
@@ -59,39 +63,55 @@ err:
     return NULL;
 }
 
-XKB_EXPORT struct xkb_keymap *
-xkb_keymap_new_from_names(struct xkb_context *ctx,
-                          const struct xkb_rule_names *rmlvo_in,
-                          enum xkb_keymap_compile_flags flags)
+static void
+rmlvo_fill_defaults(struct xkb_rule_names *rmlvo)
+{
+    if (isempty(rmlvo->rules))
+        rmlvo->rules = DEFAULT_XKB_RULES;
+    if (isempty(rmlvo->model))
+        rmlvo->model = DEFAULT_XKB_MODEL;
+    if (isempty(rmlvo->layout))
+        rmlvo->layout = DEFAULT_XKB_LAYOUT;
+}
+
+/* A rules file shared by all the jobs of a batch which use it. */
+struct batch_rules {
+    const char *name;
+    const struct rules_file *file;
+    /* The files looked up to open it, for the disk cache. */
+    darray_file_dep deps;
+};
+
+static struct xkb_keymap *
+compile_rmlvo_uncached(struct xkb_context *ctx,
+                       const struct xkb_rule_names *rmlvo,
+                       const struct batch_rules *rules,
+                       enum xkb_keymap_compile_flags flags)
 {
     bool ok;
     struct xkb_component_names kccgst;
-    struct xkb_rule_names rmlvo = *rmlvo_in;
     XkbFile *file;
     struct xkb_keymap *keymap;
 
-    if (isempty(rmlvo.rules))
-        rmlvo.rules = DEFAULT_XKB_RULES;
-    if (isempty(rmlvo.model))
-        rmlvo.model = DEFAULT_XKB_MODEL;
-    if (isempty(rmlvo.layout))
-        rmlvo.layout = DEFAULT_XKB_LAYOUT;
-
     log_dbg(ctx,
             "Compiling from RMLVO: rules '%s', model '%s', layout '%s', "
             "variant '%s', options '%s'\n",
-            strnull(rmlvo.rules), strnull(rmlvo.model),
-            strnull(rmlvo.layout), strnull(rmlvo.variant),
-            strnull(rmlvo.options));
+            strnull(rmlvo->rules), strnull(rmlvo->model),
+            strnull(rmlvo->layout), strnull(rmlvo->variant),
+            strnull(rmlvo->options));
 
-    ok = xkb_components_from_rules(ctx, &rmlvo, &kccgst);
+    if (rules)
+        ok = xkb_components_from_rules_file(ctx, rules->file, rmlvo,
+                                            &kccgst);
+    else
+        ok = xkb_components_from_rules(ctx, rmlvo, &kccgst);
     if (!ok) {
         log_err(ctx,
                 "Couldn't look up rules '%s', model '%s', layout '%s', "
                 "variant '%s', options '%s'\n",
-                strnull(rmlvo.rules), strnull(rmlvo.model),
-                strnull(rmlvo.layout), strnull(rmlvo.variant),
-                strnull(rmlvo.options));
+                strnull(rmlvo->rules), strnull(rmlvo->model),
+                strnull(rmlvo->layout), strnull(rmlvo->variant),
+                strnull(rmlvo->options));
         return NULL;
     }
 
@@ -118,6 +138,201 @@ xkb_keymap_new_from_names(struct xkb_context *ctx,
     return keymap;
 }
 
+/*
+ * Compile a keymap from RMLVO names, which must already have their
+ * defaults filled in. If @rules is not NULL, it is the already opened
+ * rules file named by the names.
+ */
+static struct xkb_keymap *
+compile_rmlvo(struct xkb_context *ctx, const struct xkb_rule_names *rmlvo,
+              const struct batch_rules *rules,
+              enum xkb_keymap_compile_flags flags)
+{
+    struct xkb_keymap *keymap;
+    darray_file_dep deps = darray_new();
+
+    keymap = xkb_context_keymap_cache_lookup(ctx, rmlvo, flags);
+    if (keymap)
+        return keymap;
+
+    if (!xkb_context_get_keymap_cache_dir(ctx)) {
+        keymap = compile_rmlvo_uncached(ctx, rmlvo, rules, flags);
+    }
+    else {
+        keymap = disk_cache_load(ctx, rmlvo, flags);
+        if (!keymap) {
+            if (rules)
+                AppendFileDeps(&deps, &rules->deps);
+
+            RecordFileDeps(ctx, &deps);
+            keymap = compile_rmlvo_uncached(ctx, rmlvo, rules, flags);
+            RecordFileDeps(ctx, NULL);
+
+            if (keymap)
+                disk_cache_store(ctx, rmlvo, flags, &deps, keymap);
+            FreeFileDeps(&deps);
+        }
+    }
+
+    if (keymap)
+        xkb_context_keymap_cache_add(ctx, rmlvo, flags, keymap);
+
+    return keymap;
+}
+
+XKB_EXPORT struct xkb_keymap *
+xkb_keymap_new_from_names(struct xkb_context *ctx,
+                          const struct xkb_rule_names *rmlvo_in,
+                          enum xkb_keymap_compile_flags flags)
+{
+    struct xkb_rule_names rmlvo = *rmlvo_in;
+
+    rmlvo_fill_defaults(&rmlvo);
+
+    return compile_rmlvo(ctx, &rmlvo, NULL, flags);
+}
+
+struct batch_job {
+    struct xkb_rule_names rmlvo;
+    struct batch_rules *rules;
+};
+
+struct batch {
+    struct xkb_context *ctx;
+    enum xkb_keymap_compile_flags flags;
+    struct batch_job *jobs;
+    size_t num_jobs;
+    struct xkb_keymap **out;
+    /* Index of the next job to take, shared by the workers. */
+    size_t next_job;
+    size_t num_compiled;
+};
+
+static void *
+batch_worker(void *arg)
+{
+    struct batch *batch = arg;
+    struct batch_job *job;
+    size_t i, num_compiled = 0;
+
+    for (;;) {
+        i = atomic_fetch_add_relaxed(&batch->next_job, 1);
+        if (i >= batch->num_jobs)
+            break;
+
+        job = &batch->jobs[i];
+        if (!job->rules->file) {
+            batch->out[i] = NULL;
+            continue;
+        }
+
+        batch->out[i] = compile_rmlvo(batch->ctx, &job->rmlvo,
+                                      job->rules, batch->flags);
+        if (batch->out[i])
+            num_compiled++;
+    }
+
+    atomic_fetch_add_relaxed(&batch->num_compiled, num_compiled);
+    return NULL;
+}
+
+XKB_EXPORT size_t
+xkb_keymap_new_from_names_batch(struct xkb_context *ctx,
+                                const struct xkb_rule_names *names,
+                                size_t num_names,
+                                struct xkb_keymap **out,
+                                unsigned int num_threads,
+                                enum xkb_keymap_compile_flags flags)
+{
+    struct batch batch;
+    struct batch_rules *rules;
+    size_t num_rules = 0;
+    pthread_t *threads = NULL;
+    unsigned int num_started = 0;
+    size_t i, j;
+    long num_cpus;
+
+    if (num_names == 0)
+        return 0;
+
+    batch.jobs = calloc(num_names, sizeof(*batch.jobs));
+    rules = calloc(num_names, sizeof(*rules));
+    if (!batch.jobs || !rules) {
+        log_err(ctx, "Couldn't allocate keymap batch\n");
+        free(batch.jobs);
+        free(rules);
+        memset(out, 0, num_names * sizeof(*out));
+        return 0;
+    }
+
+    /*
+     * Get each distinct rules file once, up front; the workers then only
+     * need to match against it. There is rarely more than one or two.
+     */
+    for (i = 0; i < num_names; i++) {
+        batch.jobs[i].rmlvo = names[i];
+        rmlvo_fill_defaults(&batch.jobs[i].rmlvo);
+
+        for (j = 0; j < num_rules; j++)
+            if (streq(rules[j].name, batch.jobs[i].rmlvo.rules))
+                break;
+
+        if (j == num_rules) {
+            rules[j].name = batch.jobs[i].rmlvo.rules;
+            if (xkb_context_get_keymap_cache_dir(ctx))
+                RecordFileDeps(ctx, &rules[j].deps);
+            rules[j].file = rules_file_get(ctx, rules[j].name);
+            RecordFileDeps(ctx, NULL);
+            num_rules++;
+        }
+
+        batch.jobs[i].rules = &rules[j];
+    }
+
+    batch.ctx = ctx;
+    batch.flags = flags;
+    batch.num_jobs = num_names;
+    batch.out = out;
+    batch.next_job = 0;
+    batch.num_compiled = 0;
+
+    if (num_threads == 0) {
+        num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (num_cpus > 0 ? num_cpus : 1);
+    }
+    if (num_threads > num_names)
+        num_threads = num_names;
+    if (!xkb_context_is_thread_safe(ctx))
+        num_threads = 1;
+
+    /* The calling thread is one of the workers. */
+    if (num_threads > 1)
+        threads = calloc(num_threads - 1, sizeof(*threads));
+    if (threads) {
+        while (num_started < num_threads - 1) {
+            if (pthread_create(&threads[num_started], NULL,
+                               batch_worker, &batch) != 0)
+                break;
+            num_started++;
+        }
+    }
+
+    batch_worker(&batch);
+
+    for (i = 0; i < num_started; i++)
+        pthread_join(threads[i], NULL);
+
+    for (j = 0; j < num_rules; j++) {
+        rules_file_put(rules[j].file);
+        FreeFileDeps(&rules[j].deps);
+    }
+
+    free(threads);
+    free(rules);
+    free(batch.jobs);
+    return batch.num_compiled;
+}
+
 XKB_EXPORT struct xkb_keymap *
 xkb_keymap_new_from_string(struct xkb_context *ctx,
                            const char *string,
@@ -137,7 +352,7 @@ xkb_keymap_new_from_string(struct xkb_context *ctx,
         return NULL;
     }
 
-    file = XkbParseString(ctx, string, "input");
+    file = XkbParseString(ctx, string, strlen(string), "input");
     if (!file) {
         log_err(ctx, "Failed to parse input xkb file\n");
         return NULL;
@@ -148,6 +363,42 @@ xkb_keymap_new_from_string(struct xkb_context *ctx,
     return keymap;
 }
 
+XKB_EXPORT struct xkb_keymap *
+xkb_keymap_new_from_buffer(struct xkb_context *ctx,
+                           const char *buffer, size_t length,
+                           enum xkb_keymap_format format,
+                           enum xkb_keymap_compile_flags flags)
+{
+    XkbFile *file;
+    struct xkb_keymap *keymap;
+
+    if (!buffer) {
+        log_err(ctx, "No buffer specified to generate XKB keymap\n");
+        return NULL;
+    }
+
+    switch (format) {
+    case XKB_KEYMAP_FORMAT_TEXT_V1:
+        /* Like a string, the keymap ends at a NUL if there is one. */
+        file = XkbParseString(ctx, buffer, strnlen(buffer, length), "input");
+        if (!file) {
+            log_err(ctx, "Failed to parse input xkb file\n");
+            return NULL;
+        }
+
+        keymap = compile_keymap_file(ctx, file, format, flags);
+        FreeXkbFile(file);
+        return keymap;
+
+    case XKB_KEYMAP_FORMAT_BINARY_V1:
+        return keymap_new_from_binary(ctx, buffer, length, flags);
+
+    default:
+        log_err(ctx, "Unsupported keymap format %d\n", format);
+        return NULL;
+    }
+}
+
 XKB_EXPORT struct xkb_keymap *
 xkb_keymap_new_from_file(struct xkb_context *ctx,
                          FILE *file,
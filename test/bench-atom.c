@@ -0,0 +1,147 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Interns and looks up the names of all the keysyms, which are about as
+ * many strings as compiling a few keymaps interns, and reports how long
+ * each takes per string.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "test.h"
+#include "atom.h"
+
+#define BENCHMARK_ROUNDS 20
+
+struct name {
+    char *string;
+    size_t len;
+};
+
+static size_t
+make_names(struct name **names_out)
+{
+    struct name *names = NULL;
+    size_t num_names = 0, alloc = 0;
+    char buf[64];
+    xkb_keysym_t ks;
+
+    for (ks = 0; ks <= 0x1100000; ks++) {
+        /* Skip most of the Unicode keysyms, which are all alike. */
+        if (ks > 0xffff && ks < 0x1000000)
+            ks = 0x1000000;
+        if (ks >= 0x1000000 && (ks & 0xff) != 0)
+            continue;
+
+        if (xkb_keysym_get_name(ks, buf, sizeof(buf)) <= 0 ||
+            buf[0] == '0')
+            continue;
+
+        if (num_names == alloc) {
+            alloc = alloc ? alloc * 2 : 1024;
+            names = realloc(names, alloc * sizeof(*names));
+            assert(names);
+        }
+
+        names[num_names].string = strdup(buf);
+        assert(names[num_names].string);
+        names[num_names].len = strlen(buf);
+        num_names++;
+    }
+
+    *names_out = names;
+    return num_names;
+}
+
+static void
+bench(const struct name *names, size_t num_names, bool thread_safe)
+{
+    struct atom_table *table;
+    struct timespec start, stop;
+    double new_secs = 0, intern_secs = 0, lookup_secs = 0;
+    xkb_atom_t atom;
+    size_t i;
+    int round;
+
+    for (round = 0; round < BENCHMARK_ROUNDS; round++) {
+        table = atom_table_new(thread_safe);
+        assert(table);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < num_names; i++) {
+            atom = atom_intern_len(table, names[i].string, names[i].len);
+            assert(atom != XKB_ATOM_NONE);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        new_secs += test_elapsed(&start, &stop);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < num_names; i++) {
+            atom = atom_intern_len(table, names[i].string, names[i].len);
+            assert(atom != XKB_ATOM_NONE);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        intern_secs += test_elapsed(&start, &stop);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < num_names; i++) {
+            atom = atom_lookup(table, names[i].string);
+            assert(atom != XKB_ATOM_NONE);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+        lookup_secs += test_elapsed(&start, &stop);
+
+        atom_table_free(table);
+    }
+
+    fprintf(stderr, "%s table, %zu strings x %d rounds:\n",
+            thread_safe ? "thread-safe" : "single-threaded",
+            num_names, BENCHMARK_ROUNDS);
+    fprintf(stderr, "\tinterning new strings: %.1f ns/string\n",
+            new_secs * 1e9 / (num_names * BENCHMARK_ROUNDS));
+    fprintf(stderr, "\tinterning known strings: %.1f ns/string\n",
+            intern_secs * 1e9 / (num_names * BENCHMARK_ROUNDS));
+    fprintf(stderr, "\tlooking up strings: %.1f ns/string\n",
+            lookup_secs * 1e9 / (num_names * BENCHMARK_ROUNDS));
+}
+
+int
+main(void)
+{
+    struct name *names;
+    size_t num_names, i;
+
+    num_names = make_names(&names);
+    assert(num_names > 0);
+
+    bench(names, num_names, false);
+    bench(names, num_names, true);
+
+    for (i = 0; i < num_names; i++)
+        free(names[i].string);
+    free(names);
+
+    return 0;
+}
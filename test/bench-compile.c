@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include <time.h>
+
+#include "test.h"
+
+#define BENCHMARK_ROUNDS 2
+#define BENCHMARK_MAX_THREADS 8
+
+/* Every combination of these is compiled, with both the evdev and base rules. */
+static const char *layouts[] = {
+    "us", "de", "ru", "il", "ca", "in", "us,ru", "de,il", "us,ca,de",
+};
+
+static const char *models[] = {
+    "pc104", "pc105",
+};
+
+static const char *options[] = {
+    "", "ctrl:nocaps", "grp:alt_shift_toggle", "compose:ralt",
+    "grp:menu_toggle,ctrl:nocaps",
+};
+
+static const char *rules[] = {
+    "evdev", "base",
+};
+
+static size_t
+make_names(struct xkb_rule_names *names)
+{
+    size_t n = 0;
+    unsigned int r, m, l, o;
+
+    for (r = 0; r < ARRAY_SIZE(rules); r++) {
+        for (m = 0; m < ARRAY_SIZE(models); m++) {
+            for (l = 0; l < ARRAY_SIZE(layouts); l++) {
+                for (o = 0; o < ARRAY_SIZE(options); o++) {
+                    names[n].rules = rules[r];
+                    names[n].model = models[m];
+                    names[n].layout = layouts[l];
+                    names[n].variant = NULL;
+                    names[n].options = options[o];
+                    n++;
+                }
+            }
+        }
+    }
+
+    return n;
+}
+
+static void
+run(struct xkb_context *ctx, const struct xkb_rule_names *names,
+    size_t num_names, struct xkb_keymap **out, unsigned int num_threads)
+{
+    struct timespec start, stop;
+    size_t num_compiled;
+    double secs;
+    int i;
+    size_t j;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < BENCHMARK_ROUNDS; i++) {
+        num_compiled = xkb_keymap_new_from_names_batch(ctx, names, num_names,
+                                                       out, num_threads, 0);
+        assert(num_compiled == num_names);
+        for (j = 0; j < num_names; j++)
+            xkb_keymap_unref(out[j]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    secs = test_elapsed(&start, &stop);
+    fprintf(stderr, "%u threads: compiled %zu keymaps in %.9fs "
+            "(%.1f keymaps/s)\n",
+            num_threads, BENCHMARK_ROUNDS * num_names, secs,
+            BENCHMARK_ROUNDS * num_names / secs);
+}
+
+int
+main(void)
+{
+    struct xkb_context *ctx;
+    struct xkb_rule_names
+        names[ARRAY_SIZE(rules) * ARRAY_SIZE(models) *
+              ARRAY_SIZE(layouts) * ARRAY_SIZE(options)];
+    struct xkb_keymap *out[ARRAY_SIZE(names)];
+    size_t num_names;
+    unsigned int num_threads;
+
+    ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                          XKB_CONTEXT_THREAD_SAFE);
+    assert(ctx);
+    assert(xkb_context_include_path_append(ctx, test_get_path("")));
+
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_CRITICAL);
+    xkb_context_set_log_verbosity(ctx, 0);
+
+    num_names = make_names(names);
+
+    for (num_threads = 1; num_threads <= BENCHMARK_MAX_THREADS;
+         num_threads *= 2)
+        run(ctx, names, num_names, out, num_threads);
+
+    xkb_context_unref(ctx);
+
+    return 0;
+}
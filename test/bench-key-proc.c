@@ -28,6 +28,7 @@
 #include "test.h"
 
 #define BENCHMARK_ITERATIONS 20000000
+#define BENCHMARK_BATCH_SIZE 32
 
 static void
 bench(struct xkb_state *state)
@@ -51,31 +52,54 @@ bench(struct xkb_state *state)
     }
 }
 
-int
-main(void)
+/*
+ * Same events as bench(), but fed through xkb_state_update_keys() in
+ * batches. The keysyms of the released keys are looked up after each
+ * batch, as a client draining its input queue would do.
+ */
+static void
+bench_batched(struct xkb_state *state)
 {
-    struct xkb_context *ctx;
-    struct xkb_keymap *keymap;
-    struct xkb_state *state;
-    struct timespec start, stop, elapsed;
+    int8_t keys[256] = { 0 };
+    struct xkb_key_event events[BENCHMARK_BATCH_SIZE];
+    xkb_keycode_t keycode;
+    xkb_keysym_t keysym;
+    int i, j, n = 0;
 
-    ctx = test_get_context();
-    assert(ctx);
+    for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        keycode = (rand() % (255 - 9)) + 9;
+        events[n].keycode = keycode;
+        events[n].direction = keys[keycode] ? XKB_KEY_UP : XKB_KEY_DOWN;
+        keys[keycode] = !keys[keycode];
+        n++;
+
+        if (n == BENCHMARK_BATCH_SIZE || i == BENCHMARK_ITERATIONS - 1) {
+            xkb_state_update_keys(state, events, n, NULL);
+            for (j = 0; j < n; j++) {
+                if (events[j].direction != XKB_KEY_UP)
+                    continue;
+                keysym = xkb_state_key_get_one_sym(state, events[j].keycode);
+                (void) keysym;
+            }
+            n = 0;
+        }
+    }
+}
 
-    keymap = test_compile_rules(ctx, "evdev", "pc104", "us,ru,il,de",
-                                ",,,neo", "grp:menu_toggle");
-    assert(keymap);
+static void
+run(struct xkb_keymap *keymap, unsigned int seed, const char *name,
+    void (*fn)(struct xkb_state *state))
+{
+    struct xkb_state *state;
+    struct timespec start, stop, elapsed;
 
     state = xkb_state_new(keymap);
     assert(state);
 
-    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_CRITICAL);
-    xkb_context_set_log_verbosity(ctx, 0);
-
-    srand(time(NULL));
+    srand(seed);
 
     clock_gettime(CLOCK_MONOTONIC, &start);
-    bench(state);
+    fn(state);
     clock_gettime(CLOCK_MONOTONIC, &stop);
 
     elapsed.tv_sec = stop.tv_sec - start.tv_sec;
@@ -85,10 +109,34 @@ main(void)
         elapsed.tv_sec--;
     }
 
-    fprintf(stderr, "ran %d iterations in %ld.%09lds\n",
-            BENCHMARK_ITERATIONS, elapsed.tv_sec, elapsed.tv_nsec);
+    fprintf(stderr, "%s: ran %d iterations in %ld.%09lds\n",
+            name, BENCHMARK_ITERATIONS, elapsed.tv_sec, elapsed.tv_nsec);
 
     xkb_state_unref(state);
+}
+
+int
+main(void)
+{
+    struct xkb_context *ctx;
+    struct xkb_keymap *keymap;
+    unsigned int seed;
+
+    ctx = test_get_context();
+    assert(ctx);
+
+    keymap = test_compile_rules(ctx, "evdev", "pc104", "us,ru,il,de",
+                                ",,,neo", "grp:menu_toggle");
+    assert(keymap);
+
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_CRITICAL);
+    xkb_context_set_log_verbosity(ctx, 0);
+
+    seed = time(NULL);
+
+    run(keymap, seed, "single", bench);
+    run(keymap, seed, "batched", bench_batched);
+
     xkb_keymap_unref(keymap);
     xkb_context_unref(ctx);
 
@@ -0,0 +1,151 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Compiles a few hundred keymaps and keeps them all alive, then reports
+ * how much the resident set grew per keymap and how long it takes to
+ * free them. Linux only, since it reads /proc/self/statm.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <time.h>
+
+#include "test.h"
+
+#define BENCHMARK_COPIES 4
+
+static const char *layouts[] = {
+    "us", "de", "ru", "il", "ca", "in", "us,ru", "de,il", "us,ca,de",
+};
+
+static const char *options[] = {
+    "", "ctrl:nocaps", "grp:alt_shift_toggle", "compose:ralt",
+    "grp:menu_toggle,ctrl:nocaps",
+};
+
+static const char *rules[] = {
+    "evdev", "base",
+};
+
+static size_t
+make_names(struct xkb_rule_names *names)
+{
+    size_t n = 0;
+    unsigned int r, l, o;
+
+    for (r = 0; r < ARRAY_SIZE(rules); r++) {
+        for (l = 0; l < ARRAY_SIZE(layouts); l++) {
+            for (o = 0; o < ARRAY_SIZE(options); o++) {
+                names[n].rules = rules[r];
+                names[n].model = "pc105";
+                names[n].layout = layouts[l];
+                names[n].variant = NULL;
+                names[n].options = options[o];
+                n++;
+            }
+        }
+    }
+
+    return n;
+}
+
+static long
+resident_size(void)
+{
+    FILE *file;
+    long size, resident;
+
+    file = fopen("/proc/self/statm", "r");
+    if (!file)
+        return -1;
+
+    if (fscanf(file, "%ld %ld", &size, &resident) != 2)
+        resident = -1;
+    fclose(file);
+
+    return resident < 0 ? -1 : resident * sysconf(_SC_PAGESIZE);
+}
+
+int
+main(void)
+{
+    struct xkb_context *ctx;
+    struct xkb_rule_names
+        names[ARRAY_SIZE(rules) * ARRAY_SIZE(layouts) * ARRAY_SIZE(options)];
+    struct xkb_keymap *keymaps[BENCHMARK_COPIES * ARRAY_SIZE(names)];
+    struct timespec start, stop;
+    size_t num_names, num_keymaps = 0;
+    long before, after;
+    double secs;
+    size_t i;
+    int copy;
+
+    ctx = test_get_context();
+    assert(ctx);
+
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_CRITICAL);
+    xkb_context_set_log_verbosity(ctx, 0);
+
+    num_names = make_names(names);
+
+    /* Warm up, so that the context's atom table is already filled in. */
+    for (i = 0; i < num_names; i++)
+        xkb_keymap_unref(xkb_keymap_new_from_names(ctx, &names[i], 0));
+
+    before = resident_size();
+    if (before < 0) {
+        fprintf(stderr, "Can't read the resident set size, skipping\n");
+        xkb_context_unref(ctx);
+        return 0;
+    }
+
+    for (copy = 0; copy < BENCHMARK_COPIES; copy++) {
+        for (i = 0; i < num_names; i++) {
+            keymaps[num_keymaps] = xkb_keymap_new_from_names(ctx, &names[i],
+                                                             0);
+            assert(keymaps[num_keymaps]);
+            num_keymaps++;
+        }
+    }
+
+    after = resident_size();
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < num_keymaps; i++)
+        xkb_keymap_unref(keymaps[i]);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    secs = test_elapsed(&start, &stop);
+
+    fprintf(stderr, "%zu keymaps: resident set grew by %ld bytes "
+            "(%ld bytes/keymap)\n",
+            num_keymaps, after - before, (after - before) / (long) num_keymaps);
+    fprintf(stderr, "freed them in %.6fs (%.2f us/keymap)\n",
+            secs, secs * 1e6 / num_keymaps);
+
+    xkb_context_unref(ctx);
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Parses each of the keymaps in test/data/keymaps over and over, and
+ * reports how many bytes per second that takes.
+ */
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "test.h"
+#include "xkbcomp-priv.h"
+
+#define BENCHMARK_ROUNDS 200
+
+/* Returns the number of bytes parsed, or 0 if the file doesn't parse. */
+static size_t
+bench_file(struct xkb_context *ctx, const char *name, double *secs)
+{
+    char path[256];
+    char *string;
+    size_t len;
+    struct timespec start, stop;
+    XkbFile *file;
+    int round;
+
+    snprintf(path, sizeof(path), "keymaps/%s", name);
+    string = test_read_file(path);
+    assert(string);
+    len = strlen(string);
+
+    file = XkbParseString(ctx, string, len, name);
+    if (!file) {
+        free(string);
+        return 0;
+    }
+    FreeXkbFile(file);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (round = 0; round < BENCHMARK_ROUNDS; round++) {
+        file = XkbParseString(ctx, string, len, name);
+        assert(file);
+        FreeXkbFile(file);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    *secs = test_elapsed(&start, &stop);
+
+    fprintf(stderr, "%s: %zu bytes, %.1f MB/s\n",
+            name, len, len * BENCHMARK_ROUNDS / *secs / 1e6);
+
+    free(string);
+    return len;
+}
+
+int
+main(void)
+{
+    struct xkb_context *ctx = test_get_context();
+    DIR *dir;
+    struct dirent *entry;
+    size_t name_len, len, total_len = 0;
+    double secs, total_secs = 0;
+
+    assert(ctx);
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_CRITICAL);
+
+    dir = opendir(test_get_path("keymaps"));
+    assert(dir);
+
+    while ((entry = readdir(dir))) {
+        name_len = strlen(entry->d_name);
+        if (name_len < 4 || !streq(entry->d_name + name_len - 4, ".xkb"))
+            continue;
+
+        len = bench_file(ctx, entry->d_name, &secs);
+        if (len > 0) {
+            total_len += len;
+            total_secs += secs;
+        }
+    }
+
+    closedir(dir);
+    assert(total_len > 0);
+
+    fprintf(stderr, "all keymaps, %d rounds: %.1f MB/s\n",
+            BENCHMARK_ROUNDS, total_len * BENCHMARK_ROUNDS / total_secs / 1e6);
+
+    xkb_context_unref(ctx);
+    return 0;
+}
@@ -32,6 +32,7 @@
 
 #include <limits.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -170,3 +171,10 @@ test_compile_rules(struct xkb_context *context, const char *rules,
 
     return keymap;
 }
+
+double
+test_elapsed(const struct timespec *start, const struct timespec *stop)
+{
+    return (stop->tv_sec - start->tv_sec) +
+           (stop->tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -21,13 +21,18 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <limits.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "test.h"
 #include "xkbcomp-priv.h"
 #include "rules.h"
 
 #define BENCHMARK_ITERATIONS 20000
+#define BENCHMARK_BATCH_SIZE 200
 
 struct test_data {
     /* Rules file */
@@ -88,17 +93,59 @@ test_rules(struct xkb_context *ctx, struct test_data *data)
     return passed;
 }
 
+static void
+free_components(struct xkb_component_names *kccgst)
+{
+    free(kccgst->keycodes);
+    free(kccgst->types);
+    free(kccgst->compat);
+    free(kccgst->symbols);
+}
+
+static void
+print_elapsed(const char *what, struct timespec start, struct timespec stop)
+{
+    fprintf(stderr, "processed %d times %s in %.9fs\n",
+            BENCHMARK_ITERATIONS, what, test_elapsed(&start, &stop));
+}
+
+static const char *batch_layouts[] = {
+    "us", "de", "fr", "us,il", "us,ru", "gb", "es,us", "jp", "br", "cz,sk",
+};
+
+static const char *batch_options[] = {
+    "", "ctrl:nocaps", "grp:menu_toggle", "ctrl:nocaps,grp:alt_shift_toggle",
+    "compose:ralt", "terminate:ctrl_alt_bksp,lv3:ralt_switch",
+};
+
+/* All the combinations of the layouts and options above, in turn. */
+static void
+fill_batch(struct xkb_rule_names *names, size_t num_names)
+{
+    size_t i;
+
+    for (i = 0; i < num_names; i++) {
+        names[i].rules = "evdev";
+        names[i].model = (i % 2 ? "pc104" : "pc105");
+        names[i].layout = batch_layouts[i % ARRAY_SIZE(batch_layouts)];
+        names[i].variant = (strchr(names[i].layout, ',') ? "," : "");
+        names[i].options = batch_options[i % ARRAY_SIZE(batch_options)];
+    }
+}
+
 static void
 benchmark(struct xkb_context *ctx)
 {
-    struct timespec start, stop, elapsed;
+    struct timespec start, stop;
     enum xkb_log_level old_level = xkb_context_get_log_level(ctx);
     int old_verb = xkb_context_get_log_verbosity(ctx);
-    int i;
+    int i, j;
     struct xkb_rule_names rmlvo = {
         "evdev", "pc105", "us,il", ",", "ctrl:nocaps,grp:menu_toggle",
     };
     struct xkb_component_names kccgst;
+    struct xkb_rule_names names[BENCHMARK_BATCH_SIZE];
+    struct xkb_component_names out[BENCHMARK_BATCH_SIZE];
 
     xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_CRITICAL);
     xkb_context_set_log_verbosity(ctx, 0);
@@ -106,25 +153,214 @@ benchmark(struct xkb_context *ctx)
     clock_gettime(CLOCK_MONOTONIC, &start);
     for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
         assert(xkb_components_from_rules(ctx, &rmlvo, &kccgst));
-        free(kccgst.keycodes);
-        free(kccgst.types);
-        free(kccgst.compat);
-        free(kccgst.symbols);
+        free_components(&kccgst);
     }
     clock_gettime(CLOCK_MONOTONIC, &stop);
+    print_elapsed("for the same names", start, stop);
+
+    fill_batch(names, BENCHMARK_BATCH_SIZE);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < BENCHMARK_ITERATIONS / BENCHMARK_BATCH_SIZE; i++) {
+        for (j = 0; j < BENCHMARK_BATCH_SIZE; j++) {
+            assert(xkb_components_from_rules(ctx, &names[j], &kccgst));
+            free_components(&kccgst);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    print_elapsed("for varied names, one at a time", start, stop);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < BENCHMARK_ITERATIONS / BENCHMARK_BATCH_SIZE; i++) {
+        assert(xkb_components_from_rules_batch(ctx, names,
+                                               BENCHMARK_BATCH_SIZE, out) ==
+               BENCHMARK_BATCH_SIZE);
+        for (j = 0; j < BENCHMARK_BATCH_SIZE; j++)
+            free_components(&out[j]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    print_elapsed("for varied names, in batches", start, stop);
 
     xkb_context_set_log_level(ctx, old_level);
     xkb_context_set_log_verbosity(ctx, old_verb);
+}
+
+/* A batch gives the same components as the names one at a time. */
+static void
+test_batch(struct xkb_context *ctx)
+{
+    struct xkb_rule_names names[64];
+    struct xkb_component_names out[ARRAY_SIZE(names)], kccgst;
+    size_t i, num_matched = 0;
+
+    fill_batch(names, ARRAY_SIZE(names));
+
+    /* Some names for other rules files, and some which fail. */
+    names[5].rules = "simple";
+    names[9].rules = "multiple-options";
+    names[9].options = "option3,option1,colon:opt,option11";
+    names[17].rules = "groups";
+    names[17].model = "pc104";
+    names[23].rules = "does-not-exist";
+    names[31].rules = "simple";
+    names[31].layout = "my_layout,second_layout";
+
+    assert(xkb_components_from_rules_batch(ctx, names, 0, out) == 0);
+
+    for (i = 0; i < ARRAY_SIZE(names); i++) {
+        if (xkb_components_from_rules(ctx, &names[i], &kccgst)) {
+            free_components(&kccgst);
+            num_matched++;
+        }
+    }
+
+    assert(xkb_components_from_rules_batch(ctx, names, ARRAY_SIZE(names),
+                                           out) == num_matched);
+
+    for (i = 0; i < ARRAY_SIZE(names); i++) {
+        if (!xkb_components_from_rules(ctx, &names[i], &kccgst)) {
+            assert(!out[i].keycodes && !out[i].types &&
+                   !out[i].compat && !out[i].symbols);
+            continue;
+        }
+
+        assert(streq(out[i].keycodes, kccgst.keycodes));
+        assert(streq(out[i].types, kccgst.types));
+        assert(streq(out[i].compat, kccgst.compat));
+        assert(streq(out[i].symbols, kccgst.symbols));
+        free_components(&kccgst);
+        free_components(&out[i]);
+    }
+
+    assert(!out[23].symbols && !out[31].symbols);
+}
+
+static void
+write_rules(const char *path, const char *symbols)
+{
+    FILE *file = fopen(path, "w");
+
+    assert(file);
+    fprintf(file, "! model = keycodes types compat symbols\n"
+                  "  *     = evdev    basic complete %s\n", symbols);
+    fclose(file);
+}
+
+static char *
+symbols_from_rules(struct xkb_context *ctx)
+{
+    const struct xkb_rule_names rmlvo = {
+        "changing", "pc105", "us", "", ""
+    };
+    struct xkb_component_names kccgst;
+
+    assert(xkb_components_from_rules(ctx, &rmlvo, &kccgst));
+    free(kccgst.keycodes);
+    free(kccgst.types);
+    free(kccgst.compat);
+    return kccgst.symbols;
+}
+
+/* The context keeps the compiled rules files, until they change. */
+static void
+test_changed_file(void)
+{
+    char dir[] = "/tmp/xkbcommon-rules-XXXXXX";
+    char path[PATH_MAX];
+    struct xkb_context *ctx;
+    char *symbols;
+
+    assert(mkdtemp(dir));
+    snprintf(path, sizeof(path), "%s/rules", dir);
+    assert(mkdir(path, 0700) == 0);
+    snprintf(path, sizeof(path), "%s/rules/changing", dir);
+    write_rules(path, "us");
+
+    ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES);
+    assert(ctx);
+    assert(xkb_context_include_path_append(ctx, dir));
+
+    symbols = symbols_from_rules(ctx);
+    assert(streq(symbols, "us"));
+    free(symbols);
+    symbols = symbols_from_rules(ctx);
+    assert(streq(symbols, "us"));
+    free(symbols);
+
+    /*
+     * The modification time may have too coarse a granularity to tell,
+     * but the size differs.
+     */
+    write_rules(path, "us+extra");
+    symbols = symbols_from_rules(ctx);
+    assert(streq(symbols, "us+extra"));
+    free(symbols);
+
+    xkb_context_unref(ctx);
 
-    elapsed.tv_sec = stop.tv_sec - start.tv_sec;
-    elapsed.tv_nsec = stop.tv_nsec - start.tv_nsec;
-    if (elapsed.tv_nsec < 0) {
-        elapsed.tv_nsec += 1000000000;
-        elapsed.tv_sec--;
+    assert(unlink(path) == 0);
+    snprintf(path, sizeof(path), "%s/rules", dir);
+    assert(rmdir(path) == 0);
+    assert(rmdir(dir) == 0);
+}
+
+/*
+ * Compile the rules from a pipe, which a child process writes to. A pipe
+ * has no stamp telling whether it changed, so it is never cached.
+ */
+static char *
+symbols_from_fifo(struct xkb_context *ctx, const char *path,
+                  const char *symbols)
+{
+    char *ret;
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        write_rules(path, symbols);
+        _exit(0);
     }
 
-    fprintf(stderr, "processed %d times in %ld.%09lds\n",
-            BENCHMARK_ITERATIONS, elapsed.tv_sec, elapsed.tv_nsec);
+    ret = symbols_from_rules(ctx);
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    return ret;
+}
+
+static void
+test_fifo(void)
+{
+    char dir[] = "/tmp/xkbcommon-rules-XXXXXX";
+    char path[PATH_MAX];
+    struct xkb_context *ctx;
+    char *symbols;
+
+    assert(mkdtemp(dir));
+    snprintf(path, sizeof(path), "%s/rules", dir);
+    assert(mkdir(path, 0700) == 0);
+    snprintf(path, sizeof(path), "%s/rules/changing", dir);
+    assert(mkfifo(path, 0600) == 0);
+
+    ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES);
+    assert(ctx);
+    assert(xkb_context_include_path_append(ctx, dir));
+
+    symbols = symbols_from_fifo(ctx, path, "us");
+    assert(streq(symbols, "us"));
+    free(symbols);
+    /* A pipe has no size, and the time is likely the same. */
+    symbols = symbols_from_fifo(ctx, path, "de");
+    assert(streq(symbols, "de"));
+    free(symbols);
+
+    xkb_context_unref(ctx);
+
+    assert(unlink(path) == 0);
+    snprintf(path, sizeof(path), "%s/rules", dir);
+    assert(rmdir(path) == 0);
+    assert(rmdir(dir) == 0);
 }
 
 int
@@ -216,6 +452,11 @@ main(int argc, char *argv[])
     };
     assert(test_rules(ctx, &test7));
 
+    test_batch(ctx);
+
     xkb_context_unref(ctx);
+
+    test_changed_file();
+    test_fifo();
     return 0;
 }
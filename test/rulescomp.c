@@ -21,9 +21,14 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <dirent.h>
+#include <limits.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "test.h"
+#include "keymap.h"
 
 #define BENCHMARK_ITERATIONS 1000
 
@@ -91,6 +96,389 @@ benchmark(struct xkb_context *context)
             BENCHMARK_ITERATIONS, elapsed.tv_sec, elapsed.tv_nsec);
 }
 
+static struct xkb_keymap *
+compile_names(struct xkb_context *context, const char *rules,
+              const char *model, const char *layout,
+              const char *variant, const char *options)
+{
+    struct xkb_rule_names rmlvo = {
+        .rules = rules,
+        .model = model,
+        .layout = layout,
+        .variant = variant,
+        .options = options,
+    };
+
+    return xkb_keymap_new_from_names(context, &rmlvo, 0);
+}
+
+static void
+test_keymap_cache(void)
+{
+    struct xkb_context *ctx = test_get_context();
+    struct xkb_keymap *a, *b, *c, *x, *y, *z;
+    size_t size;
+
+    assert(ctx);
+
+    /* Disabled by default. */
+    assert(xkb_context_get_keymap_cache_size(ctx) == 0);
+    a = compile_names(ctx, "evdev", "pc105", "us", "", "");
+    b = compile_names(ctx, "evdev", "pc105", "us", "", "");
+    assert(a && b && a != b);
+    assert(xkb_context_get_keymap_cache_hits(ctx) == 0);
+    assert(xkb_context_get_keymap_cache_misses(ctx) == 0);
+    xkb_keymap_unref(a);
+    xkb_keymap_unref(b);
+
+    xkb_context_set_keymap_cache_size(ctx, 16 * 1024 * 1024);
+    assert(xkb_context_get_keymap_cache_size(ctx) == 16 * 1024 * 1024);
+
+    a = compile_names(ctx, "evdev", "pc105", "us,ru", ",",
+                      "grp:alt_shift_toggle");
+    b = compile_names(ctx, "evdev", "pc105", "us,ru", ",",
+                      "grp:alt_shift_toggle");
+    assert(a && a == b);
+    assert(xkb_context_get_keymap_cache_hits(ctx) == 1);
+    assert(xkb_context_get_keymap_cache_misses(ctx) == 1);
+    xkb_keymap_unref(b);
+
+    /* The defaults are filled in before looking up. */
+    b = compile_names(ctx, "evdev", "pc105", "us", NULL, NULL);
+    c = compile_names(ctx, "", "", "", "", "");
+    assert(b && b == c);
+    xkb_keymap_unref(c);
+
+    /* Different options, different keymap. */
+    c = compile_names(ctx, "evdev", "pc105", "us,ru", ",", "");
+    assert(c && c != a);
+    xkb_keymap_unref(c);
+    assert(xkb_context_get_keymap_cache_hits(ctx) == 2);
+    assert(xkb_context_get_keymap_cache_misses(ctx) == 3);
+
+    /* Failures are not cached. */
+    assert(!compile_names(ctx, "does-not-exist", "", "", "", ""));
+    assert(!compile_names(ctx, "does-not-exist", "", "", "", ""));
+    assert(xkb_context_get_keymap_cache_misses(ctx) == 5);
+
+    /* Shrinking the cache evicts what no longer fits. */
+    xkb_context_set_keymap_cache_size(ctx, 1);
+    xkb_context_set_keymap_cache_size(ctx, 16 * 1024 * 1024);
+    c = compile_names(ctx, "evdev", "pc105", "us", NULL, NULL);
+    assert(c && c != b);
+    xkb_keymap_unref(b);
+    b = c;
+    c = compile_names(ctx, "evdev", "pc105", "us", NULL, NULL);
+    assert(c == b);
+    xkb_keymap_unref(c);
+
+    /* Changing the include path empties the cache. */
+    assert(xkb_context_include_path_append(ctx, test_get_path("")));
+    c = compile_names(ctx, "evdev", "pc105", "us", NULL, NULL);
+    assert(c && c != b);
+    xkb_keymap_unref(c);
+
+    /*
+     * Make room for exactly two of these keymaps. The least recently used
+     * one is evicted for the third.
+     */
+    x = compile_names(ctx, "evdev", "pc105", "us", "", "ctrl:nocaps");
+    y = compile_names(ctx, "evdev", "pc105", "de", "", "ctrl:nocaps");
+    z = compile_names(ctx, "evdev", "pc105", "ru", "", "ctrl:nocaps");
+    assert(x && y && z);
+    size = xkb_keymap_memory_size(x) +
+           MAX(xkb_keymap_memory_size(y), xkb_keymap_memory_size(z)) + 1024;
+    xkb_keymap_unref(x);
+    xkb_keymap_unref(y);
+    xkb_keymap_unref(z);
+
+    xkb_context_set_keymap_cache_size(ctx, size);
+    x = compile_names(ctx, "evdev", "pc105", "us", "", "ctrl:nocaps");
+    y = compile_names(ctx, "evdev", "pc105", "de", "", "ctrl:nocaps");
+    c = compile_names(ctx, "evdev", "pc105", "us", "", "ctrl:nocaps");
+    assert(c == x);
+    xkb_keymap_unref(c);
+    z = compile_names(ctx, "evdev", "pc105", "ru", "", "ctrl:nocaps");
+    c = compile_names(ctx, "evdev", "pc105", "us", "", "ctrl:nocaps");
+    assert(c == x);
+    xkb_keymap_unref(c);
+    c = compile_names(ctx, "evdev", "pc105", "de", "", "ctrl:nocaps");
+    assert(c && c != y);
+    xkb_keymap_unref(c);
+    xkb_keymap_unref(x);
+    xkb_keymap_unref(y);
+    xkb_keymap_unref(z);
+    xkb_context_set_keymap_cache_size(ctx, 16 * 1024 * 1024);
+
+    /*
+     * The context must be freed even though the cached keymaps still hold
+     * references to it; the remaining keymaps keep it alive until they
+     * are released.
+     */
+    xkb_context_unref(ctx);
+    xkb_keymap_unref(a);
+    xkb_keymap_unref(b);
+}
+
+static bool compiled;
+
+static void
+detect_compile_log_fn(struct xkb_context *ctx, enum xkb_log_level level,
+                      const char *fmt, va_list args)
+{
+    if (strstr(fmt, "Compiling from RMLVO"))
+        compiled = true;
+}
+
+/*
+ * A new context, as a new process would have, with @dir searched first
+ * for include files.
+ */
+static struct xkb_context *
+disk_cache_context(const char *cache_dir, const char *dir)
+{
+    struct xkb_context *ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES);
+
+    assert(ctx);
+    assert(xkb_context_include_path_append(ctx, dir));
+    assert(xkb_context_include_path_append(ctx, test_get_path("")));
+    assert(xkb_context_set_keymap_cache_dir(ctx, cache_dir));
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_DEBUG);
+    xkb_context_set_log_fn(ctx, detect_compile_log_fn);
+    return ctx;
+}
+
+static xkb_keysym_t
+disk_cache_compile(const char *cache_dir, const char *dir, bool *was_compiled)
+{
+    struct xkb_context *ctx = disk_cache_context(cache_dir, dir);
+    struct xkb_keymap *keymap;
+    const xkb_keysym_t *syms;
+    xkb_keysym_t sym;
+
+    compiled = false;
+    keymap = compile_names(ctx, "evdev", "pc105", "us", "", "");
+    assert(keymap);
+    *was_compiled = compiled;
+
+    /* <AC01> */
+    assert(xkb_keymap_key_get_syms_by_level(keymap, 38, 0, 0, &syms) == 1);
+    sym = syms[0];
+
+    xkb_keymap_unref(keymap);
+    xkb_context_unref(ctx);
+    return sym;
+}
+
+static void
+test_disk_cache(void)
+{
+    char cache_dir[] = "/tmp/xkbcommon-cache-XXXXXX";
+    char dir[] = "/tmp/xkbcommon-include-XXXXXX";
+    char path[PATH_MAX];
+    struct xkb_context *ctx;
+    FILE *file;
+    DIR *cache;
+    struct dirent *entry;
+    bool was_compiled;
+
+    assert(mkdtemp(cache_dir));
+    assert(mkdtemp(dir));
+
+    ctx = test_get_context();
+    assert(ctx);
+    assert(xkb_context_get_keymap_cache_dir(ctx) == NULL);
+    assert(!xkb_context_set_keymap_cache_dir(ctx, "/does/not/exist"));
+    assert(xkb_context_set_keymap_cache_dir(ctx, cache_dir));
+    assert(streq(xkb_context_get_keymap_cache_dir(ctx), cache_dir));
+    assert(xkb_context_set_keymap_cache_dir(ctx, NULL));
+    assert(xkb_context_get_keymap_cache_dir(ctx) == NULL);
+    xkb_context_unref(ctx);
+
+    /* Compiled the first time, loaded from the cache the second. */
+    assert(disk_cache_compile(cache_dir, dir, &was_compiled) == XKB_KEY_a);
+    assert(was_compiled);
+    assert(disk_cache_compile(cache_dir, dir, &was_compiled) == XKB_KEY_a);
+    assert(!was_compiled);
+
+    /* A file appearing earlier in the include path. */
+    snprintf(path, sizeof(path), "%s/symbols", dir);
+    assert(mkdir(path, 0700) == 0);
+    snprintf(path, sizeof(path), "%s/symbols/us", dir);
+    file = fopen(path, "w");
+    assert(file);
+    fprintf(file, "default xkb_symbols \"basic\" {\n"
+                  "    key <AC01> { [ b, B ] };\n"
+                  "};\n");
+    fclose(file);
+
+    assert(disk_cache_compile(cache_dir, dir, &was_compiled) == XKB_KEY_b);
+    assert(was_compiled);
+    assert(disk_cache_compile(cache_dir, dir, &was_compiled) == XKB_KEY_b);
+    assert(!was_compiled);
+
+    /*
+     * A file which changed. The modification time may have too coarse a
+     * granularity to tell, but the size differs.
+     */
+    file = fopen(path, "w");
+    assert(file);
+    fprintf(file, "default xkb_symbols \"basic\" {\n"
+                  "    key <AC01> { [ c ] };\n"
+                  "};\n");
+    fclose(file);
+
+    assert(disk_cache_compile(cache_dir, dir, &was_compiled) == XKB_KEY_c);
+    assert(was_compiled);
+
+    /* A file which went away. */
+    assert(unlink(path) == 0);
+    assert(disk_cache_compile(cache_dir, dir, &was_compiled) == XKB_KEY_a);
+    assert(was_compiled);
+    assert(disk_cache_compile(cache_dir, dir, &was_compiled) == XKB_KEY_a);
+    assert(!was_compiled);
+
+    snprintf(path, sizeof(path), "%s/symbols", dir);
+    assert(rmdir(path) == 0);
+    assert(rmdir(dir) == 0);
+
+    cache = opendir(cache_dir);
+    assert(cache);
+    while ((entry = readdir(cache))) {
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, entry->d_name);
+        assert(unlink(path) == 0);
+    }
+    closedir(cache);
+    assert(rmdir(cache_dir) == 0);
+}
+
+static int cached_maps;
+
+static void
+count_cached_log_fn(struct xkb_context *ctx, enum xkb_log_level level,
+                    const char *fmt, va_list args)
+{
+    if (strstr(fmt, "Using cached map"))
+        cached_maps++;
+}
+
+static char *
+file_cache_compile(struct xkb_context *ctx, const char *layout,
+                   xkb_keysym_t *sym)
+{
+    struct xkb_keymap *keymap;
+    const xkb_keysym_t *syms;
+    char *dump;
+
+    keymap = compile_names(ctx, "evdev", "pc105", layout, "", "");
+    assert(keymap);
+
+    /* <AC01> */
+    assert(xkb_keymap_key_get_syms_by_level(keymap, 38, 0, 0, &syms) >= 1);
+    *sym = syms[0];
+
+    dump = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+    assert(dump);
+    xkb_keymap_unref(keymap);
+    return dump;
+}
+
+static void
+test_file_cache(void)
+{
+    char dir[] = "/tmp/xkbcommon-include-XXXXXX";
+    char path[PATH_MAX];
+    struct xkb_context *ctx;
+    char *uncached, *dump;
+    xkb_keysym_t sym;
+    FILE *file;
+    int i;
+
+    assert(mkdtemp(dir));
+
+    ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES);
+    assert(ctx);
+    assert(xkb_context_include_path_append(ctx, dir));
+    assert(xkb_context_include_path_append(ctx, test_get_path("")));
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_DEBUG);
+    xkb_context_set_log_fn(ctx, count_cached_log_fn);
+
+    assert(!xkb_context_get_file_cache_enabled(ctx));
+    uncached = file_cache_compile(ctx, "us,de", &sym);
+    assert(cached_maps == 0);
+
+    assert(xkb_context_set_file_cache_enabled(ctx, 1));
+    assert(xkb_context_get_file_cache_enabled(ctx));
+
+    /*
+     * The compiler must not modify the parsed files, so compiling from
+     * the cache again and again gives the same keymap.
+     */
+    for (i = 0; i < 3; i++) {
+        cached_maps = 0;
+        dump = file_cache_compile(ctx, "us,de", &sym);
+        assert(streq(dump, uncached));
+        assert(i == 0 || cached_maps > 0);
+        free(dump);
+    }
+    free(uncached);
+
+    /* A different layout still shares most of the files. */
+    cached_maps = 0;
+    free(file_cache_compile(ctx, "us", &sym));
+    assert(cached_maps > 0);
+    assert(sym == XKB_KEY_a);
+
+    /* A file appearing earlier in the include path. */
+    snprintf(path, sizeof(path), "%s/symbols", dir);
+    assert(mkdir(path, 0700) == 0);
+    snprintf(path, sizeof(path), "%s/symbols/us", dir);
+    file = fopen(path, "w");
+    assert(file);
+    fprintf(file, "default xkb_symbols \"basic\" {\n"
+                  "    key <AC01> { [ b, B ] };\n"
+                  "};\n");
+    fclose(file);
+
+    free(file_cache_compile(ctx, "us", &sym));
+    assert(sym == XKB_KEY_b);
+
+    /* A file which changed; the size differs, if not the time. */
+    file = fopen(path, "w");
+    assert(file);
+    fprintf(file, "default xkb_symbols \"basic\" {\n"
+                  "    key <AC01> { [ c ] };\n"
+                  "};\n");
+    fclose(file);
+
+    free(file_cache_compile(ctx, "us", &sym));
+    assert(sym == XKB_KEY_c);
+
+    assert(xkb_context_set_file_cache_enabled(ctx, 0));
+    assert(!xkb_context_get_file_cache_enabled(ctx));
+    cached_maps = 0;
+    free(file_cache_compile(ctx, "us", &sym));
+    assert(cached_maps == 0);
+    assert(sym == XKB_KEY_c);
+
+    /* The files parsed before are kept until the context goes away. */
+    assert(xkb_context_set_file_cache_enabled(ctx, 1));
+    assert(xkb_context_get_file_cache_enabled(ctx));
+    cached_maps = 0;
+    free(file_cache_compile(ctx, "us", &sym));
+    assert(cached_maps > 0);
+    assert(sym == XKB_KEY_c);
+
+    xkb_context_unref(ctx);
+
+    assert(unlink(path) == 0);
+    snprintf(path, sizeof(path), "%s/symbols", dir);
+    assert(rmdir(path) == 0);
+    assert(rmdir(dir) == 0);
+}
+
 int main(int argc, char *argv[])
 {
     struct xkb_context *ctx = test_get_context();
@@ -118,5 +506,9 @@ int main(int argc, char *argv[])
 
     assert(!test_rmlvo(ctx, "does-not-exist", "", "", "", ""));
 
+    test_keymap_cache();
+    test_disk_cache();
+    test_file_cache();
+
     xkb_context_unref(ctx);
 }
@@ -0,0 +1,268 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "xkbcomp-priv.h"
+
+#pragma GCC diagnostic ignored "-Wmissing-format-attribute"
+
+ATTR_PRINTF(3, 0) static void
+log_fn(struct xkb_context *ctx, enum xkb_log_level level,
+       const char *fmt, va_list args)
+{
+    char *s;
+    int size;
+    darray_char *ls = xkb_context_get_user_data(ctx);
+    assert(ls);
+
+    size = vasprintf(&s, fmt, args);
+    assert(size != -1);
+
+    darray_append_string(*ls, s);
+    free(s);
+}
+
+/* Parse the string, logging to @log, which is emptied first. */
+static XkbFile *
+parse_string(struct xkb_context *ctx, darray_char *log, const char *string)
+{
+    darray_free(*log);
+    darray_append_lit(*log, "");
+    return XkbParseString(ctx, string, strlen(string), "(test)");
+}
+
+static int
+count_defs(XkbFile *file, enum stmt_type type)
+{
+    ParseCommon *stmt;
+    int count = 0;
+
+    for (stmt = file->defs; stmt; stmt = stmt->next)
+        if (stmt->type == type)
+            count++;
+
+    return count;
+}
+
+/* The string of the first indicator name in the file. */
+static const char *
+indicator_name(struct xkb_context *ctx, XkbFile *file)
+{
+    IndicatorNameDef *def = (IndicatorNameDef *) file->defs;
+
+    assert(def->common.type == STMT_INDICATOR_NAME);
+    return xkb_atom_text(ctx, def->name->value.str);
+}
+
+static void
+test_escapes(struct xkb_context *ctx, darray_char *log)
+{
+    XkbFile *file;
+
+    file = parse_string(ctx, log,
+                        "xkb_keycodes { indicator 1 = "
+                        "\"a\\n\\t\\e\\101\\q\"; };");
+    assert(file);
+    assert(streq(indicator_name(ctx, file), "a\n\t\033A\\q"));
+    assert(strstr(log->item, "Unknown escape sequence \\q in string: "
+                             "line 1, column 42 of (test)"));
+    FreeXkbFile(file);
+
+    file = parse_string(ctx, log,
+                        "xkb_keycodes { indicator 1 = \"\\60x\\7\"; };");
+    assert(file);
+    assert(streq(indicator_name(ctx, file), "0x\a"));
+    assert(log->size == 0);
+    FreeXkbFile(file);
+
+    /* An octal escape is at most 3 digits, and must fit in a byte. */
+    assert(!parse_string(ctx, log,
+                         "xkb_keycodes { indicator 1 = \"\\0101\"; };"));
+    assert(strstr(log->item, "Illegal octal escape"));
+    assert(!parse_string(ctx, log,
+                         "xkb_keycodes { indicator 1 = \"\\400\"; };"));
+    assert(strstr(log->item, "Illegal octal escape"));
+    assert(!parse_string(ctx, log,
+                         "xkb_keycodes { indicator 1 = \"\\8\"; };"));
+    assert(strstr(log->item, "Illegal octal escape"));
+}
+
+static void
+test_keywords(struct xkb_context *ctx, darray_char *log)
+{
+    XkbFile *file;
+
+    file = parse_string(ctx, log,
+                        "DEFAULT Partial XKB_KEYCODES \"x\" {\n"
+                        "    INCLUDE \"evdev\"\n"
+                        "    Alias <A> = <B>;\n"
+                        "    Indicator 1 = \"Caps Lock\";\n"
+                        "    virtual indicator 2 = \"Num Lock\";\n"
+                        "};");
+    assert(file);
+    assert(file->file_type == FILE_TYPE_KEYCODES);
+    assert(file->flags & MAP_IS_DEFAULT);
+    assert(file->flags & MAP_IS_PARTIAL);
+    assert(count_defs(file, STMT_INCLUDE) == 1);
+    assert(count_defs(file, STMT_ALIAS) == 1);
+    assert(count_defs(file, STMT_INDICATOR_NAME) == 2);
+    FreeXkbFile(file);
+
+    /* Words which only start like a keyword, or hash like one. */
+    file = parse_string(ctx, log,
+                        "xkb_keycodes {\n"
+                        "    xkb_keycodesx = 1;\n"
+                        "    aliasx = 1;\n"
+                        "    includ = 1;\n"
+                        "    indicators = 1;\n"
+                        "};");
+    assert(file);
+    assert(count_defs(file, STMT_VAR) == 4);
+    assert(count_defs(file, STMT_ALIAS) == 0);
+    FreeXkbFile(file);
+}
+
+static void
+test_numbers(struct xkb_context *ctx, darray_char *log)
+{
+    static const int64_t expected[] = { 16, 31, 8, 9, 0 };
+    XkbFile *file;
+    ParseCommon *stmt;
+    VarDef *var;
+    int i = 0;
+
+    file = parse_string(ctx, log,
+                        "xkb_keycodes {\n"
+                        "    <A> = 0x10;\n"
+                        "    <B> = 0X1f;\n"
+                        "    <C> = 010;\n"
+                        "    <D> = 9;\n"
+                        "    <E> = 0;\n"
+                        "    minimum = 0xff;\n"
+                        "    maximum = 1.5;\n"
+                        "};");
+    assert(file);
+
+    for (stmt = file->defs; stmt; stmt = stmt->next) {
+        if (stmt->type == STMT_KEYCODE) {
+            assert(((KeycodeDef *) stmt)->value == expected[i]);
+            i++;
+        }
+    }
+    assert(i == 5);
+
+    /* The parser drops floats where it doesn't expect them. */
+    stmt = file->defs;
+    while (stmt->type != STMT_VAR)
+        stmt = stmt->next;
+    var = (VarDef *) stmt;
+    assert(var->value->op == EXPR_VALUE && var->value->value.ival == 0xff);
+    var = (VarDef *) stmt->next;
+    assert(var->common.type == STMT_VAR && var->value == NULL);
+    FreeXkbFile(file);
+
+    /* A float is a single token, so it can't be a keycode. */
+    assert(!parse_string(ctx, log, "xkb_keycodes { <A> = 1.5; };"));
+}
+
+static void
+test_comments(struct xkb_context *ctx, darray_char *log)
+{
+    XkbFile *file;
+
+    file = parse_string(ctx, log,
+                        "// xkb_keycodes \"commented\" {\n"
+                        "# \"unterminated\n"
+                        "xkb_keycodes \"x\" { // <A> = 1;\n"
+                        "    <B> = 2; # <C> = 3;\n"
+                        "    #<D> = 4;\n"
+                        "    <E> = 5;//\n"
+                        "};\n"
+                        "# At the end, without a newline");
+    assert(file);
+    assert(streq(file->name, "x"));
+    assert(count_defs(file, STMT_KEYCODE) == 2);
+    assert(log->size == 0);
+    FreeXkbFile(file);
+
+    /* A lone slash is still a division. */
+    file = parse_string(ctx, log,
+                        "xkb_keycodes { minimum = 16 / 2; };");
+    assert(file);
+    assert(((VarDef *) file->defs)->value->op == EXPR_DIVIDE);
+    FreeXkbFile(file);
+}
+
+static void
+test_errors(struct xkb_context *ctx, darray_char *log)
+{
+    assert(!parse_string(ctx, log,
+                         "xkb_keycodes {\n"
+                         "    <A> = 1;\n"
+                         "    indicator 1 = \"Caps Lock;\n"
+                         "};"));
+    assert(strstr(log->item,
+                  "Unterminated string: line 3, column 19 of (test)"));
+
+    assert(!parse_string(ctx, log,
+                         "xkb_keycodes {\n"
+                         "\n"
+                         "  <AE01 = 1;\n"
+                         "};"));
+    assert(strstr(log->item,
+                  "Unterminated key name: line 3, column 3 of (test)"));
+
+    assert(!parse_string(ctx, log,
+                         "xkb_keycodes {\n"
+                         "    <A> = 1 $\n"
+                         "};"));
+    assert(strstr(log->item, "line 2, column 13 of (test)"));
+}
+
+int
+main(void)
+{
+    struct xkb_context *ctx = test_get_context();
+    darray_char log;
+
+    assert(ctx);
+
+    darray_init(log);
+    xkb_context_set_user_data(ctx, &log);
+    xkb_context_set_log_fn(ctx, log_fn);
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_WARNING);
+
+    test_escapes(ctx, &log);
+    test_keywords(ctx, &log);
+    test_numbers(ctx, &log);
+    test_comments(ctx, &log);
+    test_errors(ctx, &log);
+
+    darray_free(log);
+    xkb_context_unref(ctx);
+
+    return 0;
+}
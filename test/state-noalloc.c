@@ -0,0 +1,144 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <linux/input.h>
+
+#include "test.h"
+
+/* Offset between evdev keycodes (where KEY_ESCAPE is 1), and the evdev XKB
+ * keycode set (where ESC is 9). */
+#define EVDEV_OFFSET 8
+
+#ifdef __GLIBC__
+
+/*
+ * Count the allocations made by anything in the process, by interposing
+ * the libc allocator.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned int num_allocs;
+
+void *
+malloc(size_t size)
+{
+    num_allocs++;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    num_allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    num_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+static void
+run_keys(struct xkb_state *state)
+{
+    /* Exercise every kind of filter: set, latch, lock, group lock. */
+    static const xkb_keycode_t keys[] = {
+        KEY_LEFTSHIFT, KEY_RIGHTSHIFT, KEY_LEFTCTRL, KEY_RIGHTALT,
+        KEY_CAPSLOCK, KEY_NUMLOCK, KEY_COMPOSE, KEY_102ND, KEY_Q, KEY_A,
+        KEY_5, KEY_EQUAL, KEY_KP1, KEY_SPACE,
+    };
+    const size_t num_keys = sizeof(keys) / sizeof(keys[0]);
+    int8_t down[sizeof(keys) / sizeof(keys[0])] = { 0 };
+    struct xkb_key_event events[16];
+    enum xkb_state_component changed[16];
+    struct xkb_key_result result;
+    const xkb_keysym_t *syms;
+    size_t i, j, k;
+
+    for (i = 0; i < 100000; i++) {
+        j = rand() % num_keys;
+        xkb_state_update_key(state, keys[j] + EVDEV_OFFSET,
+                             down[j] ? XKB_KEY_UP : XKB_KEY_DOWN);
+        down[j] = !down[j];
+        xkb_state_key_get_syms(state, keys[j] + EVDEV_OFFSET, &syms);
+
+        j = rand() % num_keys;
+        xkb_state_process_key(state, keys[j] + EVDEV_OFFSET,
+                              down[j] ? XKB_KEY_UP : XKB_KEY_DOWN, &result);
+        down[j] = !down[j];
+
+        for (k = 0; k < 16; k++) {
+            j = rand() % num_keys;
+            events[k].keycode = keys[j] + EVDEV_OFFSET;
+            events[k].direction = down[j] ? XKB_KEY_UP : XKB_KEY_DOWN;
+            down[j] = !down[j];
+        }
+        xkb_state_update_keys(state, events, 16, (i % 2) ? changed : NULL);
+    }
+}
+
+int
+main(void)
+{
+    struct xkb_context *ctx = test_get_context();
+    struct xkb_keymap *keymap;
+    struct xkb_state *state;
+
+    assert(ctx);
+
+    keymap = test_compile_rules(ctx, "evdev", "pc104", "us,ru,de", ",,neo",
+                                "grp:menu_toggle,lv3:ralt_switch");
+    assert(keymap);
+
+    state = xkb_state_new(keymap);
+    assert(state);
+
+    /* Updating the state must never allocate. */
+    num_allocs = 0;
+    run_keys(state);
+    assert(num_allocs == 0);
+
+    xkb_state_unref(state);
+    xkb_keymap_unref(keymap);
+    xkb_context_unref(ctx);
+
+    return 0;
+}
+
+#else
+
+int
+main(void)
+{
+    /* Can't count the allocations; skip. */
+    return 77;
+}
+
+#endif
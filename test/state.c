@@ -111,6 +111,12 @@ test_update_key(struct xkb_keymap *keymap)
 
     assert(state);
 
+    /* Nothing changes, LEDs included, when pressing a letter. */
+    assert(xkb_state_update_key(state, KEY_Q + EVDEV_OFFSET,
+                                XKB_KEY_DOWN) == 0);
+    assert(xkb_state_update_key(state, KEY_Q + EVDEV_OFFSET,
+                                XKB_KEY_UP) == 0);
+
     /* LCtrl down */
     xkb_state_update_key(state, KEY_LEFTCTRL + EVDEV_OFFSET, XKB_KEY_DOWN);
     fprintf(stderr, "dumping state for LCtrl down:\n");
@@ -238,6 +244,186 @@ test_update_key(struct xkb_keymap *keymap)
     xkb_state_unref(state);
 }
 
+static void
+test_update_keys(struct xkb_keymap *keymap)
+{
+    struct xkb_state *state = xkb_state_new(keymap);
+    struct xkb_state *batch_state = xkb_state_new(keymap);
+    const struct xkb_key_event events[] = {
+        { KEY_CAPSLOCK + EVDEV_OFFSET, XKB_KEY_DOWN },
+        { KEY_CAPSLOCK + EVDEV_OFFSET, XKB_KEY_UP },
+        { KEY_LEFTSHIFT + EVDEV_OFFSET, XKB_KEY_DOWN },
+        { KEY_Q + EVDEV_OFFSET, XKB_KEY_DOWN },
+        { KEY_Q + EVDEV_OFFSET, XKB_KEY_UP },
+        { KEY_LEFTSHIFT + EVDEV_OFFSET, XKB_KEY_UP },
+        { KEY_COMPOSE + EVDEV_OFFSET, XKB_KEY_DOWN },
+        { KEY_COMPOSE + EVDEV_OFFSET, XKB_KEY_UP },
+        { 0, XKB_KEY_DOWN },
+    };
+    const size_t num_events = sizeof(events) / sizeof(events[0]);
+    enum xkb_state_component changed[sizeof(events) / sizeof(events[0])];
+    enum xkb_state_component mask, all = 0;
+    size_t i;
+
+    assert(state);
+    assert(batch_state);
+
+    for (i = 0; i < num_events; i++)
+        all |= xkb_state_update_key(state, events[i].keycode,
+                                    events[i].direction);
+
+    /* Per-event changes are the same as with xkb_state_update_key(). */
+    mask = xkb_state_update_keys(batch_state, events, num_events, changed);
+    assert(mask == all);
+    for (i = 0; i < num_events; i++) {
+        enum xkb_state_component expected;
+
+        xkb_state_unref(state);
+        state = xkb_state_new(keymap);
+        assert(state);
+        xkb_state_update_keys(state, events, i, NULL);
+        expected = xkb_state_update_key(state, events[i].keycode,
+                                        events[i].direction);
+        assert(changed[i] == expected);
+    }
+
+    /* The end state is the same, whether or not changed is passed. */
+    xkb_state_unref(batch_state);
+    batch_state = xkb_state_new(keymap);
+    assert(batch_state);
+    mask = xkb_state_update_keys(batch_state, events, num_events, NULL);
+    assert(mask & XKB_STATE_LEDS);
+    assert(mask & XKB_STATE_LAYOUT_LOCKED);
+    assert(xkb_state_serialize_mods(batch_state, XKB_STATE_MODS_EFFECTIVE) ==
+           xkb_state_serialize_mods(state, XKB_STATE_MODS_EFFECTIVE));
+    assert(xkb_state_serialize_layout(batch_state, XKB_STATE_LAYOUT_EFFECTIVE) ==
+           xkb_state_serialize_layout(state, XKB_STATE_LAYOUT_EFFECTIVE));
+    assert(xkb_state_led_name_is_active(batch_state, XKB_LED_NAME_CAPS) > 0);
+    assert(xkb_state_led_name_is_active(batch_state, "Group 2") > 0);
+
+    xkb_state_unref(batch_state);
+    xkb_state_unref(state);
+}
+
+static void
+check_process_key(struct xkb_state *state, struct xkb_state *ref,
+                  xkb_keycode_t kc, enum xkb_key_direction direction)
+{
+    struct xkb_key_result result;
+    const xkb_keysym_t *syms;
+    char utf8[8] = "";
+    int num_syms;
+
+    num_syms = xkb_state_key_get_syms(ref, kc, &syms);
+    if (num_syms == 1)
+        xkb_keysym_to_utf8(syms[0], utf8, sizeof(utf8));
+
+    assert(xkb_state_process_key(state, kc, direction, &result));
+
+    assert(result.layout == xkb_state_key_get_layout(ref, kc));
+    assert(result.level == xkb_state_key_get_level(ref, kc, result.layout));
+    assert(result.num_syms == num_syms);
+    assert(result.syms == syms);
+    assert(streq(result.utf8, utf8));
+    assert(~result.consumed ==
+           xkb_state_mod_mask_remove_consumed(ref, kc, ~0));
+    assert(result.repeats ==
+           xkb_keymap_key_repeats(xkb_state_get_keymap(ref), kc));
+    assert(result.changed == xkb_state_update_key(ref, kc, direction));
+}
+
+static void
+test_process_key(struct xkb_keymap *keymap)
+{
+    struct xkb_state *state = xkb_state_new(keymap);
+    struct xkb_state *ref = xkb_state_new(keymap);
+    struct xkb_key_result result;
+
+    assert(state);
+    assert(ref);
+
+    check_process_key(state, ref, KEY_Q + EVDEV_OFFSET, XKB_KEY_DOWN);
+    check_process_key(state, ref, KEY_Q + EVDEV_OFFSET, XKB_KEY_UP);
+    check_process_key(state, ref, KEY_LEFTSHIFT + EVDEV_OFFSET, XKB_KEY_DOWN);
+    check_process_key(state, ref, KEY_Q + EVDEV_OFFSET, XKB_KEY_DOWN);
+    check_process_key(state, ref, KEY_Q + EVDEV_OFFSET, XKB_KEY_UP);
+    check_process_key(state, ref, KEY_EQUAL + EVDEV_OFFSET, XKB_KEY_DOWN);
+    check_process_key(state, ref, KEY_EQUAL + EVDEV_OFFSET, XKB_KEY_UP);
+    check_process_key(state, ref, KEY_LEFTSHIFT + EVDEV_OFFSET, XKB_KEY_UP);
+    check_process_key(state, ref, KEY_6 + EVDEV_OFFSET, XKB_KEY_DOWN);
+    check_process_key(state, ref, KEY_6 + EVDEV_OFFSET, XKB_KEY_UP);
+    check_process_key(state, ref, KEY_COMPOSE + EVDEV_OFFSET, XKB_KEY_DOWN);
+    check_process_key(state, ref, KEY_COMPOSE + EVDEV_OFFSET, XKB_KEY_UP);
+    check_process_key(state, ref, KEY_Q + EVDEV_OFFSET, XKB_KEY_DOWN);
+    check_process_key(state, ref, KEY_Q + EVDEV_OFFSET, XKB_KEY_UP);
+
+    /* Back to group 1; Q pressed with Shift held down. */
+    xkb_state_process_key(state, KEY_COMPOSE + EVDEV_OFFSET, XKB_KEY_DOWN,
+                          &result);
+    assert(result.changed & XKB_STATE_LAYOUT_EFFECTIVE);
+    xkb_state_process_key(state, KEY_COMPOSE + EVDEV_OFFSET, XKB_KEY_UP,
+                          &result);
+    xkb_state_process_key(state, KEY_LEFTSHIFT + EVDEV_OFFSET, XKB_KEY_DOWN,
+                          &result);
+    assert(result.changed & XKB_STATE_MODS_DEPRESSED);
+    assert(!result.repeats);
+    xkb_state_process_key(state, KEY_Q + EVDEV_OFFSET, XKB_KEY_DOWN, &result);
+    assert(result.num_syms == 1 && result.syms[0] == XKB_KEY_Q);
+    assert(streq(result.utf8, "Q"));
+    assert(result.repeats);
+
+    assert(!xkb_state_process_key(state, 0, XKB_KEY_DOWN, &result));
+    assert(result.layout == XKB_LAYOUT_INVALID);
+    assert(result.level == XKB_LEVEL_INVALID);
+    assert(result.num_syms == 0 && result.syms == NULL);
+
+    xkb_state_unref(ref);
+    xkb_state_unref(state);
+}
+
+static void
+test_clone(struct xkb_keymap *keymap)
+{
+    struct xkb_state *state = xkb_state_new(keymap);
+    struct xkb_state *clone;
+
+    assert(state);
+
+    /* Clone while Caps Lock and Shift are held down. */
+    xkb_state_update_key(state, KEY_CAPSLOCK + EVDEV_OFFSET, XKB_KEY_DOWN);
+    xkb_state_update_key(state, KEY_LEFTSHIFT + EVDEV_OFFSET, XKB_KEY_DOWN);
+    clone = xkb_state_clone(state);
+    assert(clone);
+    assert(xkb_state_get_keymap(clone) == keymap);
+    assert(xkb_state_serialize_mods(clone, XKB_STATE_MODS_EFFECTIVE) ==
+           xkb_state_serialize_mods(state, XKB_STATE_MODS_EFFECTIVE));
+    assert(xkb_state_led_name_is_active(clone, XKB_LED_NAME_CAPS) > 0);
+
+    /* The held down keys carry over to the clone. */
+    xkb_state_update_key(clone, KEY_CAPSLOCK + EVDEV_OFFSET, XKB_KEY_UP);
+    xkb_state_update_key(clone, KEY_LEFTSHIFT + EVDEV_OFFSET, XKB_KEY_UP);
+    assert(xkb_state_mod_name_is_active(clone, XKB_MOD_NAME_CAPS,
+                                        XKB_STATE_MODS_LOCKED) > 0);
+    assert(xkb_state_mod_name_is_active(clone, XKB_MOD_NAME_SHIFT,
+                                        XKB_STATE_MODS_DEPRESSED) == 0);
+
+    /* The clone is independent of the original. */
+    xkb_state_update_key(clone, KEY_COMPOSE + EVDEV_OFFSET, XKB_KEY_DOWN);
+    assert(xkb_state_led_name_is_active(clone, "Group 2") > 0);
+    assert(xkb_state_led_name_is_active(state, "Group 2") == 0);
+    assert(xkb_state_mod_name_is_active(state, XKB_MOD_NAME_SHIFT,
+                                        XKB_STATE_MODS_DEPRESSED) > 0);
+    xkb_state_unref(clone);
+
+    xkb_state_update_key(state, KEY_LEFTSHIFT + EVDEV_OFFSET, XKB_KEY_UP);
+    assert(xkb_state_mod_name_is_active(state, XKB_MOD_NAME_SHIFT,
+                                        XKB_STATE_MODS_DEPRESSED) == 0);
+    assert(xkb_state_key_get_one_sym(state, KEY_Q + EVDEV_OFFSET) ==
+           XKB_KEY_Q);
+
+    xkb_state_unref(state);
+}
+
 static void
 test_serialisation(struct xkb_keymap *keymap)
 {
@@ -331,6 +517,56 @@ test_consume(struct xkb_keymap *keymap)
     xkb_state_unref(state);
 }
 
+/*
+ * The depressed and latched groups are not brought into range, so the
+ * LEDs must cope with any value.
+ */
+static void
+test_led_group_range(struct xkb_context *context)
+{
+    const char *str =
+        "xkb_keymap {\n"
+        "  xkb_keycodes {\n"
+        "    <ESC> = 9;\n"
+        "    indicator 1 = \"Base\"; indicator 2 = \"Latched\";\n"
+        "    indicator 3 = \"Locked\"; indicator 4 = \"Effective\";\n"
+        "  };\n"
+        "  xkb_types { include \"basic\" };\n"
+        "  xkb_compat {\n"
+        "    include \"basic\"\n"
+        "    indicator \"Base\" { whichGroupState = Base; groups = All; };\n"
+        "    indicator \"Latched\" { whichGroupState = Latched; groups = All; };\n"
+        "    indicator \"Locked\" { whichGroupState = Locked; groups = All; };\n"
+        "    indicator \"Effective\" { whichGroupState = Effective; groups = All; };\n"
+        "  };\n"
+        "  xkb_symbols {\n"
+        "    key <ESC> { [ Escape ], [ Escape ] };\n"
+        "  };\n"
+        "};\n";
+    struct xkb_keymap *keymap;
+    struct xkb_state *state;
+
+    keymap = test_compile_string(context, str);
+    assert(keymap);
+    state = xkb_state_new(keymap);
+    assert(state);
+
+    xkb_state_update_mask(state, 0, 0, 0, -1, 40, 1);
+    assert(xkb_state_led_name_is_active(state, "Base") == 0);
+    assert(xkb_state_led_name_is_active(state, "Latched") == 0);
+    assert(xkb_state_led_name_is_active(state, "Locked") > 0);
+    assert(xkb_state_led_name_is_active(state, "Effective") > 0);
+
+    xkb_state_update_mask(state, 0, 0, 0, 1, -32, 0);
+    assert(xkb_state_led_name_is_active(state, "Base") > 0);
+    assert(xkb_state_led_name_is_active(state, "Latched") == 0);
+    assert(xkb_state_led_name_is_active(state, "Locked") > 0);
+    assert(xkb_state_led_name_is_active(state, "Effective") > 0);
+
+    xkb_state_unref(state);
+    xkb_keymap_unref(keymap);
+}
+
 int
 main(void)
 {
@@ -348,10 +584,16 @@ main(void)
     assert(keymap);
 
     test_update_key(keymap);
+    test_update_keys(keymap);
+    test_process_key(keymap);
+    test_clone(keymap);
     test_serialisation(keymap);
     test_repeat(keymap);
     test_consume(keymap);
 
     xkb_keymap_unref(keymap);
+
+    test_led_group_range(context);
+
     xkb_context_unref(context);
 }
@@ -24,11 +24,274 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 
 #include "test.h"
+#include "keymap.h"
 
 #define DATA_PATH "keymaps/stringcomp.data"
 
+/*
+ * Dump the keymap in the binary format, load it back from a mapped file,
+ * and make sure it is the same keymap.
+ */
+static void
+test_binary(struct xkb_context *ctx, struct xkb_keymap *keymap)
+{
+    struct xkb_keymap *loaded;
+    char *bin, *bin2, *text, *text2, *mapped;
+    size_t size, size2;
+    FILE *file;
+
+    bin = xkb_keymap_get_as_buffer(keymap, XKB_KEYMAP_FORMAT_BINARY_V1,
+                                   &size);
+    assert(bin);
+
+    file = tmpfile();
+    assert(file);
+    assert(fwrite(bin, 1, size, file) == size);
+    assert(fflush(file) == 0);
+    mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(file), 0);
+    assert(mapped != MAP_FAILED);
+
+    loaded = xkb_keymap_new_from_buffer(ctx, mapped, size,
+                                        XKB_KEYMAP_FORMAT_BINARY_V1, 0);
+    assert(loaded);
+
+    munmap(mapped, size);
+    fclose(file);
+
+    /* Dumping it again gives the same text and the same binary. */
+    text = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+    text2 = xkb_keymap_get_as_string(loaded, XKB_KEYMAP_USE_ORIGINAL_FORMAT);
+    assert(text && text2);
+    assert(streq(text, text2));
+
+    bin2 = xkb_keymap_get_as_buffer(loaded, XKB_KEYMAP_USE_ORIGINAL_FORMAT,
+                                    &size2);
+    assert(bin2);
+    assert(size == size2 && memcmp(bin, bin2, size) == 0);
+
+    free(text);
+    free(text2);
+    free(bin2);
+    free(bin);
+    xkb_keymap_unref(loaded);
+}
+
+/*
+ * Feed the loader broken buffers. They may or may not load, but must never
+ * be read out of bounds.
+ */
+static void
+test_binary_invalid(struct xkb_context *ctx, struct xkb_keymap *keymap)
+{
+    struct xkb_keymap *loaded;
+    enum xkb_log_level old_level = xkb_context_get_log_level(ctx);
+    uint32_t *bin, *copy, word;
+    size_t size, i;
+
+    bin = (uint32_t *) xkb_keymap_get_as_buffer(keymap,
+                                                XKB_KEYMAP_FORMAT_BINARY_V1,
+                                                &size);
+    assert(bin);
+    copy = malloc(size);
+    assert(copy);
+    memcpy(copy, bin, size);
+
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_CRITICAL);
+
+    assert(!xkb_keymap_new_from_buffer(ctx, (char *) bin, 0,
+                                       XKB_KEYMAP_FORMAT_BINARY_V1, 0));
+    assert(!xkb_keymap_new_from_buffer(ctx, (char *) bin, size - 1,
+                                       XKB_KEYMAP_FORMAT_BINARY_V1, 0));
+    assert(!xkb_keymap_new_from_buffer(ctx, (char *) bin + 1, size - 1,
+                                       XKB_KEYMAP_FORMAT_BINARY_V1, 0));
+
+    /* Every word of the header, and a sample of the rest. */
+    for (i = 0; i < size / sizeof(word); i += (i < 128 ? 1 : 61)) {
+        word = copy[i];
+
+        copy[i] = 0xffffffff;
+        loaded = xkb_keymap_new_from_buffer(ctx, (char *) copy, size,
+                                            XKB_KEYMAP_FORMAT_BINARY_V1, 0);
+        xkb_keymap_unref(loaded);
+
+        copy[i] = word + 1;
+        loaded = xkb_keymap_new_from_buffer(ctx, (char *) copy, size,
+                                            XKB_KEYMAP_FORMAT_BINARY_V1, 0);
+        xkb_keymap_unref(loaded);
+
+        copy[i] = word;
+    }
+
+    xkb_context_set_log_level(ctx, old_level);
+
+    free(copy);
+    free(bin);
+}
+
+/* Every key is found by its keycode, and the index stays small. */
+static void
+assert_keys_indexed(struct xkb_keymap *keymap)
+{
+    const struct xkb_key *key;
+
+    xkb_foreach_key(key, keymap)
+        assert(XkbKey(keymap, XkbKeyAux(keymap, key)->keycode) == key);
+
+    assert(keymap->num_key_nodes <=
+           XKB_KEY_INDEX_MAX_DEPTH * keymap->num_keys);
+}
+
+/*
+ * Keys are only allocated for the keycodes which are named, however far
+ * apart they are.
+ */
+static void
+test_sparse_keycodes(struct xkb_context *ctx)
+{
+    static const struct {
+        xkb_keycode_t kc;
+        xkb_keysym_t sym;
+    } keys[] = {
+        { 9, XKB_KEY_a },
+        { 70, XKB_KEY_b },
+        { 0x2ff + 8, XKB_KEY_c },
+        { 100000, XKB_KEY_d },
+        { XKB_KEYCODE_MAX, XKB_KEY_e },
+    };
+    static const xkb_keycode_t unnamed[] = {
+        0, 8, 10, 71, 0x2ff + 7, 0x2ff + 9, 99999, 100001, XKB_KEYCODE_MAX - 1,
+    };
+    const char *str =
+        "xkb_keymap {\n"
+        "  xkb_keycodes {\n"
+        "    <AE01> = 9; <AE02> = 70; <AE03> = 775;\n"
+        "    <AE04> = 100000; <AE05> = 4294967294;\n"
+        "  };\n"
+        "  xkb_types { include \"basic\" };\n"
+        "  xkb_compat { include \"basic\" };\n"
+        "  xkb_symbols {\n"
+        "    key <AE01> { [ a ] }; key <AE02> { [ b ] };\n"
+        "    key <AE03> { [ c ] }; key <AE04> { [ d ] };\n"
+        "    key <AE05> { [ e ] };\n"
+        "  };\n"
+        "};\n";
+    struct xkb_keymap *keymap, *loaded;
+    struct xkb_state *state;
+    const xkb_keysym_t *syms;
+    char *bin;
+    size_t size, i, pass;
+
+    keymap = test_compile_string(ctx, str);
+    assert(keymap);
+    assert(xkb_keymap_memory_size(keymap) < 16384);
+    assert_keys_indexed(keymap);
+
+    bin = xkb_keymap_get_as_buffer(keymap, XKB_KEYMAP_FORMAT_BINARY_V1,
+                                   &size);
+    assert(bin);
+    loaded = xkb_keymap_new_from_buffer(ctx, bin, size,
+                                        XKB_KEYMAP_FORMAT_BINARY_V1, 0);
+    assert(loaded);
+    free(bin);
+
+    for (pass = 0; pass < 2; pass++) {
+        state = xkb_state_new(pass == 0 ? keymap : loaded);
+        assert(state);
+
+        for (i = 0; i < ARRAY_SIZE(keys); i++) {
+            assert(xkb_state_key_get_syms(state, keys[i].kc, &syms) == 1);
+            assert(syms[0] == keys[i].sym);
+        }
+
+        for (i = 0; i < ARRAY_SIZE(unnamed); i++)
+            assert(xkb_state_key_get_syms(state, unnamed[i], &syms) == 0);
+
+        xkb_state_unref(state);
+    }
+
+    xkb_keymap_unref(loaded);
+    xkb_keymap_unref(keymap);
+}
+
+static void
+assert_dumps_to(struct xkb_keymap *keymap, const char *original)
+{
+    char *dump;
+
+    assert(keymap);
+    dump = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_USE_ORIGINAL_FORMAT);
+    assert(dump);
+    assert(streq(dump, original));
+    free(dump);
+    xkb_keymap_unref(keymap);
+}
+
+/*
+ * Compile the text keymap from a buffer which isn't NUL-terminated, and
+ * from files which are mapped and which are read.
+ */
+static void
+test_text_input(struct xkb_context *ctx, const char *original)
+{
+    size_t size = strlen(original);
+    struct xkb_keymap *keymap;
+    char *mapped;
+    FILE *file;
+    int fds[2];
+    pid_t pid;
+
+    file = tmpfile();
+    assert(file);
+    assert(fwrite(original, 1, size, file) == size);
+    assert(fflush(file) == 0);
+    mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fileno(file), 0);
+    assert(mapped != MAP_FAILED);
+
+    keymap = xkb_keymap_new_from_buffer(ctx, mapped, size,
+                                        XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+    assert_dumps_to(keymap, original);
+    munmap(mapped, size);
+
+    /* The length may count the terminating NUL. */
+    keymap = xkb_keymap_new_from_buffer(ctx, original, size + 1,
+                                        XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+    assert_dumps_to(keymap, original);
+
+    rewind(file);
+    keymap = xkb_keymap_new_from_file(ctx, file, XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+    assert_dumps_to(keymap, original);
+
+    /* Only the rest of the file is read. */
+    rewind(file);
+    assert(fputs("garbage {\n", file) >= 0);
+    assert(fwrite(original, 1, size, file) == size);
+    assert(fseek(file, 10, SEEK_SET) == 0);
+    keymap = xkb_keymap_new_from_file(ctx, file, XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+    assert_dumps_to(keymap, original);
+    fclose(file);
+
+    /* A pipe can't be mapped. */
+    assert(pipe(fds) == 0);
+    pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        close(fds[0]);
+        _exit(write(fds[1], original, size) == (ssize_t) size ? 0 : 1);
+    }
+    close(fds[1]);
+    file = fdopen(fds[0], "r");
+    assert(file);
+    keymap = xkb_keymap_new_from_file(ctx, file, XKB_KEYMAP_FORMAT_TEXT_V1, 0);
+    assert_dumps_to(keymap, original);
+    fclose(file);
+    assert(waitpid(pid, NULL, 0) == pid);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -46,6 +309,7 @@ main(int argc, char *argv[])
 
     keymap = test_compile_string(ctx, original);
     assert(keymap);
+    assert_keys_indexed(keymap);
 
     dump = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_USE_ORIGINAL_FORMAT);
     assert(dump);
@@ -64,6 +328,10 @@ main(int argc, char *argv[])
         assert(0);
     }
 
+    test_binary(ctx, keymap);
+    test_binary_invalid(ctx, keymap);
+    test_text_input(ctx, original);
+
     free(original);
     free(dump);
     xkb_keymap_unref(keymap);
@@ -81,9 +349,12 @@ main(int argc, char *argv[])
     xkb_keymap_unref(keymap);
     keymap = test_compile_string(ctx, dump);
     assert(keymap);
+    test_binary(ctx, keymap);
     xkb_keymap_unref(keymap);
     free(dump);
 
+    test_sparse_keycodes(ctx);
+
     xkb_context_unref(ctx);
 
     return 0;
@@ -49,3 +49,9 @@ struct xkb_keymap *
 test_compile_rules(struct xkb_context *context, const char *rules,
                    const char *model, const char *layout, const char *variant,
                    const char *options);
+
+struct timespec;
+
+/* The seconds between two clock_gettime() readings, for the benchmarks. */
+double
+test_elapsed(const struct timespec *start, const struct timespec *stop);
@@ -0,0 +1,320 @@
+/*
+ * Copyright © 2026 The xkbcommon authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <linux/input.h>
+
+#include "test.h"
+
+/* Offset between evdev keycodes (where KEY_ESCAPE is 1), and the evdev XKB
+ * keycode set (where ESC is 9). */
+#define EVDEV_OFFSET 8
+
+#define NUM_THREADS 8
+#define NUM_ITERATIONS 20000
+
+struct thread_data {
+    struct xkb_keymap *keymap;
+    unsigned int seed;
+    /* The result of the lookups, compared between the threads. */
+    unsigned long sum;
+};
+
+/*
+ * Hammer on a keymap shared with the other threads, with a state of our own.
+ */
+static void *
+thread_func(void *arg)
+{
+    struct thread_data *data = arg;
+    struct xkb_keymap *keymap = data->keymap;
+    struct xkb_state *state = xkb_state_new(keymap);
+    struct xkb_state *clone;
+    struct xkb_key_result result;
+    const xkb_keysym_t *syms;
+    xkb_keycode_t kc;
+    xkb_layout_index_t layout;
+    int8_t down[256] = { 0 };
+    int i, num_syms;
+
+    assert(state);
+
+    for (i = 0; i < NUM_ITERATIONS; i++) {
+        kc = (rand_r(&data->seed) % (255 - 9)) + 9;
+
+        xkb_state_process_key(state, kc, down[kc] ? XKB_KEY_UP : XKB_KEY_DOWN,
+                              &result);
+        down[kc] = !down[kc];
+        data->sum += result.layout + result.level + result.num_syms +
+                     result.consumed + result.repeats;
+
+        for (layout = 0; layout < xkb_keymap_num_layouts_for_key(keymap, kc);
+             layout++) {
+            num_syms = xkb_keymap_key_get_syms_by_level(keymap, kc, layout, 0,
+                                                        &syms);
+            if (num_syms > 0)
+                data->sum += syms[0];
+        }
+
+        data->sum += xkb_keymap_mod_get_index(keymap, XKB_MOD_NAME_SHIFT);
+        data->sum += xkb_keymap_led_get_index(keymap, XKB_LED_NAME_CAPS);
+        data->sum += xkb_state_key_get_one_sym(state, kc);
+
+        /* Objects which are created and released all the time. */
+        if (i % 64 == 0) {
+            clone = xkb_state_clone(state);
+            assert(clone);
+            xkb_keymap_unref(xkb_keymap_ref(xkb_state_get_keymap(clone)));
+            xkb_state_unref(clone);
+        }
+    }
+
+    xkb_state_unref(state);
+    xkb_keymap_unref(keymap);
+
+    return NULL;
+}
+
+static void
+test_shared_keymap(struct xkb_context *ctx)
+{
+    struct xkb_keymap *keymap;
+    pthread_t threads[NUM_THREADS];
+    struct thread_data data[NUM_THREADS];
+    int i;
+
+    keymap = test_compile_rules(ctx, "evdev", "pc104", "us,ru,il,de",
+                                ",,,neo", "grp:menu_toggle");
+    assert(keymap);
+
+    /*
+     * The same sequence in every thread, so the results must match. Each
+     * thread gets its own reference to the keymap.
+     */
+    for (i = 0; i < NUM_THREADS; i++) {
+        data[i].keymap = xkb_keymap_ref(keymap);
+        data[i].seed = 1;
+        data[i].sum = 0;
+        assert(pthread_create(&threads[i], NULL, thread_func, &data[i]) == 0);
+    }
+
+    /* Only the threads hold references to the keymap now. */
+    xkb_keymap_unref(keymap);
+
+    for (i = 0; i < NUM_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    for (i = 1; i < NUM_THREADS; i++)
+        assert(data[i].sum == data[0].sum);
+}
+
+static const struct xkb_rule_names compile_names[] = {
+    { "evdev", "pc105", "us", "", "" },
+    { "evdev", "pc104", "us,ru,il,de", ",,,neo", "grp:menu_toggle" },
+    { "evdev", "pc105", "de,us", "neo,", "ctrl:nocaps" },
+    { "evdev", "pc105", "ru,ca", ",multix", "grp:alt_shift_toggle" },
+};
+
+#define NUM_COMPILE_NAMES (sizeof(compile_names) / sizeof(compile_names[0]))
+
+struct compile_data {
+    struct xkb_context *ctx;
+    unsigned int first;
+    char *dumps[NUM_COMPILE_NAMES];
+};
+
+static void *
+compile_thread_func(void *arg)
+{
+    struct compile_data *data = arg;
+    struct xkb_keymap *keymap;
+    unsigned int i, j;
+
+    for (i = 0; i < NUM_COMPILE_NAMES; i++) {
+        j = (data->first + i) % NUM_COMPILE_NAMES;
+
+        keymap = xkb_keymap_new_from_names(data->ctx, &compile_names[j], 0);
+        assert(keymap);
+        data->dumps[j] = xkb_keymap_get_as_string(keymap,
+                                                  XKB_KEYMAP_FORMAT_TEXT_V1);
+        assert(data->dumps[j]);
+        xkb_keymap_unref(keymap);
+    }
+
+    return NULL;
+}
+
+/*
+ * Compile keymaps in several threads at once on a thread-safe context, and
+ * check they come out the same as when compiled alone. With a keymap
+ * cache, the threads also race to fill it; with the file cache, it is
+ * switched on and off under them.
+ */
+static void
+test_compile(size_t cache_size, bool file_cache)
+{
+    struct xkb_context *ctx;
+    struct xkb_keymap *keymap;
+    pthread_t threads[NUM_THREADS];
+    struct compile_data data[NUM_THREADS];
+    char *expected[NUM_COMPILE_NAMES];
+    unsigned int i, j;
+    int enable;
+
+    ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                          XKB_CONTEXT_THREAD_SAFE);
+    assert(ctx);
+    assert(xkb_context_include_path_append(ctx, test_get_path("")));
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_CRITICAL);
+    xkb_context_set_keymap_cache_size(ctx, cache_size);
+    assert(xkb_context_set_file_cache_enabled(ctx, file_cache));
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        data[i].ctx = ctx;
+        data[i].first = i;
+        assert(pthread_create(&threads[i], NULL, compile_thread_func,
+                              &data[i]) == 0);
+    }
+
+    if (file_cache) {
+        for (i = 0, enable = 0; i < 1000; i++, enable = !enable)
+            assert(xkb_context_set_file_cache_enabled(ctx, enable));
+    }
+
+    for (i = 0; i < NUM_THREADS; i++)
+        assert(pthread_join(threads[i], NULL) == 0);
+
+    for (j = 0; j < NUM_COMPILE_NAMES; j++) {
+        keymap = xkb_keymap_new_from_names(ctx, &compile_names[j], 0);
+        assert(keymap);
+        expected[j] = xkb_keymap_get_as_string(keymap,
+                                               XKB_KEYMAP_FORMAT_TEXT_V1);
+        assert(expected[j]);
+        xkb_keymap_unref(keymap);
+    }
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        for (j = 0; j < NUM_COMPILE_NAMES; j++) {
+            assert(streq(data[i].dumps[j], expected[j]));
+            free(data[i].dumps[j]);
+        }
+    }
+
+    for (j = 0; j < NUM_COMPILE_NAMES; j++)
+        free(expected[j]);
+    xkb_context_unref(ctx);
+}
+
+/*
+ * Compile a batch of keymaps with a worker pool, with a failing entry in
+ * the middle, and check each against the same names compiled alone.
+ */
+static void
+test_batch(void)
+{
+    struct xkb_context *ctx;
+    struct xkb_keymap *keymap;
+    struct xkb_rule_names names[NUM_COMPILE_NAMES + 1];
+    struct xkb_keymap *out[NUM_COMPILE_NAMES + 1];
+    char *got, *expected;
+    unsigned int i, j;
+    unsigned int num_threads;
+
+    ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                          XKB_CONTEXT_THREAD_SAFE);
+    assert(ctx);
+    assert(xkb_context_include_path_append(ctx, test_get_path("")));
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_CRITICAL);
+
+    for (i = 0, j = 0; i < NUM_COMPILE_NAMES + 1; i++) {
+        if (i == 2) {
+            names[i].rules = "does-not-exist";
+            names[i].model = names[i].layout = NULL;
+            names[i].variant = names[i].options = NULL;
+        }
+        else {
+            names[i] = compile_names[j++];
+        }
+    }
+
+    for (num_threads = 0; num_threads <= 3; num_threads++) {
+        assert(xkb_keymap_new_from_names_batch(ctx, names,
+                                               NUM_COMPILE_NAMES + 1, out,
+                                               num_threads, 0) ==
+               NUM_COMPILE_NAMES);
+
+        for (i = 0; i < NUM_COMPILE_NAMES + 1; i++) {
+            if (i == 2) {
+                assert(out[i] == NULL);
+                continue;
+            }
+
+            keymap = xkb_keymap_new_from_names(ctx, &names[i], 0);
+            assert(keymap);
+            expected = xkb_keymap_get_as_string(keymap,
+                                                XKB_KEYMAP_FORMAT_TEXT_V1);
+            got = xkb_keymap_get_as_string(out[i],
+                                           XKB_KEYMAP_FORMAT_TEXT_V1);
+            assert(expected && got);
+            assert(streq(got, expected));
+            free(got);
+            free(expected);
+            xkb_keymap_unref(keymap);
+            xkb_keymap_unref(out[i]);
+        }
+    }
+
+    xkb_context_unref(ctx);
+}
+
+int
+main(void)
+{
+    struct xkb_context *ctx = test_get_context();
+    struct xkb_context *thread_safe_ctx;
+
+    assert(ctx);
+
+    test_shared_keymap(ctx);
+
+    /* Without thread-local storage, there are no thread-safe contexts. */
+    thread_safe_ctx = xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                                      XKB_CONTEXT_THREAD_SAFE);
+    if (!thread_safe_ctx) {
+        xkb_context_unref(ctx);
+        return 77;
+    }
+    xkb_context_unref(thread_safe_ctx);
+
+    test_compile(0, false);
+    test_compile(16 * 1024 * 1024, false);
+    test_compile(0, true);
+    test_batch();
+
+    xkb_context_unref(ctx);
+
+    return 0;
+}
@@ -106,6 +106,10 @@ extern "C" {
  * Objects are created in a specific context, and multiple contexts may
  * coexist simultaneously. Objects from different contexts are completely
  * separated and do not share any memory or state.
+ * The reference count of a context is atomic, but a context must not be
+ * otherwise used by several threads at the same time, e.g. to create
+ * keymaps, unless it is created with XKB_CONTEXT_THREAD_SAFE.
+ *
  * A context is created, accessed, manipulated and destroyed through the
  * xkb_context_*() API.
  */
@@ -121,6 +125,10 @@ struct xkb_context;
  * A keymap is immutable after it is created (besides reference counts, etc.);
  * if you need to change it, you must create a new one.
  *
+ * Since nothing modifies a keymap once it is compiled, and its reference
+ * count is atomic, a single keymap may be shared and used concurrently by
+ * several threads, e.g. each with its own state objects created from it.
+ *
  * A keymap object is created, accessed and destroyed through the
  * xkb_keymap_*() API.
  */
@@ -135,6 +143,9 @@ struct xkb_keymap;
  * simple state machine, wherein key presses and releases are the input, and
  * key symbols (keysyms) are the output.
  *
+ * A state object must not be used by several threads at the same time
+ * without locking, though its reference count is atomic.
+ *
  * A state object is created, accessed, manipulated and destroyed through the
  * xkb_state_*() API.
  */
@@ -407,7 +418,14 @@ xkb_keysym_to_utf32(xkb_keysym_t keysym);
 /** Flags for context creation. */
 enum xkb_context_flags {
     /** Create this context with an empty include path. */
-    XKB_CONTEXT_NO_DEFAULT_INCLUDES = (1 << 0)
+    XKB_CONTEXT_NO_DEFAULT_INCLUDES = (1 << 0),
+    /**
+     * Allow several threads to create keymaps in this context at the same
+     * time.  Changing the context itself, e.g. its include path or logging
+     * settings, still requires that no other thread is using it.  Creating
+     * such a context fails where the compiler has no thread-local storage.
+     */
+    XKB_CONTEXT_THREAD_SAFE = (1 << 1)
 };
 
 /**
@@ -646,6 +664,132 @@ xkb_context_set_log_fn(struct xkb_context *context,
 
 /** @} */
 
+/**
+ * @defgroup keymap-cache Keymap Cache
+ * Reusing keymaps compiled from the same RMLVO names.
+ *
+ * A context may keep the keymaps created with xkb_keymap_new_from_names()
+ * around, so that asking for the same RMLVO names and flags again returns
+ * a new reference to the same keymap instead of compiling it again.  This
+ * is safe because keymaps are immutable.  Empty names are filled in with
+ * their defaults before looking them up.
+ *
+ * The cache is disabled by default.  It is emptied whenever the include
+ * path changes.
+ *
+ * @{
+ */
+
+/**
+ * Set the maximum memory used by the context's keymap cache.
+ *
+ * @param context The context.
+ * @param size    The maximum size in bytes, or 0 to disable the cache.
+ *
+ * When a new keymap doesn't fit, the least recently used keymaps are
+ * dropped from the cache to make room for it.  Keymaps larger than the
+ * whole cache are not cached.
+ *
+ * @memberof xkb_context
+ */
+void
+xkb_context_set_keymap_cache_size(struct xkb_context *context, size_t size);
+
+/**
+ * Get the maximum memory used by the context's keymap cache, in bytes.
+ *
+ * @memberof xkb_context
+ */
+size_t
+xkb_context_get_keymap_cache_size(struct xkb_context *context);
+
+/**
+ * Get the number of keymaps which were found in the context's keymap cache.
+ *
+ * @memberof xkb_context
+ */
+uint64_t
+xkb_context_get_keymap_cache_hits(struct xkb_context *context);
+
+/**
+ * Get the number of keymaps which had to be compiled because they were
+ * not in the context's keymap cache, while the cache was enabled.
+ *
+ * @memberof xkb_context
+ */
+uint64_t
+xkb_context_get_keymap_cache_misses(struct xkb_context *context);
+
+/**
+ * Set a directory in which to keep keymaps across processes.
+ *
+ * @param context The context.
+ * @param path    The directory, which must exist and be writable, or NULL
+ *                to stop using it.
+ *
+ * @returns 1 on success, or 0 if the directory is not usable.
+ *
+ * Keymaps created with xkb_keymap_new_from_names() are then stored in
+ * this directory, in a private format, keyed by the RMLVO names, the
+ * include path and the compile flags.  Asking for them again, from this
+ * or another context, loads them from there without compiling them.
+ * Each stored keymap remembers the size and modification time of every
+ * file it was compiled from, and is compiled again when any of them
+ * changes.
+ *
+ * Failures to read or write the directory are not errors; the keymap is
+ * just compiled.  The directory is not used by default.
+ *
+ * @memberof xkb_context
+ */
+int
+xkb_context_set_keymap_cache_dir(struct xkb_context *context,
+                                 const char *path);
+
+/**
+ * Get the directory set with xkb_context_set_keymap_cache_dir(), or NULL.
+ *
+ * @memberof xkb_context
+ */
+const char *
+xkb_context_get_keymap_cache_dir(struct xkb_context *context);
+
+/**
+ * Set whether the context keeps the files it parses.
+ *
+ * @param context The context.
+ * @param enable  1 to keep them, or 0 to stop using them.
+ *
+ * @returns 1 on success, or 0 if enabling it failed.
+ *
+ * Compiling keymaps parses the same files, e.g. symbols/pc or
+ * types/complete, over and over.  With this enabled, each map of a file is
+ * parsed once in the context, and used again by all the keymaps which
+ * include it afterwards, as long as the file keeps the same size and
+ * modification time.  Unlike the keymap cache, this helps with keymaps
+ * which differ but share some of their files.
+ *
+ * Disabling it only stops further lookups: the files already kept are
+ * released with the context, as keymaps being compiled in other threads
+ * may still use them.  Enabling it again picks them up again.
+ *
+ * This is disabled by default.
+ *
+ * @memberof xkb_context
+ */
+int
+xkb_context_set_file_cache_enabled(struct xkb_context *context, int enable);
+
+/**
+ * Get whether the context keeps the files it parses.
+ *
+ * @memberof xkb_context
+ */
+int
+xkb_context_get_file_cache_enabled(struct xkb_context *context);
+
+/** @} */
+
 /**
  * @defgroup keymap Keymap Creation
  * Creating and destroying keymaps.
@@ -683,10 +827,55 @@ xkb_keymap_new_from_names(struct xkb_context *context,
                           const struct xkb_rule_names *names,
                           enum xkb_keymap_compile_flags flags);
 
-/** The possible keymap text formats. */
+/**
+ * Create many keymaps from RMLVO names at once.
+ *
+ * This is like calling xkb_keymap_new_from_names() for each of the names,
+ * but the keymaps are compiled by a pool of worker threads, and the rules
+ * files are only read once for the whole batch.
+ *
+ * @param context     The context in which to create the keymaps.
+ * @param names       An array of num_names RMLVO names to use.
+ * @param num_names   The number of keymaps to create.
+ * @param out         An array of num_names keymaps, which is filled with
+ * the keymap compiled from each of the names, or NULL where the
+ * compilation failed.
+ * @param num_threads The number of threads to compile with, including the
+ * calling thread.  If 0, one per online CPU.
+ * @param flags       Optional flags for the keymaps, or 0.
+ *
+ * @returns The number of keymaps successfully compiled.
+ *
+ * Only a context created with XKB_CONTEXT_THREAD_SAFE is used by several
+ * threads; otherwise, all of the keymaps are compiled in the calling
+ * thread.  The context's log function may be called from any of the
+ * worker threads.
+ *
+ * @sa xkb_keymap_new_from_names()
+ * @memberof xkb_keymap
+ */
+size_t
+xkb_keymap_new_from_names_batch(struct xkb_context *context,
+                                const struct xkb_rule_names *names,
+                                size_t num_names,
+                                struct xkb_keymap **out,
+                                unsigned int num_threads,
+                                enum xkb_keymap_compile_flags flags);
+
+/** The possible keymap formats. */
 enum xkb_keymap_format {
     /** The current/classic XKB text format, as generated by xkbcomp -xkb. */
-    XKB_KEYMAP_FORMAT_TEXT_V1 = 1
+    XKB_KEYMAP_FORMAT_TEXT_V1 = 1,
+    /**
+     * A binary dump of a compiled keymap, which can be loaded without
+     * parsing or compiling it again.  It is versioned and does not depend
+     * on where it is loaded in memory, but only works between machines
+     * with the same byte order.
+     *
+     * @sa xkb_keymap_get_as_buffer()
+     * @sa xkb_keymap_new_from_buffer()
+     */
+    XKB_KEYMAP_FORMAT_BINARY_V1 = 2
 };
 
 /**
@@ -726,6 +915,34 @@ xkb_keymap_new_from_string(struct xkb_context *context, const char *string,
                            enum xkb_keymap_format format,
                            enum xkb_keymap_compile_flags flags);
 
+/**
+ * Create a keymap from a memory buffer.
+ *
+ * @param context The context in which to create the keymap.
+ * @param buffer  The keymap, in the given format.
+ * @param length  The size of the buffer in bytes.
+ * @param format  The format of the keymap in the buffer.
+ * @param flags   Optional flags for the keymap, or 0.
+ *
+ * @returns A keymap created from the buffer, or NULL if it is invalid.
+ *
+ * In the XKB_KEYMAP_FORMAT_TEXT_V1 format, this is just like
+ * xkb_keymap_new_from_string(), except the buffer doesn't need to be
+ * NUL-terminated.
+ *
+ * In the XKB_KEYMAP_FORMAT_BINARY_V1 format, the buffer is read in
+ * place, so it may be e.g. a file or a memfd mapped with mmap(2).  It must
+ * be aligned to 4 bytes, which such a mapping always is.  The buffer is not
+ * used after this function returns.
+ *
+ * @see xkb_keymap_get_as_buffer()
+ * @memberof xkb_keymap
+ */
+struct xkb_keymap *
+xkb_keymap_new_from_buffer(struct xkb_context *context, const char *buffer,
+                           size_t length, enum xkb_keymap_format format,
+                           enum xkb_keymap_compile_flags flags);
+
 /**
  * Take a new reference on a keymap.
  *
@@ -758,7 +975,8 @@ xkb_keymap_unref(struct xkb_keymap *keymap);
  * @param keymap The keymap to get as a string.
  * @param format The keymap format to use for the string.  You can pass
  * in the special value XKB_KEYMAP_USE_ORIGINAL_FORMAT to use the format
- * from which the keymap was originally created.
+ * from which the keymap was originally created; a keymap created from the
+ * XKB_KEYMAP_FORMAT_BINARY_V1 format is then written as text.
  *
  * @returns The keymap as a NUL-terminated string, or NULL if unsuccessful.
  *
@@ -774,6 +992,35 @@ char *
 xkb_keymap_get_as_string(struct xkb_keymap *keymap,
                          enum xkb_keymap_format format);
 
+/**
+ * Get the compiled keymap as a buffer.
+ *
+ * @param keymap The keymap to get as a buffer.
+ * @param format The keymap format to use for the buffer.  You can pass
+ * in the special value XKB_KEYMAP_USE_ORIGINAL_FORMAT to use the format
+ * from which the keymap was originally created.
+ * @param size   Set to the size of the returned buffer in bytes.
+ *
+ * @returns The keymap in the given format, or NULL if unsuccessful.
+ *
+ * This is the only way to get a keymap in the XKB_KEYMAP_FORMAT_BINARY_V1
+ * format.  In the XKB_KEYMAP_FORMAT_TEXT_V1 format, this is the same as
+ * xkb_keymap_get_as_string(), and the returned size does not include the
+ * terminating NUL.
+ *
+ * The returned buffer may be fed back into xkb_keymap_new_from_buffer()
+ * to get the exact same keymap (possibly in another process, etc.).
+ *
+ * The returned buffer is dynamically allocated and should be freed by the
+ * caller.
+ *
+ * @memberof xkb_keymap
+ */
+char *
+xkb_keymap_get_as_buffer(struct xkb_keymap *keymap,
+                         enum xkb_keymap_format format,
+                         size_t *size);
+
 /** @} */
 
 /**
@@ -984,6 +1231,23 @@ xkb_keymap_key_repeats(struct xkb_keymap *keymap, xkb_keycode_t key);
 struct xkb_state *
 xkb_state_new(struct xkb_keymap *keymap);
 
+/**
+ * Create a copy of a keyboard state object.
+ *
+ * The copy has the same keymap and is in exactly the same state as the
+ * original, including held down keys, pending latches and so on, but is
+ * updated independently from it.  This can be used to try out key events
+ * on a state without affecting it.
+ *
+ * @param state The state to copy.
+ *
+ * @returns A new keyboard state object, or NULL on failure.
+ *
+ * @memberof xkb_state
+ */
+struct xkb_state *
+xkb_state_clone(struct xkb_state *state);
+
 /**
  * Take a new reference on a keyboard state object.
  *
@@ -1072,6 +1336,100 @@ enum xkb_state_component
 xkb_state_update_key(struct xkb_state *state, xkb_keycode_t key,
                      enum xkb_key_direction direction);
 
+/** A key event, as passed to xkb_state_update_keys(). */
+struct xkb_key_event {
+    /** The keycode of the key. */
+    xkb_keycode_t keycode;
+    /** Whether the key was pressed or released. */
+    enum xkb_key_direction direction;
+};
+
+/**
+ * Update the keyboard state to reflect a sequence of keys being pressed
+ * or released.
+ *
+ * This is equivalent to calling xkb_state_update_key() for each event in
+ * order, but is cheaper when many events are available at once, e.g.
+ * when draining an input device; in particular, the LEDs are only
+ * computed once for the whole batch.
+ *
+ * @param[in]  state      The keyboard state object.
+ * @param[in]  events     The key events to apply, in order.
+ * @param[in]  num_events The number of events in the events array.
+ * @param[out] changed    If not NULL, an array of num_events entries, in
+ * which the mask of state components changed by each event is stored, as
+ * would have been returned by xkb_state_update_key().  Passing it makes the
+ * LEDs be computed after every event.
+ *
+ * @returns A mask of state components that have changed at any point
+ * during the update.  Unless the changed array is passed, the LEDs
+ * are only compared between the start and the end of the batch.  If
+ * nothing in the state has changed, returns 0.
+ *
+ * @memberof xkb_state
+ */
+enum xkb_state_component
+xkb_state_update_keys(struct xkb_state *state,
+                      const struct xkb_key_event *events, size_t num_events,
+                      enum xkb_state_component *changed);
+
+/**
+ * The outcome of processing a key event with xkb_state_process_key().
+ *
+ * Except for changed, the fields describe the key in the state as it was
+ * before the event was applied, i.e. what the key produces.
+ */
+struct xkb_key_result {
+    /** The state components changed by the event, as would have been
+     *  returned by xkb_state_update_key(). */
+    enum xkb_state_component changed;
+    /** The layout of the key, as returned by xkb_state_key_get_layout(). */
+    xkb_layout_index_t layout;
+    /** The shift level of the key, as returned by
+     *  xkb_state_key_get_level(). */
+    xkb_level_index_t level;
+    /** The number of keysyms in the syms array. */
+    int num_syms;
+    /** The keysyms of the key, as returned by xkb_state_key_get_syms(),
+     *  or NULL if there are none. */
+    const xkb_keysym_t *syms;
+    /** The NUL-terminated UTF-8 representation of the keysym if the key
+     *  has exactly one keysym, otherwise (or if it has no Unicode
+     *  representation) the empty string. */
+    char utf8[8];
+    /** The modifiers consumed by the key, i.e. those which
+     *  xkb_state_mod_mask_remove_consumed() would remove. */
+    xkb_mod_mask_t consumed;
+    /** Whether the key should repeat, as returned by
+     *  xkb_keymap_key_repeats(). */
+    int repeats;
+};
+
+/**
+ * Update the keyboard state to reflect a given key being pressed or
+ * released, and get everything commonly needed to handle the key.
+ *
+ * This is equivalent to looking the key up with xkb_state_key_get_layout(),
+ * xkb_state_key_get_level(), xkb_state_key_get_syms(),
+ * xkb_keysym_to_utf8() and xkb_state_mod_mask_remove_consumed(), and then
+ * calling xkb_state_update_key(), but only needs to find the key once.
+ *
+ * @param[in]  state     The keyboard state object.
+ * @param[in]  key       The keycode of the key.
+ * @param[in]  direction Whether the key was pressed or released.
+ * @param[out] result    Where to store the result.
+ *
+ * @returns 1 if the key was processed, or 0 if the keycode is invalid, in
+ * which case result is cleared, with layout and level set to
+ * XKB_LAYOUT_INVALID and XKB_LEVEL_INVALID.
+ *
+ * @memberof xkb_state
+ */
+int
+xkb_state_process_key(struct xkb_state *state, xkb_keycode_t key,
+                      enum xkb_key_direction direction,
+                      struct xkb_key_result *result);
+
 /**
  * Get the keysyms obtained from pressing a particular key in a given
  * keyboard state.